@@ -77,5 +77,10 @@ rstatus_t random_update(struct server_pool *pool);
 uint32_t random_dispatch(struct continuum *continuum, uint32_t ncontinuum, uint32_t hash);
 rstatus_t hashslot_update(struct server_pool *pool);
 uint32_t hashslot_dispatch(struct continuum *continuum, uint32_t ncontinuum, uint32_t hash);
+rstatus_t hashslot_refresh(struct server_pool *pool, uint32_t slot, uint32_t from, bool *changed);
+rstatus_t hashslot_importing(struct server_pool *pool, uint32_t slot, uint32_t *idx);
+void hashslot_importing_reset(struct server_pool *pool, uint32_t slot);
+void hashslot_reclaim(struct context *ctx);
+void hashslot_deinit(struct server_pool *pool);
 
 #endif
@@ -26,6 +26,15 @@
 
 #define HASHSLOT_CONTINUUM_ADDITION   10  /* # extra slots to build into continuum */
 #define HASHSLOT_POINTS_PER_SERVER    1
+#define HASHSLOT_IMPORT_CACHE_USEC    1000000LL  /* how long an importing node is trusted */
+#define HASHSLOT_SNAPSHOT_REFRESH_USEC 1000000LL /* min interval of snapshot reads on moved */
+#define HASHSLOT_NO_IMPORT            ((uint32_t)-1) /* cached: slot is not being imported */
+
+#define HASHSLOT_FETCH_OWNER          0x01  /* /slot_map/<n> read in flight */
+#define HASHSLOT_FETCH_IMPORT         0x02  /* /migrate_tasks/<n> read in flight */
+
+/* building and swapping slot tables, zookeeper watches run on their own thread */
+static pthread_mutex_t hashslot_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void hashslot_get_watch(zhandle_t *zh, int type, int state, const char *path,
         void *watcherCtx)
@@ -35,6 +44,12 @@ void hashslot_get_watch(zhandle_t *zh, int type, int state, const char *path,
         struct slot_ctx *ctx_temp = (struct slot_ctx *)watcherCtx;
         int slot_index = ctx_temp->slot_index;
         struct server_pool *pool = ctx_temp->pool;
+
+        /* the slot map snapshot took over, let the per-slot watches go */
+        if (pool->slot_map_version != 0) {
+            return;
+        }
+
         char data[128];
         int datalen = sizeof(data);
         memset(data, 0, datalen);
@@ -54,47 +69,264 @@ void hashslot_get_watch(zhandle_t *zh, int type, int state, const char *path,
     }
 }
 
-static rstatus_t
-hashslot_init(struct server_pool *pool, uint32_t nserver){
-    struct continuum *hashslot;
-    uint32_t server_index;        /* server index */
-    uint32_t slot_index;          /* slot index */
-    uint32_t server_slot_per_num; /* server have slot number 8*/
-    struct slot_ctx *ctx_temp;
+static void hashslot_snapshot_fetch(struct server_pool *pool);
 
+static void
+hashslot_snapshot_watch(zhandle_t *zh, int type, int state, const char *path,
+                        void *watcherCtx)
+{
+    struct server_pool *pool = watcherCtx;
 
-    hashslot = nc_realloc(pool->hashslot, sizeof(*hashslot) * HASHSLOT_SLOT_NUM);
-    if(hashslot == NULL) {
+    if (type != ZOO_CREATED_EVENT && type != ZOO_CHANGED_EVENT &&
+        type != ZOO_DELETED_EVENT) {
+        return;
+    }
+
+    hashslot_snapshot_fetch(pool);
+}
+
+/*
+ * Build a new slot table from a slot map snapshot and swap it in when it
+ * is newer than the one we route with. Published tables are never written
+ * again but for single slot patches: the old one is retired and freed by
+ * the main context once every worker loop has turned, see hashslot_reclaim.
+ */
+static rstatus_t
+hashslot_snapshot_apply(struct server_pool *pool, const char *data, int datalen)
+{
+    uint32_t *node;
+    struct continuum *hashslot, *old;
+    struct slot_table *retired;
+    uint64_t version;
+    uint32_t slot, nserver, nmoved;
+    rstatus_t status;
+
+    node = nc_alloc(sizeof(*node) * HASHSLOT_SLOT_NUM);
+    if (node == NULL) {
         return NC_ENOMEM;
     }
 
+    status = NC_ERROR;
+
+    if (datalen < 0 || zk_slot_snapshot_decode(data, datalen, node,
+                                               HASHSLOT_SLOT_NUM, &version)) {
+        log_warn("bad slot map snapshot in %s", ZK_SLOT_SNAPSHOT_PATH);
+        goto done;
+    }
+
+    nserver = array_n(&pool->server);
+    for (slot = 0; slot < HASHSLOT_SLOT_NUM; slot++) {
+        if (node[slot] >= nserver) {
+            log_warn("slot map snapshot %"PRIu64" maps slot %"PRIu32" to "
+                     "node %"PRIu32" of %"PRIu32"", version, slot, node[slot],
+                     nserver);
+            goto done;
+        }
+    }
+
+    hashslot = nc_alloc(sizeof(*hashslot) * HASHSLOT_SLOT_NUM);
+    retired = nc_alloc(sizeof(*retired));
+    if (hashslot == NULL || retired == NULL) {
+        if (hashslot != NULL) {
+            nc_free(hashslot);
+        }
+        if (retired != NULL) {
+            nc_free(retired);
+        }
+        status = NC_ENOMEM;
+        goto done;
+    }
+
+    for (slot = 0; slot < HASHSLOT_SLOT_NUM; slot++) {
+        hashslot[slot].index = node[slot];
+        hashslot[slot].value = 0;
+    }
+
+    pthread_mutex_lock(&hashslot_lock);
+
+    if (version <= pool->slot_map_version) {
+        pthread_mutex_unlock(&hashslot_lock);
+        nc_free(hashslot);
+        nc_free(retired);
+        status = NC_OK;
+        goto done;
+    }
+
+    old = pool->hashslot;
+    nmoved = 0;
+    for (slot = 0; old != NULL && slot < HASHSLOT_SLOT_NUM; slot++) {
+        if (old[slot].index != node[slot]) {
+            nmoved++;
+        }
+    }
+
+    __sync_synchronize();
     pool->hashslot = hashslot;
     pool->nhashslotnum = HASHSLOT_SLOT_NUM;
+    pool->slot_map_version = version;
 
-    int zk_check_flag = 1;
+    if (old != NULL) {
+        retired->table = old;
+        retired->next = pool->hashslot_retired;
+        pool->hashslot_retired = retired;
+    } else {
+        nc_free(retired);
+    }
 
-    if (!pool->zh_handler) {
-        zk_check_flag = 0;
+    pthread_mutex_unlock(&hashslot_lock);
+
+    log_warn("pool %"PRIu32" '%.*s' loaded slot map %"PRIu64", %"PRIu32" "
+             "slots moved", pool->idx, pool->name.len, pool->name.data,
+             version, nmoved);
+
+    status = NC_OK;
+
+done:
+    nc_free(node);
+    return status;
+}
+
+/*
+ * Read the slot map snapshot at startup, before any worker runs. Fails
+ * when there is no snapshot, after setting a watch for its creation.
+ */
+static rstatus_t
+hashslot_snapshot_load(struct server_pool *pool)
+{
+    char *data;
+    int datalen, ret;
+    rstatus_t status;
+
+    data = nc_alloc(ZK_SLOT_SNAPSHOT_MAX);
+    if (data == NULL) {
+        return NC_ENOMEM;
+    }
+
+    datalen = ZK_SLOT_SNAPSHOT_MAX;
+    ret = zoo_wget(pool->zh_handler, ZK_SLOT_SNAPSHOT_PATH,
+                   hashslot_snapshot_watch, pool, data, &datalen, NULL);
+    if (ret == ZNONODE) {
+        zoo_wexists(pool->zh_handler, ZK_SLOT_SNAPSHOT_PATH,
+                    hashslot_snapshot_watch, pool, NULL);
+        status = NC_ERROR;
+    } else if (ret != ZOK) {
+        log_warn("get %s failed: %d", ZK_SLOT_SNAPSHOT_PATH, ret);
+        status = NC_ERROR;
     } else {
-        struct String_vector strings;
-        int child_ret = zk_get_children(pool->zh_handler, "/slot_map", NULL, NULL, &strings);
-        if (child_ret != 0) {
-            zk_check_flag = 0;
-        } else {
-            int slot_num = strings.count;
-            if (slot_num != HASHSLOT_SLOT_NUM) {
-                zk_check_flag = 0;
-            }
-        }
+        status = hashslot_snapshot_apply(pool, data, datalen);
+    }
+
+    nc_free(data);
+    return status;
+}
+
+static void
+hashslot_snapshot_exists_done(int rc, const struct Stat *stat, const void *data)
+{
+    /* only the watch matters */
+}
+
+/* runs on the zookeeper thread, like the watches */
+static void
+hashslot_snapshot_done(int rc, const char *value, int value_len,
+                       const struct Stat *stat, const void *data)
+{
+    struct server_pool *pool = (struct server_pool *)data;
+
+    if (rc == ZOK) {
+        hashslot_snapshot_apply(pool, value, value_len);
+    } else if (rc == ZNONODE) {
+        zoo_awexists(pool->zh_handler, ZK_SLOT_SNAPSHOT_PATH,
+                     hashslot_snapshot_watch, pool,
+                     hashslot_snapshot_exists_done, pool);
+    } else {
+        log_warn("get %s failed: %d", ZK_SLOT_SNAPSHOT_PATH, rc);
+    }
+
+    __sync_lock_release(&pool->slot_map_loading);
+}
+
+/*
+ * Read the slot map snapshot without waiting for it, and set the watch
+ * again. Reads asked for while one is in flight are folded into it.
+ */
+static void
+hashslot_snapshot_fetch(struct server_pool *pool)
+{
+    int ret;
+
+    if (__sync_lock_test_and_set(&pool->slot_map_loading, 1) != 0) {
+        return;
+    }
+
+    ret = zoo_awget(pool->zh_handler, ZK_SLOT_SNAPSHOT_PATH,
+                    hashslot_snapshot_watch, pool, hashslot_snapshot_done, pool);
+    if (ret != ZOK) {
+        log_warn("get %s failed: %d", ZK_SLOT_SNAPSHOT_PATH, ret);
+        __sync_lock_release(&pool->slot_map_loading);
+    }
+}
+
+/*
+ * Compatibility loader for clusters that only have the per-slot layout:
+ * one /slot_map/<n> znode and one watch per slot
+ */
+static void
+hashslot_slots_load(struct server_pool *pool)
+{
+    uint32_t slot_index;          /* slot index */
+    struct slot_ctx *ctx_temp;
+    struct String_vector strings;
+
+    int child_ret = zk_get_children(pool->zh_handler, "/slot_map", NULL, NULL, &strings);
+    if (child_ret != 0 || strings.count != HASHSLOT_SLOT_NUM) {
+        return;
     }
 
-    server_slot_per_num = pool->nhashslotnum / nserver;
     char data[128];
     int datalen = sizeof(data);
     memset(data, 0, datalen);
     char zk_path[50];
     int pathlen = sizeof(zk_path);
     memset(zk_path, 0, pathlen);
+    for (slot_index = 0; slot_index < HASHSLOT_SLOT_NUM; slot_index++) {
+        memset(data, 0, datalen);
+        memset(zk_path, 0, pathlen);
+        sprintf(zk_path, "/slot_map/%d", slot_index);
+        ctx_temp = array_get(&pool->ctx_array, slot_index);
+        ctx_temp->slot_index = slot_index;
+        ctx_temp->pool = pool;
+        int get_ret = zk_get(pool->zh_handler, ((const char *)zk_path),  hashslot_get_watch, ctx_temp, data, &datalen);
+        if (get_ret) {
+            log_warn("zookeeper handle error %d, server_index:%u, slot_index:%u", get_ret, pool->hashslot[slot_index].index, slot_index);
+        } else {
+            json_object *json_data = json_tokener_parse(data);
+            int node_index;
+            JSON_GET_INT32(json_data, "node_index", &node_index, 0);
+            json_object_put(json_data);
+            pool->hashslot[slot_index].index = node_index;
+            log_debug(LOG_DEBUG, "zookeeper handle ok, slot_index:%u, node_index:%d", slot_index, node_index);
+        }
+    }
+}
+
+static rstatus_t
+hashslot_init(struct server_pool *pool, uint32_t nserver){
+    struct continuum *hashslot;
+    uint32_t server_index;        /* server index */
+    uint32_t slot_index;          /* slot index */
+    uint32_t server_slot_per_num; /* server have slot number 8*/
+
+
+    hashslot = nc_realloc(pool->hashslot, sizeof(*hashslot) * HASHSLOT_SLOT_NUM);
+    if(hashslot == NULL) {
+        return NC_ENOMEM;
+    }
+
+    pool->hashslot = hashslot;
+    pool->nhashslotnum = HASHSLOT_SLOT_NUM;
+
+    server_slot_per_num = pool->nhashslotnum / nserver;
     for (slot_index = 0; slot_index < HASHSLOT_SLOT_NUM; slot_index++) {
         server_index = slot_index / server_slot_per_num;
 
@@ -103,30 +335,31 @@ hashslot_init(struct server_pool *pool, uint32_t nserver){
             server_index = nserver - 1;
         }
 
-        if (zk_check_flag) {
-            memset(data, 0, datalen);
-            memset(zk_path, 0, pathlen);
-            sprintf(zk_path, "/slot_map/%d", slot_index);
-            ctx_temp = array_get(&pool->ctx_array, slot_index);
-            ctx_temp->slot_index = slot_index;
-            ctx_temp->pool = pool;
-            int get_ret = zk_get(pool->zh_handler, ((const char *)zk_path),  hashslot_get_watch, ctx_temp, data, &datalen);
-            if (get_ret) {
-                pool->hashslot[slot_index].index = server_index;
-                log_warn("zookeeper handle error %d, server_index:%u, slot_index:%u", get_ret, server_index, slot_index);
-            } else {
-                json_object *json_data = json_tokener_parse(data);
-                int node_index;
-                JSON_GET_INT32(json_data, "node_index", &node_index, 0);
-                json_object_put(json_data);
-                pool->hashslot[slot_index].index = node_index;
-                log_debug(LOG_DEBUG, "zookeeper handle ok, slot_index:%u, node_index:%d", slot_index, node_index);
-            }
-        } else {
-            pool->hashslot[slot_index].index = server_index;
-        }
+        pool->hashslot[slot_index].index = server_index;
         pool->hashslot[slot_index].value = 0;
     }
+
+    if (!pool->zh_handler) {
+        return NC_OK;
+    }
+
+    /* shared with the workers, so not allocated on first use */
+    if (pool->slot_import == NULL) {
+        pool->slot_import = nc_zalloc(sizeof(*pool->slot_import) * HASHSLOT_SLOT_NUM);
+    }
+    if (pool->slot_fetching == NULL) {
+        pool->slot_fetching = nc_zalloc(sizeof(*pool->slot_fetching) * HASHSLOT_SLOT_NUM);
+    }
+    if (pool->slot_import == NULL || pool->slot_fetching == NULL) {
+        return NC_ENOMEM;
+    }
+
+    if (hashslot_snapshot_load(pool) == NC_OK) {
+        return NC_OK;
+    }
+
+    hashslot_slots_load(pool);
+
     return NC_OK;
 }
 
@@ -246,7 +479,7 @@ hashslot_update(struct server_pool *pool)
     pool->ncontinuum   = pointer_counter;
 
     if (nlive_server == 0) {
-        ASSERT(pool->hashslot != NULL);
+        ASSERT(pool->slot_owner->hashslot != NULL);
         ASSERT(pool->ncontinuum != 0);
 
         log_debug(LOG_DEBUG, "no live servers for pool %"PRIu32" '%.*s'",
@@ -262,13 +495,341 @@ hashslot_update(struct server_pool *pool)
      * Allocate the continuum for the pool, the first time, and every time we
      * add a new server to the pool
      */
-    if (pool->hashslot == NULL) {
+    if (pool->slot_owner->hashslot == NULL) {
         hashslot_init(pool, nserver);
     }
 
     return NC_OK;
 }
 
+struct slot_fetch {
+    struct server_pool *pool;  /* owner pool */
+    uint32_t           slot;
+};
+
+static rstatus_t
+hashslot_node_index(struct server_pool *pool, const char *zk_path,
+                    const char *value, int value_len, uint32_t *idx)
+{
+    char data[128];
+    int node_index = -1;
+    json_object *json_data;
+
+    if (value == NULL || value_len <= 0 || value_len >= (int)sizeof(data)) {
+        return NC_ERROR;
+    }
+    memcpy(data, value, (size_t)value_len);
+    data[value_len] = '\0';
+
+    json_data = json_tokener_parse(data);
+    if (json_data == NULL) {
+        return NC_ERROR;
+    }
+    JSON_GET_INT32(json_data, "node_index", &node_index, -1);
+    json_object_put(json_data);
+
+    if (node_index < 0 || (uint32_t)node_index >= array_n(&pool->server)) {
+        log_warn("bad node_index %d in %s", node_index, zk_path);
+        return NC_ERROR;
+    }
+
+    *idx = (uint32_t)node_index;
+    return NC_OK;
+}
+
+/*
+ * Read /<dir>/<slot> without waiting for it, at most one read per slot
+ * and kind is in flight. done gets a struct slot_fetch and frees it.
+ */
+static void
+hashslot_fetch(struct server_pool *pool, uint32_t slot, uint32_t kind,
+               const char *dir, data_completion_t done)
+{
+    char zk_path[50];
+    struct slot_fetch *fetch;
+    int ret;
+
+    if (pool->zh_handler == NULL || pool->slot_fetching == NULL) {
+        return;
+    }
+
+    if (__sync_fetch_and_or(&pool->slot_fetching[slot], kind) & kind) {
+        return;
+    }
+
+    fetch = nc_alloc(sizeof(*fetch));
+    if (fetch == NULL) {
+        __sync_fetch_and_and(&pool->slot_fetching[slot], ~kind);
+        return;
+    }
+    fetch->pool = pool;
+    fetch->slot = slot;
+
+    sprintf(zk_path, "/%s/%u", dir, slot);
+    ret = zoo_aget(pool->zh_handler, zk_path, 0, done, fetch);
+    if (ret != ZOK) {
+        log_warn("get %s failed: %d", zk_path, ret);
+        __sync_fetch_and_and(&pool->slot_fetching[slot], ~kind);
+        nc_free(fetch);
+    }
+}
+
+/* runs on the zookeeper thread, patches one slot of the table in use */
+static void
+hashslot_owner_done(int rc, const char *value, int value_len,
+                    const struct Stat *stat, const void *data)
+{
+    struct slot_fetch *fetch = (struct slot_fetch *)data;
+    struct server_pool *pool = fetch->pool;
+    uint32_t slot = fetch->slot;
+    uint32_t old_index, node_index;
+    char zk_path[50];
+
+    sprintf(zk_path, "/slot_map/%u", slot);
+    if (rc == ZOK &&
+        hashslot_node_index(pool, zk_path, value, value_len, &node_index) == NC_OK) {
+        /*
+         * a snapshot swapped in later may not have the move yet and put
+         * the slot back, the next moved reply patches it again
+         */
+        pthread_mutex_lock(&hashslot_lock);
+        old_index = pool->hashslot[slot].index;
+        if (old_index != node_index) {
+            pool->hashslot[slot].index = node_index;
+            log_warn("slot %u moved from server %u to %u", slot, old_index, node_index);
+        }
+        pthread_mutex_unlock(&hashslot_lock);
+    } else if (rc != ZOK) {
+        log_warn("get %s failed: %d", zk_path, rc);
+    }
+
+    __sync_fetch_and_and(&pool->slot_fetching[slot], ~HASHSLOT_FETCH_OWNER);
+    nc_free(fetch);
+}
+
+/*
+ * Find where a slot went after server 'from' answered "moved". The watches
+ * keep the table in step with zookeeper, so when the table already names
+ * another owner that is the answer. Otherwise the watch has not fired yet:
+ * a read of the slot map is started, without waiting for it, and the
+ * request is retried once the redirect backoff is over. With a snapshot
+ * the whole snapshot is read, at most once per
+ * HASHSLOT_SNAPSHOT_REFRESH_USEC, else the per-slot znode. Nothing is read
+ * on the event loop. Sets *changed when the slot maps to another server.
+ */
+rstatus_t
+hashslot_refresh(struct server_pool *pool, uint32_t slot, uint32_t from, bool *changed)
+{
+    uint32_t node_index;
+    int64_t now, next;
+
+    /* worker pools route with the table of the main context */
+    pool = pool->slot_owner;
+
+    *changed = false;
+    if (pool->hashslot == NULL || slot >= pool->nhashslotnum) {
+        return NC_ERROR;
+    }
+
+    node_index = pool->hashslot[slot].index;
+    if (from < array_n(&pool->server) && node_index != from) {
+        *changed = true;
+        return NC_OK;
+    }
+
+    if (pool->zh_handler == NULL) {
+        return NC_ERROR;
+    }
+
+    if (pool->slot_map_version != 0) {
+        now = nc_usec_now();
+        next = pool->next_slot_map_load;
+        if (now >= 0 && now >= next &&
+            __sync_bool_compare_and_swap(&pool->next_slot_map_load, next,
+                                         now + HASHSLOT_SNAPSHOT_REFRESH_USEC)) {
+            hashslot_snapshot_fetch(pool);
+        }
+        return NC_OK;
+    }
+
+    hashslot_fetch(pool, slot, HASHSLOT_FETCH_OWNER, "slot_map", hashslot_owner_done);
+
+    return NC_OK;
+}
+
+/* runs on the zookeeper thread */
+static void
+hashslot_import_done(int rc, const char *value, int value_len,
+                     const struct Stat *stat, const void *data)
+{
+    struct slot_fetch *fetch = (struct slot_fetch *)data;
+    struct server_pool *pool = fetch->pool;
+    struct slot_import *import;
+    uint32_t slot = fetch->slot;
+    uint32_t idx;
+    char zk_path[50];
+    int64_t now;
+
+    sprintf(zk_path, "/migrate_tasks/%u", slot);
+    if (rc != ZOK ||
+        hashslot_node_index(pool, zk_path, value, value_len, &idx) != NC_OK) {
+        /* no migrate task, the next "ask" is answered with a backoff too */
+        idx = HASHSLOT_NO_IMPORT;
+    }
+
+    now = nc_usec_now();
+    import = &pool->slot_import[slot];
+    import->index = idx;
+    __sync_synchronize();
+    import->expire = now < 0 ? 0 : now + HASHSLOT_IMPORT_CACHE_USEC;
+
+    __sync_fetch_and_and(&pool->slot_fetching[slot], ~HASHSLOT_FETCH_IMPORT);
+    nc_free(fetch);
+}
+
+/*
+ * Find the server a slot is being imported into, from the running
+ * migrate task in zookeeper. Answers, found or not, are cached for a
+ * short while since every key already moved out of the slot triggers an
+ * "ask". On a miss the migrate task is read without waiting for it and
+ * the request is retried after the redirect backoff.
+ */
+rstatus_t
+hashslot_importing(struct server_pool *pool, uint32_t slot, uint32_t *idx)
+{
+    struct slot_import *import;
+    int64_t now;
+
+    /* the cache is filled by the zookeeper thread for all contexts */
+    pool = pool->slot_owner;
+
+    if (slot >= HASHSLOT_SLOT_NUM || pool->slot_import == NULL) {
+        return NC_ERROR;
+    }
+
+    now = nc_usec_now();
+    import = &pool->slot_import[slot];
+    if (import->expire > now) {
+        __sync_synchronize();
+        if (import->index == HASHSLOT_NO_IMPORT) {
+            return NC_ERROR;
+        }
+        *idx = import->index;
+        return NC_OK;
+    }
+
+    hashslot_fetch(pool, slot, HASHSLOT_FETCH_IMPORT, "migrate_tasks", hashslot_import_done);
+
+    return NC_ERROR;
+}
+
+void
+hashslot_importing_reset(struct server_pool *pool, uint32_t slot)
+{
+    pool = pool->slot_owner;
+
+    if (pool->slot_import != NULL && slot < HASHSLOT_SLOT_NUM) {
+        pool->slot_import[slot].expire = 0;
+    }
+}
+
+static void
+hashslot_free_tables(struct slot_table *list)
+{
+    struct slot_table *next;
+
+    for (; list != NULL; list = next) {
+        next = list->next;
+        nc_free(list->table);
+        nc_free(list);
+    }
+}
+
+static void
+hashslot_reclaim_pool(struct context *ctx, struct server_pool *pool)
+{
+    struct slot_table *list;
+    uint32_t i, nworker;
+
+    nworker = array_n(&ctx->worker);
+
+    /* a worker still in the loop turn it was in at the swap may use them */
+    if (pool->hashslot_grace != NULL) {
+        for (i = 0; i < nworker; i++) {
+            struct context *worker = *(struct context **)array_get(&ctx->worker, i);
+
+            if (worker->tid != (pthread_t) -1 && worker->loops == pool->grace_loops[i]) {
+                return;
+            }
+        }
+        hashslot_free_tables(pool->hashslot_grace);
+        pool->hashslot_grace = NULL;
+    }
+
+    if (pool->hashslot_retired == NULL) {
+        return;
+    }
+
+    if (nworker != 0 && pool->grace_loops == NULL) {
+        pool->grace_loops = nc_alloc(sizeof(*pool->grace_loops) * nworker);
+        if (pool->grace_loops == NULL) {
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&hashslot_lock);
+    list = pool->hashslot_retired;
+    pool->hashslot_retired = NULL;
+    pthread_mutex_unlock(&hashslot_lock);
+
+    if (nworker == 0) {
+        hashslot_free_tables(list);
+        return;
+    }
+
+    for (i = 0; i < nworker; i++) {
+        struct context *worker = *(struct context **)array_get(&ctx->worker, i);
+
+        pool->grace_loops[i] = worker->loops;
+    }
+    pool->hashslot_grace = list;
+}
+
+/*
+ * Free the slot tables swapped out by snapshot loads. Runs in the main
+ * context between two loop turns, so the main context holds none of them;
+ * a worker is done with them once its loop count moved on.
+ */
+void
+hashslot_reclaim(struct context *ctx)
+{
+    uint32_t i;
+
+    for (i = 0; i < array_n(&ctx->pool); i++) {
+        struct server_pool *sp = array_get(&ctx->pool, i);
+
+        if (sp->dist_type != DIST_HASHSLOT || sp->shared) {
+            continue;
+        }
+
+        hashslot_reclaim_pool(ctx, sp);
+    }
+}
+
+/* every event loop is stopped */
+void
+hashslot_deinit(struct server_pool *pool)
+{
+    hashslot_free_tables(pool->hashslot_retired);
+    pool->hashslot_retired = NULL;
+    hashslot_free_tables(pool->hashslot_grace);
+    pool->hashslot_grace = NULL;
+    if (pool->grace_loops != NULL) {
+        nc_free(pool->grace_loops);
+        pool->grace_loops = NULL;
+    }
+}
+
 uint32_t
 hashslot_dispatch(struct continuum *hashslot, uint32_t nhashslotnum, uint32_t hash)
 {
@@ -45,6 +45,9 @@
 #define NC_MBUF_MIN_SIZE    MBUF_MIN_SIZE
 #define NC_MBUF_MAX_SIZE    MBUF_MAX_SIZE
 
+#define NC_WORKER_THREADS   1
+#define NC_WORKER_MAX       64
+
 static int show_help;
 static int show_version;
 static int test_conf;
@@ -65,10 +68,11 @@ static struct option long_options[] = {
     { "stats-addr",     required_argument,  NULL,   'a' },
     { "pid-file",       required_argument,  NULL,   'p' },
     { "mbuf-size",      required_argument,  NULL,   'm' },
+    { "worker-threads", required_argument,  NULL,   'w' },
     { NULL,             0,                  NULL,    0  }
 };
 
-static char short_options[] = "hVtdDv:o:c:s:i:a:p:m:";
+static char short_options[] = "hVtdDv:o:c:s:i:a:p:m:w:";
 
 static rstatus_t
 nc_daemonize(int dump_core)
@@ -205,6 +209,7 @@ nc_show_usage(void)
         "Usage: nutcracker [-?hVdDt] [-v verbosity level] [-o output file]" CRLF
         "                  [-c conf file] [-s stats port] [-a stats addr]" CRLF
         "                  [-i stats interval] [-p pid file] [-m mbuf size]" CRLF
+        "                  [-w worker threads]" CRLF
         "");
     log_stderr(
         "Options:" CRLF
@@ -222,13 +227,14 @@ nc_show_usage(void)
         "  -i, --stats-interval=N : set stats aggregation interval in msec (default: %d msec)" CRLF
         "  -p, --pid-file=S       : set pid file (default: %s)" CRLF
         "  -m, --mbuf-size=N      : set size of mbuf chunk in bytes (default: %d bytes)" CRLF
+        "  -w, --worker-threads=N : set number of event loop threads (default: %d, max: %d)" CRLF
         "",
         NC_LOG_DEFAULT, NC_LOG_MIN, NC_LOG_MAX,
         NC_LOG_PATH != NULL ? NC_LOG_PATH : "stderr",
         NC_CONF_PATH,
         NC_STATS_PORT, NC_STATS_ADDR, NC_STATS_INTERVAL,
         NC_PID_FILE != NULL ? NC_PID_FILE : "off",
-        NC_MBUF_SIZE);
+        NC_MBUF_SIZE, NC_WORKER_THREADS, NC_WORKER_MAX);
 }
 
 static rstatus_t
@@ -297,6 +303,8 @@ nc_set_default_options(struct instance *nci)
 
     nci->mbuf_chunk_size = NC_MBUF_SIZE;
 
+    nci->worker_threads = NC_WORKER_THREADS;
+
     nci->pid = (pid_t)-1;
     nci->pid_filename = NULL;
     nci->pidfile = 0;
@@ -405,6 +413,22 @@ nc_get_options(int argc, char **argv, struct instance *nci)
             nci->mbuf_chunk_size = (size_t)value;
             break;
 
+        case 'w':
+            value = nc_atoi(optarg, strlen(optarg));
+            if (value <= 0) {
+                log_stderr("nutcracker: option -w requires a non-zero number");
+                return NC_ERROR;
+            }
+
+            if (value > NC_WORKER_MAX) {
+                log_stderr("nutcracker: worker threads must be between 1 and"
+                           " %d", NC_WORKER_MAX);
+                return NC_ERROR;
+            }
+
+            nci->worker_threads = value;
+            break;
+
         case '?':
             switch (optopt) {
             case 'o':
@@ -415,6 +439,7 @@ nc_get_options(int argc, char **argv, struct instance *nci)
                 break;
 
             case 'm':
+            case 'w':
             case 'v':
             case 's':
             case 'i':
@@ -20,6 +20,7 @@
 #include <nc_server.h>
 #include <proto/nc_proto.h>
 #include <nc_zookeeper.h>
+#include <nc_failover.h>
 
 #define DEFINE_ACTION(_hash, _name) string(#_name),
 static struct string hash_strings[] = {
@@ -42,6 +43,13 @@ static struct string dist_strings[] = {
 };
 #undef DEFINE_ACTION
 
+#define DEFINE_ACTION(_read, _name) string(#_name),
+static struct string read_strings[] = {
+    READ_CODEC( DEFINE_ACTION )
+    null_string
+};
+#undef DEFINE_ACTION
+
 static struct command conf_commands[] = {
     { string("listen"),
       conf_set_listen,
@@ -111,6 +119,18 @@ static struct command conf_commands[] = {
       conf_set_num,
       offsetof(struct conf_pool, server_failure_limit) },
 
+    { string("read_policy"),
+      conf_set_read_policy,
+      offsetof(struct conf_pool, read_policy) },
+
+    { string("read_max_lag"),
+      conf_set_num,
+      offsetof(struct conf_pool, read_max_lag) },
+
+    { string("trace_rate"),
+      conf_set_num,
+      offsetof(struct conf_pool, trace_rate) },
+
     { string("servers"),
       conf_add_server_group,
       offsetof(struct conf_pool, servergroup) },
@@ -184,6 +204,12 @@ conf_server_each_transform(void *elem, void *data)
     s->next_retry = 0LL;
     s->failure_count = 0;
 
+    s->noutstanding = 0;
+    s->latency = 0LL;
+    s->repl_seq = 0LL;
+    s->repl_sent = 0LL;
+    s->repl_probed = 0LL;
+
     log_debug(LOG_VERB, "transform to server %"PRIu32" '%.*s'",
               s->idx, s->pname.len, s->pname.data);
 
@@ -221,6 +247,12 @@ conf_server_init_new(struct conf_server *cs, struct array *server, struct server
     s->next_retry = 0LL;
     s->failure_count = 0;
 
+    s->noutstanding = 0;
+    s->latency = 0LL;
+    s->repl_seq = 0LL;
+    s->repl_sent = 0LL;
+    s->repl_probed = 0LL;
+
     s->owner = sp;
 
     log_debug(LOG_VERB, "transform to server %"PRIu32" '%.*s'",
@@ -261,6 +293,11 @@ conf_pool_init(struct conf_pool *cp, struct string *name)
     cp->server_connections = CONF_UNSET_NUM;
     cp->server_retry_timeout = CONF_UNSET_NUM;
     cp->server_failure_limit = CONF_UNSET_NUM;
+    cp->read_policy = CONF_UNSET_READ;
+    cp->read_max_lag = CONF_UNSET_NUM;
+    cp->trace_rate = CONF_UNSET_NUM;
+
+    cp->zh_handler = NULL;
 
     array_null(&cp->server);
 
@@ -562,8 +599,24 @@ conf_pool_each_transform(void *elem, void *data)
     sp->nserver_continuum = 0;
     sp->continuum = NULL;
     sp->hashslot  = NULL;
+    sp->hashslot_retired = NULL;
+    sp->hashslot_grace = NULL;
+    sp->grace_loops = NULL;
+    sp->slot_map_version = 0;
+    sp->next_slot_map_load = 0LL;
+    sp->slot_map_loading = 0;
+    sp->slot_owner = sp;
+    sp->failover = NULL;
+    sp->npromoting = 0;
+    sp->slot_import = NULL;
+    sp->slot_fetching = NULL;
+    sp->zh_handler = NULL;
+    sp->init_ctx = NULL;
+    sp->shared = 0;
     sp->nlive_server = 0;
     sp->next_rebuild = 0LL;
+    sp->next_probe = 0LL;
+    array_null(&sp->server_group);
 
     sp->name = cp->name;
     sp->addrstr = cp->listen.pname;
@@ -594,8 +647,15 @@ conf_pool_each_transform(void *elem, void *data)
     sp->auto_eject_hosts = cp->auto_eject_hosts ? 1 : 0;
     sp->preconnect = cp->preconnect ? 1 : 0;
     sp->master = cp->master ? 1 : 0;
-
-    if (array_n(&cp->zookeeperserver) != 0) {
+    sp->read_policy = cp->read_policy;
+    sp->read_max_lag = (int64_t)cp->read_max_lag;
+    sp->trace_rate = (uint32_t)cp->trace_rate;
+    sp->trace_count = 0;
+
+    if (cp->zh_handler != NULL) {
+        /* worker context, servers were already loaded from zookeeper */
+        sp->zh_handler = cp->zh_handler;
+    } else if (array_n(&cp->zookeeperserver) != 0) {
         char zk_host[256];
         size_t zk_len = sizeof(zk_host);
         memset(zk_host, 0, zk_len);
@@ -621,6 +681,7 @@ conf_pool_each_transform(void *elem, void *data)
         if (status != NC_OK) {
             return status;
         }
+        cp->zh_handler = sp->zh_handler;
     }
 
     if (array_n(&cp->backupserver) != 0) {
@@ -652,6 +713,31 @@ conf_pool_each_transform(void *elem, void *data)
             log_error("slot map context init error");
             return status;
         }
+
+        sp->failover = nc_zalloc(sizeof(*sp->failover) * array_n(&sp->server));
+        if (sp->failover == NULL) {
+            return NC_ENOMEM;
+        }
+    }
+
+    /*
+     * Replicas are only known from the servers: groups of the config
+     * file, so read routing stays off when the server list came from
+     * zookeeper and does not line up with the groups
+     */
+    if (sp->read_policy != READ_MASTER && array_n(&sp->server) != 0) {
+        if (array_n(&cp->servergroup) == array_n(&sp->server)) {
+            status = server_group_init(&sp->server_group, &cp->servergroup, sp);
+            if (status != NC_OK) {
+                log_error("server group init error");
+                return status;
+            }
+        } else {
+            log_warn("pool %"PRIu32" '%.*s' has %"PRIu32" server groups for "
+                     "%"PRIu32" servers, reads go to masters", sp->idx,
+                     sp->name.len, sp->name.data, array_n(&cp->servergroup),
+                     array_n(&sp->server));
+        }
     }
 
     sp->ssdb_handle = dlopen(CONF_SSDB_HANDLE_PATH, RTLD_NOW);
@@ -707,6 +793,9 @@ conf_dump(struct conf *cf)
                   cp->server_retry_timeout);
         log_debug(LOG_VVERB, "  server_failure_limit: %d",
                   cp->server_failure_limit);
+        log_debug(LOG_VVERB, "  read_policy: %d", cp->read_policy);
+        log_debug(LOG_VVERB, "  read_max_lag: %d", cp->read_max_lag);
+        log_debug(LOG_VVERB, "  trace_rate: %d", cp->trace_rate);
 
         nserver = array_n(&cp->server);
         log_debug(LOG_VVERB, "  servers: %"PRIu32"", nserver);
@@ -1594,6 +1683,21 @@ conf_validate_pool(struct conf *cf, struct conf_pool *cp)
         cp->server_failure_limit = CONF_DEFAULT_SERVER_FAILURE_LIMIT;
     }
 
+    if (cp->read_policy == CONF_UNSET_READ) {
+        cp->read_policy = CONF_DEFAULT_READ_POLICY;
+    } else if (cp->read_policy != READ_MASTER && cp->protocol != PROTOCOL_SSDB) {
+        log_error("conf: directive \"read_policy:\" is only valid for a ssdb pool");
+        return NC_ERROR;
+    }
+
+    if (cp->read_max_lag == CONF_UNSET_NUM) {
+        cp->read_max_lag = CONF_DEFAULT_READ_MAX_LAG;
+    }
+
+    if (cp->trace_rate == CONF_UNSET_NUM) {
+        cp->trace_rate = CONF_DEFAULT_TRACE_RATE;
+    }
+
     if (cp->protocol != PROTOCOL_REDIS && cp->redis_auth.len > 0) {
         log_error("conf: directive \"redis_auth:\" is only valid for a redis pool");
         return NC_ERROR;
@@ -2321,6 +2425,35 @@ conf_set_distribution(struct conf *cf, struct command *cmd, void *conf)
     return "is not a valid distribution";
 }
 
+char *
+conf_set_read_policy(struct conf *cf, struct command *cmd, void *conf)
+{
+    uint8_t *p;
+    read_type_t *rp;
+    struct string *value, *read;
+
+    p = conf;
+    rp = (read_type_t *)(p + cmd->offset);
+
+    if (*rp != CONF_UNSET_READ) {
+        return "is a duplicate";
+    }
+
+    value = array_top(&cf->arg);
+
+    for (read = read_strings; read->len != 0; read++) {
+        if (string_compare(value, read) != 0) {
+            continue;
+        }
+
+        *rp = read - read_strings;
+
+        return CONF_OK;
+    }
+
+    return "is not a valid read policy";
+}
+
 char *
 conf_set_hashtag(struct conf *cf, struct command *cmd, void *conf)
 {
@@ -41,6 +41,7 @@
 #define CONF_UNSET_PTR  NULL
 #define CONF_UNSET_HASH (hash_type_t) -1
 #define CONF_UNSET_DIST (dist_type_t) -1
+#define CONF_UNSET_READ (read_type_t) -1
 
 #define CONF_DEFAULT_HASH                    HASH_FNV1A_64
 #define CONF_DEFAULT_DIST                    DIST_KETAMA
@@ -55,6 +56,9 @@
 #define CONF_DEFAULT_SERVER_RETRY_TIMEOUT    30 * 1000      /* in msec */
 #define CONF_DEFAULT_SERVER_FAILURE_LIMIT    2
 #define CONF_DEFAULT_SERVER_CONNECTIONS      1
+#define CONF_DEFAULT_READ_POLICY             READ_MASTER
+#define CONF_DEFAULT_READ_MAX_LAG            1000           /* in binlog seqs */
+#define CONF_DEFAULT_TRACE_RATE              0              /* off */
 #define CONF_DEFAULT_KETAMA_PORT             11211
 #define CONF_DEFAULT_TCPKEEPALIVE            false
 #define CONF_DEFAULT_DATA_LENGTH             256
@@ -104,11 +108,15 @@ struct conf_pool {
     int                server_connections;    /* server_connections: */
     int                server_retry_timeout;  /* server_retry_timeout: in msec */
     int                server_failure_limit;  /* server_failure_limit: */
+    read_type_t        read_policy;           /* read_policy: */
+    int                read_max_lag;          /* read_max_lag: in binlog seqs */
+    int                trace_rate;            /* trace_rate: trace one in trace_rate requests */
     struct array       server;                /* servers: conf_server[] */
 	struct array       servergroup;
 //	struct array       writeserver;           /*writeservers: conf_server[] */
     struct array       backupserver;          /*backupservers: conf_server[] */
     struct array       zookeeperserver;      /*zookeeperservers: conf_server[] */
+    zhandle_t          *zh_handler;           /* zookeeper handle, shared by all contexts */
     unsigned           valid:1;               /* valid? */
 };
 
@@ -150,6 +158,7 @@ char *conf_set_num(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_bool(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_hash(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_distribution(struct conf *cf, struct command *cmd, void *conf);
+char *conf_set_read_policy(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_hashtag(struct conf *cf, struct command *cmd, void *conf);
 
 rstatus_t conf_server_each_transform(void *elem, void *data);
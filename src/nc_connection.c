@@ -81,11 +81,12 @@
  * the queue.
  */
 
-static uint32_t nfree_connq;       /* # free conn q */
-static struct conn_tqh free_connq; /* free conn q */
-static uint64_t ntotal_conn;       /* total # connections counter from start */
-static uint32_t ncurr_conn;        /* current # connections */
-static uint32_t ncurr_cconn;       /* current # client connections */
+static __thread uint32_t nfree_connq;       /* # free conn q, per event loop thread */
+static __thread struct conn_tqh free_connq; /* free conn q, per event loop thread */
+/* connection counters are shared by all event loop threads */
+static uint64_t ntotal_conn;                /* total # connections counter from start */
+static uint32_t ncurr_conn;                 /* current # connections */
+static uint32_t ncurr_cconn;                /* current # client connections */
 
 /*
  * Return the context associated with this connection.
@@ -158,8 +159,8 @@ _conn_get(void)
     conn->protocol = PROTOCOL_REDIS;
     conn->authenticated = 0;
 
-    ntotal_conn++;
-    ncurr_conn++;
+    __sync_add_and_fetch(&ntotal_conn, 1);
+    __sync_add_and_fetch(&ncurr_conn, 1);
 
     return conn;
 }
@@ -205,7 +206,7 @@ conn_get(void *owner, bool client, int protocol)
         conn->post_connect = NULL;
         conn->swallow_msg = NULL;
 
-        ncurr_cconn++;
+        __sync_add_and_fetch(&ncurr_cconn, 1);
     } else {
         /*
          * server receives a response, possibly parsing it, and sends a
@@ -312,9 +313,9 @@ conn_put(struct conn *conn)
     TAILQ_INSERT_HEAD(&free_connq, conn, conn_tqe);
 
     if (conn->client) {
-        ncurr_cconn--;
+        __sync_sub_and_fetch(&ncurr_cconn, 1);
     }
-    ncurr_conn--;
+    __sync_sub_and_fetch(&ncurr_conn, 1);
 }
 
 void
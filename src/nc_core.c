@@ -25,7 +25,7 @@
 #define MAX_CHECKED_TIME_INTERVAL 2000 /*msec*/
 
 static uint32_t ctx_id; /* context generation */
-static int64_t  last_checked_time = 0LL; /*last call server_pool_connected_determine*/
+static __thread int64_t last_checked_time = 0LL; /*last call server_pool_connected_determine*/
 
 
 static rstatus_t
@@ -40,8 +40,11 @@ core_calc_connections(struct context *ctx)
         return NC_ERROR;
     }
 
+    /* every event loop thread keeps its own server connections */
     ctx->max_nfd = (uint32_t)limit.rlim_cur;
-    ctx->max_ncconn = ctx->max_nfd - ctx->max_nsconn - RESERVED_FDS;
+    ctx->max_ncconn = ctx->max_nfd -
+                      ctx->max_nsconn * (uint32_t)ctx->nci->worker_threads -
+                      RESERVED_FDS;
     log_debug(LOG_NOTICE, "max fds %"PRIu32" max client conns %"PRIu32" "
               "max server conns %"PRIu32"", ctx->max_nfd, ctx->max_ncconn,
               ctx->max_nsconn);
@@ -69,6 +72,17 @@ core_ctx_create(struct instance *nci)
     ctx->max_nfd = 0;
     ctx->max_ncconn = 0;
     ctx->max_nsconn = 0;
+    TAILQ_INIT(&ctx->retry_q);
+    ctx->nheld = 0;
+    ctx->nci = nci;
+    ctx->main = NULL;
+    array_null(&ctx->worker);
+    ctx->tid = (pthread_t) -1;
+    ctx->wake = NULL;
+    ctx->wake_sd = -1;
+    ctx->quit = 0;
+    ctx->loops = 0;
+    ctx->reuseport = nci->worker_threads > 1 ? 1 : 0;
 
     /* parse and create configuration */
     ctx->cf = conf_create(nci->conf_filename);
@@ -146,6 +160,285 @@ core_ctx_create(struct instance *nci)
     return ctx;
 }
 
+/*
+ * A worker context is a copy of the main context with its own event base,
+ * proxy listeners and server connections. Configuration, the zookeeper
+ * handle and the hashslot table are borrowed from the main context.
+ */
+static struct context *
+core_worker_create(struct context *main)
+{
+    rstatus_t status;
+    struct context *ctx;
+
+    ctx = nc_alloc(sizeof(*ctx));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    ctx->id = ++ctx_id;
+    ctx->cf = main->cf;
+    ctx->stats = NULL;
+    ctx->evb = NULL;
+    array_null(&ctx->pool);
+    ctx->max_timeout = main->max_timeout;
+    ctx->timeout = ctx->max_timeout;
+    ctx->max_nfd = main->max_nfd;
+    ctx->max_ncconn = main->max_ncconn;
+    ctx->max_nsconn = 0;
+    TAILQ_INIT(&ctx->retry_q);
+    ctx->nheld = 0;
+    ctx->nci = main->nci;
+    ctx->main = main;
+    array_null(&ctx->worker);
+    ctx->tid = (pthread_t) -1;
+    ctx->wake = NULL;
+    ctx->wake_sd = -1;
+    ctx->quit = 0;
+    ctx->loops = 0;
+    ctx->reuseport = 1;
+
+    status = server_pool_init(&ctx->pool, &ctx->cf->pool, ctx);
+    if (status != NC_OK) {
+        nc_free(ctx);
+        return NULL;
+    }
+
+    ctx->stats = stats_create_worker(&ctx->pool);
+    if (ctx->stats == NULL) {
+        server_pool_deinit(&ctx->pool);
+        nc_free(ctx);
+        return NULL;
+    }
+
+    ctx->evb = event_base_create(EVENT_SIZE, &core_core);
+    if (ctx->evb == NULL) {
+        stats_destroy(ctx->stats);
+        server_pool_deinit(&ctx->pool);
+        nc_free(ctx);
+        return NULL;
+    }
+
+    status = server_pool_preconnect(ctx);
+    if (status != NC_OK) {
+        server_pool_disconnect(ctx);
+        event_base_destroy(ctx->evb);
+        stats_destroy(ctx->stats);
+        server_pool_deinit(&ctx->pool);
+        nc_free(ctx);
+        return NULL;
+    }
+
+    status = proxy_init(ctx);
+    if (status != NC_OK) {
+        server_pool_disconnect(ctx);
+        event_base_destroy(ctx->evb);
+        stats_destroy(ctx->stats);
+        server_pool_deinit(&ctx->pool);
+        nc_free(ctx);
+        return NULL;
+    }
+
+    log_debug(LOG_VVERB, "created worker ctx %p id %"PRIu32"", ctx, ctx->id);
+
+    return ctx;
+}
+
+static rstatus_t
+core_worker_wake_recv(struct context *ctx, struct conn *conn)
+{
+    char buf[64];
+
+    /* drain the pipe, core_loop checks ctx->quit once we are back */
+    while (read(conn->sd, buf, sizeof(buf)) > 0) {
+        /* nothing */
+    }
+    conn->recv_ready = 0;
+
+    return NC_OK;
+}
+
+/*
+ * The wakeup pipe lets core_worker_stop interrupt event_wait of a worker
+ * so that it sees ctx->quit and leaves its loop on its own. The read end
+ * is a bare conn owned by the first pool, only its recv handler is used.
+ */
+static rstatus_t
+core_worker_wake_init(struct context *ctx)
+{
+    struct conn *conn;
+    int fds[2];
+
+    if (pipe(fds) < 0) {
+        log_error("pipe for worker ctx %"PRIu32" failed: %s", ctx->id,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    conn = nc_zalloc(sizeof(*conn));
+    if (conn == NULL) {
+        close(fds[0]);
+        close(fds[1]);
+        return NC_ENOMEM;
+    }
+    conn->owner = array_get(&ctx->pool, 0);
+    conn->sd = fds[0];
+    conn->proxy = 1;
+    conn->recv = core_worker_wake_recv;
+    ctx->wake = conn;
+    ctx->wake_sd = fds[1];
+
+    if (nc_set_nonblocking(fds[0]) < 0 || nc_set_nonblocking(fds[1]) < 0) {
+        log_error("set nonblock on worker ctx %"PRIu32" pipe failed: %s",
+                  ctx->id, strerror(errno));
+        return NC_ERROR;
+    }
+
+    if (event_add_conn(ctx->evb, conn) < 0) {
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+static void
+core_worker_wake(struct context *ctx)
+{
+    ssize_t n;
+
+    n = write(ctx->wake_sd, "", 1);
+    if (n < 0 && errno != EAGAIN) {
+        log_warn("wake worker ctx %"PRIu32" failed: %s", ctx->id,
+                 strerror(errno));
+    }
+}
+
+static void
+core_worker_destroy(struct context *ctx)
+{
+    log_debug(LOG_VVERB, "destroy worker ctx %p id %"PRIu32"", ctx, ctx->id);
+    if (ctx->wake != NULL) {
+        event_del_conn(ctx->evb, ctx->wake);
+        close(ctx->wake->sd);
+        close(ctx->wake_sd);
+        nc_free(ctx->wake);
+        ctx->wake = NULL;
+    }
+    proxy_deinit(ctx);
+    server_pool_disconnect(ctx);
+    event_base_destroy(ctx->evb);
+    stats_destroy(ctx->stats);
+    server_pool_deinit(&ctx->pool);
+    nc_free(ctx);
+}
+
+static void *
+core_worker_loop(void *arg)
+{
+    struct context *ctx = arg;
+    rstatus_t status;
+
+    /* mbuf, msg and conn free lists are per thread */
+    mbuf_init(ctx->nci);
+    msg_init();
+    conn_init();
+
+    for (;;) {
+        status = core_loop(ctx);
+        if (status != NC_OK) {
+            break;
+        }
+    }
+
+    if (ctx->quit) {
+        /* asked to stop by core_worker_stop */
+        return NULL;
+    }
+
+    /* take the whole instance down, as a failing main loop would */
+    log_error("event loop of worker ctx %"PRIu32" failed, stopping",
+              ctx->id);
+    ctx->main->quit = 1;
+
+    return NULL;
+}
+
+static rstatus_t
+core_worker_start(struct context *ctx)
+{
+    rstatus_t status;
+    uint32_t i, nworker;
+
+    nworker = (uint32_t)ctx->nci->worker_threads - 1;
+    if (nworker == 0) {
+        return NC_OK;
+    }
+
+    status = array_init(&ctx->worker, nworker, sizeof(struct context *));
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < nworker; i++) {
+        struct context *worker, **pworker;
+        int err;
+
+        worker = core_worker_create(ctx);
+        if (worker == NULL) {
+            return NC_ERROR;
+        }
+
+        pworker = array_push(&ctx->worker);
+        *pworker = worker;
+
+        status = core_worker_wake_init(worker);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        stats_add_worker(ctx->stats, worker->stats);
+
+        err = pthread_create(&worker->tid, NULL, core_worker_loop, worker);
+        if (err != 0) {
+            log_error("worker thread create failed: %s", strerror(err));
+            worker->tid = (pthread_t) -1;
+            return NC_ERROR;
+        }
+    }
+
+    log_debug(LOG_NOTICE, "started %"PRIu32" worker event loops", nworker);
+
+    return NC_OK;
+}
+
+static void
+core_worker_stop(struct context *ctx)
+{
+    uint32_t i;
+
+    /* ask every worker first, so that they wind down in parallel */
+    for (i = 0; i < array_n(&ctx->worker); i++) {
+        struct context *worker = *(struct context **)array_get(&ctx->worker, i);
+
+        if (worker->tid == (pthread_t) -1) {
+            continue;
+        }
+
+        worker->quit = 1;
+        core_worker_wake(worker);
+    }
+
+    for (i = 0; i < array_n(&ctx->worker); i++) {
+        struct context *worker = *(struct context **)array_get(&ctx->worker, i);
+
+        if (worker->tid == (pthread_t) -1) {
+            continue;
+        }
+
+        pthread_join(worker->tid, NULL);
+        worker->tid = (pthread_t) -1;
+    }
+}
+
 static void
 core_ctx_destroy(struct context *ctx)
 {
@@ -153,7 +446,12 @@ core_ctx_destroy(struct context *ctx)
     proxy_deinit(ctx);
     server_pool_disconnect(ctx);
     event_base_destroy(ctx->evb);
+    /* workers go after the aggregator that reads their stats */
     stats_destroy(ctx->stats);
+    while (array_n(&ctx->worker) != 0) {
+        core_worker_destroy(*(struct context **)array_pop(&ctx->worker));
+    }
+    array_deinit(&ctx->worker);
     server_pool_deinit(&ctx->pool);
     conf_destroy(ctx->cf);
     nc_free(ctx);
@@ -162,6 +460,7 @@ core_ctx_destroy(struct context *ctx)
 struct context *
 core_start(struct instance *nci)
 {
+    rstatus_t status;
     struct context *ctx;
 
     mbuf_init(nci);
@@ -170,6 +469,12 @@ core_start(struct instance *nci)
 
     ctx = core_ctx_create(nci);
     if (ctx != NULL) {
+        status = core_worker_start(ctx);
+        if (status != NC_OK) {
+            core_stop(ctx);
+            return NULL;
+        }
+
         nci->ctx = ctx;
         return ctx;
     }
@@ -184,6 +489,7 @@ core_start(struct instance *nci)
 void
 core_stop(struct context *ctx)
 {
+    core_worker_stop(ctx);
     conn_deinit();
     msg_deinit();
     mbuf_deinit();
@@ -361,6 +667,16 @@ core_loop(struct context *ctx)
     int nsd;
     int64_t now;
 
+    if (ctx->quit) {
+        return NC_ERROR;
+    }
+
+    /* nothing read from shared tables in the last turn is held any longer */
+    ctx->loops++;
+    if (ctx->main == NULL) {
+        hashslot_reclaim(ctx);
+    }
+
     nsd = event_wait(ctx->evb, ctx->timeout);
     if (nsd < 0) {
         return nsd;
@@ -368,6 +684,10 @@ core_loop(struct context *ctx)
 
     core_timeout(ctx);
 
+    req_retry(ctx);
+
+    server_pool_probe(ctx);
+
     stats_swap(ctx->stats);
 
     now = nc_usec_now();
@@ -375,7 +695,7 @@ core_loop(struct context *ctx)
         return NC_ERROR;
     }
 
-    if(now - last_checked_time > MAX_CHECKED_TIME_INTERVAL){
+    if(now - last_checked_time > MAX_CHECKED_TIME_INTERVAL * 1000LL){
         server_pool_connected_determine(ctx);
         last_checked_time = now;
     }
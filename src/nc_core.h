@@ -131,6 +131,19 @@ struct context {
     uint32_t           max_nfd;     /* max # files */
     uint32_t           max_ncconn;  /* max # client connections */
     uint32_t           max_nsconn;  /* max # server connections */
+
+    struct msg_tqh     retry_q;     /* redirected requests waiting to be retried */
+    uint32_t           nheld;       /* # requests in retry_q held for a failover */
+
+    struct instance    *nci;        /* owner instance */
+    struct context     *main;       /* main context of a worker, NULL otherwise */
+    struct array       worker;      /* worker contexts (struct context *) */
+    pthread_t          tid;         /* worker event loop thread */
+    struct conn        *wake;       /* read end of the worker wakeup pipe */
+    int                wake_sd;     /* write end of the worker wakeup pipe */
+    volatile int       quit;        /* leave the event loop? */
+    volatile uint64_t  loops;       /* # event loop turns, ends grace periods */
+    unsigned           reuseport:1; /* listen ports shared with other contexts? */
 };
 
 
@@ -144,6 +157,7 @@ struct instance {
     char            *stats_addr;                 /* stats monitoring addr */
     char            hostname[NC_MAXHOSTNAMELEN]; /* hostname */
     size_t          mbuf_chunk_size;             /* mbuf chunk size */
+    int             worker_threads;              /* # event loop threads */
     pid_t           pid;                         /* process id */
     char            *pid_filename;               /* pid filename */
     unsigned        pidfile:1;                   /* pid file created? */
@@ -0,0 +1,339 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_failover.h>
+#include <nc_zookeeper.h>
+
+/* jobs for the control thread, and rejoin jobs it has finished */
+static pthread_mutex_t failover_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t failover_cond = PTHREAD_COND_INITIALIZER;
+static struct failover_jobq failover_q = STAILQ_HEAD_INITIALIZER(failover_q);
+static struct failover_jobq failover_done_q = STAILQ_HEAD_INITIALIZER(failover_done_q);
+static bool failover_running;
+
+static void
+failover_copy_addr(char *dst, struct server *server)
+{
+    uint32_t len;
+
+    len = MIN(server->addrstr.len, (uint32_t)(NC_MAXHOSTNAMELEN - 1));
+    nc_memcpy(dst, server->addrstr.data, len);
+    dst[len] = '\0';
+}
+
+static struct failover_job *
+failover_job_get(struct server_pool *pool, uint32_t idx, failover_type_t type,
+                 struct server *server, struct server *peer)
+{
+    struct failover_job *job;
+
+    job = nc_alloc(sizeof(*job));
+    if (job == NULL) {
+        return NULL;
+    }
+
+    job->type = type;
+    job->ctx = pool->ctx;
+    job->pool = pool;
+    job->idx = idx;
+    failover_copy_addr(job->ip, server);
+    job->port = server->port;
+    failover_copy_addr(job->peer_ip, peer);
+    job->peer_port = peer->port;
+    job->err = 0;
+
+    return job;
+}
+
+/*
+ * Promote the backup with the ssdb handle, then point /nodes/<idx> at
+ * it with the failed master as its slave
+ */
+static void
+failover_run_promote(struct failover_job *job)
+{
+    struct server_pool *pool = job->pool;
+    lib_ssdb_active_standby_switch_t active_standby_switch;
+    struct String_vector strings;
+    char zk_path[64];
+    char zk_set_str[2 * NC_MAXHOSTNAMELEN + 128];
+    int ret;
+
+    active_standby_switch = (lib_ssdb_active_standby_switch_t)dlsym(pool->ssdb_handle, "active_standby_switch");
+    if (active_standby_switch == NULL) {
+        log_warn("ssdb handle has no active_standby_switch");
+        return;
+    }
+
+    job->err = active_standby_switch(job->ip, job->port, &pool->last_seq);
+    log_warn("switch between master and slave machines, error_code %d, now master:pool "
+             "%"PRIu32" '%.*s' server address:%s:%u, last_seq %"PRIu64"", job->err,
+             pool->idx, pool->name.len, pool->name.data, job->ip, job->port,
+             pool->last_seq);
+
+    ret = zk_get_children(pool->zh_handler, "/nodes", NULL, NULL, &strings);
+    if (ret) {
+        return;
+    }
+    qsort(strings.data, (size_t)strings.count, sizeof(char *), comp);
+
+    if (job->idx < (uint32_t)strings.count) {
+        sprintf(zk_set_str, "{\"status\":0,\"ip\":\"%s\",\"port\":%d,\"slave_ip\":\"%s\",\"slave_port\":%d}",
+                job->ip, job->port, job->peer_ip, job->peer_port);
+        sprintf(zk_path, "/nodes/%s", strings.data[job->idx]);
+        zk_set(pool->zh_handler, zk_path, zk_set_str);
+    }
+
+    deallocate_String_vector(&strings);
+}
+
+/* make the failed master replicate from the master that replaced it */
+static void
+failover_run_rejoin(struct failover_job *job)
+{
+    struct server_pool *pool = job->pool;
+    lib_ssdb_change_master_to_t change_master_to;
+
+    change_master_to = (lib_ssdb_change_master_to_t)dlsym(pool->ssdb_handle, "change_master_to");
+    if (change_master_to == NULL) {
+        log_warn("ssdb handle has no change_master_to");
+        job->err = SSDB_CONNECTED_ERROR;
+        return;
+    }
+
+    job->err = change_master_to(job->ip, job->port, pool->last_seq,
+                                job->peer_ip, job->peer_port);
+}
+
+static void *
+failover_loop(void *arg)
+{
+    struct failover_job *job;
+
+    for (;;) {
+        pthread_mutex_lock(&failover_lock);
+        while (STAILQ_EMPTY(&failover_q)) {
+            pthread_cond_wait(&failover_cond, &failover_lock);
+        }
+        job = STAILQ_FIRST(&failover_q);
+        STAILQ_REMOVE_HEAD(&failover_q, next);
+        pthread_mutex_unlock(&failover_lock);
+
+        switch (job->type) {
+        case FAILOVER_PROMOTE:
+            failover_run_promote(job);
+            __sync_sub_and_fetch(&job->pool->failover[job->idx].promoting, 1);
+            __sync_sub_and_fetch(&job->pool->npromoting, 1);
+            nc_free(job);
+            break;
+
+        case FAILOVER_REJOIN:
+            failover_run_rejoin(job);
+            pthread_mutex_lock(&failover_lock);
+            STAILQ_INSERT_TAIL(&failover_done_q, job, next);
+            pthread_mutex_unlock(&failover_lock);
+            break;
+
+        default:
+            NOT_REACHED();
+            nc_free(job);
+        }
+    }
+
+    return NULL;
+}
+
+/* hand a job to the control thread, starting it on first use */
+static rstatus_t
+failover_queue(struct failover_job *job)
+{
+    pthread_t tid;
+    int err;
+
+    pthread_mutex_lock(&failover_lock);
+
+    if (!failover_running) {
+        err = pthread_create(&tid, NULL, failover_loop, NULL);
+        if (err != 0) {
+            pthread_mutex_unlock(&failover_lock);
+            log_error("create failover thread failed: %s", strerror(err));
+            return NC_ERROR;
+        }
+        pthread_detach(tid);
+        failover_running = true;
+    }
+
+    STAILQ_INSERT_TAIL(&failover_q, job, next);
+    pthread_cond_signal(&failover_cond);
+
+    pthread_mutex_unlock(&failover_lock);
+
+    return NC_OK;
+}
+
+/*
+ * The pair at idx of a master pool has just been swapped: promote the
+ * new master in the background and hold writes for it until then
+ */
+rstatus_t
+failover_promote(struct server_pool *pool, uint32_t idx)
+{
+    struct failover_job *job;
+    rstatus_t status;
+
+    ASSERT(pool->master);
+
+    if (pool->ssdb_handle == NULL || pool->failover == NULL) {
+        log_warn("ssdb handle is NULL");
+        return NC_ERROR;
+    }
+
+    job = failover_job_get(pool, idx, FAILOVER_PROMOTE,
+                           array_get(&pool->server, idx),
+                           array_get(&pool->backup_server, idx));
+    if (job == NULL) {
+        return NC_ENOMEM;
+    }
+
+    __sync_add_and_fetch(&pool->failover[idx].promoting, 1);
+    __sync_add_and_fetch(&pool->npromoting, 1);
+
+    status = failover_queue(job);
+    if (status != NC_OK) {
+        __sync_sub_and_fetch(&pool->failover[idx].promoting, 1);
+        __sync_sub_and_fetch(&pool->npromoting, 1);
+        nc_free(job);
+        return status;
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Try to make the failed master at backup idx of a master pool a slave
+ * of the current master, the result comes back in failover_done
+ */
+rstatus_t
+failover_rejoin(struct server_pool *pool, uint32_t idx)
+{
+    struct failover_job *job;
+    rstatus_t status;
+
+    ASSERT(pool->master);
+
+    if (pool->ssdb_handle == NULL || pool->failover == NULL) {
+        log_warn("ssdb handle is NULL");
+        return NC_ERROR;
+    }
+
+    if (pool->failover[idx].rejoining) {
+        return NC_OK;
+    }
+
+    job = failover_job_get(pool, idx, FAILOVER_REJOIN,
+                           array_get(&pool->backup_server, idx),
+                           array_get(&pool->server, idx));
+    if (job == NULL) {
+        return NC_ENOMEM;
+    }
+
+    status = failover_queue(job);
+    if (status != NC_OK) {
+        nc_free(job);
+        return status;
+    }
+
+    pool->failover[idx].rejoining = 1;
+
+    return NC_OK;
+}
+
+/* apply the rejoin jobs of ctx the control thread has finished */
+void
+failover_done(struct context *ctx)
+{
+    struct failover_jobq doneq;
+    struct failover_job *job, *njob;
+    struct server_pool *pool;
+    struct server *server;
+    int64_t now;
+
+    STAILQ_INIT(&doneq);
+
+    pthread_mutex_lock(&failover_lock);
+    for (job = STAILQ_FIRST(&failover_done_q); job != NULL; job = njob) {
+        njob = STAILQ_NEXT(job, next);
+        if (job->ctx == ctx) {
+            STAILQ_REMOVE(&failover_done_q, job, failover_job, next);
+            STAILQ_INSERT_TAIL(&doneq, job, next);
+        }
+    }
+    pthread_mutex_unlock(&failover_lock);
+
+    now = nc_usec_now();
+
+    while (!STAILQ_EMPTY(&doneq)) {
+        job = STAILQ_FIRST(&doneq);
+        STAILQ_REMOVE_HEAD(&doneq, next);
+
+        pool = job->pool;
+        pool->failover[job->idx].rejoining = 0;
+
+        /* the pair may have been swapped back meanwhile */
+        server = array_get(&pool->backup_server, job->idx);
+        if (server->port == job->port &&
+            server->addrstr.len == nc_strlen(job->ip) &&
+            nc_strncmp(server->addrstr.data, job->ip, server->addrstr.len) == 0) {
+            if (job->err == SSDB_CONNECTED_ERROR) {
+                log_warn("connect to server '%.*s' failed, ignored",
+                         server->pname.len, server->pname.data);
+                server->next_retry = now + pool->server_retry_timeout;
+            } else {
+                log_warn("server '%.*s' follows %s:%u, error_code %d",
+                         server->pname.len, server->pname.data, job->peer_ip,
+                         job->peer_port, job->err);
+                server->next_retry = 0LL;
+            }
+        }
+
+        nc_free(job);
+    }
+}
+
+/*
+ * Is the master a write for {key, keylen} would go to being promoted?
+ * Worker pools look at the state kept by the main context's pool.
+ */
+bool
+failover_pending(struct server_pool *pool, uint8_t *key, uint32_t keylen)
+{
+    struct server_pool *owner = pool->slot_owner;
+    uint32_t idx;
+
+    if (owner->npromoting == 0 || owner->failover == NULL) {
+        return false;
+    }
+
+    idx = server_pool_idx(pool, key, keylen);
+    if (idx >= array_n(&owner->server)) {
+        return false;
+    }
+
+    return owner->failover[idx].promoting != 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_FAILOVER_H_
+#define _NC_FAILOVER_H_
+
+#include <nc_core.h>
+
+/*
+ * Failover of a master/backup pair runs on a control thread, as it talks
+ * to ssdb and zookeeper synchronously. The event loop swaps the pair at
+ * once and holds writes for that server index until the backup has been
+ * promoted, in ctx->retry_q and within the bounds below.
+ */
+#define FAILOVER_HOLD_MAX       4096    /* max # requests held per event loop */
+#define FAILOVER_HOLD_TIMEOUT   5000    /* max time a request is held in msec */
+#define FAILOVER_HOLD_POLL      10      /* held request recheck interval in msec */
+
+typedef enum failover_type {
+    FAILOVER_PROMOTE,                   /* make the backup master, record it in zookeeper */
+    FAILOVER_REJOIN,                    /* make the old master a slave of the new one */
+} failover_type_t;
+
+struct failover_job {
+    STAILQ_ENTRY(failover_job) next;    /* link in the job or done q */
+    failover_type_t            type;    /* job type */
+    struct context             *ctx;    /* context that queued the job */
+    struct server_pool         *pool;   /* pool of the pair */
+    uint32_t                   idx;     /* server index of the pair */
+    char                       ip[NC_MAXHOSTNAMELEN];      /* server the job acts on */
+    uint16_t                   port;
+    char                       peer_ip[NC_MAXHOSTNAMELEN]; /* failed master, or the master to follow */
+    uint16_t                   peer_port;
+    int                        err;     /* ssdb handle error code, 0: ok */
+};
+
+STAILQ_HEAD(failover_jobq, failover_job);
+
+/* failover state of a server index, kept by the main context's pool */
+struct server_failover {
+    volatile uint32_t promoting;        /* # promotions in flight */
+    unsigned          rejoining:1;      /* rejoin job queued? */
+};
+
+rstatus_t failover_promote(struct server_pool *pool, uint32_t idx);
+rstatus_t failover_rejoin(struct server_pool *pool, uint32_t idx);
+void failover_done(struct context *ctx);
+bool failover_pending(struct server_pool *pool, uint8_t *key, uint32_t keylen);
+
+#endif
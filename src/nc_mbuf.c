@@ -20,11 +20,12 @@
 
 #include <nc_core.h>
 
-static uint32_t nfree_mbufq;   /* # free mbuf */
-static struct mhdr free_mbufq; /* free mbuf q */
+/* per event loop thread, see mbuf_init */
+static __thread uint32_t nfree_mbufq;   /* # free mbuf */
+static __thread struct mhdr free_mbufq; /* free mbuf q */
 
-static size_t mbuf_chunk_size; /* mbuf chunk size - header + data (const) */
-static size_t mbuf_offset;     /* mbuf offset in chunk (const) */
+static __thread size_t mbuf_chunk_size; /* mbuf chunk size - header + data (const) */
+static __thread size_t mbuf_offset;     /* mbuf offset in chunk (const) */
 
 static struct mbuf *
 _mbuf_get(void)
@@ -109,12 +109,13 @@
  * server.
  */
 
-static uint64_t msg_id;          /* message id counter */
-static uint64_t frag_id;         /* fragment id counter */
-static uint32_t nfree_msgq;      /* # free msg q */
-static struct msg_tqh free_msgq; /* free msg q */
-static struct rbtree tmo_rbt;    /* timeout rbtree */
-static struct rbnode tmo_rbs;    /* timeout rbtree sentinel */
+/* per event loop thread, see msg_init */
+static __thread uint64_t msg_id;          /* message id counter */
+static __thread uint64_t frag_id;         /* fragment id counter */
+static __thread uint32_t nfree_msgq;      /* # free msg q */
+static __thread struct msg_tqh free_msgq; /* free msg q */
+static __thread struct rbtree tmo_rbt;    /* timeout rbtree */
+static __thread struct rbnode tmo_rbs;    /* timeout rbtree sentinel */
 
 #define DEFINE_ACTION(_name) string(#_name),
 static struct string msg_type_strings[] = {
@@ -220,6 +221,7 @@ done:
     STAILQ_INIT(&msg->mhdr);
     msg->mlen = 0;
     msg->start_ts = 0;
+    msg->send_ts = 0;
 
     msg->state = 0;
     msg->pos = NULL;
@@ -228,6 +230,7 @@ done:
     msg->parser = NULL;
     msg->add_auth = NULL;
     msg->result = MSG_PARSE_OK;
+    msg->redirect = NULL;
 
     msg->fragment = NULL;
     msg->reply = NULL;
@@ -251,6 +254,9 @@ done:
     msg->nfrag_done = 0;
     msg->frag_id = 0;
 
+    msg->nredirect = 0;
+    msg->retry_at = 0;
+
     msg->narg_start = NULL;
     msg->narg_end = NULL;
     msg->narg = 0;
@@ -268,6 +274,11 @@ done:
     msg->done = 0;
     msg->fdone = 0;
     msg->swallow = 0;
+    msg->asking = 0;
+    msg->probe = 0;
+    msg->trace = 0;
+    msg->held = 0;
+    msg->write = 1;
     msg->protocol = PROTOCOL_REDIS;
 
     return msg;
@@ -300,6 +311,7 @@ void register_msg_function(struct msg * msg, bool request, int protocol)
         msg->fragment = ssdb_fragment;
 		msg->reply    = ssdb_reply;
         msg->failure = ssdb_failure;
+        msg->redirect = ssdb_redirect;
         msg->pre_coalesce = ssdb_pre_coalesce;
         msg->post_coalesce = ssdb_post_coalesce;
 		break;
@@ -584,6 +596,23 @@ msg_prepend_format(struct msg *msg, const char *fmt, ...)
     return NC_OK;
 }
 
+/*
+ * Make a request that was already sent ready to be sent again. Request
+ * data always starts at the beginning of its mbufs, so only the send
+ * position needs to be reset.
+ */
+void
+msg_rewind(struct msg *msg)
+{
+    struct mbuf *mbuf;
+
+    ASSERT(msg->request);
+
+    STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
+        mbuf->pos = mbuf->start;
+    }
+}
+
 inline uint64_t
 msg_gen_frag_id(void)
 {
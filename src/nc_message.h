@@ -34,6 +34,17 @@ typedef enum msg_parse_result {
     MSG_PARSE_AGAIN,                      /* incomplete -> parse again */
 } msg_parse_result_t;
 
+#define MSG_REDIRECT_MAX 16               /* redirects before the error goes to the client */
+
+typedef enum msg_redirect_type {
+    MSG_REDIRECT_NONE,                    /* not a redirect */
+    MSG_REDIRECT_MOVED,                   /* slot is owned by another server */
+    MSG_REDIRECT_ASK,                     /* key is on the importing server */
+    MSG_REDIRECT_TRYAGAIN,                /* key is being migrated right now */
+} msg_redirect_type_t;
+
+typedef msg_redirect_type_t (*msg_redirect_t)(struct msg *r);
+
 #define MSG_TYPE_CODEC(ACTION)                                                                      \
     ACTION( UNKNOWN )                                                                               \
     ACTION( REQ_MC_GET )                       /* memcache retrieval requests */                    \
@@ -256,6 +267,7 @@ struct msg {
     struct mhdr          mhdr;            /* message mbuf header */
     uint32_t             mlen;            /* message length */
     int64_t              start_ts;        /* request start timestamp in usec */
+    int64_t              send_ts;         /* server enqueue timestamp in usec (latency_ewma, trace) */
 
     int                  state;           /* current parser state */
     uint8_t              *pos;            /* parser position marker */
@@ -268,6 +280,7 @@ struct msg {
     msg_reply_t          reply;           /* generate message reply (example: ping) */
     msg_add_auth_t       add_auth;        /* add auth message when we forward msg */
     msg_failure_t        failure;         /* transient failure response? */
+    msg_redirect_t       redirect;        /* slot redirect response? */
 
     msg_coalesce_t       pre_coalesce;    /* message pre-coalesce */
     msg_coalesce_t       post_coalesce;   /* message post-coalesce */
@@ -296,6 +309,9 @@ struct msg {
     uint32_t             nfrag_done;      /* # fragment done */
     uint64_t             frag_id;         /* id of fragmented message */
     struct msg           **frag_seq;      /* sequence of fragment message, map from keys to fragments*/
+
+    uint32_t             nredirect;       /* # times request was redirected */
+    int64_t              retry_at;        /* redirect retry time, or failover hold deadline in msec */
 	
 	uint32_t             write;
     uint32_t             protocol;
@@ -309,6 +325,10 @@ struct msg {
     unsigned             done:1;          /* done? */
     unsigned             fdone:1;         /* all fragments are done? */
     unsigned             swallow:1;       /* swallow response? */
+    unsigned             asking:1;        /* sent to an importing server? */
+    unsigned             probe:1;         /* replica lag probe? */
+    unsigned             trace:1;         /* sampled for the trace ring? */
+    unsigned             held:1;          /* held in retry_q for a failover? */
 };
 
 TAILQ_HEAD(msg_tqh, msg);
@@ -333,6 +353,7 @@ struct mbuf *msg_ensure_mbuf(struct msg *msg, size_t len);
 rstatus_t msg_append(struct msg *msg, uint8_t *pos, size_t n);
 rstatus_t msg_prepend(struct msg *msg, uint8_t *pos, size_t n);
 rstatus_t msg_prepend_format(struct msg *msg, const char *fmt, ...);
+void msg_rewind(struct msg *msg);
 
 struct msg *req_get(struct conn *conn);
 void req_put(struct msg *msg);
@@ -349,6 +370,8 @@ struct msg *req_recv_next(struct context *ctx, struct conn *conn, bool alloc);
 void req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg, struct msg *nmsg);
 struct msg *req_send_next(struct context *ctx, struct conn *conn);
 void req_send_done(struct context *ctx, struct conn *conn, struct msg *msg);
+void req_redirect(struct context *ctx, struct msg *msg, msg_redirect_type_t type, uint32_t from);
+void req_retry(struct context *ctx);
 
 struct msg *rsp_get(struct conn *conn);
 void rsp_put(struct msg *msg);
@@ -94,11 +94,16 @@ proxy_reuse(struct conn *p)
 {
     rstatus_t status;
     struct sockaddr_un *un;
+    struct server_pool *pool = p->owner;
 
     switch (p->family) {
     case AF_INET:
     case AF_INET6:
         status = nc_set_reuseaddr(p->sd);
+        if (status == NC_OK && pool->ctx->reuseport) {
+            /* every event loop thread binds its own listener */
+            status = nc_set_reuseport(p->sd);
+        }
         break;
 
     case AF_UNIX:
@@ -120,6 +125,47 @@ proxy_reuse(struct conn *p)
     return status;
 }
 
+/*
+ * Unix sockets cannot be bound more than once, so a worker context accepts
+ * on a duplicate of the main context listener instead.
+ */
+static rstatus_t
+proxy_listen_shared(struct context *ctx, struct conn *p)
+{
+    rstatus_t status;
+    struct server_pool *pool = p->owner;
+    struct server_pool *main_pool;
+
+    main_pool = array_get(&ctx->main->pool, pool->idx);
+    ASSERT(main_pool->p_conn != NULL);
+
+    p->sd = dup(main_pool->p_conn->sd);
+    if (p->sd < 0) {
+        log_error("dup of p %d on addr '%.*s' failed: %s",
+                  main_pool->p_conn->sd, pool->addrstr.len,
+                  pool->addrstr.data, strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = event_add_conn(ctx->evb, p);
+    if (status < 0) {
+        log_error("event add conn p %d on addr '%.*s' failed: %s",
+                  p->sd, pool->addrstr.len, pool->addrstr.data,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = event_del_out(ctx->evb, p);
+    if (status < 0) {
+        log_error("event del out p %d on addr '%.*s' failed: %s",
+                  p->sd, pool->addrstr.len, pool->addrstr.data,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
 static rstatus_t
 proxy_listen(struct context *ctx, struct conn *p)
 {
@@ -128,6 +174,10 @@ proxy_listen(struct context *ctx, struct conn *p)
 
     ASSERT(p->proxy);
 
+    if (p->family == AF_UNIX && ctx->main != NULL) {
+        return proxy_listen_shared(ctx, p);
+    }
+
     p->sd = socket(p->family, SOCK_STREAM, 0);
     if (p->sd < 0) {
         log_error("socket failed: %s", strerror(errno));
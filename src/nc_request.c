@@ -17,6 +17,12 @@
 
 #include <nc_core.h>
 #include <nc_server.h>
+#include <nc_hashkit.h>
+#include <nc_failover.h>
+#include <proto/nc_proto.h>
+
+#define REQ_REDIRECT_BACKOFF_MSEC       1   /* first redirect retry delay */
+#define REQ_REDIRECT_BACKOFF_SHIFT_MAX  7   /* delay doubles up to 128 msec */
 
 struct msg *
 req_get(struct conn *conn)
@@ -291,6 +297,88 @@ ferror:
     return true;
 }
 
+/*
+ * Requests queued on or in flight to a server, and its response latency
+ * when reads are routed by latency, to pick the replica for a read
+ */
+static void
+req_server_sent(struct conn *conn, struct msg *msg)
+{
+    struct server *server = conn->owner;
+    struct server_pool *pool = server->owner;
+
+    server->noutstanding++;
+
+    if (pool->read_policy == READ_LATENCY_EWMA || msg->trace) {
+        msg->send_ts = nc_usec_now();
+    }
+}
+
+/*
+ * Record where a sampled request went and how long its response took
+ */
+static void
+req_trace(struct server *server, struct msg *msg, int64_t latency)
+{
+    struct server_pool *pool = server->owner;
+    struct stats_trace_entry entry;
+    struct keypos *kpos;
+    uint8_t *key;
+    uint32_t keylen;
+
+    entry.ts = msg->send_ts;
+    entry.latency = latency;
+    entry.hash = 0;
+    entry.slot = -1;
+    entry.server = server->idx;
+    entry.write = msg->write;
+
+    if (array_n(msg->keys) != 0) {
+        kpos = array_get(msg->keys, 0);
+        key = kpos->start;
+        keylen = (uint32_t)(kpos->end - kpos->start);
+
+        entry.hash = server_pool_key_hash(pool, key, keylen);
+        if (pool->dist_type == DIST_HASHSLOT && pool->nhashslotnum != 0) {
+            entry.slot = (int32_t)server_pool_slot(pool, key, keylen);
+        }
+    }
+
+    stats_pool_trace(pool->ctx, pool, &entry);
+}
+
+static void
+req_server_done(struct conn *conn, struct msg *msg)
+{
+    struct server *server = conn->owner;
+    int64_t latency;
+
+    server->noutstanding--;
+
+    if (msg->send_ts <= 0) {
+        return;
+    }
+
+    latency = -1;
+    if (conn->err == 0 && !conn->eof) {
+        latency = nc_usec_now() - msg->send_ts;
+    }
+
+    if (msg->trace) {
+        req_trace(server, msg, latency);
+    }
+
+    if (latency < 0) {
+        return;
+    }
+
+    if (server->latency == 0) {
+        server->latency = latency;
+    } else {
+        server->latency += (latency - server->latency) / 8;
+    }
+}
+
 void
 req_server_enqueue_imsgq(struct context *ctx, struct conn *conn, struct msg *msg)
 {
@@ -310,6 +398,7 @@ req_server_enqueue_imsgq(struct context *ctx, struct conn *conn, struct msg *msg
     }
 
     TAILQ_INSERT_TAIL(&conn->imsg_q, msg, s_tqe);
+    req_server_sent(conn, msg);
 
     stats_server_incr(ctx, conn->owner, in_queue);
     stats_server_incr_by(ctx, conn->owner, in_queue_bytes, msg->mlen);
@@ -334,6 +423,7 @@ req_server_enqueue_imsgq_head(struct context *ctx, struct conn *conn, struct msg
     }
 
     TAILQ_INSERT_HEAD(&conn->imsg_q, msg, s_tqe);
+    req_server_sent(conn, msg);
 
     stats_server_incr(ctx, conn->owner, in_queue);
     stats_server_incr_by(ctx, conn->owner, in_queue_bytes, msg->mlen);
@@ -342,10 +432,13 @@ req_server_enqueue_imsgq_head(struct context *ctx, struct conn *conn, struct msg
 void
 req_server_dequeue_imsgq(struct context *ctx, struct conn *conn, struct msg *msg)
 {
+    struct server *server = conn->owner;
+
     ASSERT(msg->request);
     ASSERT(!conn->client && !conn->proxy);
 
     TAILQ_REMOVE(&conn->imsg_q, msg, s_tqe);
+    server->noutstanding--;
 
     stats_server_decr(ctx, conn->owner, in_queue);
     stats_server_decr_by(ctx, conn->owner, in_queue_bytes, msg->mlen);
@@ -363,10 +456,13 @@ req_client_enqueue_omsgq(struct context *ctx, struct conn *conn, struct msg *msg
 void
 req_server_enqueue_omsgq(struct context *ctx, struct conn *conn, struct msg *msg)
 {
+    struct server *server = conn->owner;
+
     ASSERT(msg->request);
     ASSERT(!conn->client && !conn->proxy);
 
     TAILQ_INSERT_TAIL(&conn->omsg_q, msg, s_tqe);
+    server->noutstanding++;
 
     stats_server_incr(ctx, conn->owner, out_queue);
     stats_server_incr_by(ctx, conn->owner, out_queue_bytes, msg->mlen);
@@ -390,6 +486,7 @@ req_server_dequeue_omsgq(struct context *ctx, struct conn *conn, struct msg *msg
     msg_tmo_delete(msg);
 
     TAILQ_REMOVE(&conn->omsg_q, msg, s_tqe);
+    req_server_done(conn, msg);
 
     stats_server_decr(ctx, conn->owner, out_queue);
     stats_server_decr_by(ctx, conn->owner, out_queue_bytes, msg->mlen);
@@ -552,12 +649,89 @@ req_forward_stats(struct context *ctx, struct server *server, struct msg *msg)
     stats_server_incr_by(ctx, server, request_bytes, msg->mlen);
 }
 
+/*
+ * Queue a request on a chosen server connection. An asking request is
+ * preceded by the "asking" command so the importing server accepts it.
+ */
 static void
-req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
+req_forward_conn(struct context *ctx, struct conn *c_conn, struct conn *s_conn,
+                 struct msg *msg, bool asking)
 {
     rstatus_t status;
+
+    ASSERT(!s_conn->client && !s_conn->proxy);
+
+    /* enqueue the message (request) into server inq */
+    if (TAILQ_EMPTY(&s_conn->imsg_q)) {
+        status = event_add_out(ctx->evb, s_conn);
+        if (status != NC_OK) {
+            req_forward_error(ctx, c_conn, msg);
+            s_conn->err = errno;
+            return;
+        }
+    }
+
+    if (!conn_authenticated(s_conn)) {
+        status = msg->add_auth(ctx, c_conn, s_conn);
+        if (status != NC_OK) {
+            req_forward_error(ctx, c_conn, msg);
+            s_conn->err = errno;
+            return;
+        }
+    }
+
+    /* redirects only come from ssdb cluster nodes */
+    if (asking) {
+        status = ssdb_add_asking(ctx, s_conn);
+        if (status != NC_OK) {
+            req_forward_error(ctx, c_conn, msg);
+            s_conn->err = errno;
+            return;
+        }
+    }
+    msg->asking = asking ? 1 : 0;
+
+    s_conn->enqueue_inq(ctx, s_conn, msg);
+
+    req_forward_stats(ctx, s_conn->owner, msg);
+}
+
+/*
+ * Hold a write whose master is being promoted from its backup, rather
+ * than send it to a server that may still be a read-only slave. It
+ * waits in retry_q, see req_retry.
+ */
+static bool
+req_hold(struct context *ctx, struct conn *c_conn, struct msg *msg,
+         uint8_t *key, uint32_t keylen)
+{
+    if (!msg->write || !failover_pending(c_conn->owner, key, keylen)) {
+        return false;
+    }
+
+    if (ctx->nheld >= FAILOVER_HOLD_MAX) {
+        errno = ENOBUFS;
+        req_forward_error(ctx, c_conn, msg);
+        return true;
+    }
+
+    msg->held = 1;
+    msg->retry_at = nc_msec_now() + FAILOVER_HOLD_TIMEOUT;
+    ctx->nheld++;
+    TAILQ_INSERT_TAIL(&ctx->retry_q, msg, m_tqe);
+    ctx->timeout = MIN(ctx->timeout, FAILOVER_HOLD_POLL);
+
+    log_debug(LOG_VERB, "hold req %"PRIu64" from c %d during failover",
+              msg->id, c_conn->sd);
+
+    return true;
+}
+
+static void
+req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
+{
+    struct server_pool *pool = c_conn->owner;
     struct conn *s_conn;
-    struct server_pool *pool;
     uint8_t *key;
     uint32_t keylen;
     struct keypos *kpos;
@@ -569,45 +743,198 @@ req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
         c_conn->enqueue_outq(ctx, c_conn, msg);
     }
 
-    pool = c_conn->owner;
-
     ASSERT(array_n(msg->keys) > 0);
     kpos = array_get(msg->keys, 0);
     key = kpos->start;
     keylen = (uint32_t)(kpos->end - kpos->start);
-    s_conn = server_pool_conn(ctx, c_conn->owner, key, keylen, msg->write);
+
+    if (req_hold(ctx, c_conn, msg, key, keylen)) {
+        return;
+    }
+
+    s_conn = server_pool_conn(ctx, pool, key, keylen, msg->write);
     if (s_conn == NULL) {
         req_forward_error(ctx, c_conn, msg);
         return;
     }
-    ASSERT(!s_conn->client && !s_conn->proxy);
 
-    /* enqueue the message (request) into server inq */
-    if (TAILQ_EMPTY(&s_conn->imsg_q)) {
-        status = event_add_out(ctx->evb, s_conn);
-        if (status != NC_OK) {
-            req_forward_error(ctx, c_conn, msg);
-            s_conn->err = errno;
+    if (pool->trace_rate != 0 && ++pool->trace_count >= pool->trace_rate) {
+        pool->trace_count = 0;
+        msg->trace = 1;
+    }
+
+    req_forward_conn(ctx, c_conn, s_conn, msg, false);
+
+    log_debug(LOG_VERB, "forward from c %d to s %d req %"PRIu64" len %"PRIu32
+              " type %d with key '%.*s'", c_conn->sd, s_conn->sd, msg->id,
+              msg->mlen, msg->type, keylen, key);
+}
+
+/*
+ * Send a request that got a redirect from a server again. It is still in
+ * the client outq, so the client sees its response in order.
+ */
+static void
+req_reforward(struct context *ctx, struct msg *msg, bool asking, uint32_t idx)
+{
+    struct conn *c_conn, *s_conn;
+    struct keypos *kpos;
+
+    c_conn = msg->owner;
+    ASSERT(c_conn->client && !c_conn->proxy);
+
+    if (asking) {
+        s_conn = server_pool_conn_idx(ctx, c_conn->owner, idx);
+    } else {
+        kpos = array_get(msg->keys, 0);
+        s_conn = server_pool_conn(ctx, c_conn->owner, kpos->start,
+                                  (uint32_t)(kpos->end - kpos->start), msg->write);
+    }
+    if (s_conn == NULL) {
+        req_forward_error(ctx, c_conn, msg);
+        return;
+    }
+
+    msg_rewind(msg);
+    req_forward_conn(ctx, c_conn, s_conn, msg, asking);
+
+    log_debug(LOG_VERB, "redirect from c %d to s %d req %"PRIu64" len %"PRIu32
+              " asking %d try %"PRIu32"", c_conn->sd, s_conn->sd, msg->id,
+              msg->mlen, asking, msg->nredirect);
+}
+
+/*
+ * Server 'from' answered a request with a slot redirect: follow "moved"
+ * once the slot map says where the slot went, send to the importing server
+ * with "asking" on "ask", and back off before trying again otherwise. The
+ * slot map and migrate tasks are only read asynchronously from here, a
+ * request that can't be routed yet waits in retry_q for the answer.
+ */
+void
+req_redirect(struct context *ctx, struct msg *msg, msg_redirect_type_t type,
+             uint32_t from)
+{
+    struct server_pool *pool;
+    struct keypos *kpos;
+    uint32_t slot, idx, shift;
+    bool changed;
+
+    ASSERT(msg->request && !msg->done);
+    ASSERT(array_n(msg->keys) > 0);
+
+    pool = msg->owner->owner;
+    kpos = array_get(msg->keys, 0);
+    slot = server_pool_slot(pool, kpos->start, (uint32_t)(kpos->end - kpos->start));
+
+    msg->nredirect++;
+
+    switch (type) {
+    case MSG_REDIRECT_MOVED:
+        if (msg->asking) {
+            /* migration of the slot has finished or went elsewhere */
+            hashslot_importing_reset(pool, slot);
+        }
+        if (hashslot_refresh(pool, slot, from, &changed) == NC_OK && changed) {
+            stats_pool_incr(ctx, pool, redirect_map_updates);
+            req_reforward(ctx, msg, false, 0);
             return;
         }
-    }
+        /* slot map not updated yet */
+        break;
 
-    if (!conn_authenticated(s_conn)) {
-        status = msg->add_auth(ctx, c_conn, s_conn);
-        if (status != NC_OK) {
-            req_forward_error(ctx, c_conn, msg);
-            s_conn->err = errno;
+    case MSG_REDIRECT_ASK:
+        if (hashslot_importing(pool, slot, &idx) == NC_OK) {
+            req_reforward(ctx, msg, true, idx);
             return;
         }
+        break;
+
+    case MSG_REDIRECT_TRYAGAIN:
+    default:
+        break;
     }
 
-    s_conn->enqueue_inq(ctx, s_conn, msg);
+    shift = MIN(msg->nredirect - 1, REQ_REDIRECT_BACKOFF_SHIFT_MAX);
+    msg->retry_at = nc_msec_now() + (REQ_REDIRECT_BACKOFF_MSEC << shift);
+    TAILQ_INSERT_TAIL(&ctx->retry_q, msg, m_tqe);
 
-    req_forward_stats(ctx, s_conn->owner, msg);
+    log_debug(LOG_VERB, "retry req %"PRIu64" on slot %"PRIu32" at %"PRIi64"",
+              msg->id, slot, msg->retry_at);
+}
 
-    log_debug(LOG_VERB, "forward from c %d to s %d req %"PRIu64" len %"PRIu32
-              " type %d with key '%.*s'", c_conn->sd, s_conn->sd, msg->id,
-              msg->mlen, msg->type, keylen, key);
+/*
+ * A held request goes out once the promotion of its master is over, and
+ * fails when that takes longer than FAILOVER_HOLD_TIMEOUT. Until then it
+ * is looked at every FAILOVER_HOLD_POLL msec.
+ */
+static void
+req_retry_held(struct context *ctx, struct msg *msg, int64_t now)
+{
+    struct keypos *kpos;
+    bool pending;
+
+    kpos = array_get(msg->keys, 0);
+    pending = failover_pending(msg->owner->owner, kpos->start,
+                               (uint32_t)(kpos->end - kpos->start));
+    if (pending && msg->retry_at > now) {
+        ctx->timeout = MIN(ctx->timeout, FAILOVER_HOLD_POLL);
+        return;
+    }
+
+    TAILQ_REMOVE(&ctx->retry_q, msg, m_tqe);
+    msg->held = 0;
+    ctx->nheld--;
+
+    if (pending) {
+        errno = ETIMEDOUT;
+        req_forward_error(ctx, msg->owner, msg);
+        return;
+    }
+
+    req_reforward(ctx, msg, false, 0);
+}
+
+/*
+ * Forward the requests whose redirect backoff has expired, and shorten
+ * the event wait timeout to the next one due
+ */
+void
+req_retry(struct context *ctx)
+{
+    struct msg *msg, *nmsg;
+    int64_t now;
+
+    if (TAILQ_EMPTY(&ctx->retry_q)) {
+        return;
+    }
+
+    now = nc_msec_now();
+    for (msg = TAILQ_FIRST(&ctx->retry_q); msg != NULL; msg = nmsg) {
+        nmsg = TAILQ_NEXT(msg, m_tqe);
+
+        /* client is gone */
+        if (msg->swallow) {
+            TAILQ_REMOVE(&ctx->retry_q, msg, m_tqe);
+            if (msg->held) {
+                ctx->nheld--;
+            }
+            req_put(msg);
+            continue;
+        }
+
+        if (msg->held) {
+            req_retry_held(ctx, msg, now);
+            continue;
+        }
+
+        if (msg->retry_at > now) {
+            ctx->timeout = MIN(ctx->timeout, (int)(msg->retry_at - now));
+            continue;
+        }
+
+        TAILQ_REMOVE(&ctx->retry_q, msg, m_tqe);
+        req_reforward(ctx, msg, false, 0);
+    }
 }
 
 void
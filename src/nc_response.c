@@ -17,6 +17,7 @@
 
 #include <nc_core.h>
 #include <nc_server.h>
+#include <nc_hashkit.h>
 
 struct msg *
 rsp_get(struct conn *conn)
@@ -138,6 +139,71 @@ rsp_recv_next(struct context *ctx, struct conn *conn, bool alloc)
     return msg;
 }
 
+/*
+ * A cluster node answered a request for a slot it no longer (or not yet)
+ * serves. Send the request again instead of handing the redirect to the
+ * client, unless it has bounced around too often already.
+ */
+static bool
+rsp_redirect(struct context *ctx, struct conn *s_conn, struct msg *pmsg,
+             struct msg *msg)
+{
+    struct server *server = s_conn->owner;
+    struct server_pool *pool = server->owner;
+    msg_redirect_type_t type;
+    uint32_t from;
+
+    type = msg->redirect(msg);
+    if (type == MSG_REDIRECT_NONE || pool->dist_type != DIST_HASHSLOT ||
+        pmsg->owner == NULL || array_n(pmsg->keys) == 0) {
+        return false;
+    }
+
+    switch (type) {
+    case MSG_REDIRECT_MOVED:
+        stats_pool_incr(ctx, pool, redirect_moved);
+        break;
+
+    case MSG_REDIRECT_ASK:
+        stats_pool_incr(ctx, pool, redirect_ask);
+        break;
+
+    case MSG_REDIRECT_TRYAGAIN:
+        stats_pool_incr(ctx, pool, redirect_tryagain);
+        break;
+
+    default:
+        NOT_REACHED();
+        return false;
+    }
+
+    if (pmsg->nredirect >= MSG_REDIRECT_MAX) {
+        log_warn("req %"PRIu64" redirected %"PRIu32" times, giving up",
+                 pmsg->id, pmsg->nredirect);
+        stats_pool_incr(ctx, pool, redirect_exhausted);
+        return false;
+    }
+
+    log_debug(LOG_INFO, "redirect %d rsp %"PRIu64" of req %"PRIu64" on s %d",
+              type, msg->id, pmsg->id, s_conn->sd);
+
+    /* response from server implies that server is ok and heartbeating */
+    server_ok(ctx, s_conn);
+
+    s_conn->dequeue_outq(ctx, s_conn, pmsg);
+    rsp_put(msg);
+
+    /* a replica or a swapped in backup can't tell the slot owner */
+    from = server->idx;
+    if (from >= array_n(&pool->server) || array_get(&pool->server, from) != server) {
+        from = UINT32_MAX;
+    }
+
+    req_redirect(ctx, pmsg, type, from);
+
+    return true;
+}
+
 static bool
 rsp_filter(struct context *ctx, struct conn *conn, struct msg *msg)
 {
@@ -218,6 +284,10 @@ rsp_filter(struct context *ctx, struct conn *conn, struct msg *msg)
         return true;
     }
 
+    if (msg->redirect != NULL && rsp_redirect(ctx, conn, pmsg, msg)) {
+        return true;
+    }
+
     return false;
 }
 
@@ -17,11 +17,12 @@
 
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/select.h>
 
 #include <nc_core.h>
 #include <nc_server.h>
 #include <nc_conf.h>
+#include <nc_failover.h>
+#include <proto/nc_proto.h>
 
 static void
 server_resolve(struct server *server, struct conn *conn)
@@ -133,63 +134,86 @@ server_each_set_owner(void *elem, void *data)
     return NC_OK;
 }
 
-static rstatus_t
-server_each_set_group(void *elem, void *data)
-{
-    struct server *s = elem;
-    s->group = data;
-
-    return NC_OK;
-}
-
-rstatus_t server_group_init(struct array *server_group, struct array *conf_server_group, struct server_pool *sp)
+/*
+ * Build the replica groups of a pool from its "servers:" lines. The first
+ * member of each line is the master already in pool->server, the rest
+ * are its slaves. Replicas are numbered after the masters so that they
+ * get their own stats entries.
+ */
+rstatus_t
+server_group_init(struct array *server_group, struct array *conf_server_group,
+                  struct server_pool *sp)
 {
-	rstatus_t status;
-    uint32_t nserver_group;
-	uint32_t i;
-	struct conf_server_group* conf_group;
-	struct server_group* sgroup;
+    rstatus_t status;
+    uint32_t i, j, nserver_group, nreplica;
+    struct conf_server_group *conf_group;
+    struct server_group *sgroup;
+    struct server *s;
 
     nserver_group = array_n(conf_server_group);
-    ASSERT(nserver != 0);
-    ASSERT(array_n(server) == 0);
+    ASSERT(nserver_group != 0);
+    ASSERT(array_n(server_group) == 0);
 
     status = array_init(server_group, nserver_group, sizeof(struct server_group));
     if (status != NC_OK) {
         return status;
     }
-	sgroup     = (struct server_group*)server_group->elem;
-	conf_group = (struct conf_server_group*)conf_server_group->elem;
-	
-	for (i = 0; i < conf_server_group->nelem; i++)
-	{
-		status = array_init(&sgroup->servers, array_n(&conf_group->server), sizeof(struct server));
-		if (status != NC_OK) {
-			return status;
-		}
-		status = array_each(&conf_group->server, conf_server_each_transform, &sgroup->servers);
-		if (status != NC_OK) {
-			return status;
-		}
-		
-		status = array_each(&sgroup->servers, server_each_set_owner, sp);
-		if (status != NC_OK) {
-			return status;
-		}
-		
-		status = array_each(&sgroup->servers, server_each_set_group, sgroup);
-		if (status != NC_OK) {
-			return status;
-		}
-		sgroup->loop_flag = (uint32_t)conf_group->loop;
-		sgroup->current_index = 0;
-		conf_group++;
-		sgroup++;
-	}
+
+    nreplica = 0;
+    for (i = 0; i < nserver_group; i++) {
+        conf_group = array_get(conf_server_group, i);
+        sgroup = array_push(server_group);
+
+        array_null(&sgroup->servers);
+        sgroup->loop_flag = (uint32_t)conf_group->loop;
+        sgroup->current_index = 0;
+
+        if (array_n(&conf_group->server) <= 1) {
+            continue;
+        }
+
+        status = array_init(&sgroup->servers, array_n(&conf_group->server) - 1,
+                            sizeof(struct server));
+        if (status != NC_OK) {
+            server_group_deinit(server_group);
+            return status;
+        }
+
+        for (j = 1; j < array_n(&conf_group->server); j++) {
+            status = conf_server_each_transform(array_get(&conf_group->server, j),
+                                                &sgroup->servers);
+            if (status != NC_OK) {
+                server_group_deinit(server_group);
+                return status;
+            }
+
+            s = array_top(&sgroup->servers);
+            s->idx = array_n(&sp->server) + nreplica++;
+            s->owner = sp;
+            s->group = sgroup;
+        }
+    }
+
+    log_debug(LOG_DEBUG, "init %"PRIu32" replicas in %"PRIu32" groups of pool "
+              "%"PRIu32" '%.*s'", nreplica, nserver_group, sp->idx,
+              sp->name.len, sp->name.data);
 
     return NC_OK;
 }
 
+void
+server_group_deinit(struct array *server_group)
+{
+    uint32_t i, ngroup;
+
+    for (i = 0, ngroup = array_n(server_group); i < ngroup; i++) {
+        struct server_group *sgroup = array_pop(server_group);
+
+        server_deinit(&sgroup->servers);
+    }
+    array_deinit(server_group);
+}
+
 rstatus_t
 server_init(struct array *server, struct array *conf_server,
             struct server_pool *sp)
@@ -438,74 +462,24 @@ server_each_disconnect(void *elem, void *data)
     return NC_OK;
 }
 
+/*
+ * A failed master stays in the backup slot with next_retry set until it
+ * follows the master that replaced it; the control thread tries that
+ */
 static rstatus_t
 server_each_connected_determine(void *elem, void *data)
 {
-    rstatus_t status;
-    struct server *server, *master_server;
+    struct server *server;
     struct server_pool *pool;
-    struct conn *conn;
-    uint32_t index;
-    int64_t now;                  /* current timestamp in usec */
-
-    now = nc_usec_now();
-    if (now < 0) {
-        return NC_ERROR;
-    }
+    int64_t now = *(int64_t *)data;
 
     server = elem;
     pool = server->owner;
 
-    if(server->next_retry > now) {
-        index = array_idx(&pool->backup_server, server);
-        master_server = array_get(&pool->server, index);
-
-        if (server->ns_conn_q < pool->server_connections) {
-            conn =  conn_get(server, false, (int)pool->protocol);
-            if (conn == NULL) {
-                return NC_ENOMEM;
-            }
-        }else{
-            conn = TAILQ_FIRST(&server->s_conn_q);
-        }
-
-        conn->err = 0;
-        conn->sd  = -1;
-        status = server_connect_determine(pool->ctx, server, conn);
-        if (status != NC_OK) {
-            log_warn("connect to server '%.*s' failed, ignored: %s, pid:%lu, status:%d",
-                     server->pname.len, server->pname.data, strerror(errno), (uint64_t)pthread_self(), status);
-            server->next_retry = now + pool->server_retry_timeout;
-        }else {
-            server->next_retry = 0LL;
-            log_warn("connect to server '%.*s' success",
-                     server->pname.len, server->pname.data);
-            if(pool->master)
-            {
-                if(pool->ssdb_handle) {
-                    lib_ssdb_change_master_to_t change_master_to = (lib_ssdb_active_standby_switch_t)dlsym(pool->ssdb_handle, "change_master_to");
-                    int err_no = change_master_to((const char*)server->addrstr.data, server->port, pool->last_seq,
-                                        (const char *)master_server->addrstr.data, master_server->port);
-                }else{
-                    log_warn("ssdb handle is NULL");
-                    return NC_ERROR;
-                }
-            }
-
-            conn->unref(conn);
-            conn_put(conn);
-//
-//            if(conn->sd > 0)
-//            {
-//                log_warn("put");
-//                close(conn->sd);
-//                conn->unref(conn);
-//                conn_put(conn);
-//            }else{
-//                log_warn("no put");
-//            }
-        }
+    if (server->next_retry > now) {
+        return failover_rejoin(pool, array_idx(&pool->backup_server, server));
     }
+
     return NC_OK;
 }
 
@@ -556,6 +530,11 @@ server_failure(struct context *ctx, struct server *server)
     server->failure_count = 0;
     server->next_retry = next;
 
+    /* replicas only take reads, they are not on the distribution */
+    if (server->group != NULL) {
+        return;
+    }
+
     status = server_pool_run(pool);
     if (status != NC_OK) {
         log_error("updating pool %"PRIu32" '%.*s' failed: %s", pool->idx,
@@ -609,6 +588,11 @@ server_close(struct context *ctx, struct conn *conn)
 
     conn->connected = false;
 
+    if (((struct server *)conn->owner)->group != NULL) {
+        /* no reads on this replica until a probe gets through again */
+        ((struct server *)conn->owner)->repl_probed = 0LL;
+    }
+
     if (conn->sd < 0) {
         server_failure(ctx, conn->owner);
         conn->unref(conn);
@@ -717,7 +701,8 @@ server_close(struct context *ctx, struct conn *conn)
 
     conn_put(conn);
 
-    if(!s->ns_conn_q){
+    /* replicas are not part of the master/backup pairs */
+    if(!s->ns_conn_q && s->group == NULL){
         server_active_standby_switch(s);
     }
 }
@@ -806,118 +791,6 @@ error:
 }
 
 
-rstatus_t
-server_connect_determine(struct context *ctx, struct server *server, struct conn *conn)
-{
-    rstatus_t status;
-    fd_set  readfds, writefds, exfds;
-    struct timeval tv;
-    socklen_t len;
-
-    int fd = 0;
-
-    ASSERT(!conn->client && !conn->proxy);
-
-    if (conn->err) {
-      ASSERT(conn->done && conn->sd < 0);
-      errno = conn->err;
-      return NC_ERROR;
-    }
-
-//    if (conn->sd > 0) {
-//        /* already connected on server connection */
-//        return NC_OK;
-//    }
-
-    log_debug(LOG_VVERB, "connect to server '%.*s'", server->pname.len,
-              server->pname.data);
-
-    //conn->sd = socket(conn->family, SOCK_STREAM, 0);
-    fd = socket(conn->family, SOCK_STREAM, 0);
-
-    if (fd < 0) {
-        log_error("socket for server '%.*s' failed: %s", server->pname.len,
-                  server->pname.data, strerror(errno));
-        status = NC_ERROR;
-        goto error;
-    }
-
-    status = nc_set_nonblocking(fd);
-    if (status != NC_OK) {
-        log_error("set nonblock on s %d for server '%.*s' failed: %s",
-                  conn->sd, server->pname.len, server->pname.data,
-                  strerror(errno));
-        goto error;
-    }
-
-    if (server->pname.data[0] != '/') {
-        status = nc_set_tcpnodelay(fd);
-        if (status != NC_OK) {
-            log_warn("set tcpnodelay on s %d for server '%.*s' failed, ignored: %s",
-                     conn->sd, server->pname.len, server->pname.data,
-                     strerror(errno));
-        }
-    }
-
-
-//    status = event_add_conn(ctx->evb, conn);
-//    if (status != NC_OK) {
-//        log_error("event add conn s %d for server '%.*s' failed: %s",
-//                  conn->sd, server->pname.len, server->pname.data,
-//                  strerror(errno));
-//        goto error;
-//    }
-
-
-    ASSERT(!conn->connecting && !conn->connected);
-    status = connect(fd, conn->addr, conn->addrlen);
-    if (status != NC_OK) {
-        if (errno == EINPROGRESS) {
-//            conn->connecting = 1;
-//            log_debug(LOG_DEBUG, "connecting on s %d to server '%.*s'",
-//                      conn->sd, server->pname.len, server->pname.data);
-            FD_ZERO(&readfds);
-            FD_ZERO(&writefds);
-            FD_ZERO(&exfds);
-            FD_SET(fd, &readfds);
-            FD_SET(fd, &writefds);
-            FD_SET(fd, &exfds);
-            tv.tv_sec  = 1;
-            tv.tv_usec = 0;
-            int ret = select(fd + 1, &readfds, &writefds, &exfds, &tv);
-            if(ret <= 0){
-                log_error("connect on s %d to server '%.*s' failed: %s", conn->sd,
-                          server->pname.len, server->pname.data, strerror(errno));
-                status = NC_ERROR;
-                goto error;
-            }else{
-                status = getpeername(fd, conn->addr, &conn->addrlen);
-                if (status != NC_OK) {
-                    goto error;
-                }
-                return NC_OK;
-            }
-        }
-
-        log_error("connect on s %d to server '%.*s' failed: %s", conn->sd,
-                  server->pname.len, server->pname.data, strerror(errno));
-
-        goto error;
-    }
-
-    ASSERT(!conn->connecting);
-    conn->connected = 1;
-    log_debug(LOG_INFO, "connected on s %d to server '%.*s'", conn->sd,
-              server->pname.len, server->pname.data);
-    close(fd);
-    return NC_OK;
-
-error:
-    close(fd);
-    conn->err = errno;
-    return status;
-}
-
 void
 server_connected(struct context *ctx, struct conn *conn)
 {
@@ -1016,32 +889,38 @@ server_pool_hash(struct server_pool *pool, uint8_t *key, uint32_t keylen)
     return pool->key_hash((char *)key, keylen);
 }
 
-uint32_t
-server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen)
+/*
+ * If hash_tag: is configured for this server pool, we use the part of
+ * the key within the hash tag as an input to the distributor. Otherwise
+ * we use the full key
+ */
+static void
+server_pool_hash_tag(struct server_pool *pool, uint8_t **key, uint32_t *keylen)
 {
-    uint32_t hash, idx;
-
-    ASSERT(array_n(&pool->server) != 0);
-    ASSERT(key != NULL);
-
-    /*
-     * If hash_tag: is configured for this server pool, we use the part of
-     * the key within the hash tag as an input to the distributor. Otherwise
-     * we use the full key
-     */
     if (!string_empty(&pool->hash_tag)) {
         struct string *tag = &pool->hash_tag;
         uint8_t *tag_start, *tag_end;
 
-        tag_start = nc_strchr(key, key + keylen, tag->data[0]);
+        tag_start = nc_strchr(*key, *key + *keylen, tag->data[0]);
         if (tag_start != NULL) {
-            tag_end = nc_strchr(tag_start + 1, key + keylen, tag->data[1]);
+            tag_end = nc_strchr(tag_start + 1, *key + *keylen, tag->data[1]);
             if ((tag_end != NULL) && (tag_end - tag_start > 1)) {
-                key = tag_start + 1;
-                keylen = (uint32_t)(tag_end - key);
+                *key = tag_start + 1;
+                *keylen = (uint32_t)(tag_end - *key);
             }
         }
     }
+}
+
+uint32_t
+server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen)
+{
+    uint32_t hash, idx;
+
+    ASSERT(array_n(&pool->server) != 0);
+    ASSERT(key != NULL);
+
+    server_pool_hash_tag(pool, &key, &keylen);
 
     switch (pool->dist_type) {
     case DIST_KETAMA:
@@ -1060,7 +939,7 @@ server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen)
 
     case DIST_HASHSLOT:
         hash = server_pool_hash(pool, key, keylen);
-        idx = hashslot_dispatch(pool->hashslot, pool->nhashslotnum, hash);
+        idx = hashslot_dispatch(pool->slot_owner->hashslot, pool->nhashslotnum, hash);
         break;
 
     default:
@@ -1071,10 +950,131 @@ server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen)
     return idx;
 }
 
+/*
+ * Slot of a key in a hashslot pool
+ */
+uint32_t
+server_pool_slot(struct server_pool *pool, uint8_t *key, uint32_t keylen)
+{
+    ASSERT(pool->dist_type == DIST_HASHSLOT);
+    ASSERT(pool->nhashslotnum != 0);
+
+    server_pool_hash_tag(pool, &key, &keylen);
+
+    return server_pool_hash(pool, key, keylen) % pool->nhashslotnum;
+}
+
+/*
+ * Hash of a key as the distributor sees it, after the hash tag is applied
+ */
+uint32_t
+server_pool_key_hash(struct server_pool *pool, uint8_t *key, uint32_t keylen)
+{
+    server_pool_hash_tag(pool, &key, &keylen);
+
+    if (keylen == 0) {
+        return 0;
+    }
+
+    return pool->key_hash((char *)key, keylen);
+}
+
+/*
+ * A replica takes reads while it is not ejected, answered its last lag
+ * probe recently and is at most read_max_lag binlog seqs behind its
+ * master. Lag is approximate, both sides are probed once an interval.
+ */
+static bool
+server_replica_ok(struct server_pool *pool, struct server *master,
+                  struct server *replica, int64_t now)
+{
+    if (replica->next_retry > now) {
+        return false;
+    }
+
+    if (now - replica->repl_probed >
+        SERVER_PROBE_STALE * SERVER_PROBE_INTERVAL * 1000LL) {
+        return false;
+    }
+
+    if (master->repl_seq - replica->repl_seq > pool->read_max_lag) {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Pick a replica of the idx'th master for a read with the pool read
+ * policy, or NULL when none of them is usable
+ */
+static struct server *
+server_pool_replica(struct server_pool *pool, uint32_t idx)
+{
+    struct server_group *sgroup;
+    struct server *master, *replica, *best;
+    uint32_t i, n, start;
+    int64_t now, cost, best_cost;
+
+    if (idx >= array_n(&pool->server_group)) {
+        return NULL;
+    }
+
+    sgroup = array_get(&pool->server_group, idx);
+    n = array_n(&sgroup->servers);
+    if (n == 0) {
+        return NULL;
+    }
+
+    now = nc_usec_now();
+    if (now < 0) {
+        return NULL;
+    }
+
+    master = array_get(&pool->server, idx);
+
+    /* rotate the starting point so that ties are spread too */
+    start = sgroup->current_index++ % n;
+
+    best = NULL;
+    best_cost = 0;
+    for (i = 0; i < n; i++) {
+        replica = array_get(&sgroup->servers, (start + i) % n);
+
+        if (!server_replica_ok(pool, master, replica, now)) {
+            continue;
+        }
+
+        switch (pool->read_policy) {
+        case READ_ROUND_ROBIN:
+            return replica;
+
+        case READ_LEAST_OUTSTANDING:
+            cost = replica->noutstanding;
+            break;
+
+        case READ_LATENCY_EWMA:
+            cost = replica->latency * (replica->noutstanding + 1);
+            break;
+
+        default:
+            NOT_REACHED();
+            return NULL;
+        }
+
+        if (best == NULL || cost < best_cost) {
+            best = replica;
+            best_cost = cost;
+        }
+    }
+
+    return best;
+}
+
 static struct server *
 server_pool_server(struct server_pool *pool, uint8_t *key, uint32_t keylen, int pool_write)
 {
-    struct server *server, *find = NULL;
+    struct server *server, *replica;
     uint32_t idx;
 
     idx = server_pool_idx(pool, key, keylen);
@@ -1085,67 +1085,22 @@ server_pool_server(struct server_pool *pool, uint8_t *key, uint32_t keylen, int
                 "%"PRIu32"",server_count, idx);
         return NULL;
     }
-	
-	if (1 == pool_write)
-	{
-		server = array_get(&pool->server, idx);
-	}
-	else
-	{
-		struct server_group* sg = array_get(&pool->server_group, idx);
-		uint32_t pool_index = 0;
-		if (sg->loop_flag)
-		{
-			pool_index = sg->current_index % sg->servers.nelem;
-			sg->current_index = pool_index + 1;
-		}
-		else
-		{
-			pool_index = 0;
-		}
-		
-		server = array_get(&sg->servers, pool_index);
-		if (0 == server->connected)
-		{
-			uint32_t i = 0;
-			int64_t now = nc_usec_now();
-			if (now >= server->next_retry)
-			{
-				struct conn* conn = server_conn(server);
-				if (conn != NULL)
-				{
-					server_connect(pool->ctx, server, conn);
-				}
-			}
-			for (; i < sg->servers.nelem; i++)
-			{
-				find = array_get(&sg->servers, i);
-				if (1 == find->connected)
-				{
-					server = find;
-					break;
-				}
-			}
-			
-			for (i = 0; i < pool_index; i++)
-			{
-				find = array_get(&sg->servers, i);
-				if (1 == find->connected)
-				{
-					server = find;
-					break;
-				}
-			}
-		}
-	}
-done:
+
+    server = array_get(&pool->server, idx);
+
+    if (!pool_write && pool->read_policy != READ_MASTER &&
+        array_n(&pool->server_group) != 0) {
+        replica = server_pool_replica(pool, idx);
+        if (replica != NULL) {
+            stats_pool_incr(pool->ctx, pool, replica_reads);
+            server = replica;
+        } else {
+            stats_pool_incr(pool->ctx, pool, replica_fallbacks);
+        }
+    }
+
     log_debug(LOG_VERB, "key '%.*s' on dist %d maps to server '%.*s'", keylen,
               key, pool->dist_type, server->pname.len, server->pname.data);
-			  
-	if (server)
-	{
-		printf("%.*s selected, idx:%d,write:%d, pid:%lu\n", server->pname.len, server->pname.data, idx, pool_write, (uint64_t)pthread_self());
-	}
 
     return server;
 }
@@ -1164,8 +1119,7 @@ server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key,
     }
 
     /* from a given {key, keylen} pick a server from pool */
-//    server = server_pool_server(pool, key, keylen, pool_write);
-    server = server_pool_server(pool, key, keylen, 1);
+    server = server_pool_server(pool, key, keylen, pool_write);
     if (server == NULL) {
         return NULL;
     }
@@ -1185,6 +1139,44 @@ server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key,
     return conn;
 }
 
+/*
+ * Connection to the idx'th master of a pool, used when a request has
+ * to go to a server other than the one its key hashes to
+ */
+struct conn *
+server_pool_conn_idx(struct context *ctx, struct server_pool *pool, uint32_t idx)
+{
+    rstatus_t status;
+    struct server *server;
+    struct conn *conn;
+
+    if (idx >= array_n(&pool->server)) {
+        return NULL;
+    }
+    server = array_get(&pool->server, idx);
+
+    conn = server_conn(server);
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    status = server_connect(ctx, server, conn);
+    if (status != NC_OK) {
+        server_close(ctx, conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
+static rstatus_t
+server_group_each_preconnect(void *elem, void *data)
+{
+    struct server_group *sgroup = elem;
+
+    return array_each(&sgroup->servers, server_each_preconnect, NULL);
+}
+
 static rstatus_t
 server_pool_each_preconnect(void *elem, void *data)
 {
@@ -1200,6 +1192,11 @@ server_pool_each_preconnect(void *elem, void *data)
         return status;
     }
 
+    status = array_each(&sp->server_group, server_group_each_preconnect, NULL);
+    if (status != NC_OK) {
+        return status;
+    }
+
     return NC_OK;
 }
 
@@ -1216,6 +1213,14 @@ server_pool_preconnect(struct context *ctx)
     return NC_OK;
 }
 
+static rstatus_t
+server_group_each_disconnect(void *elem, void *data)
+{
+    struct server_group *sgroup = elem;
+
+    return array_each(&sgroup->servers, server_each_disconnect, NULL);
+}
+
 static rstatus_t
 server_pool_each_disconnect(void *elem, void *data)
 {
@@ -1227,6 +1232,11 @@ server_pool_each_disconnect(void *elem, void *data)
         return status;
     }
 
+    status = array_each(&sp->server_group, server_group_each_disconnect, NULL);
+    if (status != NC_OK) {
+        return status;
+    }
+
     return NC_OK;
 }
 
@@ -1252,10 +1262,18 @@ server_pool_each_calc_connections(void *elem, void *data)
 {
     struct server_pool *sp = elem;
     struct context *ctx = data;
+    uint32_t i;
 
     ctx->max_nsconn += sp->server_connections * array_n(&sp->server);
     ctx->max_nsconn += 1; /* pool listening socket */
 
+    for (i = 0; i < array_n(&sp->server_group); i++) {
+        struct server_group *sgroup = array_get(&sp->server_group, i);
+
+        /* replica connections */
+        ctx->max_nsconn += sp->server_connections * array_n(&sgroup->servers);
+    }
+
     return NC_OK;
 }
 
@@ -1291,13 +1309,41 @@ server_pool_each_run(void *elem, void *data)
     return server_pool_run(elem);
 }
 
+/*
+ * Worker contexts route with the slot table of the main context, which is
+ * the one kept up to date by the zookeeper watches. They look it up in the
+ * main pool on every request, as a new slot map swaps in another table. Only the main context
+ * drives failover on the ssdb side, so worker pools are never master.
+ */
+static rstatus_t
+server_pool_each_share(void *elem, void *data)
+{
+    struct server_pool *sp = elem;
+    struct array *main_pool = data;
+    struct server_pool *owner;
+
+    owner = array_get(main_pool, sp->idx);
+
+    sp->slot_owner = owner;
+    sp->nhashslotnum = owner->nhashslotnum;
+    sp->shared = 1;
+    sp->master = 0;
+
+    return NC_OK;
+}
+
 static rstatus_t
 server_pool_each_connected_determine(void *elem, void *data)
 {
     rstatus_t status;
     struct server_pool *sp = elem;
 
-    status = array_each(&sp->backup_server, server_each_connected_determine, NULL);
+    if (!sp->master || sp->ssdb_handle == NULL ||
+        array_n(&sp->backup_server) != array_n(&sp->server)) {
+        return NC_OK;
+    }
+
+    status = array_each(&sp->backup_server, server_each_connected_determine, data);
     if (status != NC_OK) {
         return status;
     }
@@ -1305,11 +1351,118 @@ server_pool_each_connected_determine(void *elem, void *data)
     return NC_OK;
 }
 
+static void
+server_probe(struct context *ctx, struct server *server, int64_t now)
+{
+    rstatus_t status;
+    struct conn *conn;
+
+    if (server->next_retry > now) {
+        return;
+    }
+
+    /* keep one probe in flight, unless the last one got lost */
+    if (server->repl_sent > server->repl_probed &&
+        now - server->repl_sent < SERVER_PROBE_STALE * SERVER_PROBE_INTERVAL * 1000LL) {
+        return;
+    }
+
+    conn = server_conn(server);
+    if (conn == NULL) {
+        return;
+    }
+
+    status = server_connect(ctx, server, conn);
+    if (status != NC_OK) {
+        server_close(ctx, conn);
+        return;
+    }
+
+    if (TAILQ_EMPTY(&conn->imsg_q)) {
+        status = event_add_out(ctx->evb, conn);
+        if (status != NC_OK) {
+            conn->err = errno;
+            return;
+        }
+    }
+
+    status = ssdb_add_probe(ctx, conn);
+    if (status != NC_OK) {
+        return;
+    }
+
+    server->repl_sent = now;
+}
+
+/*
+ * Ask the masters that have replicas and the replicas themselves for
+ * their binlog position once a probe interval, see server_replica_ok
+ */
+void
+server_pool_probe(struct context *ctx)
+{
+    uint32_t i, j, k, ngroup;
+    int64_t now;
+
+    now = nc_usec_now();
+    if (now < 0) {
+        return;
+    }
+
+    for (i = 0; i < array_n(&ctx->pool); i++) {
+        struct server_pool *sp = array_get(&ctx->pool, i);
+
+        ngroup = MIN(array_n(&sp->server_group), array_n(&sp->server));
+        if (ngroup == 0) {
+            continue;
+        }
+
+        if (now >= sp->next_probe) {
+            sp->next_probe = now + SERVER_PROBE_INTERVAL * 1000LL;
+
+            for (j = 0; j < ngroup; j++) {
+                struct server_group *sgroup = array_get(&sp->server_group, j);
+
+                if (array_n(&sgroup->servers) == 0) {
+                    continue;
+                }
+
+                server_probe(ctx, array_get(&sp->server, j), now);
+                for (k = 0; k < array_n(&sgroup->servers); k++) {
+                    server_probe(ctx, array_get(&sgroup->servers, k), now);
+                }
+            }
+        }
+
+        ctx->timeout = MIN(ctx->timeout, (int)((sp->next_probe - now) / 1000LL) + 1);
+    }
+}
+
+void
+server_probed(struct server *server, int64_t seq)
+{
+    if (seq < 0) {
+        return;
+    }
+
+    server->repl_seq = seq;
+    server->repl_probed = nc_usec_now();
+}
+
 rstatus_t
 server_pool_connected_determine(struct context *ctx)
 {
-    rstatus_t status;
-    status = array_each(&ctx->pool, server_pool_each_connected_determine, NULL);
+    int64_t now;
+
+    failover_done(ctx);
+
+    now = nc_usec_now();
+    if (now < 0) {
+        return NC_ERROR;
+    }
+
+    array_each(&ctx->pool, server_pool_each_connected_determine, &now);
+
     return NC_OK;
 }
 
@@ -1352,6 +1505,15 @@ server_pool_init(struct array *server_pool, struct array *conf_pool,
         return status;
     }
 
+    if (ctx->main != NULL) {
+        status = array_each(server_pool, server_pool_each_share,
+                            &ctx->main->pool);
+        if (status != NC_OK) {
+            server_pool_deinit(server_pool);
+            return status;
+        }
+    }
+
     /* update server pool continuum */
     status = array_each(server_pool, server_pool_each_run, NULL);
     if (status != NC_OK) {
@@ -1383,12 +1545,27 @@ server_pool_deinit(struct array *server_pool)
             sp->nlive_server = 0;
         }
 
-        if (sp->hashslot != NULL) {
+        if (sp->hashslot != NULL && !sp->shared) {
             nc_free(sp->hashslot);
             sp->nhashslotnum = 0;
             sp->nlive_server = 0;
         }
 
+        hashslot_deinit(sp);
+
+        if (sp->slot_import != NULL) {
+            nc_free(sp->slot_import);
+        }
+
+        if (sp->slot_fetching != NULL) {
+            nc_free(sp->slot_fetching);
+        }
+
+        if (sp->failover != NULL) {
+            nc_free(sp->failover);
+        }
+
+        server_group_deinit(&sp->server_group);
         server_deinit(&sp->server);
         if(array_n(&sp->backup_server) == array_n(&sp->server)){
             server_deinit(&sp->backup_server);
@@ -1409,6 +1586,12 @@ server_pool_deinit(struct array *server_pool)
     log_debug(LOG_DEBUG, "deinit %"PRIu32" pools", npool);
 }
 
+/*
+ * The last connection to a master that failed has closed: swap it with
+ * its backup right away, the main context then promotes the backup on
+ * the failover thread. Without zookeeper there is nowhere to record the
+ * new master, so the pair is left alone.
+ */
 rstatus_t
 server_active_standby_switch(struct server *server)
 {
@@ -1416,9 +1599,6 @@ server_active_standby_switch(struct server *server)
     int64_t now;                  /* current timestamp in usec */
     struct server_pool *pool;     /* server pool */
     uint32_t server_index;        /* server index */
-    char zk_path[64];
-    char back_ip_str[128], server_ip_str[128];
-    char zk_set_str[256];
 
     now = nc_usec_now();
     if (now < 0) {
@@ -1427,65 +1607,30 @@ server_active_standby_switch(struct server *server)
 
     pool = server->owner;
 
-    if(server->next_retry > now) {
+    if (server->next_retry <= now) {
+        return NC_OK;
+    }
 
-        server_index = array_idx(&pool->server, server);
-        backup_server = array_get(&pool->backup_server, server_index);
+    if (pool->zh_handler == NULL ||
+        array_n(&pool->backup_server) != array_n(&pool->server)) {
+        return NC_ERROR;
+    }
 
-        struct String_vector strings;
-        int child_ret = zk_get_children(pool->zh_handler, "/nodes", NULL, NULL, &strings);
-        if (child_ret) {
-            return NC_ERROR;
-        } else {
-            qsort(strings.data, (size_t)strings.count, sizeof(char *), comp);
-        }
-//        tmp_server = backup_server;
-//        backup_server = server;
-//        server = tmp_server;
-        memcpy(&tmp_server, backup_server, sizeof(struct server));
-        memcpy(backup_server, server, sizeof(struct server));
-        memcpy(server, &tmp_server, sizeof(struct server));
-
-        TAILQ_INIT(&server->s_conn_q);
-        TAILQ_INIT(&backup_server->s_conn_q);
-
-        if(!pool->master)
-        {
-            log_warn("not master return");
-            return NC_OK;
-        }
+    server_index = array_idx(&pool->server, server);
+    backup_server = array_get(&pool->backup_server, server_index);
 
-        if(pool->ssdb_handle) {
-            lib_ssdb_active_standby_switch_t active_standby_switch = (lib_ssdb_active_standby_switch_t)dlsym(pool->ssdb_handle, "active_standby_switch");
-            int err_no = active_standby_switch((const char*)server->addrstr.data, server->port, &pool->last_seq);
-            log_warn("switch between master and slave machines, error_code %d, now master:pool "
-                    "%"PRIu32" '%.*s' server address:%.*s:%u, last_seq %lu",err_no, pool->idx,
-                    pool->name.len, pool->name.data, server->addrstr.len, server->addrstr.data, server->port, pool->last_seq);
+    memcpy(&tmp_server, backup_server, sizeof(struct server));
+    memcpy(backup_server, server, sizeof(struct server));
+    memcpy(server, &tmp_server, sizeof(struct server));
 
-        }else{
-            log_warn("ssdb handle is NULL");
-            return NC_ERROR;
-        }
+    TAILQ_INIT(&server->s_conn_q);
+    TAILQ_INIT(&backup_server->s_conn_q);
 
-        struct string back_ip, server_ip;
-        uint16_t back_port, server_port;
-        back_ip = backup_server->addrstr;
-        server_ip = server->addrstr;
-        back_port = backup_server->port;
-        server_port = server->port;
-        memset(back_ip_str, 0, sizeof(back_ip_str));
-        memset(server_ip_str, 0, sizeof(server_ip_str));
-        strncpy(back_ip_str, back_ip.data, back_ip.len);
-        strncpy(server_ip_str, server_ip.data, server_ip.len);
-        memset(zk_set_str, 0, sizeof(zk_set_str));
-        memset(zk_path, 0, sizeof(zk_path));
-        sprintf(zk_set_str, "{\"status\":0,\"ip\":\"%s\",\"port\":%d,\"slave_ip\":\"%s\",\"slave_port\":%d}", server_ip_str, server_port, back_ip_str, back_port);
-        sprintf(zk_path, "/nodes/%s", strings.data[server_index]);
-        int set_ret = zk_set(pool->zh_handler, zk_path, zk_set_str);
-        if (set_ret) {
-            return NC_ERROR;
-        }
+    if (!pool->master) {
+        log_warn("not master return");
+        return NC_OK;
     }
-    return NC_OK;
+
+    return failover_promote(pool, server_index);
 }
 
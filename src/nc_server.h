@@ -61,8 +61,27 @@
  */
 
 #define HASHSLOT_SLOT_NUM             16384
+#define SERVER_PROBE_INTERVAL         1000     /* replica probe interval in msec */
+#define SERVER_PROBE_STALE            3        /* # intervals a probe stays valid */
 typedef uint32_t (*hash_t)(const char *, size_t);
 
+/*
+ * How reads (msg->write == 0) are spread over the replicas of a server
+ * group; master sends everything to the master like writes.
+ */
+#define READ_CODEC(ACTION)                              \
+    ACTION( READ_MASTER,            master            ) \
+    ACTION( READ_ROUND_ROBIN,       round_robin       ) \
+    ACTION( READ_LEAST_OUTSTANDING, least_outstanding ) \
+    ACTION( READ_LATENCY_EWMA,      latency_ewma      ) \
+
+#define DEFINE_ACTION(_read, _name) _read,
+typedef enum read_type {
+    READ_CODEC( DEFINE_ACTION )
+    READ_SENTINEL
+} read_type_t;
+#undef DEFINE_ACTION
+
 struct continuum {
     uint32_t index;  /* server index */
     uint32_t value;  /* hash value */
@@ -86,9 +105,19 @@ struct server {
     uint32_t           failure_count; /* # consecutive failures */
 	uint32_t           connected;
 	uint32_t           is_read;
-	struct server_group* group;
+	struct server_group* group;       /* owner group, NULL for masters */
+
+    uint32_t           noutstanding;  /* # requests queued or in flight */
+    int64_t            latency;       /* response latency ewma in usec */
+    int64_t            repl_seq;      /* binlog seq from the last probe */
+    int64_t            repl_sent;     /* last probe send time in usec */
+    int64_t            repl_probed;   /* last probe reply time in usec */
 };
 
+/*
+ * Replicas of the idx'th master; servers[] holds the slaves only, the
+ * master itself stays in pool->server[idx]
+ */
 struct server_group
 {
 	struct array servers;
@@ -96,6 +125,18 @@ struct server_group
 	uint32_t current_index;
 };
 
+struct slot_import
+{
+    volatile uint32_t index;   /* importing server index */
+    volatile int64_t  expire;  /* cache expiry in usec, 0: unknown */
+};
+
+struct slot_table
+{
+    struct continuum  *table;  /* swapped out slot table */
+    struct slot_table *next;
+};
+
 struct slot_ctx
 {
     int slot_index;
@@ -119,9 +160,19 @@ struct server_pool {
     uint32_t           nserver_continuum;    /* # servers - live and dead on continuum (const) */
     struct continuum   *continuum;           /* continuum */
     uint32_t           nhashslotnum;          /*hash slot number*/
-    struct continuum   *hashslot;            /* hashslot */
+    struct continuum   *volatile hashslot;   /* hashslot, swapped whole on a new slot map snapshot */
+    struct slot_table  *hashslot_retired;    /* swapped out tables, not in a grace period yet */
+    struct slot_table  *hashslot_grace;      /* swapped out tables in the running grace period */
+    uint64_t           *grace_loops;         /* worker loop counts when the grace period began */
+    uint64_t           slot_map_version;     /* slot map snapshot version, 0: per-slot layout */
+    volatile int64_t   next_slot_map_load;   /* next snapshot read on a moved reply in usec */
+    volatile uint32_t  slot_map_loading;     /* snapshot read in flight? */
+    struct server_pool *slot_owner;          /* pool with the hashslot and failover state, self unless shared */
+    struct slot_import *slot_import;         /* importing server per slot, during migration */
+    uint32_t           *slot_fetching;       /* per slot HASHSLOT_FETCH_* reads in flight */
     uint32_t           nlive_server;         /* # live server */
     int64_t            next_rebuild;         /* next distribution rebuild time in usec */
+    int64_t            next_probe;           /* next replica probe time in usec */
 
     struct string      name;                 /* pool name (ref in conf_pool) */
     struct string      addrstr;              /* pool address - hostname:port (ref in conf_pool) */
@@ -139,6 +190,10 @@ struct server_pool {
     uint32_t           server_connections;   /* maximum # server connection */
     int64_t            server_retry_timeout; /* server retry timeout in usec */
     uint32_t           server_failure_limit; /* server failure limit */
+    int                read_policy;          /* read routing policy (read_type_t) */
+    int64_t            read_max_lag;         /* max replica lag in binlog seqs */
+    uint32_t           trace_rate;           /* trace one in trace_rate requests, 0: off */
+    uint32_t           trace_count;          /* # requests since the last traced one */
 	uint32_t           protocol;
     struct string      redis_auth;           /* redis_auth password (matches requirepass on redis) */
     unsigned           require_auth;         /* require_auth? */
@@ -147,12 +202,15 @@ struct server_pool {
     unsigned           master:1;             /* master? */
     unsigned           tcpkeepalive:1;       /* tcpkeepalive? */
     unsigned           finish_init:1;        /* finish init */
+    unsigned           shared:1;             /* hashslot owned by the main context? */
     struct array       ctx_array;            /* slot_ctx */
     zhandle_t          *zh_handler;          /* zookeeper handler */
     struct array       server_identifier;     /* server_identified */
     struct zk_init_ctx *init_ctx;            /* zookeeper init watcher ctx*/
     void               *ssdb_handle;          /*ssdb handle*/
-    uint64_t           last_seq;
+    uint64_t           last_seq;             /* binlog seq of the last promoted backup, failover thread only */
+    struct server_failover *failover;        /* failover state per server index */
+    volatile uint32_t  npromoting;           /* # promotions in flight */
 };
 
 void server_ref(struct conn *conn, void *owner);
@@ -160,6 +218,7 @@ void server_unref(struct conn *conn);
 int server_timeout(struct conn *conn);
 bool server_active(struct conn *conn);
 rstatus_t server_group_init(struct array *server_group, struct array *conf_server_group, struct server_pool *sp);
+void server_group_deinit(struct array *server_group);
 rstatus_t server_init(struct array *server, struct array *conf_server, struct server_pool *sp);
 rstatus_t write_server_init(struct array *server, struct array *conf_server, struct server_pool *sp);
 rstatus_t backup_server_init(struct array *server, struct array *conf_server, struct server_pool *sp);
@@ -169,17 +228,21 @@ rstatus_t server_update_index(struct array *ar , uint32_t index);
 void server_deinit(struct array *server);
 struct conn *server_conn(struct server *server);
 rstatus_t server_connect(struct context *ctx, struct server *server, struct conn *conn);
-rstatus_t server_connect_determine(struct context *ctx, struct server *server, struct conn *conn);
 void server_close(struct context *ctx, struct conn *conn);
 void server_connected(struct context *ctx, struct conn *conn);
 void server_ok(struct context *ctx, struct conn *conn);
 
 uint32_t server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen);
+uint32_t server_pool_key_hash(struct server_pool *pool, uint8_t *key, uint32_t keylen);
+uint32_t server_pool_slot(struct server_pool *pool, uint8_t *key, uint32_t keylen);
+struct conn *server_pool_conn_idx(struct context *ctx, struct server_pool *pool, uint32_t idx);
 struct conn *server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key, uint32_t keylen, uint32_t write);
 rstatus_t server_pool_run(struct server_pool *pool);
 rstatus_t server_pool_preconnect(struct context *ctx);
 void server_pool_disconnect(struct context *ctx);
 rstatus_t server_pool_connected_determine(struct context *ctx);
+void server_pool_probe(struct context *ctx);
+void server_probed(struct server *server, int64_t seq);
 rstatus_t server_pool_init(struct array *server_pool, struct array *conf_pool, struct context *ctx);
 void server_pool_deinit(struct array *server_pool);
 rstatus_t server_active_standby_switch(struct server *server);
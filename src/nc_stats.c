@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -216,6 +217,37 @@ stats_server_map(struct array *stats_server, struct array *server)
     return NC_OK;
 }
 
+/*
+ * Replicas come after the masters, in the order of their server->idx
+ */
+static rstatus_t
+stats_server_map_group(struct array *stats_server, struct array *server_group)
+{
+    rstatus_t status;
+    uint32_t i, j;
+
+    for (i = 0; i < array_n(server_group); i++) {
+        struct server_group *sgroup = array_get(server_group, i);
+
+        for (j = 0; j < array_n(&sgroup->servers); j++) {
+            struct server *s = array_get(&sgroup->servers, j);
+            struct stats_server *sts = array_push(stats_server);
+
+            if (sts == NULL) {
+                return NC_ENOMEM;
+            }
+            ASSERT(s->idx == array_idx(stats_server, sts));
+
+            status = stats_server_init(sts, s);
+            if (status != NC_OK) {
+                return status;
+            }
+        }
+    }
+
+    return NC_OK;
+}
+
 static void
 stats_server_unmap(struct array *stats_server)
 {
@@ -252,6 +284,13 @@ stats_pool_init(struct stats_pool *stp, struct server_pool *sp)
         return status;
     }
 
+    status = stats_server_map_group(&stp->server, &sp->server_group);
+    if (status != NC_OK) {
+        stats_server_unmap(&stp->server);
+        stats_metric_deinit(&stp->metric);
+        return status;
+    }
+
     log_debug(LOG_VVVERB, "init stats pool '%.*s' with %"PRIu32" metric and "
               "%"PRIu32" server", stp->name.len, stp->name.data,
               array_n(&stp->metric), array_n(&stp->metric));
@@ -326,6 +365,49 @@ stats_pool_unmap(struct array *stats_pool)
     log_debug(LOG_VVVERB, "unmap %"PRIu32" stats pool", npool);
 }
 
+static rstatus_t
+stats_trace_map(struct array *stats_trace, struct array *server_pool)
+{
+    rstatus_t status;
+    uint32_t i, npool;
+
+    npool = array_n(server_pool);
+
+    status = array_init(stats_trace, npool, sizeof(struct stats_trace *));
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < npool; i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+        struct stats_trace **trace = array_push(stats_trace);
+
+        *trace = NULL;
+        if (sp->trace_rate == 0) {
+            continue;
+        }
+
+        *trace = nc_zalloc(sizeof(struct stats_trace));
+        if (*trace == NULL) {
+            return NC_ENOMEM;
+        }
+    }
+
+    return NC_OK;
+}
+
+static void
+stats_trace_unmap(struct array *stats_trace)
+{
+    while (array_n(stats_trace) != 0) {
+        struct stats_trace **trace = array_pop(stats_trace);
+        if (*trace != NULL) {
+            nc_free(*trace);
+        }
+    }
+    array_deinit(stats_trace);
+}
+
 static rstatus_t
 stats_create_buf(struct stats *st)
 {
@@ -662,27 +744,22 @@ stats_aggregate_metric(struct array *dst, struct array *src)
 }
 
 static void
-stats_aggregate(struct stats *st)
+stats_aggregate_pool(struct array *sum, struct array *shadow)
 {
     uint32_t i;
 
-    if (st->aggregate == 0) {
-        log_debug(LOG_PVERB, "skip aggregate of shadow %p to sum %p as "
-                  "generator is slow", st->shadow.elem, st->sum.elem);
-        return;
-    }
-
-    log_debug(LOG_PVERB, "aggregate stats shadow %p to sum %p", st->shadow.elem,
-              st->sum.elem);
+    ASSERT(array_n(sum) == array_n(shadow));
 
-    for (i = 0; i < array_n(&st->shadow); i++) {
+    for (i = 0; i < array_n(shadow); i++) {
         struct stats_pool *stp1, *stp2;
         uint32_t j;
 
-        stp1 = array_get(&st->shadow, i);
-        stp2 = array_get(&st->sum, i);
+        stp1 = array_get(shadow, i);
+        stp2 = array_get(sum, i);
         stats_aggregate_metric(&stp2->metric, &stp1->metric);
 
+        ASSERT(array_n(&stp1->server) == array_n(&stp2->server));
+
         for (j = 0; j < array_n(&stp1->server); j++) {
             struct stats_server *sts1, *sts2;
 
@@ -691,6 +768,36 @@ stats_aggregate(struct stats *st)
             stats_aggregate_metric(&sts2->metric, &sts1->metric);
         }
     }
+}
+
+static void
+stats_aggregate(struct stats *st)
+{
+    struct stats *worker;
+
+    /* worker contexts swap on their own, fold whatever is ready */
+    for (worker = st->worker; worker != NULL; worker = worker->next) {
+        if (worker->aggregate == 0) {
+            continue;
+        }
+
+        log_debug(LOG_PVERB, "aggregate worker stats shadow %p to sum %p",
+                  worker->shadow.elem, st->sum.elem);
+
+        stats_aggregate_pool(&st->sum, &worker->shadow);
+        worker->aggregate = 0;
+    }
+
+    if (st->aggregate == 0) {
+        log_debug(LOG_PVERB, "skip aggregate of shadow %p to sum %p as "
+                  "generator is slow", st->shadow.elem, st->sum.elem);
+        return;
+    }
+
+    log_debug(LOG_PVERB, "aggregate stats shadow %p to sum %p", st->shadow.elem,
+              st->sum.elem);
+
+    stats_aggregate_pool(&st->sum, &st->shadow);
 
     st->aggregate = 0;
 }
@@ -755,24 +862,209 @@ stats_make_rsp(struct stats *st)
     return NC_OK;
 }
 
+/*
+ * Append a trace entry of a pool to buf, flushing buf to sd when full
+ */
 static rstatus_t
-stats_send_rsp(struct stats *st)
+stats_trace_flush(int sd, struct stats_buffer *buf)
+{
+    if (buf->size - buf->len >= STATS_TRACE_ROOM) {
+        return NC_OK;
+    }
+
+    if (nc_sendn(sd, buf->data, buf->len) < 0) {
+        return NC_ERROR;
+    }
+    buf->len = 0;
+
+    return NC_OK;
+}
+
+static rstatus_t
+stats_trace_add(int sd, struct stats_buffer *buf, struct stats_pool *stp,
+                struct stats_trace_entry *e, bool first)
 {
+    struct string none = null_string;
+    struct string *name;
     rstatus_t status;
-    ssize_t n;
-    int sd;
+    int n;
 
-    status = stats_make_rsp(st);
+    status = stats_trace_flush(sd, buf);
     if (status != NC_OK) {
         return status;
     }
 
+    name = &none;
+    if (e->server < array_n(&stp->server)) {
+        name = &((struct stats_server *)array_get(&stp->server, e->server))->name;
+    }
+
+    n = nc_snprintf(buf->data + buf->len, buf->size - buf->len,
+                    "%s{\"ts\":%"PRId64", \"server\":\"%.*s\", \"idx\":%"PRIu32", "
+                    "\"hash\":%"PRIu32", \"slot\":%"PRId32", \"write\":%"PRIu32", "
+                    "\"latency\":%"PRId64"}",
+                    first ? "" : ", ", e->ts, name->len, name->data, e->server,
+                    e->hash, e->slot, e->write, e->latency);
+    if (n < 0) {
+        return NC_ERROR;
+    }
+    buf->len += (size_t)n;
+
+    return NC_OK;
+}
+
+/*
+ * Copy the entries of a trace ring that were not overwritten while we
+ * read them into buf
+ */
+static rstatus_t
+stats_trace_copy(int sd, struct stats_buffer *buf, struct stats_pool *stp,
+                 struct stats_trace *trace, bool *first)
+{
+    struct stats_trace_entry e, *ep;
+    uint64_t head, n;
+    rstatus_t status;
+
+    head = trace->head;
+    n = head > STATS_TRACE_NENTRY ? head - STATS_TRACE_NENTRY : 0;
+
+    for (; n < head; n++) {
+        ep = &trace->entry[n & (STATS_TRACE_NENTRY - 1)];
+
+        if (ep->seq != 2 * n + 2) {
+            continue;
+        }
+        __sync_synchronize();
+        e = *ep;
+        __sync_synchronize();
+        if (ep->seq != 2 * n + 2) {
+            continue;
+        }
+
+        status = stats_trace_add(sd, buf, stp, &e, *first);
+        if (status != NC_OK) {
+            return status;
+        }
+        *first = false;
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Dump the trace rings of the main and the worker contexts as one JSON
+ * object with an array of routing decisions per traced pool
+ */
+static rstatus_t
+stats_send_trace(struct stats *st, int sd)
+{
+    struct stats_buffer buf;
+    uint8_t data[16 * 1024];
+    uint32_t i, ntraced;
+    rstatus_t status;
+
+    buf.data = data;
+    buf.size = sizeof(data);
+    buf.len = (size_t)nc_snprintf(buf.data, buf.size, "{");
+    ntraced = 0;
+
+    for (i = 0; i < array_n(&st->sum); i++) {
+        struct stats_pool *stp = array_get(&st->sum, i);
+        struct stats *cst;
+        bool first = true;
+        int n;
+
+        if (*(struct stats_trace **)array_get(&st->trace, i) == NULL) {
+            continue;
+        }
+
+        status = stats_trace_flush(sd, &buf);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        n = nc_snprintf(buf.data + buf.len, buf.size - buf.len, "%s\"%.*s\":[",
+                        ntraced++ > 0 ? ", " : "", stp->name.len, stp->name.data);
+        buf.len += (size_t)n;
+
+        for (cst = st; cst != NULL; cst = (cst == st) ? st->worker : cst->next) {
+            struct stats_trace *trace = *(struct stats_trace **)array_get(&cst->trace, i);
+
+            status = stats_trace_copy(sd, &buf, stp, trace, &first);
+            if (status != NC_OK) {
+                return status;
+            }
+        }
+
+        buf.len += (size_t)nc_snprintf(buf.data + buf.len, buf.size - buf.len, "]");
+    }
+
+    buf.len += (size_t)nc_snprintf(buf.data + buf.len, buf.size - buf.len, "}\n");
+
+    if (nc_sendn(sd, buf.data, buf.len) < 0) {
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+/*
+ * A collector that only connects gets the stats; "trace" sent right
+ * after connecting asks for the sampled routing decisions instead
+ */
+static bool
+stats_want_trace(int sd)
+{
+    struct pollfd pfd;
+    char cmd[64];
+    ssize_t n;
+
+    pfd.fd = sd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, STATS_CMD_TIMEOUT) <= 0) {
+        return false;
+    }
+
+    n = recv(sd, cmd, sizeof(cmd), MSG_DONTWAIT);
+    if (n < (ssize_t)(sizeof("trace") - 1)) {
+        return false;
+    }
+
+    return strncmp(cmd, "trace", sizeof("trace") - 1) == 0;
+}
+
+static rstatus_t
+stats_send_rsp(struct stats *st)
+{
+    rstatus_t status;
+    ssize_t n;
+    int sd;
+
     sd = accept(st->sd, NULL, NULL);
     if (sd < 0) {
         log_error("accept on m %d failed: %s", st->sd, strerror(errno));
         return NC_ERROR;
     }
 
+    if (stats_want_trace(sd)) {
+        log_debug(LOG_VERB, "send trace on sd %d", sd);
+
+        status = stats_send_trace(st, sd);
+        if (status != NC_OK) {
+            log_error("send trace on sd %d failed: %s", sd, strerror(errno));
+        }
+        close(sd);
+        return status;
+    }
+
+    status = stats_make_rsp(st);
+    if (status != NC_OK) {
+        close(sd);
+        return status;
+    }
+
     log_debug(LOG_VERB, "send stats on sd %d %d bytes", sd, st->buf.len);
 
     n = nc_sendn(sd, st->buf.data, st->buf.len);
@@ -879,7 +1171,7 @@ stats_start_aggregator(struct stats *st)
 static void
 stats_stop_aggregator(struct stats *st)
 {
-    if (!stats_enabled) {
+    if (!stats_enabled || st->sd < 0) {
         return;
     }
 
@@ -913,6 +1205,7 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
     array_null(&st->current);
     array_null(&st->shadow);
     array_null(&st->sum);
+    array_null(&st->trace);
 
     st->tid = (pthread_t) -1;
     st->sd = -1;
@@ -935,6 +1228,9 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
     st->updated = 0;
     st->aggregate = 0;
 
+    st->worker = NULL;
+    st->next = NULL;
+
     /* map server pool to current (a), shadow (b) and sum (c) */
 
     status = stats_pool_map(&st->current, server_pool);
@@ -952,6 +1248,11 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
         goto error;
     }
 
+    status = stats_trace_map(&st->trace, server_pool);
+    if (status != NC_OK) {
+        goto error;
+    }
+
     status = stats_create_buf(st);
     if (status != NC_OK) {
         goto error;
@@ -969,6 +1270,73 @@ error:
     return NULL;
 }
 
+/*
+ * Stats of a worker context. The worker fills current (a) and swaps it
+ * with shadow (b) exactly like the main context does, but has no sum (c)
+ * and no aggregator of its own: the aggregator of the main context folds
+ * the worker shadow into the main sum once the worker is added to it.
+ */
+struct stats *
+stats_create_worker(struct array *server_pool)
+{
+    rstatus_t status;
+    struct stats *st;
+
+    st = nc_alloc(sizeof(*st));
+    if (st == NULL) {
+        return NULL;
+    }
+
+    memset(st, 0, sizeof(*st));
+
+    array_null(&st->current);
+    array_null(&st->shadow);
+    array_null(&st->sum);
+    array_null(&st->trace);
+
+    st->tid = (pthread_t) -1;
+    st->sd = -1;
+
+    st->updated = 0;
+    st->aggregate = 0;
+
+    st->worker = NULL;
+    st->next = NULL;
+
+    status = stats_pool_map(&st->current, server_pool);
+    if (status != NC_OK) {
+        goto error;
+    }
+
+    status = stats_pool_map(&st->shadow, server_pool);
+    if (status != NC_OK) {
+        goto error;
+    }
+
+    status = stats_trace_map(&st->trace, server_pool);
+    if (status != NC_OK) {
+        goto error;
+    }
+
+    return st;
+
+error:
+    stats_destroy(st);
+    return NULL;
+}
+
+/*
+ * Called by the main thread only, while the aggregator may be walking the
+ * list, so the worker is linked in fully initialized.
+ */
+void
+stats_add_worker(struct stats *st, struct stats *worker)
+{
+    worker->next = st->worker;
+    __sync_synchronize();
+    st->worker = worker;
+}
+
 void
 stats_destroy(struct stats *st)
 {
@@ -976,6 +1344,7 @@ stats_destroy(struct stats *st)
     stats_pool_unmap(&st->sum);
     stats_pool_unmap(&st->shadow);
     stats_pool_unmap(&st->current);
+    stats_trace_unmap(&st->trace);
     stats_destroy_buf(st);
     nc_free(st);
 }
@@ -1212,3 +1581,39 @@ _stats_server_set_ts(struct context *ctx, struct server *server,
     log_debug(LOG_VVVERB, "set ts field '%.*s' to %"PRId64"", stm->name.len,
               stm->name.data, stm->value.timestamp);
 }
+
+/*
+ * Record a sampled routing decision in the trace ring of this context.
+ * Only called for requests picked by trace_rate: a pool that is not
+ * traced costs a single test on the forwarding path.
+ */
+void
+_stats_pool_trace(struct context *ctx, struct server_pool *pool,
+                  struct stats_trace_entry *entry)
+{
+    struct stats_trace *trace;
+    struct stats_trace_entry *e;
+    uint64_t n;
+
+    trace = *(struct stats_trace **)array_get(&ctx->stats->trace, pool->idx);
+    if (trace == NULL) {
+        return;
+    }
+
+    n = trace->head;
+    e = &trace->entry[n & (STATS_TRACE_NENTRY - 1)];
+
+    e->seq = 2 * n + 1;
+    __sync_synchronize();
+
+    e->ts = entry->ts;
+    e->latency = entry->latency;
+    e->hash = entry->hash;
+    e->slot = entry->slot;
+    e->server = entry->server;
+    e->write = entry->write;
+
+    __sync_synchronize();
+    e->seq = 2 * n + 2;
+    trace->head = n + 1;
+}
@@ -30,6 +30,15 @@
     /* forwarder behavior */                                                                                        \
     ACTION( forward_error,          STATS_COUNTER,      "# times we encountered a forwarding error")                \
     ACTION( fragments,              STATS_COUNTER,      "# fragments created from a multi-vector request")          \
+    /* redirect behavior */                                                                                         \
+    ACTION( redirect_moved,         STATS_COUNTER,      "# moved responses from servers")                           \
+    ACTION( redirect_ask,           STATS_COUNTER,      "# ask responses from servers")                             \
+    ACTION( redirect_tryagain,      STATS_COUNTER,      "# tryagain responses from servers")                        \
+    ACTION( redirect_map_updates,   STATS_COUNTER,      "# slot map entries updated after moved responses")         \
+    ACTION( redirect_exhausted,     STATS_COUNTER,      "# redirected requests given up on")                        \
+    /* replica behavior */                                                                                          \
+    ACTION( replica_reads,          STATS_COUNTER,      "# reads sent to a replica")                                \
+    ACTION( replica_fallbacks,      STATS_COUNTER,      "# reads sent to the master, no replica usable")            \
 
 #define STATS_SERVER_CODEC(ACTION)                                                                                  \
     /* server behavior */                                                                                           \
@@ -52,6 +61,10 @@
 #define STATS_PORT      22222
 #define STATS_INTERVAL  (30 * 1000) /* in msec */
 
+#define STATS_TRACE_NENTRY  1024    /* routing decisions kept per pool and context, power of 2 */
+#define STATS_TRACE_ROOM    512     /* trace dump buffer room for one entry */
+#define STATS_CMD_TIMEOUT   10      /* wait for a command on the stats port in msec */
+
 typedef enum stats_type {
     STATS_INVALID,
     STATS_COUNTER,    /* monotonic accumulator */
@@ -80,6 +93,26 @@ struct stats_pool {
     struct array  server; /* stats_server[] */
 };
 
+/*
+ * A sampled routing decision. The context that forwarded the request is
+ * the only writer of its trace ring; the aggregator reads it without a
+ * lock and drops an entry whose seq changed while it was copied.
+ */
+struct stats_trace_entry {
+    volatile uint64_t seq;      /* 2n+2 once the n'th entry is written, odd while writing */
+    int64_t           ts;       /* request sent timestamp in usec */
+    int64_t           latency;  /* response latency in usec, -1 when none came */
+    uint32_t          hash;     /* key hash */
+    int32_t           slot;     /* key slot, -1 if the pool has no hash slots */
+    uint32_t          server;   /* server index in stats_pool server[] */
+    uint32_t          write;    /* write request? */
+};
+
+struct stats_trace {
+    volatile uint64_t        head;                        /* # entries written */
+    struct stats_trace_entry entry[STATS_TRACE_NENTRY];   /* ring */
+};
+
 struct stats_buffer {
     size_t   len;   /* buffer length */
     uint8_t  *data; /* buffer data */
@@ -97,6 +130,7 @@ struct stats {
     struct array        current;         /* stats_pool[] (a) */
     struct array        shadow;          /* stats_pool[] (b) */
     struct array        sum;             /* stats_pool[] (c = a + b) */
+    struct array        trace;           /* stats_trace *[] per pool, NULL if not traced */
 
     pthread_t           tid;             /* stats aggregator thread */
     int                 sd;              /* stats descriptor */
@@ -114,6 +148,9 @@ struct stats {
 
     volatile int        aggregate;       /* shadow (b) aggregate? */
     volatile int        updated;         /* current (a) updated? */
+
+    struct stats        *volatile worker; /* stats of worker contexts */
+    struct stats        *next;           /* next worker stats */
 };
 
 #define DEFINE_ACTION(_name, _type, _desc) STATS_POOL_##_name,
@@ -172,6 +209,10 @@ typedef enum stats_server_field {
      _stats_server_set_ts(_ctx, _server, STATS_SERVER_##_name, _val);   \
 } while (0)
 
+#define stats_pool_trace(_ctx, _pool, _entry) do {                      \
+    _stats_pool_trace(_ctx, _pool, _entry);                             \
+} while (0)
+
 #else
 
 #define stats_pool_incr(_ctx, _pool, _name)
@@ -190,6 +231,8 @@ typedef enum stats_server_field {
 
 #define stats_server_decr_by(_ctx, _server, _name, _val)
 
+#define stats_pool_trace(_ctx, _pool, _entry)
+
 #endif
 
 #define stats_enabled   NC_STATS
@@ -208,7 +251,11 @@ void _stats_server_incr_by(struct context *ctx, struct server *server, stats_ser
 void _stats_server_decr_by(struct context *ctx, struct server *server, stats_server_field_t fidx, int64_t val);
 void _stats_server_set_ts(struct context *ctx, struct server *server, stats_server_field_t fidx, int64_t val);
 
+void _stats_pool_trace(struct context *ctx, struct server_pool *pool, struct stats_trace_entry *entry);
+
 struct stats *stats_create(uint16_t stats_port, char *stats_ip, int stats_interval, char *source, struct array *server_pool);
+struct stats *stats_create_worker(struct array *server_pool);
+void stats_add_worker(struct stats *st, struct stats *worker);
 void stats_destroy(struct stats *stats);
 void stats_swap(struct stats *stats);
 
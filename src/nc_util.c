@@ -75,6 +75,27 @@ nc_set_reuseaddr(int sd)
     return setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &reuse, len);
 }
 
+/*
+ * Allow several sockets to bind the same address, the kernel then spreads
+ * incoming connections across them.
+ */
+int
+nc_set_reuseport(int sd)
+{
+#ifdef SO_REUSEPORT
+    int reuse;
+    socklen_t len;
+
+    reuse = 1;
+    len = sizeof(reuse);
+
+    return setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &reuse, len);
+#else
+    errno = ENOPROTOOPT;
+    return -1;
+#endif
+}
+
 /*
  * Disable Nagle algorithm on TCP socket.
  *
@@ -578,8 +599,8 @@ nc_resolve(struct string *name, int port, struct sockinfo *si)
 char *
 nc_unresolve_addr(struct sockaddr *addr, socklen_t addrlen)
 {
-    static char unresolve[NI_MAXHOST + NI_MAXSERV];
-    static char host[NI_MAXHOST], service[NI_MAXSERV];
+    static __thread char unresolve[NI_MAXHOST + NI_MAXSERV];
+    static __thread char host[NI_MAXHOST], service[NI_MAXSERV];
     int status;
 
     status = getnameinfo(addr, addrlen, host, sizeof(host),
@@ -603,7 +624,7 @@ nc_unresolve_addr(struct sockaddr *addr, socklen_t addrlen)
 char *
 nc_unresolve_peer_desc(int sd)
 {
-    static struct sockinfo si;
+    static __thread struct sockinfo si;
     struct sockaddr *addr;
     socklen_t addrlen;
     int status;
@@ -629,7 +650,7 @@ nc_unresolve_peer_desc(int sd)
 char *
 nc_unresolve_desc(int sd)
 {
-    static struct sockinfo si;
+    static __thread struct sockinfo si;
     struct sockaddr *addr;
     socklen_t addrlen;
     int status;
@@ -24,6 +24,7 @@
 
 typedef int (*lib_ssdb_active_standby_switch_t)(const char* ip, uint16_t port, uint64_t* last_seq);
 typedef int (*lib_ssdb_change_master_to_t)(const char* ip, uint16_t port, uint64_t last_seq, const char* master_ip, uint16_t master_port);
+#define SSDB_CONNECTED_ERROR -1 /* the ssdb handle could not reach the server */
 
 
 #define LF                  (uint8_t) 10
@@ -87,6 +88,7 @@ typedef int (*lib_ssdb_change_master_to_t)(const char* ip, uint16_t port, uint64
 int nc_set_blocking(int sd);
 int nc_set_nonblocking(int sd);
 int nc_set_reuseaddr(int sd);
+int nc_set_reuseport(int sd);
 int nc_set_tcpnodelay(int sd);
 int nc_set_linger(int sd, int timeout);
 int nc_set_sndbuf(int sd, int size);
@@ -201,4 +201,162 @@ bool get_lock(zhandle_t *zh, const char *path, char* node_path, int timeout)
         log_error("Error %d for create\n", father_ret);
         return false;
     }
-}
\ No newline at end of file
+}
+
+static int zk_parse_num(const char **pos, const char *end, uint64_t *num)
+{
+    const char *p = *pos;
+    uint64_t n = 0;
+
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return -1;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (n > (UINT64_MAX - 9) / 10) {
+            return -1;
+        }
+        n = n * 10 + (uint64_t)(*p - '0');
+        p++;
+    }
+
+    *pos = p;
+    *num = n;
+    return 0;
+}
+
+static int zk_parse_eol(const char **pos, const char *end)
+{
+    if (*pos < end && **pos == '\n') {
+        (*pos)++;
+        return 0;
+    }
+    return *pos == end ? 0 : -1;
+}
+
+/*
+ * Fill node[0..nslot) from a snapshot. The runs must cover all slots in
+ * order, a snapshot that does not is rejected as a whole.
+ */
+int zk_slot_snapshot_decode(const char *data, int len, uint32_t *node, uint32_t nslot, uint64_t *version)
+{
+    const char *p = data, *end = data + len;
+    uint64_t n, first, count, index, next;
+
+    if (len < 2 || strncmp(p, "v1", 2) != 0) {
+        return -1;
+    }
+    p += 2;
+
+    if (zk_parse_num(&p, end, version) || zk_parse_num(&p, end, &n) ||
+        zk_parse_eol(&p, end) || n != nslot) {
+        return -1;
+    }
+
+    next = 0;
+    while (p < end) {
+        if (zk_parse_num(&p, end, &first) || zk_parse_num(&p, end, &count) ||
+            zk_parse_num(&p, end, &index) || zk_parse_eol(&p, end)) {
+            return -1;
+        }
+        if (first != next || count == 0 || first + count > nslot ||
+            index > UINT32_MAX) {
+            return -1;
+        }
+        for (; next < first + count; next++) {
+            node[next] = (uint32_t)index;
+        }
+    }
+
+    return next == nslot ? 0 : -1;
+}
+
+/*
+ * Write a snapshot of node[0..nslot) to buffer, returns its length or
+ * -1 if it does not fit
+ */
+int zk_slot_snapshot_encode(char *buffer, int size, const uint32_t *node, uint32_t nslot, uint64_t version)
+{
+    uint32_t first, next;
+    int len, n;
+
+    len = snprintf(buffer, (size_t)size, "v1 %"PRIu64" %"PRIu32"\n", version, nslot);
+    if (len < 0 || len >= size) {
+        return -1;
+    }
+
+    for (first = 0; first < nslot; first = next) {
+        for (next = first + 1; next < nslot && node[next] == node[first]; next++) {
+        }
+        n = snprintf(buffer + len, (size_t)(size - len), "%"PRIu32" %"PRIu32" %"PRIu32"\n",
+                first, next - first, node[first]);
+        if (n < 0 || n >= size - len) {
+            return -1;
+        }
+        len += n;
+    }
+
+    return len;
+}
+
+/*
+ * Move one slot to another node in the snapshot. Concurrent writers are
+ * caught by the znode version and retried. Returns ZNONODE when the
+ * cluster only has the per-slot layout.
+ */
+int zk_slot_snapshot_set(zhandle_t *zh, uint32_t slot, uint32_t node_index, uint32_t nslot)
+{
+    char *buffer;
+    uint32_t *node;
+    struct Stat stat;
+    uint64_t version;
+    int ret, len, i;
+
+    if (slot >= nslot) {
+        return ZBADARGUMENTS;
+    }
+
+    buffer = nc_alloc(ZK_SLOT_SNAPSHOT_MAX);
+    if (buffer == NULL) {
+        return ZSYSTEMERROR;
+    }
+    node = nc_alloc(sizeof(*node) * nslot);
+    if (node == NULL) {
+        nc_free(buffer);
+        return ZSYSTEMERROR;
+    }
+
+    ret = ZBADVERSION;
+    for (i = 0; i < ZK_SLOT_SNAPSHOT_RETRY && ret == ZBADVERSION; i++) {
+        len = ZK_SLOT_SNAPSHOT_MAX;
+        ret = zoo_get(zh, ZK_SLOT_SNAPSHOT_PATH, 0, buffer, &len, &stat);
+        if (ret != ZOK) {
+            break;
+        }
+
+        if (len < 0 || zk_slot_snapshot_decode(buffer, len, node, nslot, &version)) {
+            log_error("bad slot map snapshot in %s", ZK_SLOT_SNAPSHOT_PATH);
+            ret = ZBADARGUMENTS;
+            break;
+        }
+
+        node[slot] = node_index;
+        len = zk_slot_snapshot_encode(buffer, ZK_SLOT_SNAPSHOT_MAX, node, nslot, version + 1);
+        if (len < 0) {
+            ret = ZBADARGUMENTS;
+            break;
+        }
+
+        ret = zoo_set(zh, ZK_SLOT_SNAPSHOT_PATH, buffer, len, stat.version);
+    }
+
+    if (ret != ZOK && ret != ZNONODE) {
+        log_error("Error %d for slot map snapshot set, slot %u", ret, slot);
+    }
+
+    nc_free(buffer);
+    nc_free(node);
+    return ret;
+}
@@ -24,10 +24,22 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <zookeeper.h>
 
 #define BUFFER_SIZE 256
 
+/*
+ * The slot map as one versioned znode, a run per line:
+ *   v1 <version> <# slots>
+ *   <first slot> <# slots> <node index>
+ * Writers bump version on every change, readers ignore older snapshots.
+ * /slot_map/<n> keeps the per-slot layout for older proxies.
+ */
+#define ZK_SLOT_SNAPSHOT_PATH   "/slot_map_snapshot"
+#define ZK_SLOT_SNAPSHOT_MAX    (1024 * 1024)   /* znode data limit */
+#define ZK_SLOT_SNAPSHOT_RETRY  16
+
 struct zk_init_ctx
 {
     const char *host;
@@ -48,6 +60,9 @@ int zk_set(zhandle_t *zh, const char *path, const char *buffer); // zk设置节
 int zk_get_children(zhandle_t *zh, const char *path, watcher_fn watcher, void *watcherCtx, struct String_vector *strings); // zk获取节点的子节点
 int comp(const void *a, const void *b); // 排序规则，用于分布式获取锁
 bool get_lock(zhandle_t *zh, const char *path, char* node_path, int timeout); // 获取分布式锁
+int zk_slot_snapshot_decode(const char *data, int len, uint32_t *node, uint32_t nslot, uint64_t *version); // 解析slot表快照
+int zk_slot_snapshot_encode(char *buffer, int size, const uint32_t *node, uint32_t nslot, uint64_t version); // 生成slot表快照
+int zk_slot_snapshot_set(zhandle_t *zh, uint32_t slot, uint32_t node_index, uint32_t nslot); // 修改快照中一个slot
 
 #ifdef __cplusplus  
 }  
@@ -167,9 +167,12 @@ void redis_swallow_msg(struct conn *conn, struct msg *pmsg, struct msg *msg);
 void ssdb_parse_req(struct msg *r);
 void ssdb_parse_rsp(struct msg *r);
 bool ssdb_failure(struct msg *r);
+msg_redirect_type_t ssdb_redirect(struct msg *r);
 void ssdb_pre_coalesce(struct msg *r);
 void ssdb_post_coalesce(struct msg *r);
 rstatus_t ssdb_add_auth(struct context *ctx, struct conn *c_conn, struct conn *s_conn);
+rstatus_t ssdb_add_asking(struct context *ctx, struct conn *s_conn);
+rstatus_t ssdb_add_probe(struct context *ctx, struct conn *s_conn);
 rstatus_t ssdb_fragment(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msgq);
 rstatus_t ssdb_reply(struct msg *r);
 void ssdb_post_connect(struct context *ctx, struct conn *conn, struct server *server);
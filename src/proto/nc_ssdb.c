@@ -23,7 +23,7 @@
 #define SSDB_PARAM_MULTI        16384
 #define SSDB_PARAM_STOP_TWO     32768
 
-uint32_t ssdb_command_size = 79;
+uint32_t ssdb_command_size = 90;
 
 const char* ssdb_command[] = 
 {
@@ -55,7 +55,9 @@ const char* ssdb_command[] =
     "multi_hdel",
     "multi_hget",
     "multi_hset",
+    "multi_sdel",
     "multi_set",
+    "multi_sset",
     "multi_zdel",
     "multi_zget",
     "multi_zset",
@@ -75,12 +77,21 @@ const char* ssdb_command[] =
     "qslice",
     "qtrim_back",
     "qtrim_front",
+    "sdiff",
+    "sdiffstore",
     "set",
     "setbit",
     "setnx",
     "setx",
+    "sinter",
+    "sinterstore",
+    "sismember",
+    "smembers",
+    "ssize",
     "strlen",
     "substr",
+    "sunion",
+    "sunionstore",
     "ttl",
     "zavg",
     "zclear",
@@ -138,7 +149,9 @@ int ssdb_command_propery[] =
     1280,//multi_hdel
     256,//multi_hget
     34304,//multi_hset
+    1280,//multi_sdel
     54528,//multi_set
+    1280,//multi_sset
     1280,//multi_zdel
     256,//multi_zget
     34304,//multi_zset
@@ -158,12 +171,21 @@ int ssdb_command_propery[] =
     4,//qslice
     1026,//qtrim_back
     1026,//qtrim_front
+    128,//sdiff
+    1280,//sdiffstore
     1026,//set
     1028,//setbit
     1026,//setnx
     1028,//setx
+    128,//sinter
+    1280,//sinterstore
+    2,//sismember
+    1,//smembers
+    1,//ssize
     1,//strlen
     4,//substr
+    128,//sunion
+    1280,//sunionstore
     1,//ttl
     4,//zavg
     1025,//zclear
@@ -703,6 +725,55 @@ bool ssdb_failure(struct msg *r)
 	return false;
 }
 
+/*
+ * Recognize the slot redirects sent by a cluster node:
+ * "error moved", "error ask" and "error tryagain"
+ */
+msg_redirect_type_t ssdb_redirect(struct msg *r)
+{
+	struct mbuf *mbuf;
+	uint8_t *p, *last;
+	uint32_t len = 0;
+
+	mbuf = STAILQ_FIRST(&r->mhdr);
+	if (mbuf == NULL)
+	{
+		return MSG_REDIRECT_NONE;
+	}
+
+	p = mbuf->pos;
+	last = mbuf->last;
+	if (last - p < 10 || memcmp(p, "5\nerror\n", 8) != 0)
+	{
+		return MSG_REDIRECT_NONE;
+	}
+
+	for (p += 8; p < last && isdigit(*p); p++)
+	{
+		len = len * 10 + (uint32_t)(*p - '0');
+	}
+	if (p == last || *p != '\n' || (uint32_t)(last - p - 1) < len)
+	{
+		return MSG_REDIRECT_NONE;
+	}
+	p++;
+
+	if (len == 5 && memcmp(p, "moved", 5) == 0)
+	{
+		return MSG_REDIRECT_MOVED;
+	}
+	else if (len == 3 && memcmp(p, "ask", 3) == 0)
+	{
+		return MSG_REDIRECT_ASK;
+	}
+	else if (len == 8 && memcmp(p, "tryagain", 8) == 0)
+	{
+		return MSG_REDIRECT_TRYAGAIN;
+	}
+
+	return MSG_REDIRECT_NONE;
+}
+
 
 static rstatus_t
 ssdb_copy_bulk(struct msg *dst, struct msg *src)
@@ -924,6 +995,67 @@ rstatus_t ssdb_add_auth(struct context *ctx, struct conn *c_conn, struct conn *s
 	return NC_OK;
 }
 
+/*
+ * Queue an "asking" command in front of a request redirected to an
+ * importing server, the reply is swallowed
+ */
+rstatus_t ssdb_add_asking(struct context *ctx, struct conn *s_conn)
+{
+	struct msg *msg;
+	rstatus_t status;
+
+	msg = msg_get(s_conn, true, (int)s_conn->protocol);
+	if (msg == NULL)
+	{
+		return NC_ENOMEM;
+	}
+
+	status = msg_prepend_format(msg, "6\nasking\n\n");
+	if (status != NC_OK)
+	{
+		msg_put(msg);
+		return status;
+	}
+	msg->result = MSG_PARSE_OK;
+	msg->swallow = 1;
+	msg->owner = NULL;
+
+	s_conn->enqueue_inq(ctx, s_conn, msg);
+
+	return NC_OK;
+}
+
+/*
+ * Queue an "info" command used to measure how far a replica is behind
+ * its master, the reply is handled in ssdb_swallow_msg
+ */
+rstatus_t ssdb_add_probe(struct context *ctx, struct conn *s_conn)
+{
+	struct msg *msg;
+	rstatus_t status;
+
+	msg = msg_get(s_conn, true, (int)s_conn->protocol);
+	if (msg == NULL)
+	{
+		return NC_ENOMEM;
+	}
+
+	status = msg_prepend_format(msg, "4\ninfo\n\n");
+	if (status != NC_OK)
+	{
+		msg_put(msg);
+		return status;
+	}
+	msg->result = MSG_PARSE_OK;
+	msg->swallow = 1;
+	msg->probe = 1;
+	msg->owner = NULL;
+
+	s_conn->enqueue_inq(ctx, s_conn, msg);
+
+	return NC_OK;
+}
+
 static rstatus_t
 ssdb_append_key(struct msg *r, uint8_t *key, uint32_t keylen)
 {
@@ -1113,10 +1245,67 @@ rstatus_t ssdb_reply(struct msg *r)
 void ssdb_post_connect(struct context *ctx, struct conn *conn, struct server *server)
 {
 	server->connected = 1;
-	printf("%.*s connected\n", server->pname.len, server->pname.data);
+	log_debug(LOG_VERB, "s %d connected to '%.*s'", conn->sd, server->pname.len,
+			  server->pname.data);
+}
+
+/*
+ * Binlog position in an "info" reply: binlog_last_seq of a master, or
+ * last_seq of a slave in sync with its master. -1 when there is none.
+ */
+static int64_t
+ssdb_info_seq(uint8_t *buf, bool slave)
+{
+	uint8_t *p;
+
+	if (!slave)
+	{
+		p = (uint8_t *)strstr((char *)buf, "binlog_last_seq:");
+		return p == NULL ? -1 : strtoll((char *)p + 16, NULL, 10);
+	}
+
+	if (strstr((char *)buf, "status:SYNC") == NULL)
+	{
+		return -1;
+	}
+
+	for (p = buf; (p = (uint8_t *)strstr((char *)p, "last_seq:")) != NULL; p += 9)
+	{
+		if (p == buf || p[-1] == '\n')
+		{
+			return strtoll((char *)p + 9, NULL, 10);
+		}
+	}
+
+	return -1;
 }
 
 void ssdb_swallow_msg(struct conn *conn, struct msg *pmsg, struct msg *msg)
 {
-	
+	struct server *server = conn->owner;
+	struct mbuf *mbuf;
+	uint8_t *buf, *p;
+
+	if (!pmsg->probe)
+	{
+		return;
+	}
+
+	buf = nc_alloc(msg->mlen + 1);
+	if (buf == NULL)
+	{
+		return;
+	}
+
+	p = buf;
+	STAILQ_FOREACH(mbuf, &msg->mhdr, next)
+	{
+		nc_memcpy(p, mbuf->pos, mbuf_length(mbuf));
+		p += mbuf_length(mbuf);
+	}
+	*p = '\0';
+
+	server_probed(server, ssdb_info_seq(buf, server->group != NULL));
+
+	nc_free(buf);
 }
\ No newline at end of file
@@ -504,6 +504,9 @@ int main(int argc, char  **argv)
 		sprintf(data,"{\"node_index\":%d, \"migrating\":\"false\"}",nodes_num);
 		if (zk_set(zh_handler, zk_path, data))
 			log_error("zk_set fail ,zk_path:%s, data:%s",zk_path, data);
+		//proxy按快照整体加载slot表, 旧集群没有快照时只改单个slot节点
+		if (zk_slot_snapshot_set(zh_handler, atoi((*it).c_str()), nodes_num, 16384) == ZOK)
+			_log_stderr("slot map snapshot updated, slot:%s\n", (*it).c_str());
 		memset(zk_path, 0x00, sizeof(zk_path));
 		sprintf(zk_path, "/migrate_tasks/%s", (*it).c_str());
 		if(zk_delete(zh_handler,zk_path))
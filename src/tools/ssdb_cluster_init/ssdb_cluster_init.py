@@ -85,6 +85,19 @@ def init_slot_map(zk, node_size):
             path = "/slot_map/" + str(i)
             data = """{"node_index":%d, "migrating":"false"}"""%(slot_id)
             create_zookeeper(zk, path, data)
+
+        # the whole table in one node, "v1 <version> <slots>" then
+        # "<first slot> <count> <node index>" runs, proxies load it at once
+        path = "/slot_map_snapshot"
+        runs = []
+        for n in range(node_size):
+            first = n * size_per_node
+            count = size_per_node
+            if n == node_size - 1:
+                count = 16384 - first
+            runs.append("%d %d %d\n"%(first, count, n))
+        data = "v1 1 16384\n" + "".join(runs)
+        create_zookeeper(zk, path, data)
     except zookeeper.NodeExistsException, e:
             err_str = "path %s exist\n"%path
             handle_output(False, err_str)
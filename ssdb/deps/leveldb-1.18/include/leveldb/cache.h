@@ -29,6 +29,10 @@ class Cache;
 // of Cache uses a least-recently-used eviction policy.
 extern Cache* NewLRUCache(size_t capacity);
 
+// Like NewLRUCache(capacity), with 2^shard_bits independently locked
+// shards instead of 16.
+extern Cache* NewLRUCache(size_t capacity, int shard_bits);
+
 class Cache {
  public:
   Cache() { }
@@ -81,6 +85,13 @@ class Cache {
   // its cache keys.
   virtual uint64_t NewId() = 0;
 
+  // Store the number of Lookup() calls that found an entry in *hits and
+  // those that did not in *misses. Caches that don't count report 0.
+  virtual void GetStats(uint64_t* hits, uint64_t* misses) {
+    *hits = 0;
+    *misses = 0;
+  }
+
  private:
   void LRU_Remove(Handle* e);
   void LRU_Append(Handle* e);
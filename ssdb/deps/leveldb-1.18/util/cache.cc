@@ -147,6 +147,7 @@ class LRUCache {
   Cache::Handle* Lookup(const Slice& key, uint32_t hash);
   void Release(Cache::Handle* handle);
   void Erase(const Slice& key, uint32_t hash);
+  void GetStats(uint64_t* hits, uint64_t* misses);
 
  private:
   void LRU_Remove(LRUHandle* e);
@@ -159,6 +160,8 @@ class LRUCache {
   // mutex_ protects the following state.
   port::Mutex mutex_;
   size_t usage_;
+  uint64_t hits_;
+  uint64_t misses_;
 
   // Dummy head of LRU list.
   // lru.prev is newest entry, lru.next is oldest entry.
@@ -168,7 +171,7 @@ class LRUCache {
 };
 
 LRUCache::LRUCache()
-    : usage_(0) {
+    : usage_(0), hits_(0), misses_(0) {
   // Make empty circular linked list
   lru_.next = &lru_;
   lru_.prev = &lru_;
@@ -213,10 +216,19 @@ Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
     e->refs++;
     LRU_Remove(e);
     LRU_Append(e);
+    hits_++;
+  } else {
+    misses_++;
   }
   return reinterpret_cast<Cache::Handle*>(e);
 }
 
+void LRUCache::GetStats(uint64_t* hits, uint64_t* misses) {
+  MutexLock l(&mutex_);
+  *hits += hits_;
+  *misses += misses_;
+}
+
 void LRUCache::Release(Cache::Handle* handle) {
   MutexLock l(&mutex_);
   Unref(reinterpret_cast<LRUHandle*>(handle));
@@ -265,11 +277,12 @@ void LRUCache::Erase(const Slice& key, uint32_t hash) {
 }
 
 static const int kNumShardBits = 4;
-static const int kNumShards = 1 << kNumShardBits;
+static const int kMaxShardBits = 12;
 
 class ShardedLRUCache : public Cache {
  private:
-  LRUCache shard_[kNumShards];
+  LRUCache* shard_;
+  int shard_bits_;
   port::Mutex id_mutex_;
   uint64_t last_id_;
 
@@ -277,19 +290,29 @@ class ShardedLRUCache : public Cache {
     return Hash(s.data(), s.size(), 0);
   }
 
-  static uint32_t Shard(uint32_t hash) {
-    return hash >> (32 - kNumShardBits);
+  uint32_t Shard(uint32_t hash) const {
+    return shard_bits_ == 0 ? 0 : hash >> (32 - shard_bits_);
   }
 
  public:
-  explicit ShardedLRUCache(size_t capacity)
+  ShardedLRUCache(size_t capacity, int shard_bits)
       : last_id_(0) {
-    const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
-    for (int s = 0; s < kNumShards; s++) {
+    if (shard_bits < 0) {
+      shard_bits = 0;
+    } else if (shard_bits > kMaxShardBits) {
+      shard_bits = kMaxShardBits;
+    }
+    shard_bits_ = shard_bits;
+    const int num_shards = 1 << shard_bits_;
+    shard_ = new LRUCache[num_shards];
+    const size_t per_shard = (capacity + (num_shards - 1)) / num_shards;
+    for (int s = 0; s < num_shards; s++) {
       shard_[s].SetCapacity(per_shard);
     }
   }
-  virtual ~ShardedLRUCache() { }
+  virtual ~ShardedLRUCache() {
+    delete[] shard_;
+  }
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) {
     const uint32_t hash = HashSlice(key);
@@ -314,12 +337,23 @@ class ShardedLRUCache : public Cache {
     MutexLock l(&id_mutex_);
     return ++(last_id_);
   }
+  virtual void GetStats(uint64_t* hits, uint64_t* misses) {
+    *hits = 0;
+    *misses = 0;
+    for (int s = 0; s < (1 << shard_bits_); s++) {
+      shard_[s].GetStats(hits, misses);
+    }
+  }
 };
 
 }  // end anonymous namespace
 
 Cache* NewLRUCache(size_t capacity) {
-  return new ShardedLRUCache(capacity);
+  return new ShardedLRUCache(capacity, kNumShardBits);
+}
+
+Cache* NewLRUCache(size_t capacity, int shard_bits) {
+  return new ShardedLRUCache(capacity, shard_bits);
 }
 
 }  // namespace leveldb
@@ -10,13 +10,18 @@ found in the LICENSE file.
 #include "backend_sync2.h"
 #include "util/log.h"
 #include "util/strings.h"
+#include "net/fde.h"
 #include "serv.h"
 
+#define MAX_COPY_STREAMS      16
+#define COPY_STREAMS_TIMEOUT  (60 * 1000)    /* ms for all streams of a copy to connect */
+
 BackendSync::BackendSync(SSDBServer *owner, SSDBImpl *ssdb, int sync_speed, uint32_t snapshot_timeout){
 	thread_quit = false;
 	this->owner = owner;
 	this->ssdb = ssdb;
 	this->sync_speed = sync_speed;
+	this->range_workers = 0;
 
 	this->snapshot_timeout = snapshot_timeout;
 	pthread_t timer;
@@ -36,7 +41,7 @@ BackendSync::~BackendSync(){
 		// unable to acquire the mutex
 		{
 			Locking l(&mutex);
-			if(workers.empty()){
+			if(workers.empty() && range_workers == 0){
 				break;
 			}
 		}
@@ -65,7 +70,7 @@ void BackendSync::reset() {
 	while(1) {
 		{
 			Locking l(&mutex);
-			if(workers.empty()) {
+			if(workers.empty() && range_workers == 0) {
 				break;
 			}
 		}
@@ -89,6 +94,27 @@ void BackendSync::proc(const Link *link){
 	}
 }
 
+void BackendSync::proc_range(const Link *link){
+	log_info("fd: %d, accept copy stream", link->fd());
+	struct run_arg *arg = new run_arg();
+	arg->link = link;
+	arg->backend = this;
+
+	{
+		Locking l(&mutex);
+		range_workers ++;
+	}
+	pthread_t tid;
+	int err = pthread_create(&tid, NULL, &BackendSync::_range_thread, arg);
+	if(err != 0){
+		log_error("can't create thread: %s", strerror(err));
+		delete link;
+		delete arg;
+		Locking l(&mutex);
+		range_workers --;
+	}
+}
+
 void* BackendSync::_run_thread(void *arg){
 	pthread_detach(pthread_self());
 	SET_PROC_NAME("backend_sync2");
@@ -128,6 +154,17 @@ snapshot:
 		goto finished;
 	}
 
+	if (client.streams > 1 && client.status == Client::COPY && client.last_key.empty()) {
+		int ret = client.copy_parallel();
+		if (ret == -1) {
+			goto finished;
+		}
+		if (ret == 0) {
+			goto snapshot_done;
+		}
+		// too little data to split, copy it on this link
+	}
+
 	log_info("begin transfer snapshot seq(%" PRIu64 ")", client.last_seq);
 
 	// transfer snapshot
@@ -155,6 +192,7 @@ snapshot:
 		}
 	} // end while
 
+snapshot_done:
 	if (backend->thread_quit) {
 		goto finished;
 	}
@@ -277,12 +315,136 @@ finished:
 	return (void *)NULL;
 }
 
+/* one range of the snapshot a slave asked for with 'sync_range peer_port index' */
+void* BackendSync::_range_thread(void *arg){
+	pthread_detach(pthread_self());
+	SET_PROC_NAME("backend_sync2_range");
+	struct run_arg *p = (struct run_arg*)arg;
+	BackendSync *backend = (BackendSync *)p->backend;
+	Link *link = (Link *)p->link;
+	delete p;
+
+	const std::vector<Bytes> *req = link->last_recv();
+	int peer_port = req->size() > 1 ? req->at(1).Int() : 0;
+	int index = req->size() > 2 ? req->at(2).Int() : -1;
+	char buf[32];
+	int len = snprintf(buf, sizeof(buf), "%s:%d", link->remote_ip, peer_port);
+	std::string host(buf, len);
+
+	CopySnapshot *csnapshot = NULL;
+	std::string start, end;
+	int streams = 1;
+	{
+		Locking l(&backend->mutex);
+		std::map<std::string, CopySnapshot *>::iterator it = backend->snapshots.find(host);
+		if (it != backend->snapshots.end() && it->second->snapshot && !it->second->cancel
+				&& index >= 0 && index < (int)it->second->claimed.size()
+				&& !it->second->claimed[index]) {
+			csnapshot = it->second;
+			csnapshot->claimed[index] = true;
+			csnapshot->streams_running ++;
+			start = csnapshot->ranges[index];
+			end = csnapshot->ranges[index + 1];
+			streams = (int)csnapshot->claimed.size();
+		}
+	}
+	if (csnapshot == NULL) {
+		log_error("%s:%d, no copy range %d for host(%s)", link->remote_ip,
+				link->remote_port, index, host.c_str());
+		delete link;
+		Locking l(&backend->mutex);
+		backend->range_workers --;
+		return (void *)NULL;
+	}
+
+	// block IO
+	link->noblock(false);
+	log_info("begin copy range %d of host(%s)", index, host.c_str());
+
+	bool ok = false;
+	uint64_t keys = 0;
+	uint64_t seq = csnapshot->binlog_seq;
+	Iterator *iter = backend->ssdb->iterator(start, end, UINT_MAX, csnapshot->snapshot);
+	while (true) {
+		bool more = true;
+		int count = 0;
+		while (count < 1000 && link->output->size() < 2 * 1024 * 1024) {
+			if (!iter->next()) {
+				more = false;
+				break;
+			}
+			Bytes key = iter->key();
+			if (key.size() == 0) {
+				continue;
+			}
+			LogEvent event(seq, BinlogType::COPY, BinlogCommand::RAW, key, iter->val());
+			link->send(event.repr());
+			count ++;
+		}
+		keys += count;
+		if (!more) {
+			LogEvent event(seq, BinlogType::COPY, BinlogCommand::END);
+			link->send(event.repr());
+		}
+
+		float data_size_mb = link->output->size() / 1024.0 / 1024.0;
+		if (link->flush() == -1) {
+			log_error("%s:%d, fd(%d) send error.", link->remote_ip,
+					link->remote_port, link->fd());
+			break;
+		}
+		if (!more) {
+			ok = true;
+			break;
+		}
+		{
+			Locking l(&backend->mutex);
+			if (csnapshot->cancel) {
+				break;
+			}
+		}
+		if (backend->thread_quit) {
+			break;
+		}
+		// the streams share the speed limit
+		if (backend->sync_speed > 0) {
+			usleep((data_size_mb/backend->sync_speed) * streams * 1000 * 1000);
+		}
+	}
+	delete iter;
+
+	log_info("%s copy range %d of host(%s), %" PRIu64 " keys", ok ? "finished" : "aborted",
+			index, host.c_str(), keys);
+	if (ok) {
+		// accepted links close with a reset, which may drop the tail of the
+		// range on the slave's side, let the slave close first
+		Fdevents select;
+		select.set(link->fd(), FDEVENT_IN, 0, NULL);
+		const Fdevents::events_t *events = select.wait(COPY_STREAMS_TIMEOUT);
+		if (events == NULL || events->empty() || link->read() != 0) {
+			log_warn("copy range %d of host(%s), slave did not close the link", index, host.c_str());
+		}
+	}
+	delete link;
+
+	Locking l(&backend->mutex);
+	if (ok) {
+		csnapshot->streams_done ++;
+	} else {
+		csnapshot->streams_failed ++;
+	}
+	csnapshot->streams_running --;
+	backend->range_workers --;
+	return (void *)NULL;
+}
+
 /* Client */
 
 BackendSync::Client::Client(BackendSync *backend){
 	status = Client::INIT;
 	this->backend = backend;
 	link = NULL;
+	streams = 1;
 	last_seq = 0;
 	last_noop_seq = 0;
 	last_key = "";
@@ -336,6 +498,12 @@ void BackendSync::Client::init(){
 	if (req->size() > 3) {
 		this->peer_server_port = req->at(3).Int();
 	}
+	if (req->size() > 4) {
+		this->streams = req->at(4).Int();
+		if (this->streams > MAX_COPY_STREAMS) {
+			this->streams = MAX_COPY_STREAMS;
+		}
+	}
 	const char *type = "sync";
 
 	// host
@@ -534,6 +702,92 @@ copy_end:
 	return 1;
 }
 
+/**
+ * Split the snapshot into ranges and let the slave fetch each of them on
+ * a link of its own, this link only waits for them to finish.
+ * @return 0: copied, 1: not worth splitting, copy on this link, -1: error
+ */
+int BackendSync::Client::copy_parallel(){
+	CopySnapshot *csnapshot = backend->last_snapshot(this->host);
+	if (!csnapshot) {
+		return -1;
+	}
+	int n = backend->split_snapshot(csnapshot, this->streams);
+	if (n <= 1) {
+		return 1;
+	}
+
+	delete this->iter;
+	this->iter = NULL;
+
+	log_info("%s:%d fd: %d, copy in %d streams", link->remote_ip, link->remote_port, link->fd(), n);
+	LogEvent event(this->last_seq, BinlogType::COPY, BinlogCommand::PARALLEL, str(n));
+	link->send(event.repr());
+	if (link->flush() == -1) {
+		log_error("%s:%d, fd(%d) send error.", link->remote_ip, link->remote_port, link->fd());
+		goto failed;
+	}
+
+	{
+		int64_t stime = time_ms();
+		int64_t last_noop = stime;
+		while (!backend->thread_quit) {
+			usleep(100 * 1000);
+			int64_t now = time_ms();
+			{
+				Locking l(&backend->mutex);
+				if (csnapshot->streams_done == n) {
+					break;
+				}
+				if (csnapshot->streams_failed > 0) {
+					log_error("%s:%d, %d copy streams failed", link->remote_ip,
+							link->remote_port, csnapshot->streams_failed);
+					goto failed;
+				}
+				int claimed = 0;
+				for (int i = 0; i < n; i++) {
+					claimed += csnapshot->claimed[i] ? 1 : 0;
+				}
+				if (claimed < n && now - stime > COPY_STREAMS_TIMEOUT) {
+					log_error("%s:%d, only %d of %d copy streams connected", link->remote_ip,
+							link->remote_port, claimed, n);
+					goto failed;
+				}
+			}
+			// find out whether the slave is still there
+			if (now - last_noop > 5000) {
+				last_noop = now;
+				this->noop();
+				if (link->flush() == -1) {
+					log_error("%s:%d, fd(%d) send error.", link->remote_ip,
+							link->remote_port, link->fd());
+					goto failed;
+				}
+			}
+		}
+		if (backend->thread_quit) {
+			goto failed;
+		}
+	}
+
+	log_info("%s:%d fd: %d, copy end", link->remote_ip, link->remote_port, link->fd());
+	this->status = Client::SYNC;
+	{
+		LogEvent end(this->last_seq, BinlogType::COPY, BinlogCommand::END);
+		link->send(end.repr());
+	}
+	if (link->flush() == -1) {
+		log_error("%s:%d, fd(%d) send error.", link->remote_ip, link->remote_port, link->fd());
+		goto failed;
+	}
+	return 0;
+
+failed:
+	// a new copy starts from scratch, the snapshot is of no use anymore
+	backend->release_last_snapshot(this->host);
+	return -1;
+}
+
 int BackendSync::Client::seek_binlog(uint64_t seq) {
 	SSDB_BinLog *binlog = backend->owner->binlog;
 
@@ -704,8 +958,23 @@ do { \
 	delete link; \
 } while(0)
 
+// assert mutex held, the copy streams of a snapshot have to quit before it goes
+void BackendSync::cancel_streams(const std::string &host) {
+	while (true) {
+		std::map<std::string, CopySnapshot *>::iterator it = snapshots.find(host);
+		if (it == snapshots.end() || !it->second || it->second->streams_running == 0) {
+			break;
+		}
+		it->second->cancel = true;
+		mutex.unlock();
+		usleep(10 * 1000);
+		mutex.lock();
+	}
+}
+
 BackendSync::CopySnapshot *BackendSync::create_snapshot(const std::string &host) {
 	Locking l(&mutex);
+	cancel_streams(host);
 
 	// if exists delete
 	std::map<std::string, CopySnapshot *>::iterator it = snapshots.find(host);
@@ -735,6 +1004,10 @@ BackendSync::CopySnapshot *BackendSync::create_snapshot(const std::string &host)
 	csnapshot->status = CopySnapshot::ACTIVE;
 	csnapshot->last_active = now;
 	csnapshot->binlog_seq = binlog_last_seq;
+	csnapshot->streams_running = 0;
+	csnapshot->streams_done = 0;
+	csnapshot->streams_failed = 0;
+	csnapshot->cancel = false;
 	snapshots.insert(std::make_pair<std::string, CopySnapshot *>(host, csnapshot));
 
 	server->ssdb->unlock_db();
@@ -744,6 +1017,7 @@ BackendSync::CopySnapshot *BackendSync::create_snapshot(const std::string &host)
 
 void BackendSync::release_last_snapshot(const std::string &host) {
 	Locking l(&mutex);
+	cancel_streams(host);
 
 	std::map<std::string, CopySnapshot *>::iterator it;
 	it = snapshots.find(host);
@@ -770,3 +1044,44 @@ void BackendSync::mark_snapshot(const std::string &host, int status) {
 	snapshot->status = status;
 	snapshot->last_active = time(NULL);
 }
+
+/**
+ * Cut the snapshot into at most @streams ranges of about the same size,
+ * on slot bounds, as the sizes are only known per slot.
+ * @return number of ranges
+ */
+int BackendSync::split_snapshot(CopySnapshot *csnapshot, int streams) {
+	std::vector<std::string> bounds;
+	for (int16_t slot = -1; slot <= CLUSTER_SLOTS; slot++) {
+		bounds.push_back(std::string((char *)&slot, sizeof(slot)));
+	}
+	std::vector<uint64_t> sizes;
+	ssdb->approximate_sizes(bounds, &sizes);
+
+	uint64_t total = 0;
+	for (size_t i = 0; i < sizes.size(); i++) {
+		total += sizes[i];
+	}
+	std::vector<std::string> ranges;
+	ranges.push_back(bounds.front());
+	if (streams > 1 && total > 0) {
+		uint64_t size = 0;
+		for (size_t i = 0; i + 1 < sizes.size() && (int)ranges.size() < streams; i++) {
+			size += sizes[i];
+			if (size >= total * ranges.size() / streams) {
+				ranges.push_back(bounds[i + 1]);
+			}
+		}
+	}
+	ranges.push_back(bounds.back());
+	log_info("split snapshot of %" PRIu64 " bytes into %d ranges", total, (int)ranges.size() - 1);
+
+	Locking l(&mutex);
+	csnapshot->ranges = ranges;
+	csnapshot->claimed.assign(ranges.size() - 1, false);
+	csnapshot->streams_running = 0;
+	csnapshot->streams_done = 0;
+	csnapshot->streams_failed = 0;
+	csnapshot->cancel = false;
+	return (int)ranges.size() - 1;
+}
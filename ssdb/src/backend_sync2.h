@@ -33,8 +33,10 @@ private:
 	};
 	volatile bool thread_quit;
 	static void* _run_thread(void *arg);
+	static void* _range_thread(void *arg);
 	Mutex mutex;
 	std::map<pthread_t, Client *> workers;
+	int range_workers;
 	SSDBImpl *ssdb;
 	int sync_speed;
 
@@ -46,17 +48,20 @@ private:
 
 	static void* _timer_thread(void *arg);
 	void clear_timeout_snapshot();
+	void cancel_streams(const std::string &host);
 
 public:
 	CopySnapshot *last_snapshot(const std::string &host);
 	CopySnapshot *create_snapshot(const std::string &host);
 	void release_last_snapshot(const std::string &host);
 	void mark_snapshot(const std::string &host, int status);
+	int split_snapshot(CopySnapshot *csnapshot, int streams);
 
 public:
 	BackendSync(SSDBServer *owner, SSDBImpl *ssdb, int sync_speed, uint32_t snapshot_timeout=3600);
 	~BackendSync();
 	void proc(const Link *link);                                                   /* sync all */
+	void proc_range(const Link *link);                                             /* one range of a parallel copy */
 	void reset();
 
 	std::vector<std::string> stats();
@@ -72,6 +77,14 @@ struct BackendSync::CopySnapshot {
 	int status;
 	time_t last_active;
 	uint64_t binlog_seq;
+
+	// parallel copy, guarded by BackendSync::mutex
+	std::vector<std::string> ranges;     /* bounds of the ranges, one more than streams */
+	std::vector<bool> claimed;
+	int streams_running;
+	int streams_done;
+	int streams_failed;
+	bool cancel;
 };
 
 struct BackendSync::Client{
@@ -82,6 +95,7 @@ struct BackendSync::Client{
 
 	int status;
 	Link *link;
+	int streams;          /* parallel copy streams the slave asked for */
 	uint64_t last_seq;
 	uint64_t last_noop_seq;
 	std::string last_key;
@@ -109,6 +123,7 @@ struct BackendSync::Client{
 	int next_binlog(const std::string &nextfile);
 	int read(LogEvent *event);
 	int copy();
+	int copy_parallel();
 
 	std::string stats();
 };
@@ -337,6 +337,11 @@ void ReplicationSet::set_master(ClusterNode *master) {
 
 SSDBCluster::SSDBCluster(SSDBServer *server) : server(server), migrating_slot(-1) {
 	db = this->server->ssdb;
+	memset(migrating_slots_to, 0, sizeof(migrating_slots_to));
+	memset(importing_slots_from, 0, sizeof(importing_slots_from));
+	memset(slots, 0, sizeof(slots));
+	memset(importing_slots, 0, sizeof(importing_slots));
+	memset(slots_map, 0, sizeof(slots_map));
 	myself = new ClusterNode(server->local_ip, server->local_port, server->local_tag);
 	migrator = new RangeMigrate(server->binlog, server->ssdb, server->expiration, m_key_lock);
 }
@@ -347,7 +352,7 @@ SSDBCluster::~SSDBCluster() {
 }
 
 void SSDBCluster::migrate_slot(Link *link, Response *resp, int16_t slot,
-		const std::string &ip, int port, int64_t timeout_ms, int64_t speed) {
+		const std::string &ip, int port, int64_t timeout_ms, int64_t speed, int window) {
 	std::string start;
 	start.append(SSDB_VERSION_KEY_PREFIX, sizeof(SSDB_VERSION_KEY_PREFIX));
 	start.append((char*)&slot, sizeof(slot));
@@ -356,11 +361,11 @@ void SSDBCluster::migrate_slot(Link *link, Response *resp, int16_t slot,
 	end.append(SSDB_VERSION_KEY_PREFIX, sizeof(SSDB_VERSION_KEY_PREFIX));
 	end.append(1, '\xff');
 	end.append((char*)&slot, sizeof(slot));
-	migrator->migrate(link, resp, ip, port, start, end, speed, timeout_ms);
+	migrator->migrate(link, resp, ip, port, start, end, speed, timeout_ms, window);
 }
 
-void SSDBCluster::import_slot(Link *link, const std::string &sync_key) {
-	migrator->import(link, sync_key);
+void SSDBCluster::import_slot(Link *link, const std::string &sync_key, int window) {
+	migrator->import(link, sync_key, window);
 }
 
 std::string SSDBCluster::get_migrate_result() {
@@ -368,6 +373,10 @@ std::string SSDBCluster::get_migrate_result() {
 	return migrator->get_migrate_msg(ret);
 }
 
+std::string SSDBCluster::get_migrate_stats() {
+	return migrator->get_migrate_stats();
+}
+
 int SSDBCluster::flag_migrating(int16_t slot, const std::string &to_ip, int to_port) {
 	/* check if this node is the master */
 	if(!myself->is_master()) {
@@ -174,9 +174,11 @@ public:
 
 	/* migrate */
 	void migrate_slot(Link *link, Response *resp, int16_t slot,
-			const std::string &ip, int port, int64_t timeout_ms, int64_t speed); /* migrate slot to ip:port at backend */
-	void import_slot(Link *link, const std::string &prefix);                     /* import slot from the link an backend */
+			const std::string &ip, int port, int64_t timeout_ms, int64_t speed,
+			int window);                                                         /* migrate slot to ip:port at backend */
+	void import_slot(Link *link, const std::string &prefix, int window);         /* import slot from the link an backend */
 	std::string get_migrate_result();                                            /* get the result of last migration */
+	std::string get_migrate_stats();                                             /* window and throughput of last migration */
 
 	/* consistency */
 //	KeyLock &get_key_lock();
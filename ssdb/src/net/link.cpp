@@ -10,6 +10,7 @@ found in the LICENSE file.
 #include <sys/socket.h>
 
 #include "link.h"
+#include "stream.h"
 
 #include "link_redis.cpp"
 
@@ -21,6 +22,8 @@ int Link::min_send_buf = 8 * 1024;
 
 Link::Link(bool is_server){
 	redis = NULL;
+	stream = NULL;
+	parse_off = 0;
 
 	sock = -1;
 	noblock_ = false;
@@ -46,6 +49,9 @@ Link::~Link(){
 	if(redis){
 		delete redis;
 	}
+	if(stream){
+		delete stream;
+	}
 	if(input){
 		delete input;
 	}
@@ -267,32 +273,35 @@ const std::vector<Bytes>* Link::recv(){
 		return &this->recv_data;
 	}
 
-	// TODO: 记住上回的解析状态
-	int parsed = 0;
 	int size = input->size();
-	char *head = input->data();
-
-	// ignore leading empty lines
-	while(size > 0 && (head[0] == '\n' || head[0] == '\r')){
-		head ++;
-		size --;
-		parsed ++;
-	}
+	char *data = input->data();
 
-	// Redis protocol supports
-	if(head[0] == '*'){
-		if(redis == NULL){
-			redis = new RedisLink();
+	if(parse_fields.empty()){
+		// ignore leading empty lines
+		while(parse_off < size && (data[parse_off] == '\n' || data[parse_off] == '\r')){
+			parse_off ++;
 		}
-		const std::vector<Bytes> *ret = redis->recv_req(input);
-		if(ret){
-			this->recv_data = *ret;
-			return &this->recv_data;
-		}else{
-			return NULL;
+
+		// Redis protocol supports
+		if(parse_off < size && data[parse_off] == '*'){
+			parse_off = 0;
+			if(redis == NULL){
+				redis = new RedisLink();
+			}
+			const std::vector<Bytes> *ret = redis->recv_req(input);
+			if(ret){
+				this->recv_data = *ret;
+				return &this->recv_data;
+			}else{
+				return NULL;
+			}
 		}
 	}
 
+	// continue where the last call stopped
+	char *head = data + parse_off;
+	size -= parse_off;
+
 	while(size > 0){
 		char *body = (char *)memchr(head, '\n', size);
 		if(body == NULL){
@@ -303,18 +312,23 @@ const std::vector<Bytes>* Link::recv(){
 		int head_len = body - head;
 		if(head_len == 1 || (head_len == 2 && head[0] == '\r')){
 			// packet end
-			parsed += head_len;
-			input->decr(parsed);
-			return &this->recv_data;;
+			parse_off += head_len;
+			for(size_t i = 0; i < parse_fields.size(); i++){
+				this->recv_data.push_back(Bytes(data + parse_fields[i].first, parse_fields[i].second));
+			}
+			input->decr(parse_off);
+			parse_off = 0;
+			parse_fields.clear();
+			return &this->recv_data;
 		}
 		if(head[0] < '0' || head[0] > '9'){
 			//log_warn("bad format");
-			return NULL;
+			goto bad;
 		}
 
 		char head_str[20];
 		if(head_len > (int)sizeof(head_str) - 1){
-			return NULL;
+			goto bad;
 		}
 		memcpy(head_str, head, head_len - 1); // no '\n'
 		head_str[head_len - 1] = '\0';
@@ -322,32 +336,38 @@ const std::vector<Bytes>* Link::recv(){
 		int body_len = atoi(head_str);
 		if(body_len < 0){
 			//log_warn("bad format");
-			return NULL;
+			goto bad;
 		}
 		//log_debug("size: %d, head_len: %d, body_len: %d", size, head_len, body_len);
-		size -= head_len + body_len;
-		if(size < 0){
+		int left = size - head_len - body_len;
+		if(left < 1){
 			break;
 		}
-
-		this->recv_data.push_back(Bytes(body, body_len));
-
-		head += head_len + body_len;
-		parsed += head_len + body_len;
-		if(size > 0 && head[0] == '\n'){
-			head += 1;
-			size -= 1;
-			parsed += 1;
-		}else if(size > 1 && head[0] == '\r' && head[1] == '\n'){
-			head += 2;
-			size -= 2;
-			parsed += 2;
+		// the field is taken once its terminator is in too
+		int tail_len;
+		char *tail = body + body_len;
+		if(tail[0] == '\n'){
+			tail_len = 1;
+		}else if(tail[0] == '\r'){
+			if(left < 2){
+				break;
+			}
+			if(tail[1] != '\n'){
+				goto bad;
+			}
+			tail_len = 2;
 		}else{
-			break;
+			goto bad;
 		}
-		if(parsed > MAX_PACKET_SIZE){
-			 //log_warn("fd: %d, exceed max packet size, parsed: %d", this->sock, parsed);
-			 return NULL;
+
+		parse_fields.push_back(std::make_pair(parse_off + head_len, body_len));
+
+		head += head_len + body_len + tail_len;
+		size -= head_len + body_len + tail_len;
+		parse_off += head_len + body_len + tail_len;
+		if(parse_off > MAX_PACKET_SIZE){
+			 //log_warn("fd: %d, exceed max packet size, parsed: %d", this->sock, parse_off);
+			 goto bad;
 		}
 	}
 
@@ -356,25 +376,48 @@ const std::vector<Bytes>* Link::recv(){
 		if(input->space() == 0){
 			if(input->grow() == -1){
 				//log_error("fd: %d, unable to resize input buffer!", this->sock);
-				return NULL;
+				goto bad;
 			}
 			//log_debug("fd: %d, resize input buffer, %s", this->sock, input->stats().c_str());
 		}
 	}
 
 	// not ready
-	this->recv_data.clear();
 	return &this->recv_data;
+
+bad:
+	parse_off = 0;
+	parse_fields.clear();
+	return NULL;
 }
 
-int Link::send(const std::vector<std::string> &resp){
-	if(resp.empty()){
+int Link::send(const Response &resp){
+	if(resp.size() == 0){
 		return 0;
 	}
 	// Redis protocol supports
 	if(this->redis){
 		return this->redis->send_resp(this->output, resp);
 	}
+	// already in SSDB framing
+	output->append(resp.packed());
+	if(!stream){
+		output->append('\n');
+	}
+	return 0;
+}
+
+int Link::send(const std::vector<std::string> &resp){
+	if(resp.empty()){
+		return 0;
+	}
+	if(this->redis){
+		Response r;
+		for(int i=0; i<resp.size(); i++){
+			r.push_back(resp[i]);
+		}
+		return this->redis->send_resp(this->output, r);
+	}
 
 	for(int i=0; i<resp.size(); i++){
 		output->append_record(resp[i]);
@@ -7,6 +7,7 @@ found in the LICENSE file.
 #define NET_LINK_H_
 
 #include <vector>
+#include <utility>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -15,6 +16,9 @@ found in the LICENSE file.
 #include "../util/bytes.h"
 
 #include "link_redis.h"
+#include "resp.h"
+
+class Stream;
 
 class Link{
 	private:
@@ -23,6 +27,12 @@ class Link{
 		bool error_;
 		std::vector<Bytes> recv_data;
 
+		// state of a packet received in pieces, so recv() only scans
+		// new bytes: bytes of input parsed, and (offset, size) of each
+		// field, offsets as input may move when it grows
+		int parse_off;
+		std::vector<std::pair<int, int> > parse_fields;
+
 		RedisLink *redis;
 
 		static int min_recv_buf;
@@ -39,6 +49,7 @@ class Link{
 
 		Buffer *input;
 		Buffer *output;
+		Stream *stream;      /* rest of the reply being sent, NULL: none */
 
 		double create_time;
 		double active_time;
@@ -58,6 +69,9 @@ class Link{
 		bool error() const{
 			return error_;
 		}
+		bool is_redis() const{
+			return redis != NULL;
+		}
 		void mark_error(){
 			error_ = true;
 		}
@@ -84,6 +98,7 @@ class Link{
 		const std::vector<Bytes>* response();
 
 		// need to call flush to ensure all data has flush into network
+		int send(const Response &resp);
 		int send(const std::vector<std::string> &packet);
 		int send(const std::vector<Bytes> &packet);
 		int send(const Bytes &s1);
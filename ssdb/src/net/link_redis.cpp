@@ -112,6 +112,12 @@ static RedisCommand_raw cmds_raw[] = {
 	{STRATEGY_AUTO,	"srem",			"multi_sdel",	REPLY_INT},
 	{STRATEGY_AUTO,	"sismember",	"sismember",	REPLY_INT},
 	{STRATEGY_AUTO,	"smembers",		"smembers",		REPLY_MULTI_BULK},
+	{STRATEGY_AUTO,	"sinter",		"sinter",		REPLY_MULTI_BULK},
+	{STRATEGY_AUTO,	"sunion",		"sunion",		REPLY_MULTI_BULK},
+	{STRATEGY_AUTO,	"sdiff",		"sdiff",		REPLY_MULTI_BULK},
+	{STRATEGY_AUTO,	"sinterstore",	"sinterstore",	REPLY_INT},
+	{STRATEGY_AUTO,	"sunionstore",	"sunionstore",	REPLY_INT},
+	{STRATEGY_AUTO,	"sdiffstore",	"sdiffstore",	REPLY_INT},
 
 	{STRATEGY_AUTO,		"lpush",		"qpush_front", 		REPLY_INT},
 	{STRATEGY_AUTO,		"rpush",		"qpush_back", 		REPLY_INT},
@@ -428,8 +434,8 @@ const std::vector<Bytes>* RedisLink::recv_req(Buffer *input){
 	return &recv_bytes;
 }
 
-int RedisLink::send_resp(Buffer *output, const std::vector<std::string> &resp){
-	if(resp.empty()){
+int RedisLink::send_resp(Buffer *output, const Response &resp){
+	if(resp.size() == 0){
 		return 0;
 	}
 
@@ -534,7 +540,7 @@ int RedisLink::send_resp(Buffer *output, const std::vector<std::string> &resp){
 			return 0;
 		}
 		char buf[32];
-		std::vector<std::string>::const_iterator req_it, resp_it;
+		std::vector<std::string>::const_iterator req_it;
 		if(req_desc->strategy == STRATEGY_MGET){
 			req_it = recv_string.begin() + 1;
 			snprintf(buf, sizeof(buf), "*%d\r\n", (int)recv_string.size() - 1);
@@ -544,38 +550,37 @@ int RedisLink::send_resp(Buffer *output, const std::vector<std::string> &resp){
 		}
 		output->append(buf);
 
-		resp_it = resp.begin() + 1;
+		int resp_idx = 1;
 
 		while(req_it != recv_string.end()){
 			const std::string &req_key = *req_it;
 			req_it ++;
-			if(resp_it == resp.end()){
+			if(resp_idx >= resp.size()){
 				output->append("$-1\r\n");
 				continue;
 			}
-			const std::string &resp_key = *resp_it;
-			//log_debug("%s %s", req_key.c_str(), resp_key.c_str());
-			if(req_key != resp_key){
+			Bytes resp_key = resp[resp_idx];
+			if(Bytes(req_key) != resp_key){
 				output->append("$-1\r\n");
 				// loop until we find value to the requested key
 				continue;
 			}
 
-			const std::string &val = *(resp_it + 1);
+			Bytes val = resp[resp_idx + 1];
 			char buf[32];
 			snprintf(buf, sizeof(buf), "$%d\r\n", (int)val.size());
 			output->append(buf);
 			output->append(val.data(), val.size());
 			output->append("\r\n");
 
-			resp_it += 2;
+			resp_idx += 2;
 		}
 
 		return 0;
 	}
 	if(req_desc->reply_type == REPLY_BULK){
 		if(resp.size() >= 2){
-			const std::string &val = resp[1];
+			Bytes val = resp[1];
 			char buf[32];
 			snprintf(buf, sizeof(buf), "$%d\r\n", (int)val.size());
 			output->append(buf);
@@ -589,7 +594,7 @@ int RedisLink::send_resp(Buffer *output, const std::vector<std::string> &resp){
 
 	if(req_desc->reply_type == REPLY_INT){
 		if(resp.size() >= 2){
-			const std::string &val = resp[1];
+			Bytes val = resp[1];
 			output->append(":");
 			output->append(val.data(), val.size());
 			output->append("\r\n");
@@ -621,7 +626,7 @@ int RedisLink::send_resp(Buffer *output, const std::vector<std::string> &resp){
 			output->append(buf);
 		}
 		for(int i=1; i<resp.size(); i++){
-			const std::string &val = resp[i];
+			Bytes val = resp[i];
 			char buf[32];
 			snprintf(buf, sizeof(buf), "$%d\r\n", (int)val.size());
 			output->append(buf);
@@ -641,71 +646,89 @@ int RedisLink::send_resp(Buffer *output, const std::vector<std::string> &resp){
 int RedisLink::parse_req(Buffer *input){
 	recv_bytes.clear();
 
-	int parsed = 0;
 	int size = input->size();
-	char *ptr = input->data();
+	char *data = input->data();
 
-	// ignore leading empty lines
-	while(size > 0 && (ptr[0] == '\n' || ptr[0] == '\r')){
-		ptr ++;
-		size --;
-		parsed ++;
-	}
-	//dump(ptr, size);
-
-	if(ptr[0] != '*'){
-		return -1;
+	if(parse_args == 0){
+		// ignore leading empty lines
+		while(parse_off < size && (data[parse_off] == '\n' || data[parse_off] == '\r')){
+			parse_off ++;
+		}
+		if(parse_off == size){
+			return 0;
+		}
+		if(data[parse_off] != '*'){
+			goto bad;
+		}
 	}
+	//dump(data + parse_off, size - parse_off);
 
-	int num_args = 0;
+	// continue where the last call stopped
+	char *ptr;
+	ptr = data + parse_off;
+	size -= parse_off;
 	while(size > 0){
 		char *lf = (char *)memchr(ptr, '\n', size);
 		if(lf == NULL){
 			break;
 		}
 		lf += 1;
-		size -= (lf - ptr);
-		parsed += (lf - ptr);
+		int line_len = lf - ptr;
 
+		errno = 0;
 		int len = (int)strtol(ptr + 1, NULL, 10); // ptr + 1: skip '$' or '*'
-		if(errno == EINVAL){
-			return -1;
-		}
-		ptr = lf;
-		if(len < 0){
-			return -1;
+		if(errno == EINVAL || len < 0){
+			goto bad;
 		}
-		if(num_args == 0){
+		if(parse_args == 0){
 			if(len <= 0){
-				return -1;
+				goto bad;
 			}
-			num_args = len;
+			parse_args = len;
+			ptr = lf;
+			size -= line_len;
+			parse_off += line_len;
 			continue;
 		}
 
-		if(len > size - 1){
+		// the arg is taken once its terminator is in too, CRLF or LF
+		int left = size - line_len - len;
+		if(left < 1){
 			break;
 		}
+		int tail_len = 1;
+		if(lf[len] == '\r'){
+			if(left < 2){
+				break;
+			}
+			if(lf[len + 1] == '\n'){
+				tail_len = 2;
+			}
+		}
 
-		recv_bytes.push_back(Bytes(ptr, len));
+		parse_fields.push_back(std::make_pair(parse_off + line_len, len));
 
-		ptr += len + 1;
-		size -= len + 1;
-		parsed += len + 1;
-		// compatiabl with both CRLF and LF
-		if(size > 0 && *ptr == '\n'){
-			ptr += 1;
-			size -= 1;
-			parsed += 1;
-		}
+		ptr = lf + len + tail_len;
+		size -= line_len + len + tail_len;
+		parse_off += line_len + len + tail_len;
 
-		num_args --;
-		if(num_args == 0){
-			input->decr(parsed);
+		parse_args --;
+		if(parse_args == 0){
+			for(size_t i = 0; i < parse_fields.size(); i++){
+				recv_bytes.push_back(Bytes(data + parse_fields[i].first, parse_fields[i].second));
+			}
+			input->decr(parse_off);
+			parse_off = 0;
+			parse_fields.clear();
 			return 1;
 		}
 	}
 
-	recv_bytes.clear();
 	return 0;
+
+bad:
+	parse_off = 0;
+	parse_args = 0;
+	parse_fields.clear();
+	return -1;
 }
@@ -8,7 +8,9 @@ found in the LICENSE file.
 
 #include <vector>
 #include <string>
+#include <utility>
 #include "../util/bytes.h"
+#include "resp.h"
 
 struct RedisRequestDesc
 {
@@ -26,16 +28,25 @@ private:
 
 	std::vector<Bytes> recv_bytes;
 	std::vector<std::string> recv_string;
+
+	// state of a request received in pieces: bytes of input parsed,
+	// args still to come, and (offset, size) of the args parsed
+	int parse_off;
+	int parse_args;
+	std::vector<std::pair<int, int> > parse_fields;
+
 	int parse_req(Buffer *input);
 	int convert_req();
 
 public:
 	RedisLink(){
 		req_desc = NULL;
+		parse_off = 0;
+		parse_args = 0;
 	}
 
 	const std::vector<Bytes>* recv_req(Buffer *input);
-	int send_resp(Buffer *output, const std::vector<std::string> &resp);
+	int send_resp(Buffer *output, const Response &resp);
 };
 
 #endif
@@ -46,6 +46,9 @@ void ProcMap::set_proc(const std::string &c, const char *sflags, proc_t proc){
 			case 't':
 				cmd->flags |= Command::FLAG_THREAD;
 				break;
+			case 'p': // a cheap point read, an io thread may run it itself
+				cmd->flags |= Command::FLAG_POINT;
+				break;
 		}
 	}
 }
@@ -9,9 +9,11 @@ found in the LICENSE file.
 #include <vector>
 #include "resp.h"
 #include "../util/bytes.h"
+#include "../util/hash_map.h"
 
 class Link;
 class NetworkServer;
+template <class T> class SelectableQueue;
 
 #define PROC_OK			0
 #define PROC_ERROR		-1
@@ -28,6 +30,7 @@ struct Command{
 	static const int FLAG_WRITE		= (1 << 1);
 	static const int FLAG_BACKEND	= (1 << 2);
 	static const int FLAG_THREAD	= (1 << 3);
+	static const int FLAG_POINT		= (1 << 4);
 
 	std::string name;
 	int flags;
@@ -50,6 +53,7 @@ struct ProcJob{
 	NetworkServer *serv;
 	Link *link;
 	Command *cmd;
+	SelectableQueue<ProcJob> *done;    /* where a worker returns the job, NULL: to its pool */
 	double stime;
 	double time_wait;
 	double time_proc;
@@ -59,6 +63,7 @@ struct ProcJob{
 		serv = NULL;
 		link = NULL;
 		cmd = NULL;
+		done = NULL;
 		stime = 0;
 		time_wait = 0;
 		time_proc = 0;
@@ -82,19 +87,7 @@ struct BytesHash{
 };
 
 
-#define GCC_VERSION (__GNUC__ * 100 + __GNUC_MINOR__)
-#if GCC_VERSION >= 403
-	#include <tr1/unordered_map>
-	typedef std::tr1::unordered_map<Bytes, Command *, BytesHash, BytesEqual> proc_map_t;
-#else
-	#ifdef NEW_MAC
-		#include <unordered_map>
-		typedef std::unordered_map<Bytes, Command *, BytesHash, BytesEqual> proc_map_t;
-	#else
-		#include <ext/hash_map>
-		typedef __gnu_cxx::hash_map<Bytes, Command *, BytesHash, BytesEqual> proc_map_t;
-	#endif
-#endif
+typedef HASH_MAP<Bytes, Command *, BytesHash, BytesEqual> proc_map_t;
 
 
 class ProcMap
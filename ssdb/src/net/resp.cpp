@@ -7,15 +7,36 @@ found in the LICENSE file.
 #include <stdio.h>
 
 int Response::size() const{
-	return (int)resp.size();
+	return (int)items.size();
 }
 
 void Response::clear() {
-	resp.clear();
+	buf.clear();
+	items.clear();
 }
 
-void Response::push_back(const std::string &s){
-	resp.push_back(s);
+Bytes Response::operator[](int i) const{
+	return Bytes(buf.data() + items[i].off, items[i].len);
+}
+
+void Response::push_back(const Bytes &s){
+	// the length line, written backwards, snprintf is slow for tiny elements
+	char len[16];
+	char *p = len + sizeof(len);
+	*--p = '\n';
+	int n = s.size();
+	do{
+		*--p = '0' + n % 10;
+		n /= 10;
+	}while(n > 0);
+	buf.append(p, len + sizeof(len) - p);
+
+	Item item;
+	item.off = (int)buf.size();
+	item.len = s.size();
+	items.push_back(item);
+	buf.append(s.data(), s.size());
+	buf.push_back('\n');
 }
 
 void Response::add(int s){
@@ -23,86 +44,89 @@ void Response::add(int s){
 }
 
 void Response::add(int64_t s){
-	char buf[20];
-	sprintf(buf, "%" PRId64 "", s);
-	resp.push_back(buf);
+	char tmp[24];
+	int len = snprintf(tmp, sizeof(tmp), "%" PRId64 "", s);
+	push_back(Bytes(tmp, len));
 }
 
 void Response::add(uint64_t s){
-	char buf[20];
-	sprintf(buf, "%" PRIu64 "", s);
-	resp.push_back(buf);
+	char tmp[24];
+	int len = snprintf(tmp, sizeof(tmp), "%" PRIu64 "", s);
+	push_back(Bytes(tmp, len));
 }
 
 void Response::add(double s){
-	char buf[30];
-	snprintf(buf, sizeof(buf), "%f", s);
-	resp.push_back(buf);
+	char tmp[30];
+	int len = snprintf(tmp, sizeof(tmp), "%f", s);
+	if(len >= (int)sizeof(tmp)){
+		len = sizeof(tmp) - 1;
+	}
+	push_back(Bytes(tmp, len));
 }
 
-void Response::add(const std::string &s){
-	resp.push_back(s);
+void Response::add(const Bytes &s){
+	push_back(s);
 }
 
 void Response::reply_status(int status, const char *errmsg){
 	if(status == -1){
-		resp.push_back("error");
+		push_back("error");
 		if(errmsg){
-			resp.push_back(errmsg);
+			push_back(errmsg);
 		}
 	}else{
-		resp.push_back("ok");
+		push_back("ok");
 	}
 }
 
 void Response::reply_bool(int status, const char *errmsg){
 	if(status == -1){
-		resp.push_back("error");
+		push_back("error");
 		if(errmsg){
-			resp.push_back(errmsg);
+			push_back(errmsg);
 		}
 	}else if(status == 0){
-		resp.push_back("ok");
-		resp.push_back("0");
+		push_back("ok");
+		push_back("0");
 	}else{
-		resp.push_back("ok");
-		resp.push_back("1");
+		push_back("ok");
+		push_back("1");
 	}
 }
 
 void Response::reply_int(int status, int64_t val){
 	if(status == -1){
-		resp.push_back("error");
+		push_back("error");
 	}else{
-		resp.push_back("ok");
+		push_back("ok");
 		this->add(val);
 	}
 }
 
 void Response::reply_get(int status, const std::string *val, const char *errmsg){
 	if(status == -1){
-		resp.push_back("error");
+		push_back("error");
 	}else if(status == 0){
-		resp.push_back("not_found");
+		push_back("not_found");
 	}else{
-		resp.push_back("ok");
+		push_back("ok");
 		if(val){
-			resp.push_back(*val);
+			push_back(*val);
 		}
 		return;
 	}
 	if(errmsg){
-		resp.push_back(errmsg);
+		push_back(errmsg);
 	}
 }
 
 void Response::reply_list(int status, const std::vector<std::string> &list){
 	if(status == -1){
-		resp.push_back("error");
+		push_back("error");
 	}else{
-		resp.push_back("ok");
+		push_back("ok");
 		for(int i=0; i<list.size(); i++){
-			resp.push_back(list[i]);
+			push_back(list[i]);
 		}
 	}
 }
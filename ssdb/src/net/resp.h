@@ -10,20 +10,32 @@ found in the LICENSE file.
 #include <inttypes.h>
 #include <string>
 #include <vector>
+#include "../util/bytes.h"
 
+/**
+ * The elements of a response are serialized one after another into a
+ * single buffer as they are added, in the SSDB framing "len\ndata\n", so
+ * Link::send() copies the whole response into the output with one append.
+ * The offsets kept on the side let the Redis framing read the elements.
+ **/
 class Response
 {
 public:
-	std::vector<std::string> resp;
-
 	int size() const;
 	void clear();
-	void push_back(const std::string &s);
+	// the i-th element, valid until the next add
+	Bytes operator[](int i) const;
+	// all elements in SSDB framing, without the ending '\n'
+	const std::string& packed() const{
+		return buf;
+	}
+
+	void push_back(const Bytes &s);
 	void add(int s);
 	void add(int64_t s);
 	void add(uint64_t s);
 	void add(double s);
-	void add(const std::string &s);
+	void add(const Bytes &s);
 
 	void reply_status(int status, const char *errmsg=NULL);
 	void reply_bool(int status, const char *errmsg=NULL);
@@ -31,6 +43,14 @@ public:
 	// the same as Redis.REPLY_BULK
 	void reply_get(int status, const std::string *val=NULL, const char *errmsg=NULL);
 	void reply_list(int status, const std::vector<std::string> &list);
+
+private:
+	struct Item{
+		int off;   /* where the data of the element starts in buf */
+		int len;
+	};
+	std::string buf;
+	std::vector<Item> items;
 };
 
 #endif
@@ -9,8 +9,12 @@ found in the LICENSE file.
 #include "../util/config.h"
 #include "../util/log.h"
 #include "../util/ip_filter.h"
+#include "../util/slot.h"
+#include "../util/atomic.h"
 #include "link.h"
+#include "stream.h"
 #include <vector>
+#include <unistd.h>
 
 static DEF_PROC(ping);
 static DEF_PROC(info);
@@ -19,7 +23,11 @@ static DEF_PROC(auth);
 #define TICK_INTERVAL          100 // ms
 #define STATUS_REPORT_TICKS    (300 * 1000/TICK_INTERVAL) // second
 static const int READER_THREADS = 10;
-static const int WRITER_THREADS = 1;  // 必须为1, 因为某些写操作依赖单线程
+static const int WRITER_THREADS = 1;
+static const int MAX_WRITER_THREADS = 64;
+static const int MAX_IO_THREADS = 64;
+static const int STREAM_THRESHOLD = 10000;
+static const int STREAM_CHUNK_SIZE = 64 * 1024;
 
 volatile bool quit = false;
 volatile uint32_t g_ticks = 0;
@@ -38,12 +46,27 @@ void signal_handler(int sig){
 	}
 }
 
-int NetworkServer::clients_paused = 0;
-int64_t NetworkServer::clients_pause_end_time = 0;
+volatile int NetworkServer::clients_paused = 0;
+volatile int64_t NetworkServer::clients_pause_end_time = 0;
+
+void NetworkServer::pause_clients(int64_t ms){
+	__sync_lock_test_and_set(&clients_pause_end_time, time_ms() + ms);
+	__sync_lock_test_and_set(&clients_paused, 1);
+}
+
+/* the flag stays set, every io thread has to find its own blocked links */
+bool NetworkServer::clients_pause_over(){
+	if(__sync_fetch_and_add(&clients_paused, 0) == 0){
+		return true;
+	}
+	return __sync_fetch_and_add(&clients_pause_end_time, 0) < time_ms();
+}
 
 NetworkServer::NetworkServer(){
 	num_readers = READER_THREADS;
 	num_writers = WRITER_THREADS;
+	num_io_threads = 1;
+	stream_threshold = STREAM_THRESHOLD;
 
 	tick_interval = TICK_INTERVAL;
 	status_report_ticks = STATUS_REPORT_TICKS;
@@ -84,10 +107,18 @@ NetworkServer::~NetworkServer(){
 	delete fdes;
 	delete ip_filter;
 
-	writer->stop();
-	delete writer;
+	for(size_t i=0; i<writers.size(); i++){
+		writers[i]->stop();
+		delete writers[i];
+	}
 	reader->stop();
 	delete reader;
+	for(size_t i=0; i<reactors.size(); i++){
+		delete reactors[i]->fdes;
+		delete reactors[i]->links;
+		delete reactors[i]->results;
+		delete reactors[i];
+	}
 }
 
 NetworkServer* NetworkServer::init(const char *conf_file, int num_readers, int num_writers){
@@ -126,7 +157,34 @@ NetworkServer* NetworkServer::init(const Config &conf, int num_readers, int num_
 	}
 	if(num_writers >= 0){
 		serv->num_writers = num_writers;
+	}else if(conf.get_num("server.writer_threads") > 0){
+		serv->num_writers = conf.get_num("server.writer_threads");
+	}
+	if(serv->num_writers < 1){
+		serv->num_writers = 1;
+	}
+	if(serv->num_writers > MAX_WRITER_THREADS){
+		serv->num_writers = MAX_WRITER_THREADS;
+	}
+	log_info("writer_threads: %d", serv->num_writers);
+	if(conf.get_num("server.io_threads") > 1){
+		serv->num_io_threads = conf.get_num("server.io_threads");
+		if(serv->num_io_threads > MAX_IO_THREADS){
+			serv->num_io_threads = MAX_IO_THREADS;
+		}
+		// io threads only pay off on cores of their own, sharing one they
+		// just add thread switches to every write handed to a writer
+		int ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if(ncpu > 0 && serv->num_io_threads > ncpu){
+			log_warn("io_threads: %d, but only %d cpus online", serv->num_io_threads, ncpu);
+			serv->num_io_threads = ncpu;
+		}
+		log_info("io_threads: %d", serv->num_io_threads);
+	}
+	if(conf.get("server.stream_threshold") != NULL){
+		serv->stream_threshold = conf.get_num("server.stream_threshold");
 	}
+	log_info("stream_threshold: %d", serv->stream_threshold);
 	// init ip_filter
 	{
 		Config *cc = (Config *)conf.get("server");
@@ -185,8 +243,16 @@ NetworkServer* NetworkServer::init(const Config &conf, int num_readers, int num_
 }
 
 void NetworkServer::serve(){
-	writer = new ProcWorkerPool("writer");
-	writer->start(num_writers);
+	/*
+	 * Each writer is a single thread, and all keys of one slot go to the
+	 * same writer, so writes of a key (and multi-key writes, which must
+	 * stay in one slot) are still executed in the order they arrive.
+	 */
+	for(int i=0; i<num_writers; i++){
+		ProcWorkerPool *writer = new ProcWorkerPool("writer");
+		writer->start(1);
+		writers.push_back(writer);
+	}
 	reader = new ProcWorkerPool("reader");
 	reader->start(num_readers);
 
@@ -197,15 +263,86 @@ void NetworkServer::serve(){
 		exit(-1);
 	}
 
+	if(num_io_threads <= 1){
+		Reactor reactor;
+		reactor.serv = this;
+		reactor.fdes = fdes;
+		reactor.links = NULL;
+		reactor.results = NULL;
+		fdes->set(serv_link->fd(), FDEVENT_IN, 0, serv_link);
+		fdes->set(this->reader->fd(), FDEVENT_IN, 0, this->reader);
+		for(size_t i=0; i<writers.size(); i++){
+			fdes->set(this->writers[i]->fd(), FDEVENT_IN, 0, this->writers[i]);
+		}
+		loop(&reactor);
+		return;
+	}
+
+	for(int i=0; i<num_io_threads; i++){
+		Reactor *reactor = new Reactor();
+		reactor->serv = this;
+		reactor->fdes = new Fdevents();
+		reactor->links = new SelectableQueue<Link *>();
+		reactor->results = new SelectableQueue<ProcJob>();
+		err = pthread_create(&reactor->tid, NULL, &NetworkServer::_reactor_thread, reactor);
+		if(err != 0){
+			log_fatal("can't start io thread: %s", strerror(err));
+			exit(-1);
+		}
+		reactors.push_back(reactor);
+	}
+
+	// the main thread only accepts, and deals the links out in turn
+	const Fdevents::events_t *events;
+	size_t next = 0;
+	fdes->set(serv_link->fd(), FDEVENT_IN, 0, serv_link);
+	while(!quit){
+		events = fdes->wait(50);
+		if(events == NULL){
+			log_fatal("events.wait error: %s", strerror(errno));
+			break;
+		}
+		for(int i=0; i<(int)events->size(); i++){
+			if(events->at(i)->data.ptr != serv_link){
+				continue;
+			}
+			Link *link = accept_link();
+			if(link){
+				incr_links(1);
+				log_debug("new link from %s:%d, fd: %d, links: %d",
+					link->remote_ip, link->remote_port, link->fd(), this->link_count);
+				reactors[next++ % reactors.size()]->links->push(link);
+			}
+		}
+	}
+	for(size_t i=0; i<reactors.size(); i++){
+		pthread_join(reactors[i]->tid, NULL);
+	}
+}
+
+void* NetworkServer::_reactor_thread(void *arg){
+	SET_PROC_NAME("io_thread");
+	Reactor *reactor = (Reactor *)arg;
+	reactor->serv->loop(reactor);
+	return (void *)NULL;
+}
+
+void NetworkServer::loop(Reactor *reactor){
+	Fdevents *fdes = reactor->fdes;
 	link_dict_t ready_dict;
 	link_dict_t tmp_dict;
 	link_dict_t blocked_dict;
 	link_dict_t::iterator it;
 	const Fdevents::events_t *events;
+	std::vector<ProcJob> jobs;
+	std::vector<Link *> links;
 
-	fdes->set(serv_link->fd(), FDEVENT_IN, 0, serv_link);
-	fdes->set(this->reader->fd(), FDEVENT_IN, 0, this->reader);
-	fdes->set(this->writer->fd(), FDEVENT_IN, 0, this->writer);
+	if(reactor->links){
+		fdes->set(reactor->links->fd(), FDEVENT_IN, 0, reactor->links);
+	}
+	if(reactor->results){
+		fdes->set(reactor->results->fd(), FDEVENT_IN, 0, reactor->results);
+	}
 
 	uint32_t last_ticks = g_ticks;
 
@@ -235,44 +372,51 @@ void NetworkServer::serve(){
 			if(fde->data.ptr == serv_link){
 				Link *link = accept_link();
 				if(link){
-					this->link_count ++;
+					incr_links(1);
 					log_debug("new link from %s:%d, fd: %d, links: %d",
 						link->remote_ip, link->remote_port, link->fd(), this->link_count);
 					fdes->set(link->fd(), FDEVENT_IN, 1, link);
 				}
-			}else if(fde->data.ptr == this->reader || fde->data.ptr == this->writer){
-				ProcWorkerPool *worker = (ProcWorkerPool *)fde->data.ptr;
-				ProcJob job;
-				if(worker->pop(&job) == 0){
-					log_fatal("reading result from workers error!");
-					exit(0);
+			}else if(reactor->links && fde->data.ptr == reactor->links){
+				links.clear();
+				reactor->links->pop(&links);
+				for(size_t j=0; j<links.size(); j++){
+					fdes->set(links[j]->fd(), FDEVENT_IN, 1, links[j]);
 				}
-				if(proc_result(&job, &ready_dict) == PROC_ERROR){
-					//
+			}else if(reactor->results && fde->data.ptr == reactor->results){
+				// everything done by the workers since the last wakeup
+				jobs.clear();
+				reactor->results->pop(&jobs);
+				for(size_t j=0; j<jobs.size(); j++){
+					proc_result(&jobs[j], &ready_dict, fdes);
+				}
+			}else if(fde->data.ptr == this->reader || is_writer(fde->data.ptr)){
+				ProcWorkerPool *worker = (ProcWorkerPool *)fde->data.ptr;
+				jobs.clear();
+				worker->pop(&jobs);
+				for(size_t j=0; j<jobs.size(); j++){
+					proc_result(&jobs[j], &ready_dict, fdes);
 				}
 			}else{
-				proc_client_event(fde, &ready_dict);
+				proc_client_event(fde, &ready_dict, fdes);
 			}
 		}
 
 		/* if clients paused, add specified link into blocked_list and disable parsing request */
-		if(NetworkServer::clients_paused) {
-			if(NetworkServer::clients_pause_end_time < time_ms()) {
-				NetworkServer::clients_paused = 0;
-				NetworkServer::clients_pause_end_time = 0;
-				ready_dict.insert(blocked_dict.begin(), blocked_dict.end());
-				blocked_dict.clear();
-			} else {
-				blocked_dict.insert(ready_dict.begin(), ready_dict.end());
-				ready_dict.clear();
-				continue;
-			}
+		if(!NetworkServer::clients_pause_over()) {
+			blocked_dict.insert(ready_dict.begin(), ready_dict.end());
+			ready_dict.clear();
+			continue;
+		}
+		if(!blocked_dict.empty()) {
+			ready_dict.insert(blocked_dict.begin(), blocked_dict.end());
+			blocked_dict.clear();
 		}
 
 		for(it = ready_dict.begin(); it != ready_dict.end(); it ++){
 			Link *link = it->second;
 			if(link->error()){
-				this->link_count --;
+				incr_links(-1);
 				fdes->del(link->fd());
 				delete link;
 				continue;
@@ -281,7 +425,7 @@ void NetworkServer::serve(){
 			const Request *req = link->recv();
 			if(req == NULL){
 				log_warn("fd: %d, link parse error, delete link", link->fd());
-				this->link_count --;
+				incr_links(-1);
 				fdes->del(link->fd());
 				delete link;
 				continue;
@@ -295,6 +439,7 @@ void NetworkServer::serve(){
 
 			ProcJob job;
 			job.link = link;
+			job.done = reactor->results;
 			this->proc(&job);
 			if(job.result == PROC_THREAD){
 				fdes->del(link->fd());
@@ -302,25 +447,43 @@ void NetworkServer::serve(){
 			}
 			if(job.result == PROC_BACKEND){
 				fdes->del(link->fd());
-				this->link_count --;
+				incr_links(-1);
 				continue;
 			}
 
-			if(proc_result(&job, &tmp_dict) == PROC_ERROR){
+			if(proc_result(&job, &tmp_dict, fdes) == PROC_ERROR){
 				//
 			}
 		} // end foreach ready link
 	}
 }
 
+void NetworkServer::incr_links(int n){
+	Locking l(&link_mutex);
+	this->link_count += n;
+}
+
+bool NetworkServer::is_writer(const void *ptr) const {
+	for(size_t i=0; i<writers.size(); i++){
+		if(writers[i] == ptr){
+			return true;
+		}
+	}
+	return false;
+}
+
 void NetworkServer::pause() {
-	writer->pause();
+	for(size_t i=0; i<writers.size(); i++){
+		writers[i]->pause();
+	}
 	reader->pause();
 	proc_mutex.Lock(WRITE_LOCK);
 }
 
 void NetworkServer::proceed() {
-	writer->proceed();
+	for(size_t i=0; i<writers.size(); i++){
+		writers[i]->proceed();
+	}
 	reader->proceed();
 	proc_mutex.Unlock(WRITE_LOCK);
 }
@@ -344,13 +507,14 @@ Link* NetworkServer::accept_link(){
 	return link;
 }
 
-int NetworkServer::proc_result(ProcJob *job, link_dict_t *ready_dict){
+int NetworkServer::proc_result(ProcJob *job, link_dict_t *ready_dict, Fdevents *fdes){
 	Link *link = job->link;
 	int len;
 
 	if(job->cmd){
-		total_calls ++;
-		job->cmd->calls ++;
+		atomic_add_uint64(&total_calls, 1);
+		atomic_add_uint64(&job->cmd->calls, 1);
+		// timings of io threads may race, they are only statistics
 		job->cmd->time_wait += job->time_wait;
 		job->cmd->time_proc += job->time_proc;
 	}
@@ -359,6 +523,11 @@ int NetworkServer::proc_result(ProcJob *job, link_dict_t *ready_dict){
 		goto proc_err;
 	}
 
+	if(link->stream && stream_reply(link, ready_dict, fdes) == -1){
+		log_info("fd: %d, stream error, delete link", link->fd());
+		goto proc_err;
+	}
+
 	len = link->write();
 	//log_debug("write: %d", len);
 	if(len < 0){
@@ -366,10 +535,13 @@ int NetworkServer::proc_result(ProcJob *job, link_dict_t *ready_dict){
 		goto proc_err;
 	}
 
-	if(!link->output->empty()){
+	if(!link->output->empty() || link->stream){
 		fdes->set(link->fd(), FDEVENT_OUT, 1, link);
 	}
-	if(link->input->empty()){
+	if(link->stream){
+		// the requests after it wait for the whole reply
+		fdes->clr(link->fd(), FDEVENT_IN);
+	}else if(link->input->empty()){
 		fdes->set(link->fd(), FDEVENT_IN, 1, link);
 	}else{
 		fdes->clr(link->fd(), FDEVENT_IN);
@@ -378,7 +550,7 @@ int NetworkServer::proc_result(ProcJob *job, link_dict_t *ready_dict){
 	return PROC_OK;
 
 proc_err:
-	this->link_count --;
+	incr_links(-1);
 	fdes->del(link->fd());
 	delete link;
 	return PROC_ERROR;
@@ -407,7 +579,7 @@ A link is in either one of these places:
 	2. async worker queue
 So it safe to delete link when processing ready list and async worker result.
 */
-int NetworkServer::proc_client_event(const Fdevent *fde, link_dict_t *ready_dict){
+int NetworkServer::proc_client_event(const Fdevent *fde, link_dict_t *ready_dict, Fdevents *fdes){
 	Link *link = (Link *)fde->data.ptr;
 	if(fde->events & FDEVENT_IN){
 		ready_dict->insert(std::make_pair(link->fd(), link));
@@ -426,19 +598,60 @@ int NetworkServer::proc_client_event(const Fdevent *fde, link_dict_t *ready_dict
 		if(link->error()){
 			return 0;
 		}
+		if(link->stream && stream_reply(link, ready_dict, fdes) == -1){
+			log_info("fd: %d, stream error, delete link", link->fd());
+			link->mark_error();
+			// not reading while streaming, so it is closed from the ready list
+			ready_dict->insert(std::make_pair(link->fd(), link));
+			return 0;
+		}
 		int len = link->write();
 		if(len <= 0){
 			log_debug("fd: %d, write: %d, delete link", link->fd(), len);
 			link->mark_error();
+			if(link->stream){
+				ready_dict->insert(std::make_pair(link->fd(), link));
+			}
 			return 0;
 		}
-		if(link->output->empty()){
+		if(link->output->empty() && !link->stream){
 			fdes->clr(link->fd(), FDEVENT_OUT);
 		}
 	}
 	return 0;
 }
 
+/*
+ * Top up the output of a link with the next chunks of its stream, and once
+ * the reply is complete go on with the requests behind it.
+ */
+int NetworkServer::stream_reply(Link *link, link_dict_t *ready_dict, Fdevents *fdes){
+	while(link->stream && link->output->size() < STREAM_CHUNK_SIZE){
+		Response resp;
+		int ret;
+		{
+			ReadLockGuard<RWLock> guard(proc_mutex);
+			ret = link->stream->next(&resp, STREAM_CHUNK_SIZE);
+		}
+		link->output->append(resp.packed());
+		if(ret == 1){
+			continue;
+		}
+		delete link->stream;
+		link->stream = NULL;
+		if(ret == -1){
+			return -1;
+		}
+		link->output->append('\n');
+
+		fdes->set(link->fd(), FDEVENT_IN, 1, link);
+		if(!link->input->empty()){
+			ready_dict->insert(std::make_pair(link->fd(), link));
+		}
+	}
+	return 0;
+}
+
 void NetworkServer::proc(ProcJob *job){
 	job->serv = this;
 	job->result = PROC_OK;
@@ -466,30 +679,47 @@ void NetworkServer::proc(ProcJob *job){
 		if(cmd->flags & Command::FLAG_THREAD){
 			if(cmd->flags & Command::FLAG_WRITE){
 				job->result = PROC_THREAD;
-				writer->push(*job);
-			}else{
+				int idx = 0;
+				if(writers.size() > 1 && req->size() > 1){
+					const Bytes &key = req->at(1);
+					idx = key_hash_slot(key.data(), key.size(), CLUSTER_SLOTS) % writers.size();
+				}
+				writers[idx]->push(*job);
+				return;
+			}
+			// an io thread runs the point reads itself, scans and admin
+			// commands would stall every link it serves
+			if(!job->done || !(cmd->flags & Command::FLAG_POINT)){
 				job->result = PROC_THREAD;
 				reader->push(*job);
+				return;
 			}
-			return;
 		}
 
 		proc_t p = cmd->proc;
 
-		ReadLockGuard<RWLock> guard(proc_mutex);
-		job->time_wait = 1000 * (millitime() - job->stime);
-		job->result = (*p)(this, job->link, *req, &resp);
+		if(cmd->flags & Command::FLAG_THREAD){
+			ReadLockGuard<RWLock> guard(proc_mutex);
+			job->time_wait = 1000 * (millitime() - job->stime);
+			job->result = (*p)(this, job->link, *req, &resp);
+		}else{
+			// slot, lock and pause commands were written for the single
+			// main thread, with several io threads they must not overlap
+			WriteLockGuard<RWLock> guard(proc_mutex);
+			job->time_wait = 1000 * (millitime() - job->stime);
+			job->result = (*p)(this, job->link, *req, &resp);
+		}
 		job->time_proc = 1000 * (millitime() - job->stime) - job->time_wait;
 	}while(0);
 
-	if(job->link->send(resp.resp) == -1){
+	if(job->link->send(resp) == -1){
 		job->result = PROC_ERROR;
 	}else{
 		if(log_level() >= Logger::LEVEL_DEBUG){
 			log_debug("w:%.3f,p:%.3f, req: %s, resp: %s",
 				job->time_wait, job->time_proc,
 				serialize_req(*req).c_str(),
-				serialize_req(resp.resp).c_str());
+				serialize_req(resp).c_str());
 		}
 	}
 }
@@ -9,6 +9,7 @@ found in the LICENSE file.
 #include "../include.h"
 #include <string>
 #include <map>
+#include <vector>
 
 #include "fde.h"
 #include "proc.h"
@@ -34,16 +35,39 @@ private:
 	IpFilter *ip_filter;
 	Fdevents *fdes;
 
+	/*
+	 * An io thread owns its links, it reads, runs the read commands and
+	 * writes the responses itself. Write commands still go to the writers,
+	 * which return the job to the io thread of its link.
+	 * With only one, the main thread is the io thread and does the accept,
+	 * the read commands go to the reader pool.
+	 */
+	struct Reactor{
+		NetworkServer *serv;
+		pthread_t tid;
+		Fdevents *fdes;
+		SelectableQueue<Link *> *links;     /* accepted by the main thread */
+		SelectableQueue<ProcJob> *results;  /* jobs done by the writers and readers */
+	};
+	std::vector<Reactor *> reactors;
+	int num_io_threads;
+	Mutex link_mutex;
+
 	Link* accept_link();
-	int proc_result(ProcJob *job, link_dict_t *ready_list);
-	int proc_client_event(const Fdevent *fde, link_dict_t *ready_list);
+	void loop(Reactor *reactor);
+	static void* _reactor_thread(void *arg);
+	void incr_links(int n);
+	int proc_result(ProcJob *job, link_dict_t *ready_list, Fdevents *fdes);
+	int proc_client_event(const Fdevent *fde, link_dict_t *ready_list, Fdevents *fdes);
 	static void* _ops_timer_thread(void *arg);
 
 	void proc(ProcJob *job);
+	bool is_writer(const void *ptr) const;
+	int stream_reply(Link *link, link_dict_t *ready_list, Fdevents *fdes);
 
 	int num_readers;
 	int num_writers;
-	ProcWorkerPool *writer;
+	std::vector<ProcWorkerPool *> writers;  /* one thread each, jobs routed by key slot */
 	ProcWorkerPool *reader;
 	RWLock proc_mutex;
 
@@ -58,10 +82,13 @@ public:
 	int link_count;
 	uint64_t ops;
 	uint64_t total_calls;
-	static int clients_paused;
-	static int64_t clients_pause_end_time;
+	static volatile int clients_paused;
+	static volatile int64_t clients_pause_end_time;
+	static void pause_clients(int64_t ms);
+	static bool clients_pause_over();
 	bool need_auth;
 	std::string password;
+	int stream_threshold;    /* replies of more elements are streamed, 0: never */
 
 	~NetworkServer();
 
@@ -0,0 +1,27 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+#ifndef NET_STREAM_H_
+#define NET_STREAM_H_
+
+#include "resp.h"
+
+/**
+ * The rest of a reply too large to be built at once. The proc sends the
+ * head of the reply and leaves a stream on the link, then the network
+ * loop asks for the next chunk of elements whenever the output of the
+ * link runs low, so the memory a reply takes is about one chunk and the
+ * first bytes go out right away. SSDB protocol only, a Redis reply
+ * needs the number of elements up front.
+ **/
+class Stream
+{
+public:
+	virtual ~Stream(){}
+	// add elements of about @bytes to @resp, 1: more to come, 0: done, -1: error
+	virtual int next(Response *resp, int bytes) = 0;
+};
+
+#endif
@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+/* feed large pipelined requests to Link::recv byte by byte and in chunks */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "link.h"
+#include "../include.h"
+#include "../util/strings.h"
+
+static std::string ssdb_field(const std::string &s){
+	return str((int)s.size()) + "\n" + s + "\n";
+}
+
+static std::string redis_field(const std::string &s){
+	return "$" + str((int)s.size()) + "\r\n" + s + "\r\n";
+}
+
+/* one multi_set of nkv pairs, nreq times */
+static std::string make_reqs(bool redis, int nkv, int vsize, int nreq){
+	std::string val(vsize, 'v');
+	std::string req;
+	if(redis){
+		req = "*" + str(1 + nkv * 2) + "\r\n" + redis_field("mset");
+	}else{
+		req = ssdb_field("multi_set");
+	}
+	for(int i = 0; i < nkv; i++){
+		std::string key = "key" + str(i);
+		req += redis ? redis_field(key) + redis_field(val) : ssdb_field(key) + ssdb_field(val);
+	}
+	if(!redis){
+		req += "\n";
+	}
+	std::string all;
+	for(int i = 0; i < nreq; i++){
+		all += req;
+	}
+	return all;
+}
+
+/* the parser before it kept state: scan the whole packet on every call */
+static int reparse_recv(Buffer *input, std::vector<Bytes> *out){
+	out->clear();
+	int parsed = 0;
+	int size = input->size();
+	char *head = input->data();
+	while(size > 0){
+		char *body = (char *)memchr(head, '\n', size);
+		if(body == NULL){
+			break;
+		}
+		body ++;
+		int head_len = body - head;
+		if(head_len == 1){
+			input->decr(parsed + head_len);
+			return 1;
+		}
+		int body_len = atoi(head);
+		size -= head_len + body_len;
+		if(size < 1){
+			break;
+		}
+		out->push_back(Bytes(body, body_len));
+		head += head_len + body_len + 1;
+		size -= 1;
+		parsed += head_len + body_len + 1;
+	}
+	out->clear();
+	return 0;
+}
+
+/* @return MB/s, -1 if a request was lost */
+static double feed(const std::string &data, int nreq, int nfield, int chunk, bool reparse){
+	Link *link = new Link();
+	std::vector<Bytes> out;
+	int got = 0;
+	double stime = millitime();
+	for(size_t off = 0; off < data.size(); off += chunk){
+		int n = std::min((int)(data.size() - off), chunk);
+		link->input->append(data.data() + off, n);
+		while(1){
+			int fields;
+			if(reparse){
+				if(reparse_recv(link->input, &out) != 1){
+					break;
+				}
+				fields = (int)out.size();
+			}else{
+				const std::vector<Bytes> *req = link->recv();
+				if(req == NULL){
+					delete link;
+					return -1;
+				}
+				if(req->empty()){
+					break;
+				}
+				fields = (int)req->size();
+			}
+			if(fields != nfield){
+				delete link;
+				return -1;
+			}
+			got ++;
+		}
+	}
+	double secs = millitime() - stime;
+	delete link;
+	if(got != nreq){
+		return -1;
+	}
+	return data.size() / (secs > 0 ? secs : 1e-6) / 1024 / 1024;
+}
+
+int main(int argc, char **argv){
+	int nkv = argc > 1 ? atoi(argv[1]) : 200;
+	int nreq = argc > 2 ? atoi(argv[2]) : 10;
+	int vsize = 100;
+
+	std::string ssdb = make_reqs(false, nkv, vsize, nreq);
+	std::string redis = make_reqs(true, nkv, vsize, nreq);
+	printf("%d pipelined multi_set of %d pairs, %d bytes ssdb, %d bytes redis\n",
+		nreq, nkv, (int)ssdb.size(), (int)redis.size());
+
+	printf("%-8s %14s %14s %14s\n", "chunk", "ssdb reparse", "ssdb", "redis");
+	int chunks[] = {1, 64, 1460, 64 * 1024};
+	for(size_t i = 0; i < sizeof(chunks)/sizeof(chunks[0]); i++){
+		int chunk = chunks[i];
+		double a = feed(ssdb, nreq, nkv * 2 + 1, chunk, true);
+		double b = feed(ssdb, nreq, nkv * 2 + 1, chunk, false);
+		double c = feed(redis, nreq, nkv * 2 + 1, chunk, false);
+		printf("%-8d %9.1f MB/s %9.1f MB/s %9.1f MB/s\n", chunk, a, b, c);
+	}
+	return 0;
+}
@@ -9,6 +9,9 @@ found in the LICENSE file.
 #include "../util/log.h"
 #include "../include.h"
 
+// a reply larger than this does not keep its buffer for the next job
+#define MAX_KEPT_RESP_SIZE (4 * 1024 * 1024)
+
 ProcWorker::ProcWorker(const std::string &name){
 	this->name = name;
 }
@@ -19,20 +22,28 @@ void ProcWorker::init(){
 
 int ProcWorker::proc(ProcJob *job){
 	const Request *req = job->link->last_recv();
-	Response resp;
+	resp.clear();
 
 	proc_t p = job->cmd->proc;
 	job->time_wait = 1000 * (millitime() - job->stime);
 	job->result = (*p)(job->serv, job->link, *req, &resp);
 	job->time_proc = 1000 * (millitime() - job->stime) - job->time_wait;
 
-	if(job->link->send(resp.resp) == -1){
+	if(job->link->send(resp) == -1){
 		job->result = PROC_ERROR;
 	}else{
 		log_debug("w:%.3f,p:%.3f, req: %s, resp: %s",
 			job->time_wait, job->time_proc,
 			serialize_req(*req).c_str(),
-			serialize_req(resp.resp).c_str());
+			serialize_req(resp).c_str());
+	}
+	if(resp.packed().capacity() > MAX_KEPT_RESP_SIZE){
+		resp = Response();
+	}
+	if(job->done){
+		// back to the io thread owning the link
+		job->done->push(*job);
+		return 1;
 	}
 	return 0;
 }
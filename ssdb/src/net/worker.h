@@ -16,7 +16,11 @@ public:
 	ProcWorker(const std::string &name);
 	~ProcWorker(){}
 	void init();
+	// 1: the job is passed back by itself, not through the pool
 	int proc(ProcJob *job);
+private:
+	// reused by every job of this worker
+	Response resp;
 };
 
 typedef WorkerPool<ProcWorker, ProcJob> ProcWorkerPool;
@@ -8,6 +8,35 @@ found in the LICENSE file.
 #include "net/proc.h"
 #include "net/server.h"
 
+/* hgetall of a big hash */
+class HashStream : public CollectionStream
+{
+public:
+	HashStream(SSDBServer *serv, const Bytes &key, uint64_t version)
+		: CollectionStream(serv, key, version){
+	}
+
+private:
+	std::string cursor;   /* the last field sent */
+
+	int read(Response *resp, int bytes){
+		HIterator *it = serv->ssdb->hscan(key, cursor, "", UINT64_MAX, version, snapshot);
+		it->return_val(false);
+		int ret = 0;
+		while(it->next()){
+			resp->push_back(it->field);
+			resp->push_back(it->raw_val());
+			if((int)resp->packed().size() >= bytes){
+				cursor = it->field;
+				ret = 1;
+				break;
+			}
+		}
+		delete it;
+		return ret;
+	}
+};
+
 int proc_hexists(NetworkServer *net, Link *link, const Request &req, Response *resp){
 	CHECK_NUM_PARAMS(3);
 	SSDBServer *serv = (SSDBServer *)net->data;
@@ -197,13 +226,13 @@ action:
 	}
 	Request::const_iterator it=req.begin() + 1;
 	const Bytes key = *it;
+	std::string val;
 	it ++;
 	for(; it!=req.end(); it+=1){
 		const Bytes &field = *it;
-		std::string val;
 		int ret = serv->ssdb->hget(key, field, &val, version);
 		if(ret == 1){
-			resp->push_back(field.String());
+			resp->push_back(field);
 			resp->push_back(val);
 		}
 	}
@@ -387,10 +416,15 @@ action:
 	if(!exists) {
 		return 0;
 	}
+	if(use_stream(net, link, serv->ssdb->hsize(req[1], version) * 2)){
+		link->stream = new HashStream(serv, req[1], version);
+		return 0;
+	}
 	HIterator *it = serv->ssdb->hscan(req[1], "", "", UINT_MAX, version);
+	it->return_val(false);
 	while(it->next()){
 		resp->push_back(it->field);
-		resp->push_back(it->val);
+		resp->push_back(it->raw_val());
 	}
 	delete it;
 	return 0;
@@ -419,9 +453,10 @@ action:
 	}
 	uint64_t limit = req[4].Uint64();
 	HIterator *it = serv->ssdb->hscan(req[1], req[2], req[3], limit, version);
+	it->return_val(false);
 	while(it->next()){
 		resp->push_back(it->field);
-		resp->push_back(it->val);
+		resp->push_back(it->raw_val());
 	}
 	delete it;
 	return 0;
@@ -450,9 +485,10 @@ action:
 	}
 	uint64_t limit = req[4].Uint64();
 	HIterator *it = serv->ssdb->hrscan(req[1], req[2], req[3], limit, version);
+	it->return_val(false);
 	while(it->next()){
 		resp->push_back(it->field);
-		resp->push_back(it->val);
+		resp->push_back(it->raw_val());
 	}
 	delete it;
 	return 0;
@@ -513,8 +549,9 @@ action:
 	}
 	uint64_t limit = req[4].Uint64();
 	HIterator *it = serv->ssdb->hscan(req[1], req[2], req[3], limit, version);
+	it->return_val(false);
 	while(it->next()){
-		resp->push_back(it->val);
+		resp->push_back(it->raw_val());
 	}
 	delete it;
 	return 0;
@@ -405,86 +405,6 @@ action:
 	return 0;
 }
 
-#define CHECK_CROSS_SLOT(req, resp, slot, step) \
-do{ \
-	slot = -1; \
-	for(Request::const_iterator it = req.begin()+1; it != req.end(); it += (step)) { \
-		int16_t s = KEY_HASH_SLOT((*it)); \
-		if(slot == -1) { \
-			slot = s; \
-		} else if (slot != s) { \
-			resp->clear(); \
-			resp->push_back("error"); \
-			resp->push_back("crossslot"); \
-			return 0; \
-		}\
-	}\
-} while(0)
-
-#define CHECK_MULTI_ASKING(serv, link, req, resp, slot, step) \
-do { \
-	int flag = 0; \
-	int ret = serv->ssdb_cluster->test_slot_importing(slot, &flag); \
-	if(ret != 0) { \
-		resp->clear(); \
-		resp->push_back("error"); \
-		resp->push_back("server get slot info failed"); \
-		log_warn("test slot importing failed");	\
-		return 0; \
-	} \
-	if(flag) { \
-		if(link->asking) { \
-			link->asking = false; \
-			for(Request::const_iterator it = req.begin()+1; it != req.end(); it += (step)) { \
-				uint64_t version; \
-				char op; \
-				int exists; \
-				CHECK_META((*it), op, version, exists); \
-				if(!exists) { \
-					resp->clear(); \
-					resp->push_back("error"); \
-					resp->push_back("tryagain"); \
-					return 0; \
-				} \
-			} \
-			break; \
-		} else { \
-			resp->clear(); \
-			resp->push_back("error"); \
-			resp->push_back("slot migrating"); \
-		}\
-		return 0;\
-	} \
-} while(0)
-
-#define CHECK_MULTI_ASK(serv, req, resp, slot, step) \
-do { \
-	if(migrating_slot == slot) { \
-		for(Request::const_iterator it = req.begin()+1; it != req.end(); it+= (step)) { \
-			CHECK_KEY(*it); \
-			KeyLock &key_lock = serv->ssdb_cluster->get_key_lock((*it).String()); \
-			if(key_lock.test_key((*it).String())) { \
-				resp->clear(); \
-				resp->push_back("error"); \
-				resp->push_back("tryagain"); \
-				return 0; \
-			} \
-			uint64_t version; \
-			char op; \
-			int exists; \
-			CHECK_META((*it), op, version, exists); \
-			if(!exists) { \
-				resp->clear(); \
-				resp->push_back("error"); \
-				resp->push_back("ask"); \
-				return 0; \
-			} \
-		} \
-		goto action; \
-	} \
-} while(0)
-
-
 int proc_multi_exists(NetworkServer *net, Link *link, const Request &req, Response *resp){
 	SSDBServer * serv = (SSDBServer *)net->data;
 	CHECK_NUM_PARAMS(2);
@@ -621,9 +541,8 @@ int proc_multi_get(NetworkServer *net, Link *link, const Request &req, Response
 	serv->ssdb->unlock_db();
 
 	int ret;
-	std::vector<Bytes> key_list;
-	std::vector<std::string> val_list;
 	std::vector<uint64_t> version_list;
+	std::string val;
 	for(Request::const_iterator it = req.begin()+1; it != req.end(); it++) {
 		const Bytes &key = *it;
 		int flag = 0;
@@ -689,24 +608,25 @@ int proc_multi_get(NetworkServer *net, Link *link, const Request &req, Response
 			}
 		}
 
-		key_list.push_back(*it);
 		version_list.push_back(version);
 	}
 
-	/* action */
-	ret = serv->ssdb->mget(key_list, &val_list, version_list, snapshot);
-	if (ret == 0) {
-		resp->clear();
-		resp->push_back("error");
-		resp->push_back("params error");
-		goto exception;
-	} else if (ret == -1) {
-		resp->clear();
-		resp->push_back("error");
-		resp->push_back("server inner error");
-		goto exception;
+	/* action, one value buffer for all the keys */
+	resp->push_back("ok");
+	for(size_t i = 0; i < version_list.size(); i++) {
+		const Bytes &key = req[i + 1];
+		ret = serv->ssdb->get(key, &val, version_list[i], snapshot);
+		if (ret == -1) {
+			resp->clear();
+			resp->push_back("error");
+			resp->push_back("server inner error");
+			goto exception;
+		}
+		if (ret == 1) {
+			resp->push_back(key);
+			resp->push_back(val);
+		}
 	}
-	resp->reply_list(0, val_list);
 
 exception:
 	serv->ssdb->release_snapshot(snapshot);
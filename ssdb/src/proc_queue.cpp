@@ -459,6 +459,29 @@ action:
 	return 0;
 }
 
+/* the items are appended to resp as they sit in db */
+static void reply_qslice(SSDBServer *serv, const Bytes &key, int64_t begin, int64_t end,
+		uint64_t version, int exists, Response *resp){
+	QIterator *it = NULL;
+	int ret = 0;
+	if(exists) {
+		ret = serv->ssdb->qslice(key, begin, end, version, &it);
+	}
+	if(ret == -1){
+		resp->reply_status(-1);
+		return;
+	}
+	resp->push_back("ok");
+	if(ret == 0){
+		return;
+	}
+	it->return_val(false);
+	while(it->next()){
+		resp->push_back(it->raw_val());
+	}
+	delete it;
+}
+
 int proc_qslice(NetworkServer *net, Link *link, const Request &req, Response *resp){
 	SSDBServer *serv = (SSDBServer *)net->data;
 	CHECK_NUM_PARAMS(4);
@@ -478,12 +501,7 @@ int proc_qslice(NetworkServer *net, Link *link, const Request &req, Response *re
 action:
 	int64_t begin = req[2].Int64();
 	int64_t end = req[3].Int64();
-	std::vector<std::string> list;
-	int ret = 0;
-	if(exists) {
-		ret = serv->ssdb->qslice(req[1], begin, end, version, &list);
-	}
-	resp->reply_list(ret, list);
+	reply_qslice(serv, req[1], begin, end, version, exists, resp);
 	return 0;
 }
 
@@ -512,12 +530,7 @@ action:
 	}else{
 		end = -1;
 	}
-	std::vector<std::string> list;
-	int ret = 0;
-	if(exists) {
-		ret = serv->ssdb->qslice(req[1], begin, end, version, &list);
-	}
-	resp->reply_list(ret, list);
+	reply_qslice(serv, req[1], begin, end, version, exists, resp);
 	return 0;
 }
 
@@ -5,10 +5,264 @@ found in the LICENSE file.
 */
 /* sset */
 #include <stdint.h>
+#include <algorithm>
 #include "serv.h"
 #include "net/proc.h"
 #include "net/server.h"
 
+/* smembers of a big set */
+class SetStream : public CollectionStream
+{
+public:
+	SetStream(SSDBServer *serv, const Bytes &key, uint64_t version)
+		: CollectionStream(serv, key, version){
+	}
+
+private:
+	std::string cursor;   /* the last member sent */
+
+	int read(Response *resp, int bytes){
+		SIterator *it = serv->ssdb->sscan(key, cursor, UINT64_MAX, version, snapshot);
+		int ret = 0;
+		while(it->next()){
+			resp->push_back(it->elem);
+			if((int)resp->packed().size() >= bytes){
+				cursor = it->elem;
+				ret = 1;
+				break;
+			}
+		}
+		delete it;
+		return ret;
+	}
+};
+
+#define SET_PROBE_RATIO   32     /* probe a set this much bigger than the one scanned */
+#define SET_STORE_BATCH   1000   /* members written to the destination at once */
+
+/**
+ * Members of the intersection, union or difference of sets of one slot,
+ * merged in (bytewise) order from their iterators. The first set of a
+ * difference and the smallest of an intersection drive, a set much bigger
+ * than the driver is probed with sget() instead of being scanned. All
+ * reads go to one snapshot, owned by the merge.
+ **/
+class SetMerge
+{
+public:
+	enum{
+		INTER = 0,
+		UNION,
+		DIFF
+	};
+
+	std::string elem;
+
+	SetMerge(SSDBImpl *ssdb, int op){
+		this->ssdb = ssdb;
+		this->op = op;
+		this->snapshot = ssdb->get_snapshot();
+		this->done = true;
+		this->failed = false;
+	}
+	~SetMerge(){
+		close();
+		ssdb->release_snapshot(snapshot);
+	}
+
+	const leveldb::Snapshot *get_snapshot() const{
+		return snapshot;
+	}
+
+	// version read from the snapshot, size 0 for a set that doesn't exist
+	void add(const Bytes &key, uint64_t version, int64_t size){
+		Input input;
+		input.key = key.String();
+		input.version = version;
+		input.size = size;
+		input.probe = false;
+		input.it = NULL;
+		input.valid = false;
+		inputs.push_back(input);
+	}
+
+	// an upper bound of the number of members
+	int64_t max_size() const{
+		int64_t size = 0;
+		for(size_t i=0; i<inputs.size(); i++){
+			if(op == UNION){
+				size += inputs[i].size;
+			}else if(i == 0 || (op == INTER && inputs[i].size < size)){
+				size = inputs[i].size;
+			}
+		}
+		return size;
+	}
+
+	// the members after cursor, "": from the first one
+	void start(const std::string &cursor){
+		close();
+		done = false;
+		failed = false;
+		if(op == INTER){
+			// the smallest set drives
+			std::stable_sort(inputs.begin(), inputs.end(), smaller);
+		}
+		for(size_t i=0; i<inputs.size(); i++){
+			if(inputs[i].size == 0 && (op == INTER || (op == DIFF && i == 0))){
+				done = true;
+				return;
+			}
+		}
+		for(size_t i=0; i<inputs.size(); i++){
+			Input &input = inputs[i];
+			if(input.size == 0){
+				continue;
+			}
+			input.probe = op != UNION && i > 0
+				&& input.size > inputs[0].size * SET_PROBE_RATIO;
+			if(!input.probe){
+				input.it = ssdb->sscan(input.key, cursor, UINT64_MAX, input.version, snapshot);
+				input.valid = input.it->next();
+			}
+		}
+	}
+
+	bool next(){
+		if(done){
+			return false;
+		}
+		bool ret = op == UNION ? next_union() : next_driven();
+		if(!ret){
+			done = true;
+		}
+		return ret;
+	}
+
+	bool error() const{
+		return failed;
+	}
+
+private:
+	struct Input{
+		std::string key;
+		uint64_t version;
+		int64_t size;
+		bool probe;
+		SIterator *it;
+		bool valid;       /* it is on a member */
+	};
+
+	SSDBImpl *ssdb;
+	int op;
+	const leveldb::Snapshot *snapshot;
+	bool done;
+	bool failed;
+	std::vector<Input> inputs;
+
+	static bool smaller(const Input &a, const Input &b){
+		return a.size < b.size;
+	}
+
+	void close(){
+		for(size_t i=0; i<inputs.size(); i++){
+			delete inputs[i].it;
+			inputs[i].it = NULL;
+			inputs[i].valid = false;
+		}
+	}
+
+	// whether input has elem, a scanned one is moved up to it
+	int contains(Input &input, const std::string &elem){
+		if(input.probe){
+			int ret = ssdb->sget(input.key, elem, input.version, snapshot);
+			if(ret == -1){
+				failed = true;
+			}
+			return ret;
+		}
+		int r = 1;
+		while(input.valid && (r = input.it->elem.compare(elem)) < 0){
+			input.valid = input.it->next();
+		}
+		return input.valid && r == 0;
+	}
+
+	bool next_union(){
+		const std::string *min = NULL;
+		for(size_t i=0; i<inputs.size(); i++){
+			if(inputs[i].valid && (min == NULL || inputs[i].it->elem < *min)){
+				min = &inputs[i].it->elem;
+			}
+		}
+		if(min == NULL){
+			return false;
+		}
+		elem = *min;
+		for(size_t i=0; i<inputs.size(); i++){
+			if(inputs[i].valid && inputs[i].it->elem == elem){
+				inputs[i].valid = inputs[i].it->next();
+			}
+		}
+		return true;
+	}
+
+	bool next_driven(){
+		Input &driver = inputs[0];
+		while(driver.valid){
+			elem.swap(driver.it->elem);
+			driver.valid = driver.it->next();
+			bool keep = true;
+			for(size_t i=1; i<inputs.size() && keep; i++){
+				if(inputs[i].size == 0){
+					continue;
+				}
+				int ret = contains(inputs[i], elem);
+				if(failed){
+					return false;
+				}
+				keep = op == INTER ? ret == 1 : ret == 0;
+				if(op == INTER && !inputs[i].probe && !inputs[i].valid){
+					// nothing more in common
+					driver.valid = false;
+				}
+			}
+			if(keep){
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+/* sinter/sunion/sdiff of many members */
+class SetMergeStream : public Stream
+{
+public:
+	SetMergeStream(SetMerge *merge){
+		this->merge = merge;
+	}
+	~SetMergeStream(){
+		delete merge;
+	}
+
+	int next(Response *resp, int bytes){
+		merge->start(cursor);
+		while(merge->next()){
+			resp->push_back(merge->elem);
+			if((int)resp->packed().size() >= bytes){
+				cursor = merge->elem;
+				return 1;
+			}
+		}
+		return merge->error() ? -1 : 0;
+	}
+
+private:
+	SetMerge *merge;
+	std::string cursor;   /* the last member sent */
+};
+
 int proc_sismember(NetworkServer *net, Link *link, const Request &req, Response *resp){
 	SSDBServer *serv = (SSDBServer *)net->data;
 	CHECK_NUM_PARAMS(3);
@@ -255,6 +509,12 @@ action:
 		return 0;
 	}
 
+	if(use_stream(net, link, serv->ssdb->ssize(req[1], version))){
+		resp->push_back("ok");
+		link->stream = new SetStream(serv, req[1], version);
+		return 0;
+	}
+
 	uint64_t limit = UINT64_MAX;
 	SIterator *it = serv->ssdb->sscan(req[1], "", limit, version);
 	resp->push_back("ok");
@@ -302,3 +562,193 @@ action:
 	resp->reply_int(0, count);
 	return 0;
 }
+
+// add the sets req[first..], -1 with the error in resp
+static int add_sets(SSDBServer *serv, const Request &req, int first, SetMerge *merge, Response *resp){
+	for(Request::const_iterator it = req.begin() + first; it != req.end(); it++){
+		char op;
+		uint64_t version;
+		int exists = serv->ssdb->get_version(*it, &op, &version, merge->get_snapshot());
+		if(exists == -1){
+			resp->clear();
+			resp->push_back("error");
+			resp->push_back("server inner error");
+			return -1;
+		}
+		if(exists && op != DataType::SET){
+			resp->clear();
+			resp->push_back("error");
+			resp->push_back("WRONGTYPE Operation against a key holding the wrong kind of value");
+			return -1;
+		}
+		int64_t size = exists ? serv->ssdb->ssize(*it, version, merge->get_snapshot()) : 0;
+		if(size == -1){
+			resp->clear();
+			resp->push_back("error");
+			resp->push_back("server inner error");
+			return -1;
+		}
+		merge->add(*it, version, size);
+	}
+	return 0;
+}
+
+static int proc_set_merge(NetworkServer *net, Link *link, const Request &req, Response *resp, int op){
+	SSDBServer *serv = (SSDBServer *)net->data;
+	CHECK_NUM_PARAMS(2);
+	for(Request::const_iterator it = req.begin() + 1; it != req.end(); it++){
+		CHECK_KEY(*it);
+	}
+
+	int16_t slot = -1;
+	CHECK_CROSS_SLOT(req, resp, slot, 1);
+	ReadLockGuard<RWLock> slot_guard(serv->ssdb_cluster->get_state_lock(slot));
+	int16_t migrating_slot = 0;
+	GET_SLOT_MIGRATING(serv, resp, migrating_slot);
+
+	CHECK_MULTI_ASK(serv, req, resp, slot, 1);
+	CHECK_MULTI_ASKING(serv, link, req, resp, slot, 1);
+
+action:
+	SetMerge *merge = new SetMerge(serv->ssdb, op);
+	if(add_sets(serv, req, 1, merge, resp) == -1){
+		delete merge;
+		return 0;
+	}
+	resp->push_back("ok");
+	if(use_stream(net, link, merge->max_size())){
+		link->stream = new SetMergeStream(merge);
+		return 0;
+	}
+	merge->start("");
+	while(merge->next()){
+		resp->push_back(merge->elem);
+	}
+	if(merge->error()){
+		resp->clear();
+		resp->push_back("error");
+		resp->push_back("server inner error");
+	}
+	delete merge;
+	return 0;
+}
+
+// a failed store must not leave part of the result behind, on the master or the slaves
+static void set_store_failed(SSDBServer *serv, const Bytes &dst, Transaction &trans,
+		Response *resp, const char *msg){
+	int ret = serv->ssdb->del(dst, trans);
+	if(ret == -1){
+		log_error("delete %s after a failed store failed", hexmem(dst.data(), dst.size()).c_str());
+	}else if(ret > 0 && serv->binlog){
+		serv->binlog->write(BinlogType::SYNC, BinlogCommand::K_DEL, dst);
+	}
+	resp->clear();
+	resp->push_back("error");
+	resp->push_back(msg);
+}
+
+static int proc_set_merge_store(NetworkServer *net, Link *link, const Request &req, Response *resp, int op){
+	SSDBServer *serv = (SSDBServer *)net->data;
+	CHECK_READ_ONLY;
+	CHECK_NUM_PARAMS(3);
+	for(Request::const_iterator it = req.begin() + 1; it != req.end(); it++){
+		CHECK_KEY(*it);
+	}
+
+	int16_t slot = -1;
+	CHECK_CROSS_SLOT(req, resp, slot, 1);
+	CHECK_SLOT_MOVED(slot);
+	ReadLockGuard<RWLock> slot_guard(serv->ssdb_cluster->get_state_lock(slot));
+	int16_t migrating_slot = 0;
+	GET_SLOT_MIGRATING(serv, resp, migrating_slot);
+
+	CHECK_MULTI_ASK(serv, req, resp, slot, 1);
+	CHECK_MULTI_ASKING(serv, link, req, resp, slot, 1);
+
+action:
+	const Bytes &dst = req[1];
+	// the sets are read from a snapshot, the destination may be one of them
+	SetMerge merge(serv->ssdb, op);
+	if(add_sets(serv, req, 2, &merge, resp) == -1){
+		return 0;
+	}
+	merge.start("");
+
+	Transaction trans(serv->ssdb, dst);
+	int ret = serv->ssdb->del(dst, trans);
+	if(ret == -1){
+		resp->push_back("error");
+		resp->push_back("delete failed");
+		return 0;
+	}
+	if(ret > 0 && serv->binlog){
+		serv->binlog->write(BinlogType::SYNC, BinlogCommand::K_DEL, dst);
+	}
+	serv->expiration->del_ttl(dst);
+
+	bool created = false;
+	uint64_t version = 0;
+	int64_t count = 0;
+	std::vector<std::string> batch;
+	while(1){
+		bool more = merge.next();
+		if(more){
+			batch.push_back(merge.elem);
+			if(batch.size() < SET_STORE_BATCH){
+				continue;
+			}
+		}
+		if(merge.error()){
+			set_store_failed(serv, dst, trans, resp, "server inner error");
+			return 0;
+		}
+		if(!batch.empty()){
+			if(!created){
+				if(serv->ssdb->new_version(dst, DataType::SET, &version) == -1){
+					set_store_failed(serv, dst, trans, resp, "server inner error");
+					return 0;
+				}
+				created = true;
+			}
+			int64_t num = serv->ssdb->multi_sset(dst, batch, trans, version);
+			if(num == -1){
+				set_store_failed(serv, dst, trans, resp, "write failed");
+				return 0;
+			}
+			if(serv->binlog){
+				serv->binlog->write(BinlogType::SYNC, BinlogCommand::S_SET, dst, batch);
+			}
+			count += num;
+			batch.clear();
+		}
+		if(!more){
+			break;
+		}
+	}
+	resp->reply_int(0, count);
+	return 0;
+}
+
+int proc_sinter(NetworkServer *net, Link *link, const Request &req, Response *resp){
+	return proc_set_merge(net, link, req, resp, SetMerge::INTER);
+}
+
+int proc_sunion(NetworkServer *net, Link *link, const Request &req, Response *resp){
+	return proc_set_merge(net, link, req, resp, SetMerge::UNION);
+}
+
+int proc_sdiff(NetworkServer *net, Link *link, const Request &req, Response *resp){
+	return proc_set_merge(net, link, req, resp, SetMerge::DIFF);
+}
+
+int proc_sinterstore(NetworkServer *net, Link *link, const Request &req, Response *resp){
+	return proc_set_merge_store(net, link, req, resp, SetMerge::INTER);
+}
+
+int proc_sunionstore(NetworkServer *net, Link *link, const Request &req, Response *resp){
+	return proc_set_merge_store(net, link, req, resp, SetMerge::UNION);
+}
+
+int proc_sdiffstore(NetworkServer *net, Link *link, const Request &req, Response *resp){
+	return proc_set_merge_store(net, link, req, resp, SetMerge::DIFF);
+}
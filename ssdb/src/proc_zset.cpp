@@ -8,6 +8,50 @@ found in the LICENSE file.
 #include "net/proc.h"
 #include "net/server.h"
 
+/* zrange of many members, by rank first, then on after the last member sent */
+class ZRangeStream : public CollectionStream
+{
+public:
+	ZRangeStream(SSDBServer *serv, const Bytes &key, uint64_t version, uint64_t offset, uint64_t limit)
+		: CollectionStream(serv, key, version), offset(offset), limit(limit), started(false){
+	}
+
+private:
+	uint64_t offset;      /* rank of the first member */
+	uint64_t limit;       /* members still to send */
+	bool started;
+	std::string field;    /* the last member sent, and its score */
+	std::string score;
+
+	int read(Response *resp, int bytes){
+		ZIterator *it;
+		if(!started){
+			it = serv->ssdb->zrange(key, offset, limit, version, snapshot);
+			started = true;
+		}else{
+			it = serv->ssdb->zscan(key, field, score, "", limit, version, snapshot);
+		}
+		if(it == NULL){
+			return -1;
+		}
+		it->return_val(false);
+		int ret = 0;
+		while(limit > 0 && it->next()){
+			resp->push_back(it->raw_field());
+			resp->add(it->raw_score());
+			limit --;
+			if((int)resp->packed().size() >= bytes){
+				field = it->raw_field().String();
+				score = str(it->raw_score());
+				ret = limit > 0 ? 1 : 0;
+				break;
+			}
+		}
+		delete it;
+		return ret;
+	}
+};
+
 /* key: req[1] field: req[2] */
 int proc_zexists(NetworkServer *net, Link *link, const Request &req, Response *resp){
 	SSDBServer *serv = (SSDBServer *)net->data;
@@ -213,13 +257,13 @@ action:
 
 	Request::const_iterator it=req.begin() + 1;
 	const Bytes key = *it;
+	std::string score;
 	it ++;
 	for(; it!=req.end(); it+=1){
 		const Bytes &field = *it;
-		std::string score;
 		int ret = serv->ssdb->zget(key, field, &score, version);
 		if(ret == 1){
-			resp->push_back(field.String());
+			resp->push_back(field);
 			resp->push_back(score);
 		}
 	}
@@ -430,14 +474,29 @@ action:
 	}
 	int64_t start = req[2].Int64();
 	int64_t stop = req[3].Int64();
+	if(net->stream_threshold > 0 && (start < 0 || stop < 0 || stop - start >= net->stream_threshold)){
+		int64_t size = serv->ssdb->zsize(req[1], version);
+		int64_t first = start < 0 ? start + size : start;
+		int64_t last = stop < 0 ? stop + size : stop;
+		if(first < 0){
+			first = 0;
+		}
+		if(last >= size){
+			last = size - 1;
+		}
+		if(last >= first && use_stream(net, link, (last - first + 1) * 2)){
+			link->stream = new ZRangeStream(serv, req[1], version, first, last - first + 1);
+			return 0;
+		}
+	}
 	ZIterator *it = serv->ssdb->zrange(req[1], start, stop, version);
 	if(it == NULL) {
 		return 0;
 	}
-
+	it->return_val(false);
 	while(it->next()){
-		resp->push_back(it->field);
-		resp->push_back(it->score);
+		resp->push_back(it->raw_field());
+		resp->add(it->raw_score());
 	}
 	delete it;
 	return 0;
@@ -470,10 +529,10 @@ action:
 	if(it == NULL) {
 		return 0;
 	}
-
+	it->return_val(false);
 	while(it->next()){
-		resp->push_back(it->field);
-		resp->push_back(it->score);
+		resp->push_back(it->raw_field());
+		resp->add(it->raw_score());
 	}
 	delete it;
 	return 0;
@@ -545,12 +604,13 @@ action:
 		limit = offset + req[6].Uint64();
 	}
 	ZIterator *it = serv->ssdb->zscan(req[1], req[2], req[3], req[4], limit, version);
+	it->return_val(false);
 	if(offset > 0){
 		it->skip(offset);
 	}
 	while(it->next()){
-		resp->push_back(it->field);
-		resp->push_back(it->score);
+		resp->push_back(it->raw_field());
+		resp->add(it->raw_score());
 	}
 	delete it;
 	return 0;
@@ -584,12 +644,13 @@ action:
 		limit = offset + req[6].Uint64();
 	}
 	ZIterator *it = serv->ssdb->zrscan(req[1], req[2], req[3], req[4], limit, version);
+	it->return_val(false);
 	if(offset > 0){
 		it->skip(offset);
 	}
 	while(it->next()){
-		resp->push_back(it->field);
-		resp->push_back(it->score);
+		resp->push_back(it->raw_field());
+		resp->add(it->raw_score());
 	}
 	delete it;
 	return 0;
@@ -618,8 +679,9 @@ action:
 	}
 	uint64_t limit = req[5].Uint64();
 	ZIterator *it = serv->ssdb->zscan(req[1], req[2], req[3], req[4], limit, version);
+	it->return_val(false);
 	while(it->next()){
-		resp->push_back(it->field);
+		resp->push_back(it->raw_field());
 	}
 	delete it;
 	return 0;
@@ -809,8 +871,9 @@ action:
 	int64_t sum = 0;
 	if(exists) {
 		ZIterator *it = serv->ssdb->zscan(req[1], "", req[2], req[3], -1, version);
+		it->return_val(false);
 		while(it->next()){
-			sum += str_to_int64(it->score);
+			sum += it->raw_score();
 		}
 		delete it;
 	}
@@ -844,8 +907,9 @@ action:
 	int64_t sum = 0;
 	int64_t count = 0;
 	ZIterator *it = serv->ssdb->zscan(req[1], "", req[2], req[3], -1, version);
+	it->return_val(false);
 	while(it->next()){
-		sum += str_to_int64(it->score);
+		sum += it->raw_score();
 		count ++;
 	}
 	delete it;
@@ -11,18 +11,20 @@
 #define RANGE_MIGRATE_SEQ 0
 #define RANGE_MIGRATE_RECV_TIMEOUT 10000
 #define RANGE_MIGRATE_SYNCIO_RESOLUTION 200
+#define RANGE_MIGRATE_ACK "range_sync_ack"
 
 static const std::vector<Bytes> *sync_read(Fdevents *evb, Link *link, int64_t timeout_ms);
 
 RangeMigrate::RangeMigrate(SSDB_BinLog *binlog, SSDB *ssdb, ExpirationHandler *expiration, SegKeyLock &lock)
-	:binlog(binlog), ssdb(ssdb), expiration(expiration), key_lock(lock), migrate_ret(0){
+	:binlog(binlog), ssdb(ssdb), expiration(expiration), key_lock(lock), migrate_ret(0),
+	processing(0), stat_window(0), stat_keys(0), stat_acks(0), stat_start(0), stat_end(0){
 }
 
 RangeMigrate::~RangeMigrate() {
 }
 
 void RangeMigrate::migrate(Link *link, Response *resp, const std::string &ip, int port,
-		const std::string &start, const std::string &end, int speed, int64_t timeout_ms) {
+		const std::string &start, const std::string &end, int speed, int64_t timeout_ms, int window) {
 	if(processing == 1) {
 		/* there is a migrating thread running */
 		link->send("tryagain");
@@ -43,6 +45,7 @@ void RangeMigrate::migrate(Link *link, Response *resp, const std::string &ip, in
 	arg->start = start;
 	arg->end = end;
 	arg->speed = speed;
+	arg->window = window < 1 ? 1 : window;
 	arg->timeout = timeout_ms < 0 ? 0 : timeout_ms;
 	arg->resp = resp;
 
@@ -55,12 +58,13 @@ void RangeMigrate::migrate(Link *link, Response *resp, const std::string &ip, in
 	pthread_join(tid, NULL);
 }
 
-void RangeMigrate::import(Link *link, const std::string &sync_key) {
+void RangeMigrate::import(Link *link, const std::string &sync_key, int window) {
 	pthread_t tid = 0;
 	struct _thread_args *arg = new struct _thread_args();
 	arg->owner = this;
 	arg->link = link;
 	arg->sync_key = sync_key;
+	arg->window = window < 1 ? 1 : window;
 	int err = pthread_create(&tid, NULL, &RangeMigrate::_import_thread, static_cast<void*>(arg));
 	if(err != 0) {
 		log_error("can't start improt thread: %s", strerror(err));
@@ -85,6 +89,24 @@ std::string RangeMigrate::get_migrate_msg(int n) {
 	}
 }
 
+std::string RangeMigrate::get_migrate_stats() {
+	int64_t end = stat_end > 0 ? stat_end : time_ms();
+	int64_t elapsed = stat_start > 0 ? end - stat_start : 0;
+	double keys_per_sec = elapsed > 0 ? stat_keys * 1000.0 / elapsed : 0;
+	double keys_per_ack = stat_acks > 0 ? (double)stat_keys / stat_acks : 0;
+
+	char buf[512];
+	snprintf(buf, sizeof(buf),
+		"migrate_window:%d\n"
+		"migrate_keys:%" PRIu64 "\n"
+		"migrate_acks:%" PRIu64 "\n"
+		"migrate_keys_per_ack:%.2f\n"
+		"migrate_elapsed_ms:%" PRId64 "\n"
+		"migrate_keys_per_sec:%.2f",
+		stat_window, stat_keys, stat_acks, keys_per_ack, elapsed, keys_per_sec);
+	return buf;
+}
+
 void *RangeMigrate::_migrate_thread(void *arg) {
 	//pthread_detach(pthread_self());
 	SET_PROC_NAME("migrator");
@@ -99,14 +121,24 @@ void *RangeMigrate::_migrate_thread(void *arg) {
 	c.start = p->start;
 	c.end = p->end;
 	c.sync_speed = p->speed;
+	c.window = p->window;
+	c.cursor = p->start;
 	c.proc_timeout = p->timeout;
 	c.proc_start = time_ms();
 	c.send_count = 0;
 	delete p;
 
-	log_info("range migrating start");
+	c.owner->stat_window = c.window;
+	c.owner->stat_keys = 0;
+	c.owner->stat_acks = 0;
+	c.owner->stat_start = c.proc_start;
+	c.owner->stat_end = 0;
+
+	log_info("range migrating start, window: %d", c.window);
 	c.proc();
-	log_info("range migrating quit, %" PRIu64 " keys sent", c.send_count);
+	c.owner->stat_end = time_ms();
+	log_info("range migrating quit, %" PRIu64 " keys sent, %" PRIu64 " acks",
+		c.send_count, c.owner->stat_acks);
 	return NULL;
 }
 
@@ -119,6 +151,7 @@ void *RangeMigrate::_import_thread(void *arg) {
 	s.owner = p->owner;
 	s.link = p->link;
 	s.sync_key = p->sync_key;
+	s.window = p->window;
 	delete p;
 
 	log_info("range importing start");
@@ -127,10 +160,11 @@ void *RangeMigrate::_import_thread(void *arg) {
 	return NULL;
 }
 
-RangeMigrate::Client::Client() : link(NULL), status(CLIENT_DISCONNECT), ttl(-1){
+RangeMigrate::Client::Client() : status(CLIENT_DISCONNECT), link(NULL), ttl(-1), window(1){
 }
 
 RangeMigrate::Client::~Client() {
+	key_migrate_release();
 	SAFE_DELETE(link);
 }
 
@@ -150,6 +184,9 @@ void RangeMigrate::Client::reconnect() {
 		select.del(link->fd());
 	}
 	SAFE_DELETE(link);
+	/* unacked keys will be sent again after reconnected */
+	key_migrate_release();
+	cursor = start;
 	sleep(1);
 	status = CLIENT_DISCONNECT;
 }
@@ -163,14 +200,14 @@ do { \
 int RangeMigrate::Client::key_migrate_init() {
 	/**
 	 * disable write while generate migrate key, which is
-	 * the first key in the range between 'start' and 'end'.
+	 * the first key in the range between 'cursor' and 'end'.
 	 * lock is needed, as it must be sure the key invariant
 	 * before we add the sync_key to key-lock-set
 	 **/
 	WriteLockGuard<SegKeyLock> guard(owner->key_lock);
-	log_debug("key migrate init, start: %s end: %s",
-		hexmem(start.c_str(), start.size()).c_str(), hexmem(end.c_str(), end.size()).c_str());
-	Iterator *iter = owner->ssdb->iterator(start, end, UINT64_MAX);
+	log_debug("key migrate init, cursor: %s end: %s",
+		hexmem(cursor.c_str(), cursor.size()).c_str(), hexmem(end.c_str(), end.size()).c_str());
+	Iterator *iter = owner->ssdb->iterator(cursor, end, UINT64_MAX);
 	bool flag = false;
 	while(iter->next()) {
 		if(decode_version_key(iter->key(), &sync_key) == -1) {
@@ -194,6 +231,7 @@ int RangeMigrate::Client::key_migrate_init() {
 		/* reset all args */
 		sync_field = "";
 		sync_qcount = 0;
+		cursor = iter->key().String();
 		flag = true;
 		break;
 	}
@@ -204,11 +242,59 @@ int RangeMigrate::Client::key_migrate_init() {
 		/* no more key to migrate */
 		return 0;
 	}
-	log_debug("first key: %s", hexmem(sync_key.data(), sync_key.size()).c_str());
+	log_debug("next key: %s", hexmem(sync_key.data(), sync_key.size()).c_str());
 	owner->key_lock.add_key(sync_key);
+	inflight.push_back(sync_key);
 	return 1;
 }
 
+int RangeMigrate::Client::key_migrate_next() {
+	int ret = key_migrate_init();
+	if(ret == 0 && inflight.empty() && cursor != start) {
+		/* every key picked so far is gone, rescan the range once
+		 * for keys which land behind the cursor */
+		cursor = start;
+		ret = key_migrate_init();
+	}
+	return ret;
+}
+
+int RangeMigrate::Client::key_migrate_done(size_t n) {
+	if(n > inflight.size()) {
+		log_error("ack %" PRIu64 " keys, but only %" PRIu64 " in flight",
+			(uint64_t)n, (uint64_t)inflight.size());
+		return -1;
+	}
+	std::vector<std::string> keys(inflight.begin(), inflight.begin() + n);
+	/* keys are protected by key-lock-set, no row lock needed */
+	Transaction trans(owner->ssdb, Bytes());
+	if(owner->ssdb->multi_del(keys, trans) == -1) {
+		log_error("range migrate client delete %" PRIu64 " keys failed", (uint64_t)n);
+		return -1;
+	}
+	std::vector<std::string>::const_iterator it;
+	for(it = keys.begin(); it != keys.end(); ++it) {
+		owner->expiration->del_ttl(*it);
+		if(owner->binlog) {
+			owner->binlog->write(BinlogType::SYNC, BinlogCommand::K_DEL, *it);
+		}
+		KEY_LOCK_DELETE_KEY(owner->key_lock, *it);
+	}
+	inflight.erase(inflight.begin(), inflight.begin() + n);
+	send_count += n;
+	owner->stat_keys += n;
+	owner->stat_acks += 1;
+	return 0;
+}
+
+void RangeMigrate::Client::key_migrate_release() {
+	while(!inflight.empty()) {
+		log_debug("delete key in key lock for status %d", status);
+		KEY_LOCK_DELETE_KEY(owner->key_lock, inflight.front());
+		inflight.pop_front();
+	}
+}
+
 #define SSDB_RANGE_MIGRATE_CHECK_KEY(k1, k2) \
 do {\
 	if(k1 != k2) {\
@@ -276,14 +362,19 @@ void RangeMigrate::Client::init() {
 	const std::vector<Bytes> *req = NULL;
 	status = CLIENT_INITIALIZED;
 	/* get the first key to send */
-	if(key_migrate_init() == 0) {
+	int ret = key_migrate_next();
+	if(ret == -1) {
+		status = CLIENT_ABORT;
+		return;
+	}
+	if(ret == 0) {
 		log_info("there is no key to sync");
 		status = CLIENT_DONE;
 		return;
 	}
 
-	/* key is locked. Now, send the key */
-	link->send("migrate", sync_key);
+	/* key is locked. Now, send the key and the window we'd like to use */
+	link->send("migrate", sync_key, str(window));
 	link->noblock();
 	if(link->flush() == -1) {
 		log_error("send cmd migrate error: %s", strerror(errno));
@@ -330,8 +421,8 @@ void RangeMigrate::Client::init() {
 	}*/
 
 unlock_key:
-	log_debug("delete key in key lock for status %d", status);
-	KEY_LOCK_DELETE_KEY(owner->key_lock, sync_key);
+	key_migrate_release();
+	cursor = start;
 }
 
 int RangeMigrate::Client::flush() {
@@ -346,6 +437,7 @@ int RangeMigrate::Client::flush() {
 	if(sync_speed > 0) {
 		usleep(static_cast<uint64_t>(data_size_mb / sync_speed) * 1000 * 1000);
 	}
+	return 0;
 }
 
 int RangeMigrate::Client::copy_kv() {
@@ -468,17 +560,58 @@ void RangeMigrate::Client::copy() {
 			ret = -1;
 	}
 	if(ret == 0) {
-		/* send ttl and require ack */
+		/* send ttl and require ack, the key stays locked until acked */
 		ttl = owner->expiration->get_ttl(sync_key);
 		LogEvent log(RANGE_MIGRATE_SEQ, BinlogType::COPY, BinlogCommand::ACK, sync_key, ttl);
 		link->send(log.repr(), "ack");
-		/* flush every time a key sent */
-		status = CLIENT_ACK;
-		ret = flush();
+		if(link->output->size() > 2 * 1024 * 1024) {
+			ret = flush();
+		}
 	}
 	if(ret == -1) {
-		/* unlock key */
-		KEY_LOCK_DELETE_KEY(owner->key_lock, sync_key);
+		/* keys in flight are released on reconnect or quit */
+		if(status != CLIENT_RECONNECT) {
+			status = CLIENT_ABORT;
+		}
+		return;
+	}
+	schedule();
+}
+
+void RangeMigrate::Client::schedule() {
+	/* proc timeout only after full key migration */
+	bool expired = proc_timeout > 0 && time_ms() - proc_start > proc_timeout;
+	if(!expired && inflight.size() < (size_t)window) {
+		int ret = key_migrate_next();
+		if(ret == -1) {
+			status = CLIENT_ABORT;
+			return;
+		}
+		if(ret == 1) {
+			status = CLIENT_INITIALIZED;
+			return;
+		}
+	}
+
+	if(!inflight.empty()) {
+		/* window is full or range is drained, wait for acks */
+		status = CLIENT_ACK;
+		flush();
+		return;
+	}
+
+	if(expired) {
+		status = CLIENT_TIMEOUT;
+		return;
+	}
+
+	LogEvent log(RANGE_MIGRATE_SEQ, BinlogType::COPY, BinlogCommand::END);
+	link->send(log.repr(), "sync_end");
+	if(flush() == -1) {
+		log_error("range migrate client send sync_end failed");
+		status = CLIENT_ABORT;
+	} else {
+		status = CLIENT_EOF;
 	}
 }
 
@@ -495,45 +628,32 @@ void RangeMigrate::Client::confirm(char cmd) {
 		status = CLIENT_ABORT;
 		return;
 	}
-	if(log.cmd() != cmd) {
+	if(log.cmd() != cmd || req->size() < 2) {
 		log_error("invalid ack, migration abort");
 		status = CLIENT_ABORT;
 		return;
 	}
 
 	if(cmd == BinlogCommand::ACK) {
-		Transaction trans(owner->ssdb, sync_key);
-		if(owner->ssdb->del(sync_key, trans) == -1) {
-			log_error("range migrate client delete key: %s failed, migration abort",
-				hexmem(sync_key.c_str(), sync_key.size()).c_str());
+		/**
+		 * a windowed importer acks a batch of keys with the count
+		 * as value and the last key imported as key, older importers
+		 * ack every key with a constant message.
+		 **/
+		int64_t n = 1;
+		if((*req)[1] != RANGE_MIGRATE_ACK) {
+			n = (*req)[1].Int64();
+		}
+		if(n <= 0 || key_migrate_done(n) == -1) {
+			log_error("range migrate client confirm %" PRId64 " keys failed, migration abort", n);
 			status = CLIENT_ABORT;
 			return;
 		}
-		owner->expiration->del_ttl(sync_key);
-		if(owner->binlog) {
-			owner->binlog->write(BinlogType::SYNC, BinlogCommand::K_DEL, sync_key);
-		}
-
-		KEY_LOCK_DELETE_KEY(owner->key_lock, sync_key);
-		status = CLIENT_INITIALIZED;
-		if(key_migrate_init() == 0) {
-			LogEvent log(RANGE_MIGRATE_SEQ, BinlogType::COPY, BinlogCommand::END);
-			link->send(log.repr(), "sync_end");
-			int ret = flush();
-			if (ret == -1) {
-				log_error("range migrate client send sync_end failed");
-				status = CLIENT_ABORT;
-			} else {
-				status = CLIENT_EOF;
-			}
-		}
-		++send_count;
+		schedule();
 	} else if (cmd == BinlogCommand::END){
-		KEY_LOCK_DELETE_KEY(owner->key_lock, sync_key);
 		status = CLIENT_DONE;
 	} else {
 		log_error("unexpected command: %c, migration abort", cmd);
-		KEY_LOCK_DELETE_KEY(owner->key_lock, sync_key);
 		status = CLIENT_ABORT;
 	}
 }
@@ -578,30 +698,28 @@ void RangeMigrate::Client::proc() {
 				owner->migrate_ret = 0;
 				msg = "done";
 				goto finish;
+			case CLIENT_TIMEOUT:
+				log_info("range migrate timeout");
+				owner->migrate_ret = 0;
+				msg = "continue";
+				goto finish;
 			default:
 				log_warn("unknown status");
 				owner->migrate_ret = -1;
 				msg = "abort";
 				goto finish;
 		}
-
-		/* proc timeout only after full key migration */
-		if(status == CLIENT_INITIALIZED && proc_timeout > 0 && time_ms() - proc_start > proc_timeout) {
-			log_info("range migrate timeout");
-			owner->migrate_ret = 0;
-			msg = "continue";
-			goto finish;
-		}
 	}
 
 finish:
+	key_migrate_release();
 	/* block process, do not flush link here */
 	resp->push_back(msg);
 	owner->processing = 0;
 }
 
 
-RangeMigrate::Server::Server() {
+RangeMigrate::Server::Server() : link(NULL), window(1), pending_acks(0) {
 }
 
 RangeMigrate::Server::~Server() {
@@ -621,6 +739,13 @@ void RangeMigrate::Server::proc() {
 			goto err;
 		} else {
 			int ret = proc_req(*req);
+			/* ack once the source stops sending or the window is full */
+			if(ret == 0 && pending_acks > 0 && (pending_acks >= window || link->input->empty())) {
+				if(send_ack() != 0) {
+					log_error("send command ack failed");
+					goto err;
+				}
+			}
 			if(ret == 1) {
 				log_info("range importe done");
 				return;
@@ -733,6 +858,9 @@ int RangeMigrate::Server::proc_req(const std::vector<Bytes> &req) {
 			{
 				log_debug("ack received");
 				first = true;
+				if(!log.key().empty()) {
+					sync_key = log.key().String();
+				}
 				/* set ttl */
 				log_debug("recvieve ttl, key: %s ttl: %" PRId64, hexmem(sync_key.data(), sync_key.size()).c_str(), log.ttl());
 				int64_t ttl = log.ttl();
@@ -744,7 +872,11 @@ int RangeMigrate::Server::proc_req(const std::vector<Bytes> &req) {
 					}
 				}
 
-				if(send_cmd(BinlogType::COPY, BinlogCommand::ACK, "", "range_sync_ack") != 0) {
+				if(window > 1) {
+					/* acked in batch by proc() */
+					++pending_acks;
+					ack_key = sync_key;
+				} else if(send_cmd(BinlogType::COPY, BinlogCommand::ACK, "", RANGE_MIGRATE_ACK) != 0) {
 					log_error("send command ack failed");
 					return -1;
 				}
@@ -894,6 +1026,12 @@ int RangeMigrate::Server::send_cmd(char log_type, char cmd, const Bytes &key, co
 	return 0;
 }
 
+int RangeMigrate::Server::send_ack() {
+	int ret = send_cmd(BinlogType::COPY, BinlogCommand::ACK, ack_key, str(pending_acks));
+	pending_acks = 0;
+	return ret;
+}
+
 static const std::vector<Bytes> *sync_read(Fdevents *evb, Link *link, int64_t timeout_ms) {
 	const std::vector<Bytes> *req = NULL;
 	const Fdevents::events_t *events = NULL;
@@ -1,6 +1,7 @@
 #ifndef SSDB_RANGE_MIGRATE_H_
 #define SSDB_RANGE_MIGRATE_H_
 
+#include <deque>
 #include "include.h"
 #include "leveldb/slice.h"
 #include "net/fde.h"
@@ -9,6 +10,9 @@
 #include "ssdb/binlog2.h"
 #include "ssdb/ttl.h"
 
+/* keys in flight by default while migrating a slot */
+#define RANGE_MIGRATE_DEFAULT_WINDOW 64
+
 class Link;
 class Response;
 class SegKeyLock;
@@ -18,11 +22,12 @@ public:
 	~RangeMigrate();
 
 	void migrate(Link *link, Response *resp, const std::string &ip, int port,
-		const std::string &start, const std::string &end, int speed, int64_t timeout_ms);
-	void import(Link *link, const std::string &prefix);
+		const std::string &start, const std::string &end, int speed, int64_t timeout_ms, int window);
+	void import(Link *link, const std::string &prefix, int window);
 
 	int get_migrate_ret();                        /* get last migrate status */
 	std::string get_migrate_msg(int n);           /* get error msg by errno */
+	std::string get_migrate_stats();              /* window and throughput of last migration */
 
 private:
 	SSDB_BinLog *binlog;
@@ -31,6 +36,13 @@ private:
 	SegKeyLock &key_lock;
 	int migrate_ret;  /* 0: done 1: processing -1: error(abort) */
 	int processing:1; /* only one migrate thread */
+
+	/* stats of the last migration, written by the migrate thread */
+	int stat_window;           /* keys in flight */
+	uint64_t stat_keys;        /* keys acknowledged and deleted */
+	uint64_t stat_acks;        /* ack messages received */
+	int64_t stat_start;        /* start time(ms) */
+	int64_t stat_end;          /* end time(ms), 0 if running */
 	static void *_migrate_thread(void *arg);
 	static void *_import_thread(void *arg);
 
@@ -45,6 +57,7 @@ private:
 		Link *upstream;
 		Response *resp;
 		int speed;
+		int window;
 		int64_t timeout;
 		bool clear_key;
 	};
@@ -59,10 +72,14 @@ private:
 		void confirm(char cmd);                /* read a command */
 		void confirm_ack();                    /* read ack and delete key*/
 		void confirm_eof();                    /* read end, delete key and call cb */
+		void schedule();                       /* pick next key or wait for acks */
 		int flush();                           /* flush data to network */
 		void connect();                        /* connect to the target 'ip:port' */
 		void reconnect();                      /* reset link, iterator and status */
-		int key_migrate_init();                /* find and add prefix to key-lock-set */
+		int key_migrate_init();                /* find the key after cursor and add it to key-lock-set */
+		int key_migrate_next();                /* key_migrate_init, rescan the range once drained */
+		int key_migrate_done(size_t n);        /* delete the first n keys in flight in one batch */
+		void key_migrate_release();            /* unlock all keys in flight */
 		int adjust(const LogEvent &log);       /* adjust the args of the key specified */
 		int copy_kv();
 		int copy_hash();
@@ -80,6 +97,7 @@ private:
 			CLIENT_EOF,
 			CLIENT_ABORT,
 			CLIENT_DONE,
+			CLIENT_TIMEOUT,
 		} status;                 /* sync stauts */
 
 		RangeMigrate *owner;      /* owner of this client */
@@ -98,6 +116,9 @@ private:
 		int64_t ttl;              /* arg 'ttl' */
 		std::string sync_field;   /* arg 'field' for zset, set and hash */
 		uint64_t send_count;      /* number of raw key sended */
+		int window;               /* max keys in flight */
+		std::deque<std::string> inflight; /* locked keys sent or being sent, unacked */
+		std::string cursor;       /* version key of the last key picked */
 		int64_t proc_timeout;     /* migrating timeout(ms) */
 		int64_t proc_start;       /* migrating start time */
 		Response *resp;           /* response vector */
@@ -116,6 +137,9 @@ private:
 		Fdevents select;         /* event pool for io */
 		int copy_count;          /* number of raw key copied */
 		bool first;              /* flag of first raw key */
+		int window;              /* window negotiated with the source, 1 for per-key ack */
+		int pending_acks;        /* keys imported but not acknowledged yet */
+		std::string ack_key;     /* last key imported */
 
 		void proc();                                   /* main process */
 		int init();                                    /* response to 'migrate' */
@@ -123,6 +147,7 @@ private:
 		int proc_req(const std::vector<Bytes> &req);   /* process the requests */
 		int send_cmd(char log_type, char cmd,
 			const Bytes &key, const Bytes &value); /* send a command */
+		int send_ack();                                /* acknowledge pending keys */
 	};
 };
 
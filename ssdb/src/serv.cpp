@@ -12,6 +12,7 @@ found in the LICENSE file.
 #include "serv.h"
 #include "net/proc.h"
 #include "net/server.h"
+#include "range_migrate.h"
 
 DEF_PROC(get);
 DEF_PROC(set);
@@ -69,17 +70,17 @@ DEF_PROC(ssize);
 DEF_PROC(multi_sdel);
 DEF_PROC(sismember);
 DEF_PROC(smembers);
-//DEF_PROC(sdiff);
-//DEF_PROC(sdiffstore);
-//DEF_PROC(inter);
-//DEF_PROC(interstore);
+DEF_PROC(sdiff);
+DEF_PROC(sdiffstore);
+DEF_PROC(sinter);
+DEF_PROC(sinterstore);
 //DEF_PROC(srem);
 //DEF_PROC(smove);
 //DEF_PROC(spop);
 //DEF_PROC(srandmember);
 //DEF_PROC(sscan);
-//DEF_PROC(sunion);
-//DEF_PROC(sunionstore);
+DEF_PROC(sunion);
+DEF_PROC(sunionstore);
 
 DEF_PROC(zrank);
 DEF_PROC(zrrank);
@@ -135,6 +136,7 @@ DEF_PROC(qltrim);
 DEF_PROC(dump);
 DEF_PROC(dump_slot);
 DEF_PROC(sync140);
+DEF_PROC(sync_range);
 DEF_PROC(info);
 DEF_PROC(version);
 DEF_PROC(dbsize);
@@ -196,18 +198,18 @@ DEF_PROC(client_pause);
 #define REG_PROC(c, f)     net->proc_map.set_proc(#c, f, proc_##c)
 
 void SSDBServer::reg_procs(NetworkServer *net){
-	REG_PROC(get, "rt");
+	REG_PROC(get, "rtp");
 	REG_PROC(set, "wt");
 	REG_PROC(del, "wt");
 	REG_PROC(setx, "wt");
 	REG_PROC(setnx, "wt");
 	REG_PROC(getset, "wt");
-	REG_PROC(getbit, "rt");
+	REG_PROC(getbit, "rtp");
 	REG_PROC(setbit, "wt");
 	REG_PROC(countbit, "rt");
 	REG_PROC(substr, "rt");
 	REG_PROC(getrange, "rt");
-	REG_PROC(strlen, "rt");
+	REG_PROC(strlen, "rtp");
 	REG_PROC(bitcount, "rt");
 	REG_PROC(incr, "wt");
 	REG_PROC(decr, "wt");
@@ -215,19 +217,19 @@ void SSDBServer::reg_procs(NetworkServer *net){
 	REG_PROC(rscan, "rt");
 	REG_PROC(keys, "rt");
 	REG_PROC(rkeys, "rt");
-	REG_PROC(exists, "rt");
+	REG_PROC(exists, "rtp");
 	REG_PROC(multi_exists, "rt");
 	REG_PROC(multi_get, "rt");
 	REG_PROC(multi_set, "wt");
 	REG_PROC(multi_del, "wt");
-	REG_PROC(ttl, "rt");
+	REG_PROC(ttl, "rtp");
 	REG_PROC(expire, "wt");
 	REG_PROC(expire_at, "wt");
 	REG_PROC(pexpire, "wt");
 	REG_PROC(pexpire_at, "wt");
 
-	REG_PROC(hsize, "rt");
-	REG_PROC(hget, "rt");
+	REG_PROC(hsize, "rtp");
+	REG_PROC(hget, "rtp");
 	REG_PROC(hset, "wt");
 	REG_PROC(hdel, "wt");
 	REG_PROC(hincr, "wt");
@@ -240,7 +242,7 @@ void SSDBServer::reg_procs(NetworkServer *net){
 	REG_PROC(hvals, "rt");
 	REG_PROC(hlist, "rt");
 	REG_PROC(hrlist, "rt");
-	REG_PROC(hexists, "rt");
+	REG_PROC(hexists, "rtp");
 	REG_PROC(multi_hexists, "rt");
 	REG_PROC(multi_hsize, "rt");
 	REG_PROC(multi_hget, "rt");
@@ -252,8 +254,8 @@ void SSDBServer::reg_procs(NetworkServer *net){
 	REG_PROC(zrrank, "rt");
 	REG_PROC(zrange, "rt");
 	REG_PROC(zrrange, "rt");
-	REG_PROC(zsize, "rt");
-	REG_PROC(zget, "rt");
+	REG_PROC(zsize, "rtp");
+	REG_PROC(zget, "rtp");
 	REG_PROC(zset, "wt");
 	REG_PROC(zdel, "wt");
 	REG_PROC(zincr, "wt");
@@ -269,7 +271,7 @@ void SSDBServer::reg_procs(NetworkServer *net){
 	REG_PROC(zavg, "rt");
 	REG_PROC(zremrangebyrank, "wt");
 	REG_PROC(zremrangebyscore, "wt");
-	REG_PROC(zexists, "rt");
+	REG_PROC(zexists, "rtp");
 	REG_PROC(multi_zexists, "rt");
 	REG_PROC(multi_zsize, "rt");
 	REG_PROC(multi_zget, "rt");
@@ -280,13 +282,19 @@ void SSDBServer::reg_procs(NetworkServer *net){
 
 	REG_PROC(multi_sset, "wt");
 	REG_PROC(multi_sdel, "wt");
-	REG_PROC(ssize, "rt");
-	REG_PROC(sismember, "rt");
+	REG_PROC(ssize, "rtp");
+	REG_PROC(sismember, "rtp");
 	REG_PROC(smembers, "rt");
-
-	REG_PROC(qsize, "rt");
-	REG_PROC(qfront, "rt");
-	REG_PROC(qback, "rt");
+	REG_PROC(sinter, "rt");
+	REG_PROC(sunion, "rt");
+	REG_PROC(sdiff, "rt");
+	REG_PROC(sinterstore, "wt");
+	REG_PROC(sunionstore, "wt");
+	REG_PROC(sdiffstore, "wt");
+
+	REG_PROC(qsize, "rtp");
+	REG_PROC(qfront, "rtp");
+	REG_PROC(qback, "rtp");
 	REG_PROC(qpush, "wt");
 	REG_PROC(qpush_front, "wt");
 	REG_PROC(qpush_back, "wt");
@@ -301,7 +309,7 @@ void SSDBServer::reg_procs(NetworkServer *net){
 	REG_PROC(qrlist, "rt");
 	REG_PROC(qslice, "rt");
 	REG_PROC(qrange, "rt");
-	REG_PROC(qget, "rt");
+	REG_PROC(qget, "rtp");
 	REG_PROC(qset, "wt");
 	REG_PROC(qltrim, "wt");
 
@@ -310,6 +318,7 @@ void SSDBServer::reg_procs(NetworkServer *net){
 	REG_PROC(dump, "w");
 	REG_PROC(dump_slot, "w");
 	REG_PROC(sync140, "b");
+	REG_PROC(sync_range, "b");
 	REG_PROC(info, "r");
 	REG_PROC(version, "r");
 	REG_PROC(dbsize, "rt");
@@ -452,6 +461,10 @@ SSDBServer::SSDBServer(SSDB *ssdb, SSDB *meta, Config *conf,
 		// init slave
 		this->slave = new Slave(this, meta, local_port);
 		this->slave->init();
+		this->slave->sync_streams = conf->get_num("replication.sync_streams");
+		this->slave->apply_threads = conf->get_num("replication.apply_threads");
+		this->slave->apply_batch = conf->get_num("replication.apply_batch");
+		this->slave->apply_batch_ms = conf->get_num("replication.apply_batch_ms");
 
 		int skip_slave_start = conf->get_num("rpl.skip_slave_start");
 		if (!this->slave->mi->ip.empty()
@@ -671,13 +684,19 @@ int proc_sync140(NetworkServer *net, Link *link, const Request &req, Response *r
 	return PROC_BACKEND;
 }
 
+int proc_sync_range(NetworkServer *net, Link *link, const Request &req, Response *resp){
+	SSDBServer *serv = (SSDBServer *)net->data;
+	serv->backend_sync->proc_range(link);
+	return PROC_BACKEND;
+}
+
 int proc_asking(NetworkServer *net, Link *link, const Request &req, Response *resp) {
 	link->asking = true;
 	resp->push_back("ok");
 	return 0;
 }
 
-/* migrate_slot [slot] [ip] [port] [timeout] [speed]*/
+/* migrate_slot [slot] [ip] [port] [timeout] [speed] [window]*/
 int proc_migrate_slot(NetworkServer *net, Link *link, const Request &req, Response *resp) {
 	SSDBServer *serv = (SSDBServer *)net->data;
 	CHECK_NUM_PARAMS(6);
@@ -689,6 +708,13 @@ int proc_migrate_slot(NetworkServer *net, Link *link, const Request &req, Respon
 	if(speed <= 0) {
 		speed = 1;
 	}
+	int window = RANGE_MIGRATE_DEFAULT_WINDOW;
+	if(req.size() > 6) {
+		window = req[6].Int();
+		if(window <= 0) {
+			window = 1;
+		}
+	}
 	if(slot <= 0 && slot >= CLUSTER_SLOTS) {
 		resp->push_back("error");
 		resp->push_back("invalid slot");
@@ -711,7 +737,7 @@ int proc_migrate_slot(NetworkServer *net, Link *link, const Request &req, Respon
 		resp->push_back("incompeleted migration");
 		return 0;
 	} else {
-		serv->ssdb_cluster->migrate_slot(link, resp, slot, ip, port, timeout_ms, speed);
+		serv->ssdb_cluster->migrate_slot(link, resp, slot, ip, port, timeout_ms, speed, window);
 		log_debug("migrate quite");
 		return 0;
 	}
@@ -721,6 +747,8 @@ int proc_migrate(NetworkServer *net, Link *link, const Request &req, Response *r
 	SSDBServer *serv = (SSDBServer *)net->data;
 	/* inner command, don't check vaildation */
 	int16_t slot = KEY_HASH_SLOT(req[1]);
+	/* window is absent from older sources, ack every key then */
+	int window = req.size() > 2 ? req[2].Int() : 1;
 	log_debug("sync_key: %s slot: %d", req[1].String().c_str(), slot);
 	ReadLockGuard<RWLock> guard(serv->ssdb_cluster->get_state_lock(slot));
 	int flag = 0;
@@ -731,7 +759,7 @@ int proc_migrate(NetworkServer *net, Link *link, const Request &req, Response *r
 		return 0;
 	}
 	if(flag) {
-		serv->ssdb_cluster->import_slot(link, req[1].String());
+		serv->ssdb_cluster->import_slot(link, req[1].String(), window);
 		return PROC_BACKEND;
 	} else {
 		log_warn("importing flag not set, reject impoting slot %d", slot);
@@ -1029,6 +1057,7 @@ int proc_unset_slot(NetworkServer *net, Link *link, const Request &req, Response
 int proc_migrate_result(NetworkServer *net, Link *link, const Request &req, Response *resp) {
 	SSDBServer *serv = (SSDBServer *)net->data;
 	resp->push_back(serv->ssdb_cluster->get_migrate_result());
+	resp->push_back(serv->ssdb_cluster->get_migrate_stats());
 	return 0;
 }
 
@@ -1154,6 +1183,14 @@ int proc_info(NetworkServer *net, Link *link, const Request &req, Response *resp
 		}
 	}
 
+	resp->push_back("\n");
+	resp->push_back("# binlog");
+	{
+		if (serv->binlog) {
+			resp->push_back(serv->binlog->stats() + "\n");
+		}
+	}
+
 	resp->push_back("\n");
 	resp->push_back("# slot");
 	{
@@ -1188,6 +1225,7 @@ int proc_info(NetworkServer *net, Link *link, const Request &req, Response *resp
 	{
 		uint64_t nexpires = serv->expiration->expires();
 		resp->push_back("expires:" + str(nexpires));
+		resp->push_back(serv->expiration->stats() + "\n");
 	}
 
 	if(req.size() == 1 || req[1] == "leveldb"){
@@ -1369,6 +1407,16 @@ int proc_change_master_to(NetworkServer *net, Link *link, const Request &req, Re
 		return 0;
 	}
 
+	/* the seqs applied per slot are those of the old master's binlog */
+	if (ip != serv->slave->mi->ip || port != serv->slave->mi->port
+			|| last_seq != serv->slave->mi->last_seq) {
+		if (serv->slave->reset_applied_seqs() == -1) {
+			resp->push_back("error");
+			resp->push_back("internal error");
+			return 0;
+		}
+	}
+
 	serv->slave->mi->ip = ip;
 	serv->slave->mi->port = port;
 	serv->slave->mi->last_seq = last_seq;
@@ -1495,8 +1543,7 @@ int proc_client_pause(NetworkServer *net, Link *link, const Request &req, Respon
 
 	int64_t spam = req[1].Int64();
 	log_info("proc_client_pause");
-	net->clients_paused = 1;
-	net->clients_pause_end_time = time_ms() + spam;
+	NetworkServer::pause_clients(spam);
 	resp->push_back("ok");
 	return 0;
 }
@@ -1537,3 +1584,33 @@ int proc_type(NetworkServer *net, Link *link, const Request &req, Response *resp
 	}
 	return 0;
 }
+
+CollectionStream::CollectionStream(SSDBServer *serv, const Bytes &key, uint64_t version){
+	this->serv = serv;
+	this->key = key.String();
+	this->version = version;
+	this->snapshot = serv->ssdb->get_snapshot();
+	this->checked = false;
+}
+
+CollectionStream::~CollectionStream(){
+	serv->ssdb->release_snapshot(snapshot);
+}
+
+int CollectionStream::next(Response *resp, int bytes){
+	if(!checked){
+		// the proc read the version just before the snapshot was taken
+		char op;
+		uint64_t current;
+		int exists = serv->ssdb->get_version(key, &op, &current, snapshot);
+		if(exists == -1){
+			return -1;
+		}
+		if(!exists || current != version){
+			log_error("%s changed before the snapshot, stream fails", hexmem(key.data(), key.size()).c_str());
+			return -1;
+		}
+		checked = true;
+	}
+	return read(resp, bytes);
+}
@@ -16,6 +16,8 @@ found in the LICENSE file.
 #include "backend_sync2.h"
 #include "slave.h"
 #include "net/server.h"
+#include "net/link.h"
+#include "net/stream.h"
 #include "cluster.h"
 #include "ssdb/binlog2.h"
 
@@ -66,6 +68,37 @@ public:
 	void init_slave(const Config &conf);
 };
 
+/**
+ * The reply of a big collection, streamed. Every chunk is read from a
+ * snapshot taken with the request, by a new iterator starting after the
+ * last element sent, so the reply is the whole collection as of the
+ * request even if the key is changed, deleted or replaced meanwhile.
+ * It fails only if the key changed between the proc and the snapshot.
+ **/
+class CollectionStream : public Stream
+{
+public:
+	CollectionStream(SSDBServer *serv, const Bytes &key, uint64_t version);
+	~CollectionStream();
+	int next(Response *resp, int bytes);
+
+protected:
+	SSDBServer *serv;
+	std::string key;
+	uint64_t version;
+	// every chunk is read from this, so the reply is the collection as of the request
+	const leveldb::Snapshot *snapshot;
+	bool checked;
+
+	// elements after the last ones read, 1: more to come, 0: done
+	virtual int read(Response *resp, int bytes) = 0;
+};
+
+// whether a reply of @size elements should be streamed to @link
+static inline bool use_stream(NetworkServer *net, Link *link, int64_t size){
+	return net->stream_threshold > 0 && size > net->stream_threshold && !link->is_redis();
+}
+
 #define CHECK_KV_KEY_RANGE(n) do{ \
 		if(!link->ignore_key_range && req.size() > n){ \
 			if(!serv->in_kv_range(req[n])){ \
@@ -215,4 +248,83 @@ do { \
 	} \
 } while(0)
 
+#define CHECK_CROSS_SLOT(req, resp, slot, step) \
+do{ \
+	slot = -1; \
+	for(Request::const_iterator it = req.begin()+1; it != req.end(); it += (step)) { \
+		int16_t s = KEY_HASH_SLOT((*it)); \
+		if(slot == -1) { \
+			slot = s; \
+		} else if (slot != s) { \
+			resp->clear(); \
+			resp->push_back("error"); \
+			resp->push_back("crossslot"); \
+			return 0; \
+		}\
+	}\
+} while(0)
+
+#define CHECK_MULTI_ASKING(serv, link, req, resp, slot, step) \
+do { \
+	int flag = 0; \
+	int ret = serv->ssdb_cluster->test_slot_importing(slot, &flag); \
+	if(ret != 0) { \
+		resp->clear(); \
+		resp->push_back("error"); \
+		resp->push_back("server get slot info failed"); \
+		log_warn("test slot importing failed");	\
+		return 0; \
+	} \
+	if(flag) { \
+		if(link->asking) { \
+			link->asking = false; \
+			for(Request::const_iterator it = req.begin()+1; it != req.end(); it += (step)) { \
+				uint64_t version; \
+				char op; \
+				int exists; \
+				CHECK_META((*it), op, version, exists); \
+				if(!exists) { \
+					resp->clear(); \
+					resp->push_back("error"); \
+					resp->push_back("tryagain"); \
+					return 0; \
+				} \
+			} \
+			break; \
+		} else { \
+			resp->clear(); \
+			resp->push_back("error"); \
+			resp->push_back("slot migrating"); \
+		}\
+		return 0;\
+	} \
+} while(0)
+
+#define CHECK_MULTI_ASK(serv, req, resp, slot, step) \
+do { \
+	if(migrating_slot == slot) { \
+		for(Request::const_iterator it = req.begin()+1; it != req.end(); it+= (step)) { \
+			CHECK_KEY(*it); \
+			KeyLock &key_lock = serv->ssdb_cluster->get_key_lock((*it).String()); \
+			if(key_lock.test_key((*it).String())) { \
+				resp->clear(); \
+				resp->push_back("error"); \
+				resp->push_back("tryagain"); \
+				return 0; \
+			} \
+			uint64_t version; \
+			char op; \
+			int exists; \
+			CHECK_META((*it), op, version, exists); \
+			if(!exists) { \
+				resp->clear(); \
+				resp->push_back("error"); \
+				resp->push_back("ask"); \
+				return 0; \
+			} \
+		} \
+		goto action; \
+	} \
+} while(0)
+
 #endif
@@ -10,6 +10,21 @@ found in the LICENSE file.
 #include "util/thread.h"
 #include "serv.h"
 
+/* key, in the data db, of the progress of a copy written in batches */
+#define COPY_PROGRESS_KEY	meta_key("MASTER_COPY_PROGRESS")
+/* key, in the data db, of the last seq written in a batch of events */
+#define SYNC_PROGRESS_KEY	meta_key("MASTER_SYNC_PROGRESS")
+/* key, in the data db, of the applied seq of a slot */
+#define APPLIED_SEQ_KEY(slot)	meta_key("SLOT_APPLIED_SEQ|" + str(slot))
+
+/* meta keys of the data db are in the reserve slot, like those of the cluster */
+static std::string meta_key(const std::string &name) {
+	std::string key = "\xff\xff\xff\xff\xff|" + name + "|KV";
+	int16_t reserve_slot = -1;
+	key.append((char*)&reserve_slot, sizeof(reserve_slot));
+	return key;
+}
+
 /*
 Slave::Slave(SSDB *ssdb, SSDB *meta, const char *ip, int port, bool is_mirror){
 	this->quit_thread = false;
@@ -54,6 +69,23 @@ Slave::Slave(SSDBServer *serv, SSDB *meta, int port) {
 	this->mi = new MasterInfo(new RplInfoHandler(this->meta));
 
 	this->connect_retry = 0;
+	this->sync_streams = 0;
+	this->copy_quit = false;
+	this->apply_threads = 0;
+	this->apply_batch = 0;
+	this->apply_batch_ms = 0;
+	this->batch_size = 0;
+	this->deferring = false;
+	this->saved_seq = 0;
+	this->unsaved = 0;
+	this->unsaved_since = 0;
+	this->apply_seq = 0;
+	this->apply_pending = 0;
+	this->apply_failed = false;
+	this->apply_quit = false;
+	pthread_mutex_init(&this->apply_mutex, NULL);
+	pthread_cond_init(&this->apply_cond, NULL);
+	this->applied_seqs.assign(CLUSTER_SLOTS, 0);
 	// statistics
 	this->copy_count = 0;
 	this->sync_count = 0;
@@ -71,6 +103,8 @@ Slave::~Slave(){
 	if (this->mi) {
 		delete this->mi;
 	}
+	pthread_cond_destroy(&this->apply_cond);
+	pthread_mutex_destroy(&this->apply_mutex);
 	log_debug("Slave finalized");
 }
 
@@ -107,6 +141,8 @@ std::string Slave::stats() const{
 
 void Slave::init() {
 	this->mi->load();
+	this->load_progress();
+	this->load_applied_seqs();
 }
 
 void Slave::start(){
@@ -191,7 +227,12 @@ int Slave::connect(){
 			}
 
 			log_info("send sync, last_seq=%" PRIu64 ", last_key=%s", this->mi->last_seq, this->mi->last_key.c_str());
-			link->send("sync140", str(this->mi->last_seq), this->mi->last_key, str(this->server_port));
+			if (this->sync_streams > 1) {
+				link->send("sync140", str(this->mi->last_seq), this->mi->last_key, str(this->server_port),
+						str(this->sync_streams));
+			} else {
+				link->send("sync140", str(this->mi->last_seq), this->mi->last_key, str(this->server_port));
+			}
 			if (link->flush() == -1) {
 				log_error("network error");
 				delete link;
@@ -219,13 +260,20 @@ void* Slave::_run_thread(void *arg){
 #define MAX_RECV_TIMEOUT	300 * 1000
 #define MAX_RECV_IDLE		(MAX_RECV_TIMEOUT/RECV_TIMEOUT)
 
+	slave->start_apply_workers();
+
 	while(true){
+		slave->save_apply_progress();
 		if(slave->quit_thread) {
 			if(slave->failover_seq <= 0 || slave->failover_seq == slave->mi->last_seq) {
 				break;
 			}
 		}
 		if(reconnect){
+			slave->stop_copy_streams(true);
+			/* resume from what is applied for sure */
+			slave->drain();
+			slave->flush_progress();
 			slave->status = DISCONNECTED;
 			reconnect = false;
 			select.del(slave->link->fd());
@@ -248,6 +296,10 @@ void* Slave::_run_thread(void *arg){
 			sleep(1);
 			continue;
 		} else if (events->empty()) {
+			if (slave->flush_progress() != 0) {
+				reconnect = true;
+				continue;
+			}
 			if (idle++ >= MAX_RECV_IDLE) {
 				log_error("the master hasn't responsed for awhile, reconnect...");
 				idle = 0;
@@ -288,6 +340,10 @@ void* Slave::_run_thread(void *arg){
 		} // end while (1)
 	} // end while (!this->quit-thread)
 
+	slave->stop_copy_streams(true);
+	slave->drain();
+	slave->stop_apply_workers();
+	slave->flush_progress();
 	slave->running = false;
 	slave->failover_seq = 0;
 	log_info("Slave thread quit, last_seq=%" PRIu64", last_key=%s", slave->mi->last_seq, slave->mi->last_key.c_str());
@@ -349,11 +405,28 @@ v2:
 }
 
 int Slave::proc(const LogEvent &event, const std::vector<Bytes> &req){
+	if (this->apply_batch > 0) {
+		if (event.type() == BinlogType::COPY && event.cmd() == BinlogCommand::RAW) {
+			return this->proc_raw_batched(event);
+		}
+		/* what is batched goes first, unless the event joins it */
+		bool joins = (event.type() == BinlogType::SYNC || event.type() == BinlogType::MIRROR)
+				&& this->apply_workers.empty();
+		if (!joins && this->unsaved > 0 && this->flush_progress() != 0) {
+			return -1;
+		}
+	}
 	switch(event.type()){
 		case BinlogType::NOOP:
+			if (this->drain() != 0 || this->flush_progress() != 0) {
+				return -1;
+			}
 			return this->proc_noop(event, req);
 			break;
 		case BinlogType::COPY:{
+			if (this->drain() != 0) {
+				return -1;
+			}
 			status = COPY;
 			log_debug("slave proc [copy] key[%s] seq[%" PRIu64 "]",
 					hexmem(event.key().data(), event.key().size()).c_str(), event.seq());
@@ -368,6 +441,12 @@ int Slave::proc(const LogEvent &event, const std::vector<Bytes> &req){
 					sync_count, this->mi->last_seq, event.seq());
 			}
 			log_debug("slave proc [sync] key[%s] seq[%lu]", event.key().data(), event.seq());
+			if (!this->apply_workers.empty()) {
+				return this->dispatch(event, req[0]);
+			}
+			if (this->apply_batch > 0) {
+				return this->proc_sync_batched(event);
+			}
 			return this->proc_sync(event, req);
 			break;
 		}
@@ -394,6 +473,8 @@ int Slave::proc_noop(const LogEvent &event, const std::vector<Bytes> &req){
 int Slave::proc_copy(const LogEvent &event, const std::vector<Bytes> &req) {
 	switch(event.cmd()){
 		case BinlogCommand::BEGIN:
+			this->stop_copy_streams(true);
+
 			/* disbale workers */
 			log_info("full sync detected, disable server...");
 			serv->net->pause();
@@ -406,6 +487,8 @@ int Slave::proc_copy(const LogEvent &event, const std::vector<Bytes> &req) {
 			/* flush db */
 			serv->ssdb->flushdb();
 
+			this->applied_seqs.assign(CLUSTER_SLOTS, 0);
+
 			log_info("reset binlog...");
 			/* reset binlog */
 			if (serv->binlog->reset() != 0) {
@@ -429,13 +512,24 @@ int Slave::proc_copy(const LogEvent &event, const std::vector<Bytes> &req) {
 
 			log_info("copy begin");
 			break;
+		case BinlogCommand::PARALLEL:
+			log_info("copy in %s streams", event.key().String().c_str());
+			if (this->start_copy_streams(event.key().Int()) != 0) {
+				return -1;
+			}
+			break;
 		case BinlogCommand::END:
+			if (!this->copy_streams.empty() && this->stop_copy_streams(false) != 0) {
+				log_error("copy streams failed, copy again");
+				return -1;
+			}
 			log_info("copy end, copy_count=%" PRIu64 ", last_seq=%" PRIu64 ", seq=%" PRIu64,
 				copy_count, this->mi->last_seq, event.seq());
 			this->status = SYNC;
 			this->mi->last_seq = event.seq();
 			this->mi->last_key = "";
 			this->save_progress(true);
+			serv->ssdb->raw_del(COPY_PROGRESS_KEY);
 			break;
 		default:
 			if(++copy_count % 1000 == 1){
@@ -448,7 +542,609 @@ int Slave::proc_copy(const LogEvent &event, const std::vector<Bytes> &req) {
 	return 0;
 }
 
+int Slave::start_copy_streams(int n) {
+	this->stop_copy_streams(true);
+	this->copy_quit = false;
+	for (int i = 0; i < n; i++) {
+		CopyStream *stream = new CopyStream();
+		stream->slave = this;
+		stream->index = i;
+		stream->status = 0;
+		stream->keys = 0;
+		int err = pthread_create(&stream->tid, NULL, &Slave::_copy_thread, stream);
+		if (err != 0) {
+			log_error("can't create thread: %s", strerror(err));
+			delete stream;
+			this->stop_copy_streams(true);
+			return -1;
+		}
+		this->copy_streams.push_back(stream);
+	}
+	return 0;
+}
+
+/* @return -1 if any of the streams did not finish its range */
+int Slave::stop_copy_streams(bool abort) {
+	if (abort) {
+		this->copy_quit = true;
+	}
+	int ret = 0;
+	for (size_t i = 0; i < this->copy_streams.size(); i++) {
+		CopyStream *stream = this->copy_streams[i];
+		pthread_join(stream->tid, NULL);
+		if (stream->status != 1) {
+			ret = -1;
+		}
+		this->copy_count += stream->keys;
+		delete stream;
+	}
+	this->copy_streams.clear();
+	return ret;
+}
+
+void* Slave::_copy_thread(void *arg) {
+	SET_PROC_NAME("replicator_copy");
+	CopyStream *stream = (CopyStream *)arg;
+	int ret = stream->slave->copy_range(stream);
+	stream->status = ret == 0 ? 1 : -1;
+	return (void *)NULL;
+}
+
+int Slave::copy_range(CopyStream *stream) {
+	const char *ip = this->mi->ip.c_str();
+	int port = this->mi->port;
+	int ret = -1;
+	int idle = 0;
+	Fdevents select;
+	const Fdevents::events_t *events;
+	std::vector<std::string> kvs;
+
+	Link *link = Link::connect(ip, port);
+	if (link == NULL) {
+		log_error("failed to connect to master: %s:%d %s", ip, port, strerror(errno));
+		return -1;
+	}
+	if (!this->mi->auth.empty()) {
+		const std::vector<Bytes> *resp = link->request("auth", this->mi->auth);
+		if (resp == NULL || resp->empty() || resp->at(0) != "ok") {
+			log_error("auth error");
+			delete link;
+			return -1;
+		}
+	}
+	link->send("sync_range", str(this->server_port), str(stream->index));
+	if (link->flush() == -1) {
+		log_error("network error");
+		delete link;
+		return -1;
+	}
+	select.set(link->fd(), FDEVENT_IN, 0, NULL);
+
+	while (!this->copy_quit) {
+		events = select.wait(RECV_TIMEOUT);
+		if (events == NULL) {
+			log_error("events.wait error: %s", strerror(errno));
+			break;
+		} else if (events->empty()) {
+			if (idle++ >= MAX_RECV_IDLE) {
+				log_error("copy range %d, the master hasn't responsed for awhile", stream->index);
+				break;
+			}
+			continue;
+		}
+		idle = 0;
+		if (link->read() <= 0) {
+			log_error("copy range %d, link.read error: %s", stream->index, strerror(errno));
+			break;
+		}
+
+		bool end = false;
+		bool error = false;
+		while (!end) {
+			const std::vector<Bytes> *req = link->recv();
+			if (req == NULL) {
+				log_error("copy range %d, link.recv error: %s", stream->index, strerror(errno));
+				error = true;
+				break;
+			} else if (req->empty()) {
+				break;
+			}
+			LogEvent event;
+			if (event.load(req->at(0)) < 0 || event.type() != BinlogType::COPY) {
+				log_error("copy range %d, unexpected event: %s", stream->index,
+						hexmem(req->at(0).data(), req->at(0).size()).c_str());
+				error = true;
+				break;
+			}
+			if (event.cmd() == BinlogCommand::END) {
+				end = true;
+			} else if (event.cmd() == BinlogCommand::RAW) {
+				kvs.push_back(event.key().String());
+				kvs.push_back(event.val().String());
+			}
+		}
+		if (error) {
+			break;
+		}
+		/* everything read so far in one write */
+		if (!kvs.empty()) {
+			if (serv->ssdb->raw_multi_set(kvs) == -1) {
+				break;
+			}
+			stream->keys += kvs.size() / 2;
+			kvs.clear();
+		}
+		if (end) {
+			log_info("copy range %d end, %" PRIu64 " keys", stream->index, stream->keys);
+			ret = 0;
+			break;
+		}
+	}
+
+	select.del(link->fd());
+	delete link;
+	return ret;
+}
+
+#define MAX_APPLY_PENDING	10000
+
+void Slave::start_apply_workers() {
+	for (int i = 0; i < this->apply_threads && this->apply_threads > 1; i++) {
+		ApplyWorker *worker = new ApplyWorker();
+		worker->slave = this;
+		pthread_cond_init(&worker->cond, NULL);
+		int err = pthread_create(&worker->tid, NULL, &Slave::_apply_thread, worker);
+		if (err != 0) {
+			log_error("can't create thread: %s", strerror(err));
+			pthread_cond_destroy(&worker->cond);
+			delete worker;
+			break;
+		}
+		this->apply_workers.push_back(worker);
+	}
+	if (!this->apply_workers.empty()) {
+		log_info("apply binlog on %d threads", (int)this->apply_workers.size());
+	}
+}
+
+void Slave::stop_apply_workers() {
+	pthread_mutex_lock(&this->apply_mutex);
+	this->apply_quit = true;
+	for (size_t i = 0; i < this->apply_workers.size(); i++) {
+		pthread_cond_signal(&this->apply_workers[i]->cond);
+	}
+	pthread_mutex_unlock(&this->apply_mutex);
+
+	for (size_t i = 0; i < this->apply_workers.size(); i++) {
+		ApplyWorker *worker = this->apply_workers[i];
+		pthread_join(worker->tid, NULL);
+		pthread_cond_destroy(&worker->cond);
+		delete worker;
+	}
+	this->apply_workers.clear();
+	this->apply_quit = false;
+}
+
+/* queue the event on the worker of its slot, @return -1 if a worker failed */
+int Slave::dispatch(const LogEvent &event, const Bytes &raw) {
+	ApplyWorker *worker = this->apply_workers[event_slot(event) % this->apply_workers.size()];
+
+	pthread_mutex_lock(&this->apply_mutex);
+	while (this->apply_pending >= MAX_APPLY_PENDING && !this->apply_failed) {
+		pthread_cond_wait(&this->apply_cond, &this->apply_mutex);
+	}
+	if (this->apply_failed) {
+		pthread_mutex_unlock(&this->apply_mutex);
+		return -1;
+	}
+	if (this->apply_inflight.empty() && this->mi->last_seq > this->apply_seq) {
+		/* moved on by a noop or a copy */
+		this->apply_seq = this->mi->last_seq;
+	}
+	this->apply_inflight[event.seq()] = false;
+	this->apply_pending ++;
+	worker->queue.push_back(raw.String());
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&this->apply_mutex);
+	return 0;
+}
+
+/* wait for the workers to take care of every event queued, @return -1 if any failed */
+int Slave::drain() {
+	if (this->apply_workers.empty()) {
+		return 0;
+	}
+	pthread_mutex_lock(&this->apply_mutex);
+	while (this->apply_pending > 0) {
+		pthread_cond_wait(&this->apply_cond, &this->apply_mutex);
+	}
+	int ret = this->apply_failed ? -1 : 0;
+	/* the ones after a failed event are sent again, apply() skips those
+	 * another worker got done */
+	this->apply_inflight.clear();
+	this->apply_failed = false;
+	pthread_mutex_unlock(&this->apply_mutex);
+
+	this->save_apply_progress();
+	return ret;
+}
+
+/* last_seq only moves to where all events before are applied */
+void Slave::save_apply_progress() {
+	if (this->apply_workers.empty()) {
+		return;
+	}
+	pthread_mutex_lock(&this->apply_mutex);
+	uint64_t seq = this->apply_seq;
+	pthread_mutex_unlock(&this->apply_mutex);
+	if (seq > this->mi->last_seq) {
+		this->mi->last_seq = seq;
+		this->save_progress();
+	}
+}
+
+void* Slave::_apply_thread(void *arg) {
+	SET_PROC_NAME("replicator_apply");
+	ApplyWorker *worker = (ApplyWorker *)arg;
+	Slave *slave = worker->slave;
+	std::deque<std::string> batch;
+
+	while (true) {
+		pthread_mutex_lock(&slave->apply_mutex);
+		while (worker->queue.empty() && !slave->apply_quit) {
+			pthread_cond_wait(&worker->cond, &slave->apply_mutex);
+		}
+		if (worker->queue.empty()) {
+			pthread_mutex_unlock(&slave->apply_mutex);
+			break;
+		}
+		batch.swap(worker->queue);
+		bool failed = slave->apply_failed;
+		pthread_mutex_unlock(&slave->apply_mutex);
+
+		/* take all queued at once, and report them at once */
+		std::vector<uint64_t> applied;
+		for (size_t i = 0; i < batch.size() && !failed; i++) {
+			LogEvent event;
+			if (event.load(batch[i]) < 0 || slave->apply(event) < 0) {
+				failed = true;
+				break;
+			}
+			applied.push_back(event.seq());
+		}
+
+		pthread_mutex_lock(&slave->apply_mutex);
+		for (size_t i = 0; i < applied.size(); i++) {
+			slave->apply_inflight[applied[i]] = true;
+		}
+		while (!slave->apply_inflight.empty() && slave->apply_inflight.begin()->second) {
+			slave->apply_seq = slave->apply_inflight.begin()->first;
+			slave->apply_inflight.erase(slave->apply_inflight.begin());
+		}
+		if (failed) {
+			slave->apply_failed = true;
+		}
+		slave->apply_pending -= (int)batch.size();
+		pthread_cond_broadcast(&slave->apply_cond);
+		pthread_mutex_unlock(&slave->apply_mutex);
+		batch.clear();
+	}
+	return (void *)NULL;
+}
+
 int Slave::proc_sync(const LogEvent &event, const std::vector<Bytes> &req){
+	int ret = this->apply(event);
+	if (ret < 0) {
+		return ret;
+	}
+
+	this->mi->last_seq = event.seq();
+	if(event.type() == BinlogType::COPY){
+		this->mi->last_key = event.key().String();
+	}
+	this->save_progress(event.type() == BinlogType::COPY);
+
+	return 0;
+}
+
+/*
+ * The events of a key are written in the batch, with the progress, and the
+ * batch is written before an event reads that key again. Those that write
+ * on their own are applied between two batches.
+ */
+int Slave::proc_sync_batched(const LogEvent &event) {
+	bool defer = deferrable(event);
+	std::string name = event_name(event);
+	if ((!defer || this->batch_keys.count(name)) && this->batch_size > 0) {
+		if (this->flush_progress() != 0) {
+			return -1;
+		}
+	}
+	if (this->unsaved == 0) {
+		this->unsaved_since = time_ms();
+		this->saved_seq = this->mi->last_seq;
+		this->saved_key = this->mi->last_key;
+	}
+
+	this->deferring = defer;
+	int ret = this->apply(event);
+	this->deferring = false;
+	if (ret < 0) {
+		return ret;
+	}
+	if (defer) {
+		this->batch_keys.insert(name);
+		this->batch_size ++;
+	}
+	this->unsaved ++;
+	this->mi->last_seq = event.seq();
+	if (this->batch_full()) {
+		return this->flush_progress();
+	}
+	return 0;
+}
+
+bool Slave::batch_full() {
+	if (this->unsaved >= this->apply_batch) {
+		return true;
+	}
+	return this->apply_batch_ms > 0 && this->unsaved > 0
+		&& time_ms() - this->unsaved_since >= this->apply_batch_ms;
+}
+
+/* copied keys are blind writes, a batch of them and the progress go in one write */
+int Slave::proc_raw_batched(const LogEvent &event) {
+	if (this->unsaved == 0) {
+		this->unsaved_since = time_ms();
+		this->saved_seq = this->mi->last_seq;
+		this->saved_key = this->mi->last_key;
+	}
+	this->batch.Put(leveldb::Slice(event.key().data(), event.key().size()),
+			leveldb::Slice(event.val().data(), event.val().size()));
+	this->batch_size ++;
+	this->unsaved ++;
+	if(++copy_count % 1000 == 1){
+		log_debug("copy_count=%" PRIu64 ", last_seq=%" PRIu64 ", seq=%" PRIu64 "",
+			copy_count, this->mi->last_seq, event.seq());
+	}
+	this->status = COPY;
+	this->mi->last_seq = event.seq();
+	this->mi->last_key = event.key().String();
+	if (this->batch_full()) {
+		return this->flush_progress();
+	}
+	return 0;
+}
+
+/* a batched event is logged once the batch is written, others right away */
+void Slave::binlog_write(char cmd, const Bytes &key) {
+	if (!this->deferring) {
+		serv->binlog->write(BinlogType::SYNC, cmd, key);
+		return;
+	}
+	Unlogged u;
+	u.cmd = cmd;
+	u.key = key.String();
+	u.has_val = false;
+	this->unlogged.push_back(u);
+}
+
+void Slave::binlog_write(char cmd, const Bytes &key, const Bytes &val) {
+	if (!this->deferring) {
+		serv->binlog->write(BinlogType::SYNC, cmd, key, val);
+		return;
+	}
+	Unlogged u;
+	u.cmd = cmd;
+	u.key = key.String();
+	u.val = val.String();
+	u.has_val = true;
+	this->unlogged.push_back(u);
+}
+
+/* write what is batched along with the progress, @return -1 on error */
+int Slave::flush_progress() {
+	if (this->unsaved == 0) {
+		return 0;
+	}
+	bool copying = !this->mi->last_key.empty();
+	this->unsaved = 0;
+	if (this->batch_size > 0) {
+		if (copying) {
+			this->batch.Put(COPY_PROGRESS_KEY, str(this->mi->last_seq) + "\n" + this->mi->last_key);
+		} else {
+			this->batch.Put(SYNC_PROGRESS_KEY, str(this->mi->last_seq));
+		}
+		leveldb::Status s = serv->ssdb->write(leveldb::WriteOptions(), &this->batch);
+		this->batch.Clear();
+		this->batch_size = 0;
+		this->batch_keys.clear();
+		if (!s.ok()) {
+			log_error("write batched events failed: %s", s.ToString().c_str());
+			/* resume from what the db has, the events come again */
+			this->unlogged.clear();
+			this->mi->last_seq = this->saved_seq;
+			this->mi->last_key = this->saved_key;
+			return -1;
+		}
+		/* only what the db has goes in our binlog */
+		for (size_t i = 0; i < this->unlogged.size(); i++) {
+			const Unlogged &u = this->unlogged[i];
+			if (u.has_val) {
+				serv->binlog->write(BinlogType::SYNC, u.cmd, u.key, u.val);
+			} else {
+				serv->binlog->write(BinlogType::SYNC, u.cmd, u.key);
+			}
+		}
+		this->unlogged.clear();
+	}
+	/* in the meta db too, behind the data */
+	this->save_progress(copying);
+	return 0;
+}
+
+/* the batches may have got further than the meta db knows */
+void Slave::load_progress() {
+	std::string val;
+	if (this->mi->last_key.empty()) {
+		if (serv->ssdb->raw_get(SYNC_PROGRESS_KEY, &val) == 1
+				&& str_to_uint64(val) > this->mi->last_seq) {
+			this->mi->last_seq = str_to_uint64(val);
+			log_info("sync progress, last_seq=%" PRIu64, this->mi->last_seq);
+		}
+		return;
+	}
+	if (serv->ssdb->raw_get(COPY_PROGRESS_KEY, &val) != 1) {
+		return;
+	}
+	size_t pos = val.find('\n');
+	if (pos == std::string::npos) {
+		return;
+	}
+	this->mi->last_seq = str_to_uint64(val.substr(0, pos));
+	this->mi->last_key = val.substr(pos + 1);
+	log_info("copy progress, last_seq=%" PRIu64 ", last_key=%s", this->mi->last_seq,
+			hexmem(this->mi->last_key.data(), this->mi->last_key.size()).c_str());
+}
+
+/* the key an event changes, some events carry it encoded with a field */
+std::string Slave::event_name(const LogEvent &event) {
+	std::string k, f;
+	uint64_t seq;
+	switch(event.cmd()){
+	case BinlogCommand::H_SET:
+	case BinlogCommand::H_INCR:
+	case BinlogCommand::H_DECR:
+		if (decode_hash_key_ex(event.key(), &k, &f) == 0) {
+			return k;
+		}
+		break;
+	case BinlogCommand::Z_SET:
+	case BinlogCommand::Z_INCR:
+	case BinlogCommand::Z_DECR:
+		if (decode_zset_key_ex(event.key(), &k, &f) == 0) {
+			return k;
+		}
+		break;
+	case BinlogCommand::Q_SET:
+		if (decode_qitem_key_ex(event.key(), &k, &seq) == 0) {
+			return k;
+		}
+		break;
+	default:
+		break;
+	}
+	return event.key().String();
+}
+
+int Slave::event_slot(const LogEvent &event) {
+	return KEY_HASH_SLOT(event_name(event));
+}
+
+/* @return false if applying the event twice is not the same as once */
+bool Slave::idempotent(const LogEvent &event) {
+	switch(event.cmd()){
+	case BinlogCommand::K_INCR:
+	case BinlogCommand::K_DECR:
+	case BinlogCommand::H_INCR:
+	case BinlogCommand::H_DECR:
+	case BinlogCommand::Z_INCR:
+	case BinlogCommand::Z_DECR:
+	case BinlogCommand::Z_POP_FRONT:
+	case BinlogCommand::Z_POP_BACK:
+	case BinlogCommand::Q_PUSH_FRONT:
+	case BinlogCommand::Q_PUSH_BACK:
+	case BinlogCommand::Q_POP_FRONT:
+	case BinlogCommand::Q_POP_BACK:
+		return false;
+	default:
+		return true;
+	}
+}
+
+/* @return true if the event is applied in a single commit, that can be batched */
+bool Slave::deferrable(const LogEvent &event) {
+	switch(event.cmd()){
+	case BinlogCommand::K_SET:
+	case BinlogCommand::K_DEL:
+	case BinlogCommand::K_INCR:
+	case BinlogCommand::K_DECR:
+	case BinlogCommand::K_SETBIT:
+	case BinlogCommand::H_SET:
+	case BinlogCommand::H_DEL:
+	case BinlogCommand::H_INCR:
+	case BinlogCommand::H_DECR:
+	case BinlogCommand::Z_SET:
+	case BinlogCommand::Z_DEL:
+	case BinlogCommand::Z_INCR:
+	case BinlogCommand::Z_DECR:
+	case BinlogCommand::Z_POP_FRONT:
+	case BinlogCommand::Z_POP_BACK:
+	case BinlogCommand::Q_PUSH_FRONT:
+	case BinlogCommand::Q_PUSH_BACK:
+	case BinlogCommand::Q_POP_FRONT:
+	case BinlogCommand::Q_POP_BACK:
+	case BinlogCommand::Q_SET:
+	case BinlogCommand::S_SET:
+	case BinlogCommand::S_DEL:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * A batched event is written with the progress, so it is never applied
+ * twice. Otherwise the slot's applied seq goes in the same write as an
+ * event that is not safe to apply twice.
+ */
+void Slave::prepare(Transaction &trans, const LogEvent &event) {
+	if (this->deferring) {
+		trans.defer(&this->batch);
+		return;
+	}
+	if (event.type() == BinlogType::COPY || idempotent(event)) {
+		return;
+	}
+	trans.attach(APPLIED_SEQ_KEY(event_slot(event)), str(event.seq()));
+}
+
+/* one get per slot, most of them have none */
+void Slave::load_applied_seqs() {
+	this->applied_seqs.assign(CLUSTER_SLOTS, 0);
+	for (int slot = 0; slot < CLUSTER_SLOTS; slot++) {
+		std::string val;
+		if (serv->ssdb->raw_get(APPLIED_SEQ_KEY(slot), &val) == 1) {
+			this->applied_seqs[slot] = str_to_uint64(val);
+		}
+	}
+}
+
+int Slave::reset_applied_seqs() {
+	if (serv->ssdb->raw_del(SYNC_PROGRESS_KEY) == -1) {
+		log_error("del sync progress failed");
+		return -1;
+	}
+	for (int slot = 0; slot < CLUSTER_SLOTS; slot++) {
+		if (this->applied_seqs[slot] == 0) {
+			continue;
+		}
+		if (serv->ssdb->raw_del(APPLIED_SEQ_KEY(slot)) == -1) {
+			log_error("del applied seq of slot %d failed", slot);
+			return -1;
+		}
+		this->applied_seqs[slot] = 0;
+	}
+	return 0;
+}
+
+int Slave::apply(const LogEvent &event){
+	int slot = event_slot(event);
+	if (event.type() != BinlogType::COPY && event.seq() <= this->applied_seqs[slot]) {
+		/* sent again after a crash or a failed event, the slot has got past it */
+		log_debug("skip applied binlog, seq=%" PRIu64 ", slot=%d", event.seq(), slot);
+		return 0;
+	}
 
 	int ret = 0;
 	switch(event.cmd()){
@@ -569,13 +1265,9 @@ int Slave::proc_sync(const LogEvent &event, const std::vector<Bytes> &req){
 		log_error("apply binlog event failed seq=%" PRIu64 ", cmd=%" PRIu8, event.seq(), (unsigned char)event.cmd());
 		return ret;
 	}
-
-	this->mi->last_seq = event.seq();
-	if(event.type() == BinlogType::COPY){
-		this->mi->last_key = event.key().String();
+	if (!idempotent(event) && event.type() != BinlogType::COPY && !this->deferring) {
+		this->applied_seqs[slot] = event.seq();
 	}
-	this->save_progress(event.type() == BinlogType::COPY);
-
 	return 0;
 }
 
@@ -616,9 +1308,10 @@ int Slave::proc_k_set(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, key);
+	this->prepare(trans, event);
 	int ret = serv->ssdb->set(key, val, trans, version);
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::K_SET,
+		this->binlog_write(BinlogCommand::K_SET,
 				key, val);
 	}
 
@@ -631,9 +1324,10 @@ int Slave::proc_k_del(const LogEvent &event) {
 	Bytes key = event.key();
 
 	Transaction trans(serv->ssdb, key);
+	this->prepare(trans, event);
 	int ret = serv->ssdb->del(key, trans);
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::K_DEL, key);
+		this->binlog_write(BinlogCommand::K_DEL, key);
 	}
 
 	serv->expiration->del_ttl(key);
@@ -659,10 +1353,11 @@ int Slave::proc_k_incr(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, key);
+	this->prepare(trans, event);
 	int64_t new_val;
 	int ret = serv->ssdb->incr(key, by, &new_val, trans, version);
 	if (ret > 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::K_INCR,
+		this->binlog_write(BinlogCommand::K_INCR,
 				key, val);
 	}
 
@@ -688,10 +1383,11 @@ int Slave::proc_k_decr(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, key);
+	this->prepare(trans, event);
 	int64_t new_val;
 	int ret = serv->ssdb->incr(key, dir*by, &new_val, trans, version);
 	if (ret > 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::K_DECR,
+		this->binlog_write(BinlogCommand::K_DECR,
 				key, val);
 	}
 	return ret;
@@ -710,7 +1406,7 @@ int Slave::proc_k_expire(const LogEvent &event) {
 	if (ret == 1) {
 		ret = serv->expiration->set_ttl(key, val.Int());
 		if (ret >= 0 && serv->binlog) {
-			serv->binlog->write(BinlogType::SYNC, BinlogCommand::K_EXPIRE,
+			this->binlog_write(BinlogCommand::K_EXPIRE,
 					key, val);
 		}
 	}
@@ -732,7 +1428,7 @@ int Slave::proc_k_expire_at(const LogEvent &event) {
 		int64_t span = val.Int64()-time(NULL);
 		ret = serv->expiration->set_ttl(key, span);
 		if (ret >= 0 && serv->binlog) {
-			serv->binlog->write(BinlogType::SYNC, BinlogCommand::K_EXPIRE_AT,
+			this->binlog_write(BinlogCommand::K_EXPIRE_AT,
 					key, val);
 		}
 	}
@@ -759,9 +1455,10 @@ int Slave::proc_k_setbit(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, key);
+	this->prepare(trans, event);
 	int ret = serv->ssdb->setbit(key, offset, on, trans, version);
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::K_SETBIT,
+		this->binlog_write(BinlogCommand::K_SETBIT,
 				key, val);
 	}
 
@@ -790,10 +1487,11 @@ int Slave::proc_h_set(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, k);
+	this->prepare(trans, event);
 	ret = serv->ssdb->hset(Bytes(k.data(), k.size()),
 			Bytes(f.data(), f.size()), val, trans, version);
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::H_SET, key, val);
+		this->binlog_write(BinlogCommand::H_SET, key, val);
 	}
 
 	return ret;
@@ -814,10 +1512,11 @@ int Slave::proc_h_del(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, key);
+	this->prepare(trans, event);
 	int ret = serv->ssdb->hdel(Bytes(key.data(), key.size()),
 			Bytes(field.data(), field.size()), trans, version);
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::H_DEL, key, field);
+		this->binlog_write(BinlogCommand::H_DEL, key, field);
 	}
 
 	return ret;
@@ -839,7 +1538,7 @@ int Slave::proc_h_clear(const LogEvent &event) {
 	Transaction trans(serv->ssdb, key);
 	int64_t count = serv->ssdb->hclear(key, trans, version);
 	if (count >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::H_CLEAR, key);
+		this->binlog_write(BinlogCommand::H_CLEAR, key);
 	}
 
 	return count >= 0 ? 0 : -1;
@@ -870,11 +1569,12 @@ int Slave::proc_h_incr(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, k);
+	this->prepare(trans, event);
 	int64_t new_val;
 	ret = serv->ssdb->hincr(Bytes(k.data(), k.size()),
 			Bytes(f.data(), f.size()), by, &new_val, trans, version);
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::H_INCR, key, val);
+		this->binlog_write(BinlogCommand::H_INCR, key, val);
 	}
 
 	return ret;
@@ -906,11 +1606,12 @@ int Slave::proc_h_decr(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, k);
+	this->prepare(trans, event);
 	int64_t new_val;
 	ret = serv->ssdb->hincr(Bytes(k.data(), k.size()),
 			Bytes(f.data(), f.size()), dir*by, &new_val, trans, version);
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::H_DECR,
+		this->binlog_write(BinlogCommand::H_DECR,
 				key, val);
 	}
 
@@ -939,10 +1640,11 @@ int Slave::proc_z_set(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, k);
+	this->prepare(trans, event);
 	ret = serv->ssdb->zset(Bytes(k.data(), k.size()),
 			Bytes(f.data(), f.size()), val, trans, version);
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Z_SET, key, val);
+		this->binlog_write(BinlogCommand::Z_SET, key, val);
 	}
 
 	return ret;
@@ -963,9 +1665,10 @@ int Slave::proc_z_del(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, key);
+	this->prepare(trans, event);
 	int ret = serv->ssdb->zdel(key, field, trans, version);
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Z_DEL, key, field);
+		this->binlog_write(BinlogCommand::Z_DEL, key, field);
 	}
 
 	return ret;
@@ -1009,7 +1712,7 @@ int Slave::proc_z_clear(const LogEvent &event) {
 	}
 
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Z_CLEAR, key);
+		this->binlog_write(BinlogCommand::Z_CLEAR, key);
 	}
 
 	return ret;
@@ -1041,10 +1744,11 @@ int Slave::proc_z_incr(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, k);
+	this->prepare(trans, event);
 	ret = serv->ssdb->zincr(Bytes(k.data(), k.size()),
 			Bytes(f.data(), f.size()), by, &new_val, trans, version);
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Z_INCR,
+		this->binlog_write(BinlogCommand::Z_INCR,
 				key, val);
 	}
 
@@ -1078,23 +1782,24 @@ int Slave::proc_z_decr(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, k);
+	this->prepare(trans, event);
 	ret = serv->ssdb->zincr(Bytes(k.data(), k.size()),
 			Bytes(f.data(), f.size()), dir*by, &new_val, trans, version);
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Z_DECR,
+		this->binlog_write(BinlogCommand::Z_DECR,
 				key, val);
 	}
 
 	return ret;
 }
 
-int Slave::zpop(ZIterator *it, SSDBServer *serv, const Bytes &key, Transaction &trans) {
+/* every member popped in one commit */
+int Slave::zpop(ZIterator *it, SSDBServer *serv, const Bytes &key, Transaction &trans, uint64_t version) {
+	std::vector<std::string> fields;
 	while (it->next()) {
-		int ret = serv->ssdb->zdel(key, it->key, trans, it->version);
-		if (ret < 0)
-			return ret;
+		fields.push_back(it->key);
 	}
-	return 0;
+	return serv->ssdb->multi_zdel(key, fields, trans, version) < 0 ? -1 : 0;
 }
 
 int Slave::proc_z_pop_front(const LogEvent &event) {
@@ -1113,12 +1818,13 @@ int Slave::proc_z_pop_front(const LogEvent &event) {
 
 	uint64_t limit = val.Uint64();
 	Transaction trans(serv->ssdb, key);
+	this->prepare(trans, event);
 	ZIterator *it = serv->ssdb->zscan(key, "", "", "", limit, version);
-	int ret = zpop(it, serv, key, trans);
+	int ret = zpop(it, serv, key, trans, version);
 	delete it;
 
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Z_POP_FRONT,
+		this->binlog_write(BinlogCommand::Z_POP_FRONT,
 				key, val);
 	}
 
@@ -1141,12 +1847,13 @@ int Slave::proc_z_pop_back(const LogEvent &event) {
 
 	uint64_t limit = val.Uint64();
 	Transaction trans(serv->ssdb, key);
+	this->prepare(trans, event);
 	ZIterator *it = serv->ssdb->zrscan(key, "", "", "", limit, version);
-	int ret = zpop(it, serv, key, trans);
+	int ret = zpop(it, serv, key, trans, version);
 	delete it;
 
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Z_POP_BACK,
+		this->binlog_write(BinlogCommand::Z_POP_BACK,
 				key, val);
 	}
 
@@ -1169,9 +1876,10 @@ int Slave::proc_q_push_front(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, key);
+	this->prepare(trans, event);
 	size = serv->ssdb->qpush_front(key, item, trans, version);
 	if (size >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Q_PUSH_FRONT,
+		this->binlog_write(BinlogCommand::Q_PUSH_FRONT,
 				key, item);
 	}
 
@@ -1195,9 +1903,10 @@ int Slave::proc_q_push_back(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, key);
+	this->prepare(trans, event);
 	size = serv->ssdb->qpush_back(key, item, trans, version);
 	if (size >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Q_PUSH_BACK,
+		this->binlog_write(BinlogCommand::Q_PUSH_BACK,
 				key, item);
 	}
 
@@ -1221,21 +1930,16 @@ int Slave::proc_q_pop_front(const LogEvent &event) {
 		return -1;
 	}
 
-	int ret = 0;
+	/* every pop and the applied mark in one commit */
 	Transaction trans(serv->ssdb, key);
-	while (size-- > 0) {
-		std::string item;
-		ret = serv->ssdb->qpop_front(key, &item, trans, version);
-		if (ret <= 0) {
-			break;
-		}
-	}
+	this->prepare(trans, event);
+	int64_t ret = serv->ssdb->qtrim_front(key, size, trans, version);
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Q_POP_FRONT,
+		this->binlog_write(BinlogCommand::Q_POP_FRONT,
 				key, val);
 	}
 
-	return ret;
+	return ret>=0 ? 0 : -1;
 }
 
 int Slave::proc_q_pop_back(const LogEvent &event) {
@@ -1255,21 +1959,16 @@ int Slave::proc_q_pop_back(const LogEvent &event) {
 		return -1;
 	}
 
-	int ret = 0;
+	/* every pop and the applied mark in one commit */
 	Transaction trans(serv->ssdb, key);
-	while (size-- > 0) {
-		std::string item;
-		ret = serv->ssdb->qpop_back(key, &item, trans, version);
-		if (ret <= 0) {
-			break;
-		}
-	}
+	this->prepare(trans, event);
+	int64_t ret = serv->ssdb->qtrim_back(key, size, trans, version);
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Q_POP_BACK,
+		this->binlog_write(BinlogCommand::Q_POP_BACK,
 				key, val);
 	}
 
-	return ret;
+	return ret>=0 ? 0 : -1;
 }
 
 int Slave::proc_q_fix(const LogEvent &event) {
@@ -1281,7 +1980,7 @@ int Slave::proc_q_fix(const LogEvent &event) {
 	int ret = serv->ssdb->qfix(key, trans);
 
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Q_FIX, key);
+		this->binlog_write(BinlogCommand::Q_FIX, key);
 	}
 
 	return ret;*/
@@ -1314,7 +2013,7 @@ int Slave::proc_q_clear(const LogEvent &event) {
 		}
 	}
 	if (ret >= 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Q_CLEAR, key);
+		this->binlog_write(BinlogCommand::Q_CLEAR, key);
 	}
 
 	return ret;
@@ -1344,9 +2043,10 @@ int Slave::proc_q_set(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, k);
+	this->prepare(trans, event);
 	ret = serv->ssdb->qset(k, index, val, trans, version);
 	if (ret > 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC, BinlogCommand::Q_SET, key, val);
+		this->binlog_write(BinlogCommand::Q_SET, key, val);
 	}
 
 	return ret>0 ? 0 : -1;
@@ -1367,10 +2067,10 @@ int Slave::proc_s_set(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, key);
+	this->prepare(trans, event);
 	int ret = serv->ssdb->sset(key, item, trans, version);
 	if (ret > 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC,
-				BinlogCommand::S_SET, key, item);
+		this->binlog_write(BinlogCommand::S_SET, key, item);
 	}
 
 	return ret;
@@ -1391,10 +2091,10 @@ int Slave::proc_s_del(const LogEvent &event) {
 	}
 
 	Transaction trans(serv->ssdb, key);
+	this->prepare(trans, event);
 	int ret = serv->ssdb->sdel(key, item, trans, version);
 	if (ret > 0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC,
-			BinlogCommand::S_DEL, key, item);
+		this->binlog_write(BinlogCommand::S_DEL, key, item);
 	}
 
 	return ret;
@@ -1416,8 +2116,7 @@ int Slave::proc_s_clear(const LogEvent &event) {
 	Transaction trans(serv->ssdb, key);
 	int ret = serv->ssdb->sclear(key, trans, version);
 	if (ret >0 && serv->binlog) {
-		serv->binlog->write(BinlogType::SYNC,
-			BinlogCommand::S_CLEAR, key);
+		this->binlog_write(BinlogCommand::S_CLEAR, key);
 	}
 	return ret;
 }
@@ -10,8 +10,12 @@ found in the LICENSE file.
 #include <string>
 #include <pthread.h>
 #include <vector>
+#include <deque>
+#include <map>
+#include <set>
 #include "ssdb/ssdb_impl.h"
 #include "ssdb/logevent.h"
+#include "leveldb/write_batch.h"
 #include "net/link.h"
 #include "rpl_mi.h"
 
@@ -52,14 +56,90 @@ private:
 	int proc_copy(const LogEvent &event, const std::vector<Bytes> &req);
 
 	int proc_sync(const LogEvent &event, const std::vector<Bytes> &req);
+	int apply(const LogEvent &event);
+
+	// per slot, the seq of the last event applied that must not be applied twice,
+	// written in the same write as the event, unless the event is batched
+	std::vector<uint64_t> applied_seqs;
+	static std::string event_name(const LogEvent &event);
+	static int event_slot(const LogEvent &event);
+	static bool idempotent(const LogEvent &event);
+	static bool deferrable(const LogEvent &event);
+	void prepare(Transaction &trans, const LogEvent &event);
+	void load_applied_seqs();
 
 	unsigned int connect_retry;
 	int connect();
 	bool connected() { return link != NULL; }
 
+	// parallel copy, one link per range of the master's snapshot
+	struct CopyStream{
+		Slave *slave;
+		int index;
+		pthread_t tid;
+		volatile int status;       /* 0: running, 1: done, -1: failed */
+		uint64_t keys;
+	};
+	std::vector<CopyStream *> copy_streams;
+	volatile bool copy_quit;
+	int start_copy_streams(int n);
+	int stop_copy_streams(bool abort);
+	static void* _copy_thread(void *arg);
+	int copy_range(CopyStream *stream);
+
+	// parallel apply, the events of one slot always go to the same worker
+	struct ApplyWorker{
+		Slave *slave;
+		pthread_t tid;
+		pthread_cond_t cond;
+		std::deque<std::string> queue;    /* raw events */
+	};
+	std::vector<ApplyWorker *> apply_workers;
+	pthread_mutex_t apply_mutex;
+	pthread_cond_t apply_cond;            /* an event is applied */
+	std::map<uint64_t, bool> apply_inflight;    /* seq => applied, in master order */
+	uint64_t apply_seq;                   /* every event up to it is applied */
+	int apply_pending;                    /* dispatched, not yet taken care of */
+	bool apply_failed;
+	bool apply_quit;
+	void start_apply_workers();
+	void stop_apply_workers();
+	int dispatch(const LogEvent &event, const Bytes &raw);
+	int drain();
+	void save_apply_progress();
+	static void* _apply_thread(void *arg);
+
+	// batched apply
+	leveldb::WriteBatch batch;            /* copied keys and events not written yet */
+	int batch_size;
+	std::set<std::string> batch_keys;     /* keys with events in the batch */
+	bool deferring;                       /* the event being applied goes in the batch */
+	uint64_t saved_seq;                   /* the progress the db has, if the batch is lost */
+	std::string saved_key;
+	int unsaved;                          /* events applied since the progress was saved */
+	int64_t unsaved_since;
+	struct Unlogged {
+		char cmd;
+		std::string key;
+		std::string val;
+		bool has_val;
+	};
+	std::vector<Unlogged> unlogged;       /* binlog of the batched events, written after the batch */
+	void binlog_write(char cmd, const Bytes &key);
+	void binlog_write(char cmd, const Bytes &key, const Bytes &val);
+	bool batch_full();
+	int proc_raw_batched(const LogEvent &event);
+	int proc_sync_batched(const LogEvent &event);
+	int flush_progress();
+	void load_progress();
+
 public:
 	std::string auth;
 	int failover_seq;
+	int sync_streams;          /* ask the master to copy on this many links */
+	int apply_threads;         /* apply binlog events on this many threads */
+	int apply_batch;           /* events between two progress saves, 0: every event */
+	int apply_batch_ms;        /* at most this long between two progress saves */
 
 	Slave(SSDBServer *serv, SSDB *meta, int serv_port);
 	~Slave();
@@ -79,6 +159,8 @@ public:
 public:
 	void init();
 	void save_progress(bool include_last_key = false);
+	// forget what was applied from the old master, before following another one
+	int reset_applied_seqs();
 
 private:
 	// KV
@@ -124,7 +206,7 @@ private:
 	int proc_raw(const LogEvent &event);
 
 private:
-	static int zpop(ZIterator *iter, SSDBServer *serv, const Bytes &name, Transaction &trans);
+	static int zpop(ZIterator *iter, SSDBServer *serv, const Bytes &name, Transaction &trans, uint64_t version);
 };
 
 #endif
@@ -57,11 +57,16 @@ void MyApplication::run(){
 	log_info("max_open_files   : %d", option.max_open_files);
 	log_info("compaction_speed : %d MB/s", option.compaction_speed);
 	log_info("compression      : %s", option.compression.c_str());
+	log_info("meta_cache_size  : %d MB", option.meta_cache_size);
+	log_info("zset_rank_index  : %d members", option.zset_rank_threshold);
 	log_info("binlog           : %s", option.binlog? "yes" : "no");
 	log_info("binlog dir       : %s", option.binlog_dir.c_str());
 	log_info("max_binlog_size  : %d MB", option.max_binlog_size);
 	log_info("purge_logs_span  : %" PRIu64 " s", option.purge_logs_span);
 	log_info("sync_binlog      : %d", option.sync_binlog);
+	log_info("group_commit     : %d, max_batch: %d, max_delay: %d us", option.binlog_group_commit,
+			option.binlog_group_max_batch, option.binlog_group_max_delay);
+	log_info("binlog_index     : every %d seqs", option.binlog_index_interval);
 	log_info("sync_speed       : %d MB/s", conf->get_num("replication.sync_speed"));
 
 	if (option.max_binlog_size == 0) {
@@ -106,6 +111,9 @@ void MyApplication::run(){
 	        mkdir(option.binlog_dir.c_str(),S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
 		binlog = new SSDB_BinLog(meta_db, option.binlog_dir,
 				option.max_binlog_size, option.sync_binlog, option.purge_logs_span);
+		binlog->set_group_commit(option.binlog_group_commit,
+				option.binlog_group_max_batch, option.binlog_group_max_delay);
+		binlog->set_index_interval(option.binlog_index_interval);
 
 		if (binlog->recover() != 0) {
 			log_fatal("binlog recover failed.");
@@ -17,6 +17,9 @@ found in the LICENSE file.
 #define BINLOG_READ_BUFFER_SIZE		1024*1024
 #define BINLOG_WRITE_BUFFER_SIZE	1024*1024
 
+#define BINLOG_GROUP_MAX_BATCH		128
+#define BINLOG_GROUP_MAX_DELAY		0
+
 const std::string SSDB_BinLog::BINLOG_FILE_LIST = "\xff\xff\xff\xff\xff|BINLOG_FILE_LIST|QUEUE";
 const std::string SSDB_BinLog::BINLOG_LAST_SEQ = "\xff\xff\xff\xff\xff|BINLOG_LAST_SEQ|KV";
 
@@ -39,9 +42,27 @@ SSDB_BinLog::SSDB_BinLog(SSDB *meta, const std::string &dir, uint64_t max_binlog
 	this->active_log_size = 0;
 
 	this->purge_logs_span = purge_span;
+	this->index_interval = 0;
+	this->last_written_seq = 0;
+
+	this->group_commit = false;
+	this->group_max_batch = BINLOG_GROUP_MAX_BATCH;
+	this->group_max_delay = BINLOG_GROUP_MAX_DELAY;
+	this->group_leader_active = false;
+	this->group_enqueued = 0;
+	this->group_committed = 0;
+
+	this->stat_group_commits = 0;
+	this->stat_group_events = 0;
+	this->stat_group_max_size = 0;
+	this->stat_fsyncs = 0;
+	this->stat_fsync_us = 0;
+	this->stat_fsync_max_us = 0;
 
 	pthread_mutex_init(&this->mutex, NULL);
 	pthread_cond_init(&this->cond, NULL);
+	pthread_cond_init(&this->group_leader_cond, NULL);
+	pthread_cond_init(&this->group_done_cond, NULL);
 }
 
 SSDB_BinLog::~SSDB_BinLog() {
@@ -53,6 +74,22 @@ SSDB_BinLog::~SSDB_BinLog() {
 	if (writer) {
 		delete writer;
 	}
+
+	pthread_cond_destroy(&this->group_leader_cond);
+	pthread_cond_destroy(&this->group_done_cond);
+}
+
+void SSDB_BinLog::set_index_interval(uint32_t interval) {
+	this->index_interval = interval;
+	this->writer->set_index_interval(interval);
+}
+
+void SSDB_BinLog::set_group_commit(bool enable, int max_batch, int max_delay) {
+	pthread_mutex_lock(&mutex);
+	this->group_commit = enable;
+	this->group_max_batch = max_batch > 0 ? max_batch : BINLOG_GROUP_MAX_BATCH;
+	this->group_max_delay = max_delay > 0 ? max_delay : 0;
+	pthread_mutex_unlock(&mutex);
 }
 
 int SSDB_BinLog::erase_befores(size_t idx) {
@@ -131,6 +168,7 @@ int SSDB_BinLog::recover() {
 		log_error("load last seq failed.");
 		return -1;
 	}
+	last_written_seq = last_seq;
 
 	// load binlog name list
 	std::vector<std::string> tmp_files;
@@ -195,6 +233,13 @@ int SSDB_BinLog::recover() {
 
 			reader.unbind();
 			logfile.close();
+
+			// binlogs written before index enabled, or index lost
+			if (index_interval > 0 && !file_exists(LogIndex::index_name(filename))) {
+				if (LogIndex::rebuild(filename, index_interval) != 0) {
+					log_warn("rebuild index of (%s) failed", filename.c_str());
+				}
+			}
 		}
 
 		if (first_valid_binlog_idx > 0) {
@@ -218,7 +263,7 @@ int SSDB_BinLog::rotate() {
 	std::string next_filename = generate_name(next_file_num);
 
 	/* don't increase seq for rotate event */
-	LogEvent rotate_event(last_seq, BinlogType::SYNC, BinlogCommand::ROTATE,
+	LogEvent rotate_event(last_written_seq, BinlogType::SYNC, BinlogCommand::ROTATE,
 			Bytes(next_filename));
 	if (writer->write(&rotate_event) != 0) {
 		log_error("write rotate event failed.");
@@ -276,8 +321,9 @@ int SSDB_BinLog::new_file() {
 	}
 	writer->bind(active_log);
 
-	/* don't increase seq for new file */
-	LogEvent desc_event(last_seq, BinlogType::SYNC, BinlogCommand::DESC);
+	/* don't increase seq for new file, events with larger seq may be
+	 * still pending in group commit queue */
+	LogEvent desc_event(last_written_seq, BinlogType::SYNC, BinlogCommand::DESC);
 	writer->write(&desc_event);
 	writer->flush_to_file();
 
@@ -289,7 +335,7 @@ int SSDB_BinLog::new_file() {
 		return -1;
 	}
 	files.push_back(filename);
-	files_min_seq.insert(std::make_pair<std::string, uint64_t>(filename, last_seq));
+	files_min_seq.insert(std::make_pair<std::string, uint64_t>(filename, last_written_seq));
 
 	return 0;
 }
@@ -317,7 +363,12 @@ int SSDB_BinLog::write_impl(LogEvent *event) {
 
 	if (event) {
 		statistic(event->repr().size());
-		return writer->write(event);
+		if (writer->write(event) != 0) {
+			return -1;
+		}
+		if (event->seq() != SSDB_BINLOG_RESEVE_SEQ) {
+			last_written_seq = event->seq();
+		}
 	}
 
 	return 0;
@@ -338,6 +389,9 @@ int SSDB_BinLog::write_impl(LogEventBatch *batch) {
 			if (writer->write(batch->events[i]) != 0) {
 				return -1;
 			}
+			if (batch->events[i]->seq() != SSDB_BINLOG_RESEVE_SEQ) {
+				last_written_seq = batch->events[i]->seq();
+			}
 		}
 	}
 
@@ -369,10 +423,8 @@ int SSDB_BinLog::write(LogEvent *event) {
 	return ret;
 }
 
-int SSDB_BinLog::write(char type, char cmd) {
-	int ret = 0;
-
-	this->pre_write();
+uint64_t SSDB_BinLog::assign_seq(char cmd) {
+	// assert this->mutex held.
 
 	uint64_t target_seq = SSDB_BINLOG_RESEVE_SEQ;
 	unsigned char v = (unsigned char)cmd;
@@ -381,6 +433,146 @@ int SSDB_BinLog::write(char type, char cmd) {
 		this->incr_seq();
 		target_seq = last_seq;
 	}
+	return target_seq;
+}
+
+void SSDB_BinLog::group_lead() {
+	// assert this->mutex held, and still held on return.
+
+	group_leader_active = true;
+
+	/* wait a while for followers to fill up the batch */
+	if (group_max_delay > 0 && group_pending.events.size() < group_max_batch) {
+		struct timeval now;
+		struct timespec ts;
+		gettimeofday(&now, NULL);
+		uint64_t usec = now.tv_usec + group_max_delay;
+		ts.tv_sec = now.tv_sec + usec / 1000000;
+		ts.tv_nsec = (usec % 1000000) * 1000;
+		while (group_pending.events.size() < group_max_batch) {
+			if (pthread_cond_timedwait(&group_leader_cond, &mutex, &ts) == ETIMEDOUT) {
+				break;
+			}
+		}
+	}
+
+	/* take at most group_max_batch events, the rest is left to next leader */
+	LogEventBatch batch;
+	std::vector<LogEvent *> &pending = group_pending.events;
+	size_t n = pending.size() < group_max_batch ? pending.size() : group_max_batch;
+	batch.events.assign(pending.begin(), pending.begin() + n);
+	pending.erase(pending.begin(), pending.begin() + n);
+	uint64_t first_ticket = group_committed;
+	uint64_t last_ticket = group_committed + n;
+
+	pthread_mutex_unlock(&mutex);
+
+	/* we are the only one touching writer now */
+	bool synced = false;
+	uint64_t sync_us = 0;
+	int ret = this->write_impl(&batch);
+	if (ret != 0) {
+		log_error("write event batch failed. ret(%d).", ret);
+	}
+	if (ret == 0 && (ret = this->flush()) != 0) {
+		log_error("flush binlog failed. ret(%d).", ret);
+	}
+	if (ret == 0 && sync_binlog) {
+		synced = true;
+		if ((ret = this->sync_file(&sync_us)) != 0) {
+			log_error("sync binlog failed. ret(%d).", ret);
+		}
+	}
+
+	pthread_mutex_lock(&mutex);
+
+	stat_group_commits++;
+	stat_group_events += n;
+	if (n > stat_group_max_size) {
+		stat_group_max_size = n;
+	}
+	if (synced) {
+		stat_fsync(sync_us);
+	}
+	if (ret != 0 && n > 0) {
+		group_errors[last_ticket] = first_ticket;
+	}
+	group_committed = last_ticket;
+	group_leader_active = false;
+
+	broadcast_update();
+	pthread_cond_broadcast(&group_done_cond);
+}
+
+int SSDB_BinLog::group_write(LogEvent *event) {
+	// assert this->mutex held, released on return.
+
+	group_pending.add_event(event);
+	uint64_t ticket = ++group_enqueued;
+	return group_wait(ticket, ticket);
+}
+
+int SSDB_BinLog::group_write(LogEventBatch *batch) {
+	// assert this->mutex held, released on return.
+
+	/* the events are owned by group_pending from now on */
+	uint64_t first_ticket = group_enqueued + 1;
+	for (size_t i = 0; i < batch->events.size(); i++) {
+		group_pending.add_event(batch->events[i]);
+	}
+	group_enqueued += batch->events.size();
+	batch->events.clear();
+	return group_wait(first_ticket, group_enqueued);
+}
+
+int SSDB_BinLog::group_wait(uint64_t first_ticket, uint64_t last_ticket) {
+	// assert this->mutex held, released on return.
+
+	std::multiset<uint64_t>::iterator waiter = group_waiters.insert(first_ticket);
+
+	if (group_leader_active && group_pending.events.size() >= group_max_batch) {
+		pthread_cond_signal(&group_leader_cond);
+	}
+
+	while (group_committed < last_ticket) {
+		if (!group_leader_active) {
+			/* no leader right now, take over and flush pending events */
+			group_lead();
+			continue;
+		}
+		pthread_cond_wait(&group_done_cond, &mutex);
+	}
+
+	/* failed ranges are disjoint and ordered, only the first one ending at or
+	 * after our first ticket may overlap with our tickets */
+	int ret = 0;
+	std::map<uint64_t, uint64_t>::iterator it = group_errors.lower_bound(first_ticket);
+	if (it != group_errors.end() && it->second < last_ticket) {
+		ret = -1;
+	}
+
+	/* ranges ending before the first ticket of every waiter left can't concern
+	 * anyone anymore, later writers only get tickets after group_enqueued */
+	group_waiters.erase(waiter);
+	uint64_t oldest = group_waiters.empty() ? group_enqueued + 1 : *group_waiters.begin();
+	while (!group_errors.empty() && group_errors.begin()->first < oldest) {
+		group_errors.erase(group_errors.begin());
+	}
+
+	pthread_mutex_unlock(&mutex);
+
+	return ret;
+}
+
+int SSDB_BinLog::write(char type, char cmd) {
+	int ret = 0;
+
+	this->pre_write();
+
+	uint64_t target_seq = assign_seq(cmd);
+	if (group_commit) {
+		return group_write(new LogEvent(target_seq, type, cmd));
+	}
 
 	LogEvent event(target_seq, type, cmd);
 	ret = write(&event);
@@ -395,12 +587,9 @@ int SSDB_BinLog::write(char type, char cmd, const Bytes &key, uint64_t ttl) {
 
 	this->pre_write();
 
-	uint64_t target_seq = SSDB_BINLOG_RESEVE_SEQ;
-	unsigned char v = (unsigned char)cmd;
-	if (v >= SSDB_SYNC_CMD_MIN && v <= SSDB_SYNC_CMD_MAX) {
-		/* incr seq for validate cmd only */
-		this->incr_seq();
-		target_seq = last_seq;
+	uint64_t target_seq = assign_seq(cmd);
+	if (group_commit) {
+		return group_write(new LogEvent(target_seq, type, cmd, key, ttl));
 	}
 
 	LogEvent event(target_seq, type, cmd, key, ttl);
@@ -416,13 +605,11 @@ int SSDB_BinLog::write(char type, char cmd, const Bytes &key, const Bytes &val,
 
 	this->pre_write();
 
-	uint64_t target_seq = SSDB_BINLOG_RESEVE_SEQ;
-	unsigned char v = (unsigned char)cmd;
-	if (v >= SSDB_SYNC_CMD_MIN && v <= SSDB_SYNC_CMD_MAX) {
-		/* incr seq for validate cmd only */
-		this->incr_seq();
-		target_seq = last_seq;
+	uint64_t target_seq = assign_seq(cmd);
+	if (group_commit) {
+		return group_write(new LogEvent(target_seq, type, cmd, key, val, ttl));
 	}
+
 	LogEvent event(target_seq, type, cmd, key, val, ttl);
 	ret = write(&event);
 
@@ -431,12 +618,103 @@ int SSDB_BinLog::write(char type, char cmd, const Bytes &key, const Bytes &val,
 	return ret;
 }
 
+int SSDB_BinLog::write(char type, char cmd, const std::vector<std::string> &keys) {
+	if (keys.empty()) {
+		return 0;
+	}
+
+	this->pre_write();
+
+	LogEventBatch batch;
+	for (size_t i = 0; i < keys.size(); i++) {
+		uint64_t target_seq = assign_seq(cmd);
+		batch.add_event(new LogEvent(target_seq, type, cmd, keys[i]));
+	}
+	return write_batch(&batch);
+}
+
+int SSDB_BinLog::write(char type, char cmd, const Bytes &key, const std::vector<std::string> &vals) {
+	if (vals.empty()) {
+		return 0;
+	}
+
+	this->pre_write();
+
+	LogEventBatch batch;
+	for (size_t i = 0; i < vals.size(); i++) {
+		uint64_t target_seq = assign_seq(cmd);
+		batch.add_event(new LogEvent(target_seq, type, cmd, key, vals[i]));
+	}
+	return write_batch(&batch);
+}
+
+// called after pre_write()
+int SSDB_BinLog::write_batch(LogEventBatch *batch) {
+	if (group_commit) {
+		return group_write(batch);
+	}
+
+	int ret = this->write_impl(batch);
+	if (ret != 0) {
+		log_error("write event batch failed. ret(%d).", ret);
+	}
+	if (ret == 0 && (ret = this->flush()) != 0) {
+		log_error("flush binlog failed. ret(%d).", ret);
+	}
+	if (ret == 0 && sync_binlog && (ret = this->sync()) != 0) {
+		log_error("sync binlog failed. ret(%d).", ret);
+	}
+
+	this->post_write();
+
+	return ret;
+}
+
 int SSDB_BinLog::flush() {
 	return writer->flush_to_file();
 }
 
 int SSDB_BinLog::sync() {
-	return writer->sync_file();
+	uint64_t us = 0;
+	int ret = sync_file(&us);
+	stat_fsync(us);
+	return ret;
+}
+
+int SSDB_BinLog::sync_file(uint64_t *us) {
+	double start = millitime();
+	int ret = writer->sync_file();
+	*us = (uint64_t)((millitime() - start) * 1000 * 1000);
+	return ret;
+}
+
+void SSDB_BinLog::stat_fsync(uint64_t us) {
+	// assert this->mutex held.
+
+	stat_fsyncs++;
+	stat_fsync_us += us;
+	if (us > stat_fsync_max_us) {
+		stat_fsync_max_us = us;
+	}
+}
+
+std::string SSDB_BinLog::stats() const {
+	std::string s;
+	s.append("binlog_last_seq:" + str(last_seq) + "\n");
+	s.append("binlog_group_commit:" + str(group_commit ? 1 : 0) + "\n");
+	s.append("binlog_group_max_batch:" + str((uint64_t)group_max_batch) + "\n");
+	s.append("binlog_group_max_delay:" + str(group_max_delay) + "\n");
+	s.append("binlog_group_commits:" + str(stat_group_commits) + "\n");
+	s.append("binlog_group_events:" + str(stat_group_events) + "\n");
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.2f", stat_group_commits > 0 ?
+			(double)stat_group_events / stat_group_commits : 0.0);
+	s.append("binlog_group_avg_size:" + std::string(buf) + "\n");
+	s.append("binlog_group_peak_size:" + str(stat_group_max_size) + "\n");
+	s.append("binlog_fsyncs:" + str(stat_fsyncs) + "\n");
+	s.append("binlog_fsync_avg_us:" + str(stat_fsyncs > 0 ? stat_fsync_us / stat_fsyncs : 0) + "\n");
+	s.append("binlog_fsync_max_us:" + str(stat_fsync_max_us));
+	return s;
 }
 
 std::string SSDB_BinLog::find_binlog(uint64_t seq) const {
@@ -480,6 +758,7 @@ int SSDB_BinLog::clean() {
 int SSDB_BinLog::reset() {
 	stop();
 	last_seq = 0;
+	last_written_seq = 0;
 	save_last_seq();
 
 	if (clean() < 0) {
@@ -594,6 +873,7 @@ int SSDB_BinLog::purge_logs(const std::string &to_log, bool included) {
 			log_error("remove binlog (%s) failed, errno(%d)", logname.c_str(), errno);
 			return -1;
 		}
+		unlink(LogIndex::index_name(filename).c_str());
 
 		files.pop_front();
 		files_min_seq.erase(logname);
@@ -9,6 +9,7 @@ found in the LICENSE file.
 #include <string>
 #include <list>
 #include <map>
+#include <set>
 #include <pthread.h>
 #include "ssdb.h"
 #include "logevent.h"
@@ -42,9 +43,35 @@ private:
 	uint64_t active_log_size;
 
 	uint64_t purge_logs_span;
+	uint32_t index_interval;
 
 	std::map<std::string, uint32_t> inuse_binlogs;
 
+	/* seq of the last event handed to writer, lags last_seq in group commit mode */
+	uint64_t last_written_seq;
+
+	// group commit
+	bool group_commit;
+	size_t group_max_batch;          /* max events flushed by one leader */
+	int group_max_delay;             /* us, leader waits for followers at most */
+	bool group_leader_active;
+	LogEventBatch group_pending;
+	uint64_t group_enqueued;         /* ticket of the last enqueued event */
+	uint64_t group_committed;        /* ticket of the last flushed event */
+	/* failed tickets (begin, end], keyed by end, kept until no waiter may still need them */
+	std::map<uint64_t, uint64_t> group_errors;
+	std::multiset<uint64_t> group_waiters;  /* first ticket of every writer in group_wait */
+	pthread_cond_t group_leader_cond;
+	pthread_cond_t group_done_cond;
+
+	// statistic
+	uint64_t stat_group_commits;
+	uint64_t stat_group_events;
+	uint64_t stat_group_max_size;
+	uint64_t stat_fsyncs;
+	uint64_t stat_fsync_us;
+	uint64_t stat_fsync_max_us;
+
 public:
 	// update cond
 	pthread_mutex_t mutex;
@@ -64,6 +91,15 @@ private:
 
 	int clean();
 
+	uint64_t assign_seq(char cmd);
+	int group_write(LogEvent *event);
+	int group_write(LogEventBatch *batch);
+	int write_batch(LogEventBatch *batch);
+	int group_wait(uint64_t first_ticket, uint64_t last_ticket);
+	void group_lead();
+	int sync_file(uint64_t *us);
+	void stat_fsync(uint64_t us);
+
 public:
 	SSDB_BinLog(SSDB *meta, const std::string &dir, uint64_t max_binlog_size=0, bool sync=false, time_t purge_span = 0);
 	~SSDB_BinLog();
@@ -83,10 +119,25 @@ public:
 	int write(char type, char cmd);
 	int write(char type, char cmd, const Bytes &key, uint64_t ttl=0);
 	int write(char type, char cmd, const Bytes &key, const Bytes &val, uint64_t ttl=0);
+	/* an event for every key, with consecutive seqs and flushed(and fsynced) at once */
+	int write(char type, char cmd, const std::vector<std::string> &keys);
+	/* an event (key, val) for every val, written the same way */
+	int write(char type, char cmd, const Bytes &key, const std::vector<std::string> &vals);
 
 	int flush();
+	/* the caller must hold this->mutex */
 	int sync();
 
+	/*
+	 * group commit: concurrent writers enqueue events, one of them
+	 * becomes the leader and flushes(and fsyncs) the whole batch.
+	 * @max_delay in microseconds, 0 means don't wait for followers.
+	 */
+	void set_group_commit(bool enable, int max_batch, int max_delay);
+	/* index every @interval seqs of each binlog, 0 disable, call before recover() */
+	void set_index_interval(uint32_t interval);
+	std::string stats() const;
+
 	void incr_inuse(const std::string &binlog);
 	void decr_inuse(const std::string &binlog);
 	bool inuse(const std::string &binlog);
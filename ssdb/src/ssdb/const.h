@@ -18,6 +18,7 @@ public:
 	static const char ZSET		= 's'; // key => score
 	static const char ZSCORE	= 'z'; // key|score => ""
 	static const char ZSIZE		= 'Z';
+	static const char ZRANK		= 'r'; // key|level|bucket => count
 	static const char SET		= 'm';
 	static const char SSIZE		= 'M';
 	static const char QUEUE		= 'q';
@@ -59,6 +60,8 @@ public:
 	static const char BEGIN	= 7;
 	static const char END	= 8;
 	static const char ACK	= 9;
+	/* a copy split into key ranges, each sent on its own link */
+	static const char PARALLEL	= 17;
 
 	static const char STOP		= 125;
 	static const char DESC		= 126;
@@ -100,6 +100,10 @@ void KIterator::return_val(bool onoff){
 	this->return_val_ = onoff;
 }
 
+Bytes KIterator::raw_val(){
+	return it->val();
+}
+
 bool KIterator::next(){
 	while(it->next()){
 		Bytes ks = it->key();
@@ -136,6 +140,10 @@ void HIterator::return_val(bool onoff){
 	this->return_val_ = onoff;
 }
 
+Bytes HIterator::raw_val(){
+	return it->val();
+}
+
 bool HIterator::next(){
 	while(it->next()){
 		Bytes ks = it->key();
@@ -163,12 +171,18 @@ bool HIterator::next(){
 ZIterator::ZIterator(Iterator *it, const Bytes &key){
 	this->it = it;
 	this->key.assign(key.data(), key.size());
+	this->return_val_ = true;
+	this->raw_score_ = 0;
 }
 
 ZIterator::~ZIterator(){
 	delete it;
 }
 
+void ZIterator::return_val(bool onoff){
+	this->return_val_ = onoff;
+}
+
 bool ZIterator::skip(uint64_t offset){
 	while(offset-- > 0){
 		if(this->next() == false){
@@ -187,13 +201,17 @@ bool ZIterator::next(){
 		if(ks.data()[0] != DataType::ZSCORE){
 			return false;
 		}
-		std::string k;
-		if(decode_zscore_key(ks, &k, &field, &score, &version) == -1){
+		Bytes k;
+		if(decode_zscore_key(ks, &k, &raw_field_, &raw_score_, &version) == -1){
 			continue;
 		}
-		if(k != this->key) {
+		if(k != Bytes(this->key)) {
 			return false;
 		}
+		if(return_val_){
+			field.assign(raw_field_.data(), raw_field_.size());
+			score = str(raw_score_);
+		}
 		return true;
 	}
 	return false;
@@ -241,12 +259,21 @@ bool SIterator::next() {
 QIterator::QIterator(Iterator *it, const Bytes &key) {
 	this->it = it;
 	this->key.assign(key.data(), key.size());
+	this->return_val_ = true;
 }
 
 QIterator::~QIterator() {
 	delete it;
 }
 
+void QIterator::return_val(bool onoff) {
+	this->return_val_ = onoff;
+}
+
+Bytes QIterator::raw_val() {
+	return it->val();
+}
+
 bool QIterator::skip(uint64_t offset) {
 	while(offset-- > 0) {
 		if(this->next() == false) {
@@ -270,7 +297,9 @@ bool QIterator::next() {
 		if(k != this->key) {
 			return false;
 		}
-		this->val.assign(v.data(), v.size());
+		if(return_val_) {
+			this->val.assign(v.data(), v.size());
+		}
 		return true;
 	}
 	return false;
@@ -50,6 +50,8 @@ public:
 	~KIterator();
 	void return_val(bool onoff);
 	bool next();
+	// the value in db, without copying it into val, valid until next()
+	Bytes raw_val();
 private:
 	Iterator *it;
 	bool return_val_;
@@ -67,6 +69,8 @@ public:
 	~HIterator();
 	void return_val(bool onoff);
 	bool next();
+	// the value in db, without copying it into val, valid until next()
+	Bytes raw_val();
 private:
 	Iterator *it;
 	bool return_val_;
@@ -82,10 +86,22 @@ public:
 
 	ZIterator(Iterator *it, const Bytes &key);
 	~ZIterator();
+	// false: leave field and score empty, use raw_field() and raw_score()
+	void return_val(bool onoff);
 	bool skip(uint64_t offset);
 	bool next();
+	// the field in db, without copying it into field, valid until next()
+	Bytes raw_field(){
+		return raw_field_;
+	}
+	int64_t raw_score(){
+		return raw_score_;
+	}
 private:
 	Iterator *it;
+	bool return_val_;
+	Bytes raw_field_;
+	int64_t raw_score_;
 };
 
 
@@ -112,10 +128,14 @@ public:
 	uint64_t version;
 	QIterator(Iterator *it, const Bytes &key);
 	~QIterator();
+	void return_val(bool onoff);
 	bool skip(uint64_t offset);
 	bool next();
+	// the value in db, without copying it into val, valid until next()
+	Bytes raw_val();
 private:
 	Iterator *it;
+	bool return_val_;
 };
 
 #endif
@@ -8,9 +8,85 @@ found in the LICENSE file.
 #include "../include.h"
 #include "../util/log.h"
 #include "../util/strings.h"
+#include "../util/file.h"
 #include <map>
 #include <stdlib.h>
 
+/* LogIndex */
+
+#define LOG_INDEX_ENTRY_LEN (2*sizeof(uint64_t))
+
+int LogIndex::lookup(const std::string &logname, uint64_t seq, uint64_t *offset) {
+	int fd = ::open(index_name(logname).c_str(), O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+
+	// binary search, a partial entry at the tail is ignored
+	int found = 0;
+	char entry[LOG_INDEX_ENTRY_LEN];
+	uint64_t lo = 0;
+	uint64_t hi = filesize(fd) / LOG_INDEX_ENTRY_LEN;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (pread(fd, entry, LOG_INDEX_ENTRY_LEN, mid * LOG_INDEX_ENTRY_LEN) != (ssize_t)LOG_INDEX_ENTRY_LEN) {
+			log_error("read index of (%s) failed, errno(%d).", logname.c_str(), errno);
+			::close(fd);
+			return -1;
+		}
+		if (LogEvent::unpack64(entry) <= seq) {
+			*offset = LogEvent::unpack64(entry + sizeof(uint64_t));
+			found = 1;
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	::close(fd);
+	return found;
+}
+
+int LogIndex::rebuild(const std::string &logname, uint32_t interval) {
+	assert (interval > 0);
+
+	LogFile logfile(logname.c_str());
+	if (logfile.open(O_RDONLY, 0644) != 0) {
+		log_error("open binlog (%s) failed", logname.c_str());
+		return -1;
+	}
+
+	LogReader reader(1024*1024);
+	LogEvent event;
+	std::string buf;
+	uint64_t last_seq = 0;
+	uint64_t count = 0;
+	reader.bind(&logfile);
+	while (true) {
+		uint64_t pos = reader.tell();
+		if (reader.read(&event) != 1) {
+			break;
+		}
+		uint64_t seq = event.seq();
+		if (seq != 0 && (last_seq == 0 || seq >= last_seq + interval)) {
+			LogEvent::pack64(buf, seq);
+			LogEvent::pack64(buf, pos);
+			last_seq = seq;
+			count++;
+		}
+	}
+	reader.unbind();
+	logfile.close();
+
+	if (file_put_contents(index_name(logname), buf) < 0) {
+		log_error("write index of (%s) failed, errno(%d).", logname.c_str(), errno);
+		return -1;
+	}
+	log_info("rebuild index of (%s), %" PRIu64 " entries", logname.c_str(), count);
+
+	return 0;
+}
+
 
 /* LogReader */
 
@@ -105,6 +181,16 @@ int LogReader::read(LogEvent *event) {
 int LogReader::seek_to_seq(uint64_t seq) {
 	assert (read_cache->fd > 0);
 
+	/* jump close to @seq with the sparse index, then scan forward */
+	uint64_t offset = 0;
+	if (logfile && LogIndex::lookup(logfile->filename, seq, &offset) == 1
+			&& offset > read_cache->tell()) {
+		if (read_cache->seek(offset) != 0) {
+			log_error("seek_to_seq seek to indexed offset(%" PRIu64 ") failed.", offset);
+			return -1;
+		}
+	}
+
 	char header[LOG_EVENT_HEAD_LEN];
 	while (1) {
 		int ret = read_cache->readn(header, LOG_EVENT_HEAD_LEN);
@@ -145,6 +231,22 @@ void LogWriter::bind(LogFile *file) {
 	this->logfile = file;
 	this->write_cache->reset();
 	this->write_cache->fd = logfile->fd;
+
+	this->file_offset = 0;
+	if (logfile->fd >= 0) {
+		off_t end = lseek(logfile->fd, 0, SEEK_END);
+		this->file_offset = end > 0 ? (uint64_t)end : 0;
+	}
+
+	this->index_last_seq = 0;
+	this->index_buf.clear();
+	if (index_interval > 0) {
+		std::string index_name = LogIndex::index_name(logfile->filename);
+		this->index_fd = ::open(index_name.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if (this->index_fd < 0) {
+			log_warn("create index (%s) failed, errno(%d).", index_name.c_str(), errno);
+		}
+	}
 }
 
 void LogWriter::unbind() {
@@ -152,18 +254,45 @@ void LogWriter::unbind() {
 		flush_to_file();
 		logfile = NULL;
 	}
+	if (index_fd >= 0) {
+		::close(index_fd);
+		index_fd = -1;
+	}
 }
 
 int LogWriter::write(LogEvent *event) {
+	uint64_t offset = file_offset;
 	int ret = write_cache->append(event->repr());
 	if (ret != 0) {
 		log_error("write logevent failed");
+		return ret;
+	}
+	file_offset += event->repr().size();
+
+	uint64_t seq = event->seq();
+	if (index_fd >= 0 && seq != 0
+			&& (index_last_seq == 0 || seq >= index_last_seq + index_interval)) {
+		LogEvent::pack64(index_buf, seq);
+		LogEvent::pack64(index_buf, offset);
+		index_last_seq = seq;
 	}
 	return ret;
 }
 
 int LogWriter::flush_to_file() {
-	return write_cache->flush_to_file();
+	int ret = write_cache->flush_to_file();
+	if (ret != 0) {
+		return ret;
+	}
+
+	// index entries never point beyond data on file
+	if (index_fd >= 0 && !index_buf.empty()) {
+		if (::write(index_fd, index_buf.data(), index_buf.size()) != (ssize_t)index_buf.size()) {
+			log_warn("write binlog index failed, errno(%d).", errno);
+		}
+		index_buf.clear();
+	}
+	return 0;
 }
 
 int LogWriter::sync_file() {
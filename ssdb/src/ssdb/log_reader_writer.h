@@ -54,6 +54,27 @@ public:
 	}
 };
 
+/*
+ * sparse seq -> offset index of a binlog, stored next to it as "<binlog>.idx".
+ * the index is an array of fixed size entries(seq, offset of the event)
+ * in ascending seq order, one entry every `interval` seqs.
+ */
+class LogIndex {
+public:
+	static std::string index_name(const std::string &logname) {
+		return logname + ".idx";
+	}
+
+	/*
+	 * find the offset of the last indexed event whose seq <= @seq.
+	 * return 1 if found, 0 if not indexed, less than 0 on error.
+	 */
+	static int lookup(const std::string &logname, uint64_t seq, uint64_t *offset);
+
+	/* scan the whole binlog and rewrite its index */
+	static int rebuild(const std::string &logname, uint32_t interval);
+};
+
 class LogReader {
 private:
 	ReadCache *read_cache;
@@ -85,6 +106,8 @@ public:
 	 * seek exactly after the event has seq of @seq.
 	 */
 	int seek_to_seq(uint64_t seq);
+
+	uint64_t tell() const { return read_cache->tell(); }
 };
 
 class LogWriter {
@@ -92,16 +115,32 @@ private:
 	WriteCache *write_cache;
 	LogFile *logfile;
 
+	// sparse seq index, see LogIndex
+	uint32_t index_interval;
+	int index_fd;
+	uint64_t index_last_seq;
+	uint64_t file_offset;
+	std::string index_buf;
+
 public:
-	LogWriter(size_t cache_size)
+	LogWriter(size_t cache_size, uint32_t index_interval=0)
 	: write_cache(new WriteCache(cache_size))
-	, logfile(NULL) { }
+	, logfile(NULL)
+	, index_interval(index_interval)
+	, index_fd(-1)
+	, index_last_seq(0)
+	, file_offset(0) { }
 	~LogWriter() {
 		if (write_cache) {
 			delete write_cache;
 		}
 	}
 
+	/* index every @interval seqs, 0 disable index, take effect on next bind */
+	void set_index_interval(uint32_t interval) {
+		index_interval = interval;
+	}
+
 public:
 	void bind(LogFile *file);
 	void unbind();
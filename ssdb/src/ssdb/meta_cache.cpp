@@ -0,0 +1,178 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+#include <stdio.h>
+#include <inttypes.h>
+#include "meta_cache.h"
+
+/* rough memory cost of a node besides its key, including the hash entry */
+#define META_CACHE_NODE_OVERHEAD (sizeof(Node) + 48)
+
+MetaCache::MetaCache(size_t capacity, int shards) {
+	if(shards <= 0) {
+		shards = 1;
+	}
+	this->num_shards = shards;
+	this->shard_capacity = capacity / shards;
+	this->shards = new Shard[shards];
+	for(int i = 0; i < shards; i++) {
+		Shard *shard = &this->shards[i];
+		pthread_mutex_init(&shard->mutex, NULL);
+		shard->usage = 0;
+		shard->gen = 0;
+		shard->hits = 0;
+		shard->misses = 0;
+		shard->evictions = 0;
+	}
+}
+
+MetaCache::~MetaCache() {
+	this->clear();
+	for(int i = 0; i < num_shards; i++) {
+		pthread_mutex_destroy(&shards[i].mutex);
+	}
+	delete[] shards;
+}
+
+MetaCache::Shard *MetaCache::shard_of(const std::string &key) {
+	/* FNV-1a */
+	uint32_t h = 2166136261u;
+	for(size_t i = 0; i < key.size(); i++) {
+		h ^= (unsigned char)key[i];
+		h *= 16777619u;
+	}
+	return &shards[h % num_shards];
+}
+
+int MetaCache::get(const std::string &key, char *t, uint64_t *version) {
+	Shard *shard = shard_of(key);
+	pthread_mutex_lock(&shard->mutex);
+	map_t::iterator it = shard->map.find(key);
+	if(it == shard->map.end()) {
+		shard->misses++;
+		pthread_mutex_unlock(&shard->mutex);
+		return 0;
+	}
+	Node *node = it->second;
+	shard->lru.remove(node);
+	shard->lru.push_back(node);
+	*t = node->type;
+	*version = node->version;
+	shard->hits++;
+	pthread_mutex_unlock(&shard->mutex);
+	return 1;
+}
+
+uint64_t MetaCache::generation(const std::string &key) {
+	Shard *shard = shard_of(key);
+	pthread_mutex_lock(&shard->mutex);
+	uint64_t gen = shard->gen;
+	pthread_mutex_unlock(&shard->mutex);
+	return gen;
+}
+
+void MetaCache::fill(const std::string &key, char t, uint64_t version, uint64_t gen) {
+	Shard *shard = shard_of(key);
+	pthread_mutex_lock(&shard->mutex);
+	if(shard->gen == gen) {
+		insert(shard, key, t, version);
+	}
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+void MetaCache::set(const std::string &key, char t, uint64_t version) {
+	Shard *shard = shard_of(key);
+	pthread_mutex_lock(&shard->mutex);
+	shard->gen++;
+	insert(shard, key, t, version);
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+void MetaCache::erase(const std::string &key) {
+	Shard *shard = shard_of(key);
+	pthread_mutex_lock(&shard->mutex);
+	shard->gen++;
+	map_t::iterator it = shard->map.find(key);
+	if(it != shard->map.end()) {
+		remove(shard, it->second);
+	}
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+void MetaCache::clear() {
+	for(int i = 0; i < num_shards; i++) {
+		Shard *shard = &shards[i];
+		pthread_mutex_lock(&shard->mutex);
+		shard->gen++;
+		while(!shard->lru.empty()) {
+			remove(shard, shard->lru.head);
+		}
+		pthread_mutex_unlock(&shard->mutex);
+	}
+}
+
+/* shard lock held */
+void MetaCache::insert(Shard *shard, const std::string &key, char t, uint64_t version) {
+	map_t::iterator it = shard->map.find(key);
+	if(it != shard->map.end()) {
+		Node *node = it->second;
+		node->type = t;
+		node->version = version;
+		shard->lru.remove(node);
+		shard->lru.push_back(node);
+		return;
+	}
+	size_t cost = key.size() + META_CACHE_NODE_OVERHEAD;
+	if(cost > shard_capacity) {
+		return;
+	}
+	while(!shard->lru.empty() && shard->usage + cost > shard_capacity) {
+		remove(shard, shard->lru.head);
+		shard->evictions++;
+	}
+	Node *node = new Node();
+	node->key = key;
+	node->type = t;
+	node->version = version;
+	shard->map[key] = node;
+	shard->lru.push_back(node);
+	shard->usage += cost;
+}
+
+/* shard lock held */
+void MetaCache::remove(Shard *shard, Node *node) {
+	shard->lru.remove(node);
+	shard->map.erase(node->key);
+	shard->usage -= node->key.size() + META_CACHE_NODE_OVERHEAD;
+	delete node;
+}
+
+std::string MetaCache::stats() {
+	uint64_t hits = 0, misses = 0, evictions = 0, entries = 0, usage = 0;
+	for(int i = 0; i < num_shards; i++) {
+		Shard *shard = &shards[i];
+		pthread_mutex_lock(&shard->mutex);
+		hits += shard->hits;
+		misses += shard->misses;
+		evictions += shard->evictions;
+		entries += shard->lru.size;
+		usage += shard->usage;
+		pthread_mutex_unlock(&shard->mutex);
+	}
+	double ratio = (hits + misses) > 0 ? (double)hits / (hits + misses) : 0;
+
+	char buf[512];
+	snprintf(buf, sizeof(buf),
+		"meta_cache_hits:%" PRIu64 "\n"
+		"meta_cache_misses:%" PRIu64 "\n"
+		"meta_cache_hit_ratio:%.4f\n"
+		"meta_cache_entries:%" PRIu64 "\n"
+		"meta_cache_evictions:%" PRIu64 "\n"
+		"meta_cache_memory:%" PRIu64 "\n"
+		"meta_cache_capacity:%" PRIu64,
+		hits, misses, ratio, entries, evictions, usage,
+		(uint64_t)shard_capacity * num_shards);
+	return buf;
+}
@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+#ifndef SSDB_META_CACHE_H_
+#define SSDB_META_CACHE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include "../util/list.h"
+#include "../util/hash_map.h"
+
+/**
+ * Bounded LRU cache of version key -> (type, version), sharded by key.
+ *
+ * A reader takes generation() before looking the version key up in
+ * leveldb and passes it to fill(). Any erase() in the shard after that
+ * bumps the generation and the fill is dropped, so a lookup racing with
+ * a delete can't bring a stale version back.
+ **/
+class MetaCache {
+public:
+	MetaCache(size_t capacity, int shards=16);   /* capacity in bytes */
+	~MetaCache();
+
+	// @return 1: hit, 0: miss
+	int get(const std::string &key, char *t, uint64_t *version);
+	uint64_t generation(const std::string &key);
+	void fill(const std::string &key, char t, uint64_t version, uint64_t gen);
+	void set(const std::string &key, char t, uint64_t version);
+	void erase(const std::string &key);
+	void clear();
+
+	std::string stats();
+
+private:
+	struct Node {
+		std::string key;
+		char type;
+		uint64_t version;
+		Node *prev;
+		Node *next;
+	};
+	typedef HASH_MAP<std::string, Node *> map_t;
+
+	struct Shard {
+		pthread_mutex_t mutex;
+		map_t map;
+		LinkedList<Node *> lru;  /* least recently used at head */
+		size_t usage;            /* bytes */
+		uint64_t gen;
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+	};
+
+	Shard *shards;
+	int num_shards;
+	size_t shard_capacity;
+
+	Shard *shard_of(const std::string &key);
+	void insert(Shard *shard, const std::string &key, char t, uint64_t version);
+	void remove(Shard *shard, Node *node);
+};
+
+#endif
@@ -18,11 +18,23 @@ void Options::load(const Config &conf){
 	block_size = (size_t)conf.get_num("leveldb.block_size");
 	compaction_speed = conf.get_num("leveldb.compaction_speed");
 	compression = conf.get_str("leveldb.compression");
+	cache_shards = conf.get_num("leveldb.cache_shards");
+	bloom_bits_per_key = conf.get_num("leveldb.bloom_bits_per_key");
+	meta_cache_size = conf.get_num("leveldb.meta_cache_size");
+	zset_rank_threshold = conf.get_num("leveldb.zset_rank_threshold");
+	gc_keys_per_sec = conf.get_num("leveldb.gc_keys_per_sec");
+	gc_mb_per_sec = conf.get_num("leveldb.gc_mb_per_sec");
+	gc_batch_size = conf.get_num("leveldb.gc_batch_size");
+	gc_compact_threshold = conf.get_num("leveldb.gc_compact_threshold");
 	//int binlog = conf.get_num("rpl.binlog");
 	binlog_dir = conf.get_str("rpl.binlog_dir");
 	int sync_binlog = conf.get_num("rpl.sync_binlog");
 	max_binlog_size = conf.get_num("rpl.max_binlog_size");
 	std::string purge_logs_span_str = conf.get_str("rpl.purge_logs_span");
+	int binlog_group_commit = conf.get_num("rpl.binlog_group_commit");
+	binlog_group_max_batch = conf.get_num("rpl.binlog_group_max_batch");
+	binlog_group_max_delay = conf.get_num("rpl.binlog_group_max_delay");
+	binlog_index_interval = conf.get_num("rpl.binlog_index_interval");
 
 	strtolower(&compression);
 	if(compression != "no"){
@@ -33,6 +45,7 @@ void Options::load(const Config &conf){
 	// always enable binlog
 	this->binlog = true;
 	this->sync_binlog = (sync_binlog==1) ? true : false;
+	this->binlog_group_commit = (binlog_group_commit==1) ? true : false;
 
 	if(cache_size <= 0){
 		cache_size = 8;
@@ -53,6 +66,65 @@ void Options::load(const Config &conf){
 		}
 	}
 
+	if(cache_shards <= 0){
+		cache_shards = 16;
+	}
+	if(cache_shards > 4096){
+		cache_shards = 4096;
+	}
+	int shards = 1;
+	while(shards < cache_shards){
+		shards <<= 1;
+	}
+	cache_shards = shards;
+
+	if(bloom_bits_per_key == 0){
+		bloom_bits_per_key = 10;
+	}else if(bloom_bits_per_key < 0){
+		bloom_bits_per_key = 0;
+	}
+
+	if(meta_cache_size == 0){
+		meta_cache_size = 32;
+	}else if(meta_cache_size < 0){
+		meta_cache_size = 0;
+	}
+
+	if(zset_rank_threshold < 0){
+		zset_rank_threshold = 0;
+	}
+
+	if(gc_keys_per_sec == 0){
+		gc_keys_per_sec = 50000;
+	}else if(gc_keys_per_sec < 0){
+		gc_keys_per_sec = 0;
+	}
+	if(gc_mb_per_sec == 0){
+		gc_mb_per_sec = 16;
+	}else if(gc_mb_per_sec < 0){
+		gc_mb_per_sec = 0;
+	}
+	if(gc_batch_size <= 0){
+		gc_batch_size = 1000;
+	}
+	if(gc_compact_threshold == 0){
+		gc_compact_threshold = 100000;
+	}else if(gc_compact_threshold < 0){
+		gc_compact_threshold = 0;
+	}
+
+	if(binlog_group_max_batch <= 0){
+		binlog_group_max_batch = 128;
+	}
+	if(binlog_group_max_delay < 0){
+		binlog_group_max_delay = 0;
+	}
+	if(binlog_index_interval == 0){
+		binlog_index_interval = 1000;
+	}else if(binlog_index_interval < 0){
+		binlog_index_interval = 0;
+	}
+
 	purge_logs_span = str_to_span(purge_logs_span_str);
 	if (purge_logs_span < 0) {
 		purge_logs_span = 0;
@@ -22,11 +22,23 @@ public:
 	size_t block_size;
 	int compaction_speed;
 	std::string compression;
+	int cache_shards; // block and meta cache shards, a power of 2
+	int bloom_bits_per_key; // 0: no bloom filter
+	int meta_cache_size; // MB, 0: disabled
+	int zset_rank_threshold; // members, 0: disabled
+	int gc_keys_per_sec; // 0: unlimited
+	int gc_mb_per_sec; // 0: unlimited
+	int gc_batch_size; // keys deleted per write
+	int gc_compact_threshold; // keys, 0: never compact after gc
 	bool binlog;
 	bool sync_binlog;
 	std::string binlog_dir;
 	int max_binlog_size; // MB
 	time_t purge_logs_span;
+	bool binlog_group_commit;
+	int binlog_group_max_batch;
+	int binlog_group_max_delay; // us
+	int binlog_index_interval;
 };
 
 #endif
@@ -45,19 +45,23 @@ public:
 	virtual int raw_set(const Bytes &key, const Bytes &val) = 0;
 	virtual int raw_del(const Bytes &key) = 0;
 	virtual int raw_get(const Bytes &key, std::string *val, const leveldb::Snapshot *snapshot=NULL) = 0;
-	virtual int raw_size(const Bytes &key, int64_t *size) = 0;
+	virtual int raw_size(const Bytes &key, int64_t *size, const leveldb::Snapshot *snapshot=NULL) = 0;
 	virtual int incr_raw_size(const Bytes &key, int64_t incr, int64_t *size, Transaction &trans) = 0;
 
 	/* key value */
 	virtual int set(const Bytes &key, const Bytes &val, Transaction &trans, uint64_t version) = 0;
 	virtual int del(const Bytes &key, Transaction &trans) = 0;
+	// delete all keys in one write batch, return number of keys deleted
+	virtual int multi_del(const std::vector<std::string> &keys, Transaction &trans) = 0;
+	// also take keys[i] out of the zset zsets[i], all in one write batch
+	virtual int multi_del(const std::vector<std::string> &keys, const std::vector<std::string> &zsets,
+			Transaction &trans, uint64_t zset_version) = 0;
 	// -1: error, 1: ok, 0: value is not an integer or out of range
 	virtual int incr(const Bytes &key, int64_t by, int64_t *new_val, Transaction &trans, uint64_t version) = 0;
 	virtual int setbit(const Bytes &key, int bitoffset, int on, Transaction &trans, uint64_t version) = 0;
 	virtual int getbit(const Bytes &key, int bitoffset, uint64_t version) = 0;
 
-	virtual int get(const Bytes &key, std::string *val, uint64_t version) = 0;
-	virtual int mget(const std::vector<Bytes> &key, std::vector<std::string> *val, std::vector<uint64_t> version, const leveldb::Snapshot *snapshot) = 0;
+	virtual int get(const Bytes &key, std::string *val, uint64_t version, const leveldb::Snapshot *snapshot=NULL) = 0;
 	// return (start, end]
 	virtual KIterator* scan(const Bytes &start, const Bytes &end, uint64_t limit) = 0;
 	virtual KIterator* rscan(const Bytes &start, const Bytes &end, uint64_t limit) = 0;
@@ -76,13 +80,15 @@ public:
 			std::vector<std::string> *list) = 0;
 	virtual int hrlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 			std::vector<std::string> *list) = 0;
-	virtual HIterator* hscan(const Bytes &key, const Bytes &start, const Bytes &end, uint64_t limit, uint64_t version) = 0;
+	virtual HIterator* hscan(const Bytes &key, const Bytes &start, const Bytes &end, uint64_t limit, uint64_t version, const leveldb::Snapshot *snapshot=NULL) = 0;
 	virtual HIterator* hrscan(const Bytes &key, const Bytes &start, const Bytes &end, uint64_t limit, uint64_t version) = 0;
 
 	/* zset */
 
 	virtual int zset(const Bytes &key, const Bytes &field, const Bytes &score, Transaction &trans, uint64_t version) = 0;
 	virtual int zdel(const Bytes &key, const Bytes &field, Transaction &trans, uint64_t version) = 0;
+	// -1: error, other: number of members deleted, all in one write
+	virtual int64_t multi_zdel(const Bytes &key, const std::vector<std::string> &fields, Transaction &trans, uint64_t version) = 0;
 	// -1: error, 1: ok, 0: value is not an integer or out of range
 	virtual int zincr(const Bytes &key, const Bytes &field, int64_t by, int64_t *new_val, Transaction &trans, uint64_t version) = 0;
 	virtual int64_t zclear(const Bytes &key, Transaction &trans, uint64_t version) = 0;
@@ -95,14 +101,14 @@ public:
 	virtual int64_t zrrank(const Bytes &key, const Bytes &field, uint64_t version) = 0;
 	virtual ZIterator* zrange(const Bytes &key, int64_t start, int64_t stop, uint64_t version) = 0;
 	virtual ZIterator* zrrange(const Bytes &key, int64_t start, int64_t stop, uint64_t version) = 0;
-	virtual ZIterator* zrange(const Bytes &key, uint64_t offset, uint64_t limit, uint64_t version) = 0;
+	virtual ZIterator* zrange(const Bytes &key, uint64_t offset, uint64_t limit, uint64_t version, const leveldb::Snapshot *snapshot=NULL) = 0;
 	virtual ZIterator* zrrange(const Bytes &key, uint64_t offset, uint64_t limit, uint64_t version) = 0;
 	/**
 	 * scan by score, but won't return @key if key.score=score_start.
 	 * return (score_start, score_end]
 	 */
 	virtual ZIterator* zscan(const Bytes &key, const Bytes &field,
-			const Bytes &score_start, const Bytes &score_end, uint64_t limit, uint64_t version) = 0;
+			const Bytes &score_start, const Bytes &score_end, uint64_t limit, uint64_t version, const leveldb::Snapshot *snapshot=NULL) = 0;
 	virtual ZIterator* zrscan(const Bytes &key, const Bytes &field,
 			const Bytes &score_start, const Bytes &score_end, uint64_t limit, uint64_t version) = 0;
 	virtual int zlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
@@ -110,12 +116,14 @@ public:
 	virtual int zrlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 			std::vector<std::string> *list) = 0;
 	/* set */
-	virtual int sget(const Bytes &key, const Bytes &elem, uint64_t version) = 0;
+	virtual int sget(const Bytes &key, const Bytes &elem, uint64_t version, const leveldb::Snapshot *snapshot=NULL) = 0;
 	virtual int sset(const Bytes &key, const Bytes &elem, Transaction &trans, uint64_t version) = 0;
+	// add elems in one write batch, return the number of new ones
+	virtual int64_t multi_sset(const Bytes &key, const std::vector<std::string> &elems, Transaction &trans, uint64_t version) = 0;
 	virtual int sdel(const Bytes &key, const Bytes &elem, Transaction &trans, uint64_t version) = 0;
 	virtual int64_t sclear(const Bytes &key, Transaction &trans, uint64_t version) = 0;
-	virtual int64_t ssize(const Bytes &key, uint64_t version) = 0;
-	virtual SIterator *sscan(const Bytes &key, const Bytes &elem, uint64_t limit, uint64_t version) = 0;
+	virtual int64_t ssize(const Bytes &key, uint64_t version, const leveldb::Snapshot *snapshot=NULL) = 0;
+	virtual SIterator *sscan(const Bytes &key, const Bytes &elem, uint64_t limit, uint64_t version, const leveldb::Snapshot *snapshot=NULL) = 0;
 	virtual SIterator *srscan(const Bytes &key, const Bytes &elem, uint64_t limit, uint64_t version) = 0;
 
 	virtual int64_t qsize(const Bytes &key, uint64_t version) = 0;
@@ -129,6 +137,9 @@ public:
 	// @return 0: empty queue, 1: item popped, -1: error
 	virtual int qpop_front(const Bytes &key, std::string *item, Transaction &trans, uint64_t version) = 0;
 	virtual int qpop_back(const Bytes &key, std::string *item, Transaction &trans, uint64_t version) = 0;
+	// @return -1: error, other: the number of items popped, all in one write
+	virtual int64_t qtrim_front(const Bytes &key, uint64_t limit, Transaction &trans, uint64_t version) = 0;
+	virtual int64_t qtrim_back(const Bytes &key, uint64_t limit, Transaction &trans, uint64_t version) = 0;
 	virtual int qfix(const Bytes &name, Transaction &trans) = 0;
 	virtual int qlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 			std::vector<std::string> *list) = 0;
@@ -136,6 +147,8 @@ public:
 			std::vector<std::string> *list) = 0;
 	virtual int qslice(const Bytes &name, int64_t offset, int64_t limit, uint64_t version,
 			std::vector<std::string> *list) = 0;
+	// -1: error, 0: no item, 1: *it walks the items from begin to end
+	virtual int qslice(const Bytes &name, int64_t begin, int64_t end, uint64_t version, QIterator **it) = 0;
 	virtual int qget(const Bytes &key, int64_t index, std::string *item, uint64_t version) = 0;
 	virtual int qset(const Bytes &key, int64_t index, const Bytes &item, Transaction &trans, uint64_t version) = 0;
 	virtual int64_t qclear(const Bytes &key, Transaction &trans, uint64_t version) = 0;
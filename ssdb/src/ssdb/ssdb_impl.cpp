@@ -3,11 +3,13 @@ Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
 Use of this source code is governed by a BSD-style license that can be
 found in the LICENSE file.
 */
+#include <map>
 #include "ssdb_impl.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
 #include "leveldb/cache.h"
 #include "leveldb/filter_policy.h"
+#include "leveldb/write_batch.h"
 
 #include "iterator.h"
 #include "comparator.h"
@@ -16,15 +18,54 @@ found in the LICENSE file.
 #include "t_zset.h"
 #include "t_queue.h"
 #include "version.h"
+#include "../util/atomic.h"
 
-static void *ssdb_gc_thread(void *arg);
+/* the bloom filter, counting the lookups it spared a data block read */
+class CountingFilterPolicy : public leveldb::FilterPolicy
+{
+public:
+	mutable volatile uint64_t checked;
+	mutable volatile uint64_t useful;
+
+	CountingFilterPolicy(int bits_per_key) : checked(0), useful(0){
+		policy = leveldb::NewBloomFilterPolicy(bits_per_key);
+	}
+	virtual ~CountingFilterPolicy(){
+		delete policy;
+	}
+	/* same name as the bloom filter, so existing tables keep their filters */
+	virtual const char *Name() const{
+		return policy->Name();
+	}
+	virtual void CreateFilter(const leveldb::Slice *keys, int n, std::string *dst) const{
+		policy->CreateFilter(keys, n, dst);
+	}
+	virtual bool KeyMayMatch(const leveldb::Slice &key, const leveldb::Slice &filter) const{
+		atomic_add_uint64(&checked, 1);
+		if(policy->KeyMayMatch(key, filter)){
+			return true;
+		}
+		atomic_add_uint64(&useful, 1);
+		return false;
+	}
+
+private:
+	const leveldb::FilterPolicy *policy;
+};
 
 SSDBImpl::SSDBImpl(int32_t concurrency)
-	: ldb(NULL), global_version(0), version_update_threshold(10000), num_version_update(0), inited(0){
+	: ldb(NULL), versions(NULL), gc(NULL), zrank_threshold(0), inited(0), meta_cache(NULL), filter_policy(NULL){
 	dblocks = new DBKeyLock(concurrency);
 }
 
 SSDBImpl::~SSDBImpl(){
+	/* stop the threads writing to ldb first */
+	if(gc){
+		delete gc;
+	}
+	if(versions){
+		delete versions;
+	}
 	if(ldb){
 		delete ldb;
 	}
@@ -37,14 +78,34 @@ SSDBImpl::~SSDBImpl(){
 	if (dblocks) {
 		delete dblocks;
 	}
+	if (meta_cache) {
+		delete meta_cache;
+	}
 }
 
 SSDB* SSDB::open(const Options &opt, const std::string &dir){
 	SSDBImpl *ssdb = new SSDBImpl();
 	ssdb->options.create_if_missing = true;
 	ssdb->options.max_open_files = opt.max_open_files;
-	ssdb->options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-	ssdb->options.block_cache = leveldb::NewLRUCache(opt.cache_size * 1048576);
+	if(opt.bloom_bits_per_key > 0){
+		ssdb->filter_policy = new CountingFilterPolicy(opt.bloom_bits_per_key);
+		ssdb->options.filter_policy = ssdb->filter_policy;
+	}
+	int shard_bits = 0;
+	while((1 << shard_bits) < opt.cache_shards){
+		shard_bits++;
+	}
+	ssdb->options.block_cache = leveldb::NewLRUCache(opt.cache_size * 1048576, shard_bits);
+	if(opt.meta_cache_size > 0){
+		ssdb->meta_cache = new MetaCache((size_t)opt.meta_cache_size * 1048576, opt.cache_shards);
+	}
+	ssdb->zrank_threshold = opt.zset_rank_threshold;
+	if(ssdb->zrank_threshold < 0){
+		ssdb->zrank_threshold = 0;
+	}else if(ssdb->zrank_threshold > 0 && ssdb->zrank_threshold < ZRANK_MIN_THRESHOLD){
+		ssdb->zrank_threshold = ZRANK_MIN_THRESHOLD;
+	}
+	ssdb->gc = new VersionGC(ssdb, opt);
 	ssdb->options.block_size = opt.block_size * 1024;
 	ssdb->options.write_buffer_size = opt.write_buffer_size * 1024 * 1024;
 	ssdb->options.compaction_speed = opt.compaction_speed;
@@ -79,33 +140,15 @@ int SSDBImpl::init(const std::string &name) {
 		return 0;
 	}
 	this->name = name;
-	std::string vg;
-	std::string key = global_version_key();
-	int ret = this->raw_get(key, &vg);
-	if (ret == 0) {
-		/* initiate global version */
-		int r = this->raw_set(key, "0");
-		if (r != 1) {
-			log_error("initiate global version failed");
-			return -1;
-		}
-	} else {
-		/* step foward over a distance to guarantee there are no conflicts after a reboot */
-		global_version = str_to_uint64(vg);
-		global_version += version_update_threshold*10;
-		ret = this->raw_set(key, str(global_version));
-		if (ret != 1) {
-			log_error("setp foward global_version failed");
-			return -1;
-		}
+	versions = new VersionAllocator(this);
+	if(versions->init() == -1) {
+		log_error("initiate global version failed");
+		return -1;
 	}
 
 	/* start gc thread */
 	log_info("start gc");
-	pthread_t tid;
-	int err = pthread_create(&tid, NULL, &ssdb_gc_thread, this);
-	if(err != 0) {
-		log_error("start gc thread failed: %s", strerror(err));
+	if(gc->start() == -1) {
 		return -1;
 	}
 	inited = 1;
@@ -118,12 +161,17 @@ leveldb::Options SSDBImpl::get_options() {
 
 int SSDBImpl::flushdb(){
 	this->lock_db();
+	/* keep lease renewals and gc off ldb while it is replaced */
+	gc->pause();
+	versions->pause();
 
 	delete ldb;
 
 	leveldb::Status status = leveldb::DestroyDB(dir, options);
 	if (!status.ok()) {
 		log_error("destroy db %s failed: %s", dir.c_str(), status.ToString().c_str());
+		versions->resume(false);
+		gc->resume();
 		this->unlock_db();
 		return -1;
 	}
@@ -131,9 +179,19 @@ int SSDBImpl::flushdb(){
 	status = leveldb::DB::Open(options, dir, &ldb);
 	if (!status.ok()) {
 		log_error("open db %s failed: %s", dir.c_str(), status.ToString().c_str());
+		versions->resume(false);
+		gc->resume();
 		this->unlock_db();
 		return -1;
 	}
+	if (meta_cache) {
+		meta_cache->clear();
+	}
+	/* the lease went away with the data, versions must still never go back */
+	if (versions->resume(true) == -1) {
+		log_error("persist global version failed after flushdb");
+	}
+	gc->resume();
 
 	this->unlock_db();
 
@@ -174,9 +232,33 @@ Iterator* SSDBImpl::rev_iterator(const std::string &start, const std::string &en
 
 /* raw operates */
 
+static inline bool is_version_key(const leveldb::Slice &key){
+	return key.starts_with(leveldb::Slice(SSDB_VERSION_KEY_PREFIX, sizeof(SSDB_VERSION_KEY_PREFIX)));
+}
+
+/* drop the cached versions a write batch touches */
+class MetaCacheInvalidator : public leveldb::WriteBatch::Handler {
+public:
+	MetaCache *cache;
+
+	virtual void Put(const leveldb::Slice &key, const leveldb::Slice &value) {
+		if(is_version_key(key)) {
+			cache->erase(key.ToString());
+		}
+	}
+	virtual void Delete(const leveldb::Slice &key) {
+		if(is_version_key(key)) {
+			cache->erase(key.ToString());
+		}
+	}
+};
+
 int SSDBImpl::raw_set(const Bytes &key, const Bytes &val){
 	leveldb::WriteOptions write_opts;
 	leveldb::Status s = ldb->Put(write_opts, slice(key), slice(val));
+	if(meta_cache && is_version_key(slice(key))){
+		meta_cache->erase(key.String());
+	}
 	if(!s.ok()){
 		log_error("set error: %s", s.ToString().c_str());
 		return -1;
@@ -184,9 +266,26 @@ int SSDBImpl::raw_set(const Bytes &key, const Bytes &val){
 	return 1;
 }
 
+int SSDBImpl::raw_multi_set(const std::vector<std::string> &kvs){
+	leveldb::WriteBatch batch;
+	for(size_t i = 0; i + 1 < kvs.size(); i += 2){
+		batch.Put(kvs[i], kvs[i + 1]);
+	}
+	leveldb::WriteOptions write_opts;
+	leveldb::Status s = this->write(write_opts, &batch);
+	if(!s.ok()){
+		log_error("multi set error: %s", s.ToString().c_str());
+		return -1;
+	}
+	return (int)(kvs.size() / 2);
+}
+
 int SSDBImpl::raw_del(const Bytes &key){
 	leveldb::WriteOptions write_opts;
 	leveldb::Status s = ldb->Delete(write_opts, slice(key));
+	if(meta_cache && is_version_key(slice(key))){
+		meta_cache->erase(key.String());
+	}
 	if(!s.ok()){
 		log_error("del error: %s", s.ToString().c_str());
 		return -1;
@@ -221,6 +320,20 @@ uint64_t SSDBImpl::size(){
 	return sizes[0];
 }
 
+void SSDBImpl::approximate_sizes(const std::vector<std::string> &bounds, std::vector<uint64_t> *sizes){
+	sizes->clear();
+	if(bounds.size() < 2){
+		return;
+	}
+	size_t n = bounds.size() - 1;
+	std::vector<leveldb::Range> ranges(n);
+	for(size_t i = 0; i < n; i++){
+		ranges[i] = leveldb::Range(bounds[i], bounds[i + 1]);
+	}
+	sizes->resize(n);
+	ldb->GetApproximateSizes(&ranges[0], (int)n, &(*sizes)[0]);
+}
+
 uint64_t SSDBImpl::leveldbfilesize(){
 	uint64_t size;
 	ldb->GetDbSize(&size);
@@ -255,6 +368,47 @@ std::vector<std::string> SSDBImpl::info(){
 		}
 	}
 
+	if(options.block_cache){
+		uint64_t hits, misses;
+		options.block_cache->GetStats(&hits, &misses);
+		char buf[256];
+		snprintf(buf, sizeof(buf),
+			"block_cache_hits:%" PRIu64 "\n"
+			"block_cache_misses:%" PRIu64 "\n"
+			"block_cache_hit_ratio:%.4f",
+			hits, misses, (hits + misses) > 0 ? (double)hits / (hits + misses) : 0);
+		info.push_back("block_cache");
+		info.push_back(buf);
+	}
+
+	if(filter_policy){
+		uint64_t checked = filter_policy->checked;
+		uint64_t useful = filter_policy->useful;
+		char buf[256];
+		snprintf(buf, sizeof(buf),
+			"bloom_filter_checked:%" PRIu64 "\n"
+			"bloom_filter_useful:%" PRIu64 "\n"
+			"bloom_filter_useful_ratio:%.4f",
+			checked, useful, checked > 0 ? (double)useful / checked : 0);
+		info.push_back("bloom_filter");
+		info.push_back(buf);
+	}
+
+	if(gc){
+		info.push_back("gc");
+		info.push_back(gc->stats());
+	}
+
+	if(versions){
+		info.push_back("global_version");
+		info.push_back(versions->stats());
+	}
+
+	if(meta_cache){
+		info.push_back("meta_cache");
+		info.push_back(meta_cache->stats());
+	}
+
 	return info;
 }
 
@@ -429,45 +583,47 @@ void SSDBImpl::unlock_db() {
 }
 
 leveldb::Status SSDBImpl::write(const leveldb::WriteOptions &options, leveldb::WriteBatch *batch) {
-	return ldb->Write(options, batch);
-}
-
-int SSDBImpl::_update_global_version() {
-	num_version_update++;
-	global_version++;
-	if(num_version_update <= version_update_threshold) {
-		/* there is nothing to do, return ASAP */
-		return 1;
+	leveldb::Status s = ldb->Write(options, batch);
+	if(meta_cache) {
+		/* invalidate after the write, so a concurrent miss can't refill the old version */
+		MetaCacheInvalidator invalidator;
+		invalidator.cache = meta_cache;
+		batch->Iterate(&invalidator);
 	}
-	/* record and reset counter */
-	num_version_update = 0;
-	int ret = this->raw_set(global_version_key(), str(global_version));
-	if(ret != 1) {
-		log_error("update global version failed");
-		return -1;
-	}
-	return 1;
+	return s;
 }
 
 int SSDBImpl::new_version(const Bytes &key, char t, uint64_t *version) {
-	int ret = _update_global_version();
+	uint64_t v;
+	int ret = versions->alloc(&v);
 	if (ret == -1) {
 		log_error("update global version failed");
 		return -1;
 	}
 	std::string k = encode_version_key(key);
-	std::string v = encode_version(t, global_version);
-	ret = this->raw_set(k, v);
+	ret = this->raw_set(k, encode_version(t, v));
 	if(ret != 1) {
 		log_error("new version failed, key:%s", key.String().c_str());
 		return -1;
 	}
-	*version = global_version;
+	if(meta_cache) {
+		meta_cache->set(k, t, v);
+	}
+	*version = v;
 	return 1;
 }
 
 int SSDBImpl::get_version(const Bytes &key, char *t, uint64_t *version, const leveldb::Snapshot *snapshot) {
 	std::string k = encode_version_key(key);
+	/* snapshot reads may see an older version, bypass the cache */
+	MetaCache *cache = snapshot ? NULL : meta_cache;
+	uint64_t gen = 0;
+	if(cache) {
+		if(cache->get(k, t, version) == 1) {
+			return 1;
+		}
+		gen = cache->generation(k);
+	}
 	std::string v;
 	int ret = this->raw_get(k, &v, snapshot);
 	if(ret == -1) {
@@ -485,6 +641,9 @@ int SSDBImpl::get_version(const Bytes &key, char *t, uint64_t *version, const le
 		return -1;
 	}
 	*t = version_type;
+	if(cache) {
+		cache->fill(k, version_type, *version, gen);
+	}
 	return 1;
 }
 
@@ -510,9 +669,75 @@ int SSDBImpl::del(const Bytes &key, Transaction &trans) {
 	return 1;
 }
 
-int SSDBImpl::raw_size(const Bytes &key, int64_t *size) {
+int SSDBImpl::multi_del(const std::vector<std::string> &keys, Transaction &trans) {
+	trans.begin();
+	int num = this->_multi_del(keys, trans);
+	if(num <= 0) {
+		return num;
+	}
+	Transaction::Status s = trans.commit();
+	if(!s.ok()){
+		log_error("multi delete commit failed");
+		return -1;
+	}
+	return num;
+}
+
+int SSDBImpl::multi_del(const std::vector<std::string> &keys, const std::vector<std::string> &zsets,
+		Transaction &trans, uint64_t zset_version) {
+	trans.begin();
+	int num = this->_multi_del(keys, trans);
+	if(num == -1) {
+		return -1;
+	}
+	std::map<std::string, std::vector<std::string> > fields;
+	for(size_t i = 0; i < keys.size() && i < zsets.size(); i++) {
+		fields[zsets[i]].push_back(keys[i]);
+	}
+	int64_t removed = 0;
+	std::map<std::string, std::vector<std::string> >::const_iterator it;
+	for(it = fields.begin(); it != fields.end(); ++it) {
+		int64_t ret = this->_multi_zdel(it->first, it->second, trans, zset_version);
+		if(ret == -1) {
+			return -1;
+		}
+		removed += ret;
+	}
+	if(num == 0 && removed == 0) {
+		return 0;
+	}
+	Transaction::Status s = trans.commit();
+	if(!s.ok()){
+		log_error("multi delete commit failed");
+		return -1;
+	}
+	return num;
+}
+
+/* stage the deletions in trans, return number of keys found */
+int SSDBImpl::_multi_del(const std::vector<std::string> &keys, Transaction &trans) {
+	int num = 0;
+	std::vector<std::string>::const_iterator it;
+	for(it = keys.begin(); it != keys.end(); ++it) {
+		uint64_t version;
+		char t;
+		int ret = this->get_version(*it, &t, &version);
+		if(ret == -1) {
+			return -1;
+		}
+		if(ret == 0) {
+			continue;
+		}
+		trans.del(encode_version_key(*it));
+		trans.put(encode_deprecated_key(*it, t, version), "");
+		++num;
+	}
+	return num;
+}
+
+int SSDBImpl::raw_size(const Bytes &key, int64_t *size, const leveldb::Snapshot *snapshot) {
 	std::string value;
-	int found = this->raw_get(key, &value);
+	int found = this->raw_get(key, &value, snapshot);
 	if(found == -1) {
 		return -1;
 	}
@@ -557,71 +782,3 @@ Iterator* SSDBImpl::keys(int16_t slot) {
 std::string SSDBImpl::get_name() {
 	return this->name;
 }
-
-/* GC */
-static void *ssdb_gc_thread(void *arg) {
-	pthread_detach(pthread_self());
-	SSDBImpl *ssdb = (SSDBImpl *)arg;
-	std::string name = ssdb->get_name();
-	std::string procname = "gc_" + name;
-	SET_PROC_NAME(procname.c_str());
-	std::string start = encode_deprecated_key("", DataType::MIN_PREFIX, 0);
-	std::string end = encode_deprecated_key("\xff", DataType::MAX_PREFIX, UINT_MAX);
-	while(true) {
-		uint64_t count = 0;
-		Iterator *it = ssdb->iterator(start, end, UINT_MAX);
-		if(it != NULL) {
-			while(it->next()) {
-				std::string key;
-				uint64_t version;
-				char t;
-				if(decode_deprecated_key(it->key(), &key, &t, &version) == -1) {
-					log_error("gc decode deprecated key failed: %s", hexmem((it->key()).data(), (it->key()).size()).c_str());
-				}
-				Transaction trans(ssdb, Bytes());
-				switch(t) {
-					case DataType::KV:
-						ssdb->raw_del(encode_kv_key(key, version));
-						log_debug("gc %s delete kv %s", name.c_str(),  key.c_str());
-						count ++;
-						break;
-					case DataType::HASH:
-						ssdb->hclear(key, trans, version);
-						log_debug("gc %s delete hash %s", name.c_str(),  key.c_str());
-						count ++;
-						break;
-					case DataType::SET:
-						ssdb->sclear(key, trans, version);
-						log_debug("gc %s delete set %s", name.c_str(),  key.c_str());
-						count ++;
-						break;
-					case DataType::ZSET:
-						ssdb->zclear(key, trans, version);
-						log_debug("gc %s delete sorted set %s", name.c_str(), key.c_str());
-						count ++;
-						break;
-					case DataType::QUEUE:
-						log_debug("gc %s delete queue %s", name.c_str(), key.c_str());
-						ssdb->qclear(key, trans, version);
-						count ++;
-						break;
-					default:
-						log_error("gc %s unknown type: %s", name.c_str(), hexmem((it->key()).data(), (it->key()).size()).c_str());
-				}
-
-				/* delete record */
-				ssdb->raw_del(it->key());
-			}
-		}
-		SAFE_DELETE(it);
-		if(count == 0) {
-			/* pause for a while */
-			sleep(60);
-		} else {
-			/* give some time tp clean up low level data */
-			sleep(10);
-		}
-		log_debug("gc %s loop done, clean %" PRIu64 " keys", name.c_str(), count);
-	}
-	return NULL;
-}
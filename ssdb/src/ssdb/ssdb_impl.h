@@ -19,6 +19,11 @@ found in the LICENSE file.
 #include "t_queue.h"
 #include "concurrent.h"
 #include "t_set.h"
+#include "meta_cache.h"
+#include "version_alloc.h"
+#include "version_gc.h"
+
+class CountingFilterPolicy;
 
 inline
 static leveldb::Slice slice(const Bytes &b){
@@ -29,16 +34,19 @@ class SSDBImpl : public SSDB
 {
 private:
 	friend class SSDB;
+	friend class VersionGC;
 	leveldb::DB* ldb;
 	leveldb::Options options;
-	uint64_t global_version;             /* global version increase by 1 every time coming up to an delete */
-	uint64_t version_update_threshold;   /* threshold to record global version */
-	uint64_t num_version_update;         /* numbers of version updates since last record */
+	VersionAllocator *versions;          /* global version, increased by 1 for every new key */
+	VersionGC *gc;                       /* collects the data of deleted versions */
+	int64_t zrank_threshold;             /* build rank index for zsets of this size, 0: never */
 	int inited;
 	std::string name;
 	std::string dir;
 
 	DBKeyLock *dblocks;
+	MetaCache *meta_cache;               /* version key -> (type, version), NULL if disabled */
+	CountingFilterPolicy *filter_policy; /* options.filter_policy, NULL if disabled */
 
 	SSDBImpl(int32_t concurrency=1024);
 
@@ -67,6 +75,8 @@ public:
 	//void flushdb();
 	virtual uint64_t size();
 	virtual uint64_t leveldbfilesize();
+	// sizes[i]: approximate size of [bounds[i], bounds[i+1])
+	void approximate_sizes(const std::vector<std::string> &bounds, std::vector<uint64_t> *sizes);
 	virtual std::vector<std::string> info();
 	virtual void compact();
 	virtual int key_range(std::vector<std::string> *keys);
@@ -77,21 +87,25 @@ public:
 
 	/* raw operates */
 	virtual int raw_set(const Bytes &key, const Bytes &val);
+	// kvs: key, val, key, val...; written in one batch
+	int raw_multi_set(const std::vector<std::string> &kvs);
 	virtual int raw_del(const Bytes &key);
 	virtual int raw_get(const Bytes &key, std::string *val, const leveldb::Snapshot *snapshot=NULL);
-	virtual int raw_size(const Bytes &key, int64_t *size);
+	virtual int raw_size(const Bytes &key, int64_t *size, const leveldb::Snapshot *snapshot=NULL);
 	virtual int incr_raw_size(const Bytes &key, int64_t incr, int64_t *size, Transaction &trans);
 
 	/* key value */
 	virtual int set(const Bytes &key, const Bytes &val, Transaction &trans, uint64_t version);
 	virtual int del(const Bytes &key, Transaction &trans);
+	virtual int multi_del(const std::vector<std::string> &keys, Transaction &trans);
+	virtual int multi_del(const std::vector<std::string> &keys, const std::vector<std::string> &zsets,
+			Transaction &trans, uint64_t zset_version);
 	// -1: error, 1: ok, 0: value is not an integer or out of range
 	virtual int incr(const Bytes &key, int64_t by, int64_t *new_val, Transaction &trans, uint64_t version);
 	virtual int setbit(const Bytes &key, int bitoffset, int on, Transaction &trans, uint64_t version);
 	virtual int getbit(const Bytes &key, int bitoffset, uint64_t version);
 
-	virtual int get(const Bytes &key, std::string *val, uint64_t version);
-	virtual int mget(const std::vector<Bytes> &key, std::vector<std::string> *val, std::vector<uint64_t> version, const leveldb::Snapshot *snapshot);
+	virtual int get(const Bytes &key, std::string *val, uint64_t version, const leveldb::Snapshot *snapshot=NULL);
 	// return (start, end]
 	virtual KIterator* scan(const Bytes &start, const Bytes &end, uint64_t limit);
 	virtual KIterator* rscan(const Bytes &start, const Bytes &end, uint64_t limit);
@@ -111,12 +125,13 @@ public:
 			std::vector<std::string> *list);
 	virtual int hrlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 			std::vector<std::string> *list);
-	virtual HIterator* hscan(const Bytes &key, const Bytes &start, const Bytes &end, uint64_t limit, uint64_t version);
+	virtual HIterator* hscan(const Bytes &key, const Bytes &start, const Bytes &end, uint64_t limit, uint64_t version, const leveldb::Snapshot *snapshot=NULL);
 	virtual HIterator* hrscan(const Bytes &key, const Bytes &start, const Bytes &end, uint64_t limit, uint64_t version);
 
 	/* zset */
 	virtual int zset(const Bytes &key, const Bytes &field, const Bytes &score, Transaction &trans, uint64_t version);
 	virtual int zdel(const Bytes &key, const Bytes &field, Transaction &trans, uint64_t version);
+	virtual int64_t multi_zdel(const Bytes &key, const std::vector<std::string> &fields, Transaction &trans, uint64_t version);
 	// -1: error, 1: ok, 0: value is not an integer or out of range
 	virtual int zincr(const Bytes &key, const Bytes &field, int64_t by, int64_t *new_val, Transaction &trans, uint64_t version);
 	//int multi_zset(const Bytes &name, const std::vector<Bytes> &kvs, int offset=0, char log_type=BinlogType::SYNC);
@@ -132,14 +147,14 @@ public:
 	virtual int64_t zclear(const Bytes &key, Transaction &trans, uint64_t version);
 	virtual ZIterator* zrange(const Bytes &key, int64_t start, int64_t stop, uint64_t version);
 	virtual ZIterator* zrrange(const Bytes &key, int64_t start, int64_t stop, uint64_t version);
-	virtual ZIterator* zrange(const Bytes &key, uint64_t offset, uint64_t limit, uint64_t version);
+	virtual ZIterator* zrange(const Bytes &key, uint64_t offset, uint64_t limit, uint64_t version, const leveldb::Snapshot *snapshot=NULL);
 	virtual ZIterator* zrrange(const Bytes &key, uint64_t offset, uint64_t limit, uint64_t version);
 	/**
 	 * scan by score, but won't return @key if key.score=score_start.
 	 * return (score_start, score_end]
 	 */
 	virtual ZIterator* zscan(const Bytes &key, const Bytes &field,
-			const Bytes &score_start, const Bytes &score_end, uint64_t limit, uint64_t version);
+			const Bytes &score_start, const Bytes &score_end, uint64_t limit, uint64_t version, const leveldb::Snapshot *snapshot=NULL);
 	virtual ZIterator* zrscan(const Bytes &key, const Bytes &field,
 			const Bytes &score_start, const Bytes &score_end, uint64_t limit, uint64_t version);
 	virtual int zlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
@@ -147,12 +162,13 @@ public:
 	virtual int zrlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 			std::vector<std::string> *list);
 	/* set */
-	virtual int sget(const Bytes &key, const Bytes &elem, uint64_t version);
+	virtual int sget(const Bytes &key, const Bytes &elem, uint64_t version, const leveldb::Snapshot *snapshot=NULL);
 	virtual int sset(const Bytes &key, const Bytes &elem, Transaction &trans, uint64_t version);
+	virtual int64_t multi_sset(const Bytes &key, const std::vector<std::string> &elems, Transaction &trans, uint64_t version);
 	virtual int sdel(const Bytes &key, const Bytes &elem, Transaction &trans, uint64_t version);
 	virtual int64_t sclear(const Bytes &key, Transaction &trans, uint64_t version);
-	virtual int64_t ssize(const Bytes &key, uint64_t version);
-	virtual SIterator *sscan(const Bytes &key, const Bytes &elem, uint64_t limit, uint64_t version);
+	virtual int64_t ssize(const Bytes &key, uint64_t version, const leveldb::Snapshot *snapshot=NULL);
+	virtual SIterator *sscan(const Bytes &key, const Bytes &elem, uint64_t limit, uint64_t version, const leveldb::Snapshot *snapshot=NULL);
 	virtual SIterator *srscan(const Bytes &key, const Bytes &elem, uint64_t limit, uint64_t version);
 	virtual int64_t qsize(const Bytes &key, uint64_t version);
 	virtual int64_t qclear(const Bytes &key, Transaction &trans, uint64_t version);
@@ -166,6 +182,9 @@ public:
 	// @return 0: empty queue, 1: item popped, -1: error
 	virtual int qpop_front(const Bytes &key, std::string *item, Transaction &trans, uint64_t version);
 	virtual int qpop_back(const Bytes &key, std::string *item, Transaction &trans, uint64_t version);
+	// @return -1: error, other: the number of items popped, all in one write
+	virtual int64_t qtrim_front(const Bytes &key, uint64_t limit, Transaction &trans, uint64_t version);
+	virtual int64_t qtrim_back(const Bytes &key, uint64_t limit, Transaction &trans, uint64_t version);
 	virtual int qfix(const Bytes &key, Transaction &trans);
 	virtual int qlist(const Bytes &name_s, const Bytes &name_e, uint64_t limit,
 			std::vector<std::string> *list);
@@ -173,6 +192,7 @@ public:
 			std::vector<std::string> *list);
 	virtual int qslice(const Bytes &key, int64_t offset, int64_t limit, uint64_t version,
 			std::vector<std::string> *list);
+	virtual int qslice(const Bytes &key, int64_t begin, int64_t end, uint64_t version, QIterator **it);
 	virtual int qget(const Bytes &key, int64_t index, std::string *item, uint64_t version);
 	virtual int qset(const Bytes &key, int64_t index, const Bytes &item, Transaction &trans, uint64_t version);
 	virtual QIterator *qscan(const Bytes &key, uint64_t seq_start, uint64_t limit, uint64_t version);
@@ -180,7 +200,16 @@ public:
 private:
 	int64_t _qpush(const Bytes &key, const Bytes &item, uint64_t front_or_back_seq, Transaction &trans, uint64_t version);
 	int _qpop(const Bytes &key, std::string *item, uint64_t front_or_back_seq, Transaction &trans, uint64_t version);
-	int _update_global_version();
+	int64_t _qtrim(const Bytes &key, uint64_t limit, uint64_t front_or_back_seq, Transaction &trans, uint64_t version);
+	int _multi_del(const std::vector<std::string> &keys, Transaction &trans);
+	int64_t _multi_zdel(const Bytes &key, const std::vector<std::string> &fields, Transaction &trans, uint64_t version);
+	int _zrank_update(const Bytes &key, const std::string *old_score, const std::string *new_score,
+			int64_t size, Transaction &trans, uint64_t version);
+	int _zrank_build(const Bytes &key, const std::string &new_score, Transaction &trans, uint64_t version);
+	int _zrank_drop(const Bytes &key, Transaction &trans, uint64_t version);
+	int _zrank_indexed(const Bytes &key, uint64_t version, const leveldb::Snapshot *snapshot=NULL);
+	int64_t _zrank_before(const Bytes &key, int64_t score, uint64_t version);
+	int _zrank_locate(const Bytes &key, uint64_t pos, std::string *score, uint64_t *ties, uint64_t version, const leveldb::Snapshot *snapshot=NULL);
 
 public:
 	// snapshot
@@ -146,7 +146,7 @@ int SSDBImpl::hget(const Bytes &key, const Bytes &field, std::string *val, uint6
 	return this->raw_get(hkey, val);
 }
 
-HIterator* SSDBImpl::hscan(const Bytes &key, const Bytes &start, const Bytes &end, uint64_t limit, uint64_t version){
+HIterator* SSDBImpl::hscan(const Bytes &key, const Bytes &start, const Bytes &end, uint64_t limit, uint64_t version, const leveldb::Snapshot *snapshot){
 	std::string key_start, key_end;
 
 	key_start = encode_hash_key(key, start, version);
@@ -156,7 +156,7 @@ HIterator* SSDBImpl::hscan(const Bytes &key, const Bytes &start, const Bytes &en
 	}
 	//dump(key_start.data(), key_start.size(), "scan.start");
 	//dump(key_end.data(), key_end.size(), "scan.end");
-	return new HIterator(this->iterator(key_start, key_end, limit), key);
+	return new HIterator(this->iterator(key_start, key_end, limit, snapshot), key);
 }
 
 HIterator* SSDBImpl::hrscan(const Bytes &key, const Bytes &start, const Bytes &end, uint64_t limit, uint64_t version){
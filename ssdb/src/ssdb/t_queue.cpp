@@ -19,7 +19,7 @@ static int qset_one(SSDBImpl *ssdb, const Bytes &name, uint64_t seq, const Bytes
 	return 0;
 }
 
-static int64_t incr_qsize(SSDBImpl *ssdb, const Bytes &key, int64_t incr, Transaction &trans, uint16_t version) {
+static int64_t incr_qsize(SSDBImpl *ssdb, const Bytes &key, int64_t incr, Transaction &trans, uint64_t version) {
 	std::string qskey = encode_qsize_key(key, version);
 	int64_t size;
 	if(ssdb->incr_raw_size(qskey, incr, &size, trans) == -1) {
@@ -265,6 +265,60 @@ int SSDBImpl::qpop_back(const Bytes &name, std::string *item, Transaction &trans
 	return _qpop(name, item, QBACK_SEQ, trans, version);
 }
 
+/* pop up to limit items in one commit, @return the number of items popped, -1: error */
+int64_t SSDBImpl::_qtrim(const Bytes &key, uint64_t limit, uint64_t front_or_back_seq, Transaction &trans, uint64_t version){
+	trans.begin();
+
+	int64_t size = this->qsize(key, version);
+	if(size == -1){
+		return -1;
+	}
+	if(size == 0 || limit == 0){
+		return 0;
+	}
+	int64_t count = (uint64_t)size < limit? size : (int64_t)limit;
+
+	uint64_t seq;
+	int ret = qget_uint64(this->ldb, key, front_or_back_seq, &seq, version);
+	if(ret == -1){
+		return -1;
+	}
+	if(ret == 0){
+		return 0;
+	}
+
+	for(int64_t i=0; i<count; i++){
+		qdel_one(this, key, seq, trans, version);
+		seq += (front_or_back_seq == QFRONT_SEQ)? +1 : -1;
+	}
+
+	size = incr_qsize(this, key, -count, trans, version);
+	if(size == -1){
+		return -1;
+	}
+	if(size > 0){
+		ret = qset_one(this, key, front_or_back_seq, Bytes(&seq, sizeof(seq)), trans, version);
+		if(ret == -1){
+			return -1;
+		}
+	}
+
+	Transaction::Status s = trans.commit();
+	if(!s.ok()){
+		log_error("Write error! %s", s.ToString().c_str());
+		return -1;
+	}
+	return count;
+}
+
+int64_t SSDBImpl::qtrim_front(const Bytes &name, uint64_t limit, Transaction &trans, uint64_t version){
+	return _qtrim(name, limit, QFRONT_SEQ, trans, version);
+}
+
+int64_t SSDBImpl::qtrim_back(const Bytes &name, uint64_t limit, Transaction &trans, uint64_t version){
+	return _qtrim(name, limit, QBACK_SEQ, trans, version);
+}
+
 int64_t SSDBImpl::qclear(const Bytes &key, Transaction &trans, uint64_t version) {
 	int64_t count = 0;
 	while(true) {
@@ -378,59 +432,50 @@ int SSDBImpl::qfix(const Bytes &name, Transaction &trans){
 	return 0;
 }
 
-int SSDBImpl::qslice(const Bytes &key, int64_t begin, int64_t end, uint64_t version, std::vector<std::string> *list)
+/* the seqs of the items from begin to end, 0: no item in the range */
+static int qslice_seqs(leveldb::DB* db, const Bytes &key, int64_t begin, int64_t end, uint64_t version,
+		uint64_t *seq_begin, uint64_t *seq_end)
 {
 	int ret;
-	uint64_t seq_begin, seq_end;
-	if(begin >= 0 && end >= 0){
-		uint64_t tmp_seq;
-		ret = qget_uint64(this->ldb, key, QFRONT_SEQ, &tmp_seq, version);
-		if(ret != 1){
-			return ret;
-		}
-		seq_begin = tmp_seq + begin;
-		seq_end = tmp_seq + end;
-	}else if(begin < 0 && end < 0){
-		uint64_t tmp_seq;
-		ret = qget_uint64(this->ldb, key, QBACK_SEQ, &tmp_seq, version);
-		if(ret != 1){
-			return ret;
-		}
-		seq_begin = tmp_seq + begin + 1;
-		seq_end = tmp_seq + end + 1;
+	uint64_t f_seq, b_seq;
+	ret = qget_uint64(db, key, QFRONT_SEQ, &f_seq, version);
+	if(ret != 1){
+		return ret;
+	}
+	ret = qget_uint64(db, key, QBACK_SEQ, &b_seq, version);
+	if(ret != 1){
+		return ret;
+	}
+	if(begin >= 0){
+		*seq_begin = f_seq + begin;
 	}else{
-		uint64_t f_seq, b_seq;
-		ret = qget_uint64(this->ldb, key, QFRONT_SEQ, &f_seq, version);
-		if(ret != 1){
-			return ret;
-		}
-		ret = qget_uint64(this->ldb, key, QBACK_SEQ, &b_seq, version);
-		if(ret != 1){
-			return ret;
-		}
-		if(begin >= 0){
-			seq_begin = f_seq + begin;
-		}else{
-			seq_begin = b_seq + begin + 1;
-		}
-		if(end >= 0){
-			seq_end = f_seq + end;
-		}else{
-			seq_end = b_seq + end + 1;
-		}
+		*seq_begin = b_seq + begin + 1;
 	}
+	if(end >= 0){
+		*seq_end = f_seq + end;
+	}else{
+		*seq_end = b_seq + end + 1;
+	}
+	if(*seq_end > b_seq){
+		*seq_end = b_seq;
+	}
+	if(*seq_begin < f_seq || *seq_begin > *seq_end){
+		return 0;
+	}
+	return 1;
+}
 
-	for(; seq_begin <= seq_end; seq_begin++){
-		std::string item;
-		ret = qget_by_seq(this->ldb, key, seq_begin, &item, version);
-		if(ret == -1){
-			return -1;
-		}
-		if(ret == 0){
-			return 0;
-		}
-		list->push_back(item);
+int SSDBImpl::qslice(const Bytes &key, int64_t begin, int64_t end, uint64_t version, std::vector<std::string> *list)
+{
+	QIterator *it = NULL;
+	int ret = this->qslice(key, begin, end, version, &it);
+	if(ret != 1){
+		return ret;
+	}
+	while(it->next()){
+		list->push_back(it->val);
 	}
+	delete it;
 	return 0;
 }
 
@@ -581,3 +626,14 @@ static QIterator *qiterator(
 QIterator *SSDBImpl::qscan(const Bytes &key, uint64_t seq_start, uint64_t limit, uint64_t version) {
 	return qiterator(this, key, seq_start, limit, version, Iterator::FORWARD);
 }
+
+int SSDBImpl::qslice(const Bytes &key, int64_t begin, int64_t end, uint64_t version, QIterator **it) {
+	uint64_t seq_begin, seq_end;
+	int ret = qslice_seqs(this->ldb, key, begin, end, version, &seq_begin, &seq_end);
+	if(ret != 1){
+		return ret;
+	}
+	// the iterator starts after seq_start
+	*it = qiterator(this, key, seq_begin - 1, seq_end - seq_begin + 1, version, Iterator::FORWARD);
+	return 1;
+}
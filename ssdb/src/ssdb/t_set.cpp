@@ -22,10 +22,10 @@ static int incr_ssize(SSDBImpl *ssdb, const Bytes &key, int64_t incr, Transactio
 	return 0;
 }
 
-int SSDBImpl::sget(const Bytes &key, const Bytes &elem, uint64_t version) {
+int SSDBImpl::sget(const Bytes &key, const Bytes &elem, uint64_t version, const leveldb::Snapshot *snapshot) {
 	std::string skey = encode_set_key(key, elem, version);
 	std::string value;
-	return this->raw_get(skey, &value);
+	return this->raw_get(skey, &value, snapshot);
 }
 
 int SSDBImpl::sset(const Bytes &key, const Bytes &elem, Transaction &trans, uint64_t version) {
@@ -52,6 +52,36 @@ int SSDBImpl::sset(const Bytes &key, const Bytes &elem, Transaction &trans, uint
 	return 1;
 }
 
+int64_t SSDBImpl::multi_sset(const Bytes &key, const std::vector<std::string> &elems, Transaction &trans, uint64_t version) {
+	trans.begin();
+
+	int64_t num = 0;
+	for(size_t i = 0; i < elems.size(); i++) {
+		int found = this->sget(key, elems[i], version);
+		if(found == -1) {
+			return -1;
+		}
+		if(found != 0) {
+			continue;
+		}
+		trans.put(encode_set_key(key, elems[i], version), "");
+		num ++;
+	}
+	if(num == 0) {
+		return 0;
+	}
+	if(incr_ssize(this, key, num, trans, version) == -1) {
+		return -1;
+	}
+
+	Transaction::Status s = trans.commit();
+	if(!s.ok()) {
+		log_error("multi_sset error: %s", s.ToString().c_str());
+		return -1;
+	}
+	return num;
+}
+
 int SSDBImpl::sdel(const Bytes &key, const Bytes &elem, Transaction &trans, uint64_t version) {
 	trans.begin();
 	int found = this->sget(key, elem, version);
@@ -74,10 +104,10 @@ int SSDBImpl::sdel(const Bytes &key, const Bytes &elem, Transaction &trans, uint
 	}
 	return 1;
 }
-int64_t SSDBImpl::ssize(const Bytes &key, uint64_t version){
+int64_t SSDBImpl::ssize(const Bytes &key, uint64_t version, const leveldb::Snapshot *snapshot){
 	std::string sskey = encode_ssize_key(key, version);
 	int64_t size;
-	int ret = this->raw_size(sskey, &size);
+	int ret = this->raw_size(sskey, &size, snapshot);
 	if(ret == -1) {
 		return -1;
 	}
@@ -94,11 +124,12 @@ static SIterator* siterator(
 		const Bytes &elem_start,
 		uint64_t limit,
 		Iterator::Direction direction,
-		uint64_t version) {
+		uint64_t version,
+		const leveldb::Snapshot *snapshot=NULL) {
 	if(direction == Iterator::FORWARD) {
 		std::string start = encode_set_key(key, elem_start, version);
 		std::string end = encode_set_key(key, "\xff", version);
-		return new SIterator(ssdb->iterator(start, end, limit), key);
+		return new SIterator(ssdb->iterator(start, end, limit, snapshot), key);
 	} else {
 		std::string start = encode_set_key(key, elem_start, version);
 		std::string end = encode_set_key(key, "", version);
@@ -106,8 +137,8 @@ static SIterator* siterator(
 	}
 }
 
-SIterator* SSDBImpl::sscan(const Bytes &key, const Bytes &elem, uint64_t limit, uint64_t version) {
-	return siterator(this, key, elem, limit, Iterator::FORWARD, version);
+SIterator* SSDBImpl::sscan(const Bytes &key, const Bytes &elem, uint64_t limit, uint64_t version, const leveldb::Snapshot *snapshot) {
+	return siterator(this, key, elem, limit, Iterator::FORWARD, version, snapshot);
 }
 
 SIterator* SSDBImpl::srscan(const Bytes &key, const Bytes &elem, uint64_t limit, uint64_t version) {
@@ -4,25 +4,34 @@ Use of this source code is governed by a BSD-style license that can be
 found in the LICENSE file.
 */
 #include <limits.h>
+#include <map>
+#include <set>
 #include "t_zset.h"
 #include "version.h"
+#include "leveldb/comparator.h"
 #include "concurrent.h"
 #include <sstream>
 
 static const char *SSDB_SCORE_MIN		= "-9223372036854775808";
 static const char *SSDB_SCORE_MAX		= "+9223372036854775807";
 
+/* offsets below this are cheaper to skip than to locate in the rank index */
+#define ZRANK_LINEAR_MAX 1024
+
 // for test
 #ifdef BAIDU_TEST
 static void print_ascii(const std::string &str);
 #endif
 
-static int incr_zsize(SSDBImpl *ssdb, const Bytes &key, int64_t incr, Transaction &trans, uint64_t version) {
+static int incr_zsize(SSDBImpl *ssdb, const Bytes &key, int64_t incr, Transaction &trans, uint64_t version, int64_t *new_size=NULL) {
 	std::string zskey = encode_zsize_key(key, version);
 	int64_t size;
 	if(ssdb->incr_raw_size(zskey, incr, &size, trans) == -1) {
 		return -1;
 	}
+	if(new_size) {
+		*new_size = size;
+	}
 	if(size == 0) {
 		trans.del(zskey);
 		trans.del(encode_version_key(key));
@@ -67,11 +76,15 @@ int SSDBImpl::zset(const Bytes &key, const Bytes &field, const Bytes &score, Tra
 		k0 = encode_zset_key(key, field, version);
 		trans.put(k0, new_score);
 
+		int64_t size = -1;
 		if(found == 0) {
-			if (incr_zsize(this, key, 1, trans, version) == -1) {
+			if (incr_zsize(this, key, 1, trans, version, &size) == -1) {
 				return -1;
 			}
 		}
+		if(_zrank_update(key, found ? &old_score : NULL, &new_score, size, trans, version) == -1) {
+			return -1;
+		}
 
 		Transaction::Status s = trans.commit();
 		if(!s.ok()) {
@@ -96,7 +109,11 @@ int SSDBImpl::zdel(const Bytes &key, const Bytes &field, Transaction &trans, uin
 	std::string ss = encode_zscore_key(key, field, old_score, version);
 	trans.del(ss);
 	trans.del(zkey);
-	if(incr_zsize(this, key, -1, trans, version) == -1) {
+	int64_t size;
+	if(incr_zsize(this, key, -1, trans, version, &size) == -1) {
+		return -1;
+	}
+	if(_zrank_update(key, &old_score, NULL, size, trans, version) == -1) {
 		return -1;
 	}
 
@@ -107,6 +124,90 @@ int SSDBImpl::zdel(const Bytes &key, const Bytes &field, Transaction &trans, uin
 	return 1;
 }
 
+// -1: error, other: number of members deleted, all in one write
+int64_t SSDBImpl::multi_zdel(const Bytes &key, const std::vector<std::string> &fields, Transaction &trans, uint64_t version){
+	trans.begin();
+	int64_t num = this->_multi_zdel(key, fields, trans, version);
+	if(num <= 0){
+		return num;
+	}
+	Transaction::Status s = trans.commit();
+	if(!s.ok()){
+		log_error("zdel commit failed: %s", s.ToString().c_str());
+		return -1;
+	}
+	return num;
+}
+
+/**
+ * stage the deletion of several members in trans, the size and the rank
+ * buckets are read once and adjusted by the sum of the changes.
+ * retval: number of members deleted, -1: error
+ **/
+int64_t SSDBImpl::_multi_zdel(const Bytes &key, const std::vector<std::string> &fields, Transaction &trans, uint64_t version){
+	std::set<std::string> done;
+	std::vector<int64_t> scores;
+	int64_t num = 0;
+	for(size_t i = 0; i < fields.size(); i++){
+		const std::string &field = fields[i];
+		if(!done.insert(field).second){
+			continue;
+		}
+		std::string zkey = encode_zset_key(key, field, version);
+		std::string old_score;
+		int found = this->raw_get(zkey, &old_score);
+		if(found == -1){
+			return -1;
+		}
+		if(found == 0){
+			continue;
+		}
+		trans.del(encode_zscore_key(key, field, old_score, version));
+		trans.del(zkey);
+		scores.push_back(str_to_int64(old_score));
+		num ++;
+	}
+	if(num == 0){
+		return 0;
+	}
+
+	int64_t size;
+	if(incr_zsize(this, key, -num, trans, version, &size) == -1){
+		return -1;
+	}
+	if(size + num < ZRANK_MIN_SIZE){
+		return num;
+	}
+	int indexed = _zrank_indexed(key, version);
+	if(indexed == -1){
+		return -1;
+	}
+	if(indexed == 0){
+		return num;
+	}
+	if(zrank_threshold <= 0 || size < ZRANK_MIN_SIZE){
+		if(_zrank_drop(key, trans, version) == -1){
+			return -1;
+		}
+		return num;
+	}
+	std::map<std::string, int64_t> buckets;
+	for(size_t i = 0; i < scores.size(); i++){
+		uint64_t u = zrank_score(scores[i]);
+		for(int level = 0; level < ZRANK_LEVELS; level++){
+			buckets[encode_zrank_key(key, version, level, zrank_bucket(u, level))] --;
+		}
+	}
+	std::map<std::string, int64_t>::const_iterator it;
+	for(it = buckets.begin(); it != buckets.end(); ++it){
+		int64_t count;
+		if(this->incr_raw_size(it->first, it->second, &count, trans) == -1){
+			return -1;
+		}
+	}
+	return num;
+}
+
 /* retval 0: updated 1: new -1: error */
 int SSDBImpl::zincr(const Bytes &key, const Bytes &field, int64_t by, int64_t *new_val, Transaction &trans, uint64_t version) {
 	trans.begin();
@@ -117,9 +218,10 @@ int SSDBImpl::zincr(const Bytes &key, const Bytes &field, int64_t by, int64_t *n
 	if(ret == -1) {
 		return -1;
 	}
+	int64_t size = -1;
 	if(ret == 0) {
 		*new_val = by;
-		if(incr_zsize(this, key, 1 , trans, version) == -1) {
+		if(incr_zsize(this, key, 1 , trans, version, &size) == -1) {
 			return -1;
 		}
 	} else {
@@ -129,6 +231,9 @@ int SSDBImpl::zincr(const Bytes &key, const Bytes &field, int64_t by, int64_t *n
 	std::string score = str(*new_val);
 	trans.put(zkey, score);
 	trans.put(encode_zscore_key(key, field, score, version), "");
+	if(_zrank_update(key, ret ? &value : NULL, &score, size, trans, version) == -1) {
+		return -1;
+	}
 
 	Transaction::Status s = trans.commit();
 	if(!s.ok()) {
@@ -164,7 +269,8 @@ static ZIterator* ziterator(
 	SSDBImpl *ssdb,
 	const Bytes &key, const Bytes &key_start,
 	const Bytes &score_start, const Bytes &score_end,
-	uint64_t limit, Iterator::Direction direction, uint64_t version)
+	uint64_t limit, Iterator::Direction direction, uint64_t version,
+	const leveldb::Snapshot *snapshot=NULL)
 {
 	if(direction == Iterator::FORWARD){
 		std::string start, end;
@@ -178,7 +284,7 @@ static ZIterator* ziterator(
 		}else{
 			end = encode_zscore_key(key, "\xff", score_end, version);
 		}
-		return new ZIterator(ssdb->iterator(start, end, limit), key);
+		return new ZIterator(ssdb->iterator(start, end, limit, snapshot), key);
 	}else{
 		std::string start, end;
 		if(score_start.empty()){
@@ -199,7 +305,36 @@ static ZIterator* ziterator(
 	}
 }
 
+/* -1: error or not found */
+static int64_t zrank_by_index(SSDBImpl *ssdb, const Bytes &key, const Bytes &field, int64_t before, const std::string &score, uint64_t version){
+	/* members of the same score are ordered by field */
+	ZIterator *it = ziterator(ssdb, key, "", score, "", UINT64_MAX, Iterator::FORWARD, version);
+	int64_t ret = before;
+	while(true){
+		if(it->next() == false || it->score != score){
+			ret = -1;
+			break;
+		}
+		if(field == it->field){
+			break;
+		}
+		ret ++;
+	}
+	delete it;
+	return ret;
+}
+
 int64_t SSDBImpl::zrank(const Bytes &key, const Bytes &field, uint64_t version){
+	if(_zrank_indexed(key, version) == 1){
+		std::string score;
+		if(this->zget(key, field, &score, version) != 1){
+			return -1;
+		}
+		int64_t before = _zrank_before(key, str_to_int64(score), version);
+		if(before >= 0){
+			return zrank_by_index(this, key, field, before, score, version);
+		}
+	}
 	ZIterator *it =	ziterator(this, key, "", "", "", INT_MAX, Iterator::FORWARD, version);
 	int64_t ret = 0;
 	while(true){
@@ -217,6 +352,14 @@ int64_t SSDBImpl::zrank(const Bytes &key, const Bytes &field, uint64_t version){
 }
 
 int64_t SSDBImpl::zrrank(const Bytes &key, const Bytes &field, uint64_t version){
+	if(_zrank_indexed(key, version) == 1){
+		int64_t size = this->zsize(key, version);
+		int64_t rank = this->zrank(key, field, version);
+		if(size < 0 || rank < 0){
+			return -1;
+		}
+		return size - 1 - rank;
+	}
 	ZIterator *it = ziterator(this, key, "", "", "", INT_MAX, Iterator::BACKWARD, version);
 	int64_t ret = 0;
 	while(true){
@@ -301,14 +444,48 @@ ZIterator* SSDBImpl::zrrange(const Bytes &key, int64_t start, int64_t stop, uint
 	}
 }
 
-ZIterator* SSDBImpl::zrange(const Bytes &key, uint64_t offset, uint64_t limit, uint64_t version){
+ZIterator* SSDBImpl::zrange(const Bytes &key, uint64_t offset, uint64_t limit, uint64_t version, const leveldb::Snapshot *snapshot){
+	if(offset >= ZRANK_LINEAR_MAX && _zrank_indexed(key, version, snapshot) == 1){
+		std::string score;
+		uint64_t ties;
+		int ret = _zrank_locate(key, offset, &score, &ties, version, snapshot);
+		if(ret == 0){
+			/* out of range */
+			return ziterator(this, key, "", "", "", 0, Iterator::FORWARD, version, snapshot);
+		}
+		if(ret == 1){
+			ZIterator *it = ziterator(this, key, "", score, "", ties + limit, Iterator::FORWARD, version, snapshot);
+			it->skip(ties);
+			return it;
+		}
+	}
 	limit = offset + limit;
-	ZIterator *it = ziterator(this, key, "", "", "", limit, Iterator::FORWARD, version);
+	ZIterator *it = ziterator(this, key, "", "", "", limit, Iterator::FORWARD, version, snapshot);
 	it->skip(offset);
 	return it;
 }
 
 ZIterator* SSDBImpl::zrrange(const Bytes &key, uint64_t offset, uint64_t limit, uint64_t version){
+	if(offset >= ZRANK_LINEAR_MAX && _zrank_indexed(key, version) == 1){
+		int64_t size = this->zsize(key, version);
+		if(size >= 0 && offset >= (uint64_t)size){
+			return ziterator(this, key, "", "", "", 0, Iterator::BACKWARD, version);
+		}
+		std::string score;
+		uint64_t ties;
+		if(size >= 0 && _zrank_locate(key, size - 1 - offset, &score, &ties, version) == 1){
+			/* find the field to start from, then walk backward just above it */
+			ZIterator *it = ziterator(this, key, "", score, "", ties + 1, Iterator::FORWARD, version);
+			it->skip(ties);
+			if(it->next()){
+				std::string start = it->field;
+				start.append(1, '\0');
+				delete it;
+				return ziterator(this, key, start, score, "", limit, Iterator::BACKWARD, version);
+			}
+			delete it;
+		}
+	}
 	limit = offset + limit;
 	ZIterator *it = ziterator(this, key, "", "", "", limit, Iterator::BACKWARD, version);
 	it->skip(offset);
@@ -316,18 +493,19 @@ ZIterator* SSDBImpl::zrrange(const Bytes &key, uint64_t offset, uint64_t limit,
 }
 
 ZIterator* SSDBImpl::zscan(const Bytes &key, const Bytes &field,
-		const Bytes &score_start, const Bytes &score_end, uint64_t limit, uint64_t version)
+		const Bytes &score_start, const Bytes &score_end, uint64_t limit, uint64_t version,
+		const leveldb::Snapshot *snapshot)
 {
 	std::string score;
 	// if only key is specified, load its value
 	if(!key.empty() && score_start.empty()){
-		if(this->zget(key, field, &score, version) == -1) {
+		if(this->zget(key, field, &score, version, snapshot) == -1) {
 			return NULL;
 		}
 	}else{
 		score = score_start.String();
 	}
-	return ziterator(this, key, field, score, score_end, limit, Iterator::FORWARD, version);
+	return ziterator(this, key, field, score, score_end, limit, Iterator::FORWARD, version, snapshot);
 }
 
 ZIterator* SSDBImpl::zrscan(const Bytes &key, const Bytes &field,
@@ -361,6 +539,190 @@ int64_t SSDBImpl::zclear(const Bytes &key, Transaction &trans, uint64_t version)
 	return count;
 }
 
+/* rank index */
+
+/* 1: indexed, 0: not indexed, -1: error */
+int SSDBImpl::_zrank_indexed(const Bytes &key, uint64_t version, const leveldb::Snapshot *snapshot){
+	std::string val;
+	return this->raw_get(encode_zrank_marker(key, version), &val, snapshot);
+}
+
+/**
+ * keep the rank index in step with a member moving from old_score to
+ * new_score(NULL for insertion or deletion), in the same transaction.
+ * size: zset size after the change, -1 if unchanged
+ **/
+int SSDBImpl::_zrank_update(const Bytes &key, const std::string *old_score, const std::string *new_score,
+		int64_t size, Transaction &trans, uint64_t version){
+	if(size >= 0){
+		/* neither before nor after the change large enough to be indexed */
+		int64_t before = size + (old_score ? 1 : 0) - (new_score ? 1 : 0);
+		if(before < ZRANK_MIN_SIZE && size < ZRANK_MIN_SIZE){
+			return 0;
+		}
+	}
+	int ret = _zrank_indexed(key, version);
+	if(ret == -1){
+		return -1;
+	}
+	if(ret == 0){
+		/* build once an insertion makes the zset large enough */
+		if(zrank_threshold <= 0 || old_score != NULL || size < zrank_threshold){
+			return 0;
+		}
+		return _zrank_build(key, *new_score, trans, version);
+	}
+
+	/* disabled, or shrunk below the size that is never indexed */
+	if(zrank_threshold <= 0 || (size >= 0 && size < ZRANK_MIN_SIZE)){
+		return _zrank_drop(key, trans, version);
+	}
+	uint64_t uo = old_score ? zrank_score(str_to_int64(*old_score)) : 0;
+	uint64_t un = new_score ? zrank_score(str_to_int64(*new_score)) : 0;
+	for(int level = 0; level < ZRANK_LEVELS; level++){
+		uint64_t bo = zrank_bucket(uo, level);
+		uint64_t bn = zrank_bucket(un, level);
+		if(old_score && new_score && bo == bn){
+			continue;
+		}
+		int64_t count;
+		if(old_score && this->incr_raw_size(encode_zrank_key(key, version, level, bo), -1, &count, trans) == -1){
+			return -1;
+		}
+		if(new_score && this->incr_raw_size(encode_zrank_key(key, version, level, bn), 1, &count, trans) == -1){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int SSDBImpl::_zrank_build(const Bytes &key, const std::string &new_score, Transaction &trans, uint64_t version){
+	std::map<uint64_t, int64_t> counts[ZRANK_LEVELS];
+	uint64_t u = zrank_score(str_to_int64(new_score));
+	for(int level = 0; level < ZRANK_LEVELS; level++){
+		counts[level][zrank_bucket(u, level)] ++;
+	}
+	uint64_t num = 1;
+	ZIterator *it = ziterator(this, key, "", "", "", UINT64_MAX, Iterator::FORWARD, version);
+	while(it->next()){
+		u = zrank_score(str_to_int64(it->score));
+		for(int level = 0; level < ZRANK_LEVELS; level++){
+			counts[level][zrank_bucket(u, level)] ++;
+		}
+		num ++;
+	}
+	delete it;
+
+	for(int level = 0; level < ZRANK_LEVELS; level++){
+		std::map<uint64_t, int64_t>::const_iterator c;
+		for(c = counts[level].begin(); c != counts[level].end(); c++){
+			int64_t count = c->second;
+			trans.put(encode_zrank_key(key, version, level, c->first), Bytes((char *)&count, sizeof(count)));
+		}
+	}
+	trans.put(encode_zrank_marker(key, version), "");
+	log_info("build rank index of zset %s, %" PRIu64 " members",
+		hexmem(key.data(), key.size()).c_str(), num);
+	return 0;
+}
+
+int SSDBImpl::_zrank_drop(const Bytes &key, Transaction &trans, uint64_t version){
+	std::string start = encode_zrank_key(key, version, 0, 0);
+	std::string end = encode_zrank_marker(key, version);
+	uint64_t num = 0;
+	leveldb::Iterator *it = ldb->NewIterator(leveldb::ReadOptions());
+	for(it->Seek(start); it->Valid(); it->Next()){
+		if(options.comparator->Compare(it->key(), end) > 0){
+			break;
+		}
+		trans.del(Bytes(it->key().data(), it->key().size()));
+		num ++;
+	}
+	bool ok = it->status().ok();
+	delete it;
+	if(!ok){
+		return -1;
+	}
+	log_info("drop rank index of zset %s, %" PRIu64 " buckets",
+		hexmem(key.data(), key.size()).c_str(), num);
+	return 0;
+}
+
+/* number of members with a score lower than 'score', -1: error */
+int64_t SSDBImpl::_zrank_before(const Bytes &key, int64_t score, uint64_t version){
+	uint64_t u = zrank_score(score);
+	int64_t before = 0;
+	leveldb::Iterator *it = ldb->NewIterator(leveldb::ReadOptions());
+	for(int level = 0; level < ZRANK_LEVELS; level++){
+		/* count the buckets left to ours under the same parent */
+		uint64_t id = zrank_bucket(u, level);
+		uint64_t lo = id & ~(uint64_t)(ZRANK_FANOUT - 1);
+		if(lo == id){
+			continue;
+		}
+		std::string end = encode_zrank_key(key, version, level, id);
+		for(it->Seek(encode_zrank_key(key, version, level, lo)); it->Valid(); it->Next()){
+			if(options.comparator->Compare(it->key(), end) >= 0){
+				break;
+			}
+			int64_t count;
+			if(it->value().size() != sizeof(count)){
+				continue;
+			}
+			memcpy(&count, it->value().data(), sizeof(count));
+			before += count;
+		}
+	}
+	bool ok = it->status().ok();
+	delete it;
+	return ok ? before : -1;
+}
+
+/**
+ * find the score of the member at 'pos'(0 based, ascending) and how
+ * many members of the same score come before it.
+ * 1: found, 0: out of range, -1: error
+ **/
+int SSDBImpl::_zrank_locate(const Bytes &key, uint64_t pos, std::string *score, uint64_t *ties, uint64_t version,
+		const leveldb::Snapshot *snapshot){
+	uint64_t prefix = 0;
+	leveldb::ReadOptions read_options;
+	read_options.snapshot = snapshot;
+	leveldb::Iterator *it = ldb->NewIterator(read_options);
+	for(int level = 0; level < ZRANK_LEVELS; level++){
+		uint64_t lo = level == 0 ? 0 : prefix << 8;
+		std::string end = encode_zrank_key(key, version, level, lo + ZRANK_FANOUT - 1);
+		bool found = false;
+		for(it->Seek(encode_zrank_key(key, version, level, lo)); it->Valid(); it->Next()){
+			if(options.comparator->Compare(it->key(), end) > 0){
+				break;
+			}
+			uint8_t l;
+			uint64_t bucket;
+			int64_t count;
+			if(decode_zrank_key(Bytes(it->key().data(), it->key().size()), &l, &bucket) == -1 || it->value().size() != sizeof(count)){
+				continue;
+			}
+			memcpy(&count, it->value().data(), sizeof(count));
+			if(count > 0 && pos < (uint64_t)count){
+				prefix = bucket;
+				found = true;
+				break;
+			}
+			pos -= count;
+		}
+		if(!found){
+			int ret = it->status().ok() ? 0 : -1;
+			delete it;
+			return ret;
+		}
+	}
+	delete it;
+	*score = str((int64_t)(prefix ^ 0x8000000000000000ULL));
+	*ties = pos;
+	return 1;
+}
+
 static void get_znames(Iterator *it, std::vector<std::string> *list){
 	/*while(it->next()){
 		Bytes ks = it->key();
@@ -176,6 +176,86 @@ int decode_zscore_key(const Bytes &slice, std::string *key, std::string *field,
 	return 0;
 }
 
+/* the same as above, key and field point into slice, no copies */
+static inline
+int decode_zscore_key(const Bytes &slice, Bytes *key, Bytes *field, int64_t *score, uint64_t *version){
+	const char *p = slice.data();
+	if(slice.size() < 2){
+		return -1;
+	}
+	int klen = (uint8_t)p[1];
+	int flen = slice.size() - 2 - klen - sizeof(uint64_t) - 1 - sizeof(int64_t) - 1 - sizeof(int16_t);
+	if(flen < 0){
+		return -1;
+	}
+	*key = Bytes(p + 2, klen);
+	p += 2 + klen;
+	*version = big_endian(*(uint64_t *)p);
+	p += sizeof(uint64_t) + 1;
+	*score = (int64_t)decode_score(*(int64_t *)p);
+	p += sizeof(int64_t) + 1;
+	*field = Bytes(p, flen);
+	return 0;
+}
+
+/**
+ * rank index: counters of members per score bucket at 8 levels, level l
+ * buckets by the top (l+1) bytes of the order preserving score, so level 7
+ * is the exact score. A bucket counts every member below it.
+ **/
+#define ZRANK_LEVELS 8
+#define ZRANK_FANOUT 256
+#define ZRANK_MARKER_LEVEL 0xff
+/* lowest build threshold, smaller zsets are walked faster than indexed */
+#define ZRANK_MIN_THRESHOLD 1024
+/* an index is dropped once its zset shrinks below this, so zsets smaller
+ * than that never have one and their writes don't look for it */
+#define ZRANK_MIN_SIZE (ZRANK_MIN_THRESHOLD / 2)
+
+/* int64 score -> uint64 with the same order */
+#define zrank_score(s) ((uint64_t)(s) ^ 0x8000000000000000ULL)
+#define zrank_bucket(u, level) ((u) >> (8 * (ZRANK_LEVELS - 1 - (level))))
+
+/* type|len(key)|key|version|level|bucket|slot */
+static inline
+std::string encode_zrank_key(const Bytes &key, uint64_t version, uint8_t level, uint64_t bucket){
+	std::string buf;
+	buf.append(1, DataType::ZRANK);
+	buf.append(1, (uint8_t)key.size());
+	buf.append(key.data(), key.size());
+
+	version = big_endian(version);
+	buf.append((char*)&version, sizeof(version));
+
+	buf.append(1, (char)level);
+	bucket = big_endian(bucket);
+	buf.append((char*)&bucket, sizeof(bucket));
+
+	int16_t slot = KEY_HASH_SLOT(key);
+	buf.append((char*)&slot, sizeof(slot));
+	return buf;
+}
+
+/* only level and bucket are decoded, the key is known by the caller */
+static inline
+int decode_zrank_key(const Bytes &slice, uint8_t *level, uint64_t *bucket){
+	int size = slice.size() - (int)sizeof(int16_t) - 1 - (int)sizeof(uint64_t);
+	if(size < 1 || slice.data()[0] != DataType::ZRANK){
+		return -1;
+	}
+	uint64_t b;
+	memcpy(&b, slice.data() + size + 1, sizeof(b));
+	*level = (uint8_t)slice.data()[size];
+	*bucket = big_endian(b);
+	return 0;
+}
+
+/* the index exists for a zset if its marker does */
+static inline
+std::string encode_zrank_marker(const Bytes &key, uint64_t version){
+	return encode_zrank_key(key, version, ZRANK_MARKER_LEVEL, 0);
+}
+
 static inline
 std::string zset_key_prefix(const Bytes &key, uint64_t version) {
 	std::string buf;
@@ -0,0 +1,138 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+/* key creation throughput with concurrent writers, leased allocator vs the old locked counter */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "ssdb.h"
+#include "options.h"
+#include "../util/bytes.h"
+#include "version.h"
+#include "version_alloc.h"
+#include "../include.h"
+#include "../util/log.h"
+#include "../util/strings.h"
+#include "../util/thread.h"
+
+/* what _update_global_version did: one lock, persisted inline every 10000 versions */
+class LockedCounter {
+public:
+	LockedCounter(SSDB *db) : db(db), version(0), updates(0) {}
+	int alloc(uint64_t *v){
+		Locking l(&mutex);
+		*v = ++version;
+		if(++updates <= 10000){
+			return 1;
+		}
+		updates = 0;
+		return db->raw_set(global_version_key(), str(version));
+	}
+private:
+	SSDB *db;
+	Mutex mutex;
+	uint64_t version;
+	uint64_t updates;
+};
+
+enum Mode { LOCKED, LEASED, NEW_VERSION };
+
+struct Worker {
+	pthread_t tid;
+	int id;
+	int num;
+	Mode mode;
+	SSDB *db;
+	LockedCounter *locked;
+	VersionAllocator *leased;
+	std::vector<uint64_t> versions;
+};
+
+static void *run(void *arg){
+	Worker *w = (Worker *)arg;
+	w->versions.reserve(w->num);
+	for(int i = 0; i < w->num; i++){
+		uint64_t v = 0;
+		int ret;
+		if(w->mode == LOCKED){
+			ret = w->locked->alloc(&v);
+		}else if(w->mode == LEASED){
+			ret = w->leased->alloc(&v);
+		}else{
+			std::string key = "k" + str(w->id) + "_" + str(i);
+			ret = w->db->new_version(key, DataType::KV, &v);
+		}
+		if(ret == -1){
+			fprintf(stderr, "alloc failed\n");
+			exit(1);
+		}
+		w->versions.push_back(v);
+	}
+	return NULL;
+}
+
+/* @return versions per second, -1 if two allocations got the same version */
+static double bench(SSDB *db, Mode mode, int threads, int num){
+	LockedCounter locked(db);
+	VersionAllocator leased(db);
+	if(mode == LEASED && leased.init() == -1){
+		exit(1);
+	}
+	std::vector<Worker> workers(threads);
+	double stime = millitime();
+	for(int i = 0; i < threads; i++){
+		Worker *w = &workers[i];
+		w->id = i;
+		w->num = num / threads;
+		w->mode = mode;
+		w->db = db;
+		w->locked = &locked;
+		w->leased = &leased;
+		pthread_create(&w->tid, NULL, run, w);
+	}
+	std::vector<uint64_t> all;
+	for(int i = 0; i < threads; i++){
+		pthread_join(workers[i].tid, NULL);
+	}
+	double secs = millitime() - stime;
+	for(int i = 0; i < threads; i++){
+		all.insert(all.end(), workers[i].versions.begin(), workers[i].versions.end());
+	}
+	std::sort(all.begin(), all.end());
+	if(std::adjacent_find(all.begin(), all.end()) != all.end()){
+		return -1;
+	}
+	return all.size() / (secs > 0 ? secs : 1e-6);
+}
+
+int main(int argc, char **argv){
+	int num = argc > 1 ? atoi(argv[1]) : 400000;
+	set_log_level(Logger::LEVEL_ERROR);
+
+	std::string dir = "./tmp/version_bench";
+	Options opt;
+	opt.compression = "no";
+	SSDB *db = SSDB::open(opt, dir);
+	if(!db || db->init(dir) == -1){
+		fprintf(stderr, "could not open %s\n", dir.c_str());
+		exit(1);
+	}
+
+	printf("%d versions per run\n", num);
+	printf("%-8s %14s %14s %14s\n", "threads", "locked", "leased", "new_version");
+	int threads[] = {1, 2, 4, 8, 16};
+	for(size_t i = 0; i < sizeof(threads)/sizeof(threads[0]); i++){
+		int n = threads[i];
+		double a = bench(db, LOCKED, n, num);
+		double b = bench(db, LEASED, n, num);
+		double c = bench(db, NEW_VERSION, n, num / 4);
+		printf("%-8d %11.0f/s %11.0f/s %11.0f/s\n", n, a, b, c);
+	}
+	delete db;
+	return 0;
+}
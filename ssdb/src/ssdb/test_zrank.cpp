@@ -0,0 +1,109 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+/* compare zrank/zrrank/zrange with and without the zset rank index */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "ssdb.h"
+#include "options.h"
+#include "transaction.h"
+#include "iterator.h"
+#include "../include.h"
+#include "../util/log.h"
+
+static SSDB *open_db(const std::string &dir, int threshold, uint64_t *version){
+	Options opt;
+	opt.compression = "no";
+	opt.zset_rank_threshold = threshold;
+	SSDB *ssdb = SSDB::open(opt, dir);
+	if(!ssdb || ssdb->init(dir) == -1){
+		fprintf(stderr, "could not open %s\n", dir.c_str());
+		exit(1);
+	}
+	ssdb->new_version("z", DataType::ZSET, version);
+	return ssdb;
+}
+
+static double bench_rank(SSDB *ssdb, uint64_t version, const std::vector<std::string> &fields, bool rev, int64_t *sum){
+	double stime = millitime();
+	for(size_t i = 0; i < fields.size(); i++){
+		*sum += rev ? ssdb->zrrank("z", fields[i], version) : ssdb->zrank("z", fields[i], version);
+	}
+	return (millitime() - stime) * 1000 / fields.size();
+}
+
+static double bench_range(SSDB *ssdb, uint64_t version, const std::vector<uint64_t> &offsets, bool rev, std::string *out){
+	double stime = millitime();
+	for(size_t i = 0; i < offsets.size(); i++){
+		ZIterator *it = rev ? ssdb->zrrange("z", offsets[i], (uint64_t)10, version)
+			: ssdb->zrange("z", offsets[i], (uint64_t)10, version);
+		while(it->next()){
+			out->append(it->field);
+		}
+		delete it;
+	}
+	return (millitime() - stime) * 1000 / offsets.size();
+}
+
+int main(int argc, char **argv){
+	int num = argc > 1 ? atoi(argv[1]) : 100000;
+	int queries = argc > 2 ? atoi(argv[2]) : 100;
+	set_log_level(Logger::LEVEL_ERROR);
+	srand(1);
+
+	uint64_t v1, v2;
+	SSDB *linear = open_db("./tmp/zrank_linear", -1, &v1);
+	SSDB *indexed = open_db("./tmp/zrank_indexed", 1, &v2);
+
+	printf("insert %d members\n", num);
+	double stime = millitime();
+	for(int i = 0; i < num; i++){
+		std::string field = "m" + str(i);
+		/* a narrow score range gives ties */
+		std::string score = str(rand() % (num / 4 + 1) - num / 8);
+		Transaction t1(linear, Bytes("z"));
+		linear->zset("z", field, score, t1, v1);
+	}
+	double t_linear = millitime() - stime;
+	stime = millitime();
+	srand(1);
+	for(int i = 0; i < num; i++){
+		std::string field = "m" + str(i);
+		std::string score = str(rand() % (num / 4 + 1) - num / 8);
+		Transaction t2(indexed, Bytes("z"));
+		indexed->zset("z", field, score, t2, v2);
+	}
+	double t_indexed = millitime() - stime;
+	printf("%-12s %10s %10s\n", "", "linear", "indexed");
+	printf("%-12s %8.2f s %8.2f s\n", "insert", t_linear, t_indexed);
+
+	std::vector<std::string> fields;
+	std::vector<uint64_t> offsets;
+	for(int i = 0; i < queries; i++){
+		fields.push_back("m" + str(rand() % num));
+		offsets.push_back(rand() % num);
+	}
+
+	const char *names[] = {"zrank", "zrrank"};
+	for(int r = 0; r < 2; r++){
+		int64_t s1 = 0, s2 = 0;
+		double a = bench_rank(linear, v1, fields, r == 1, &s1);
+		double b = bench_rank(indexed, v2, fields, r == 1, &s2);
+		printf("%-12s %7.3f ms %7.3f ms%s\n", names[r], a, b, s1 == s2 ? "" : "  MISMATCH");
+	}
+	const char *range_names[] = {"zrange", "zrrange"};
+	for(int r = 0; r < 2; r++){
+		std::string o1, o2;
+		double a = bench_range(linear, v1, offsets, r == 1, &o1);
+		double b = bench_range(indexed, v2, offsets, r == 1, &o2);
+		printf("%-12s %7.3f ms %7.3f ms%s\n", range_names[r], a, b, o1 == o2 ? "" : "  MISMATCH");
+	}
+
+	delete linear;
+	delete indexed;
+	return 0;
+}
@@ -7,13 +7,25 @@ found in the LICENSE file.
 #include "transaction.h"
 #include "ssdb.h"
 
+/* copies the updates of a transaction into a batch written later */
+class DeferredCopier : public leveldb::WriteBatch::Handler {
+public:
+	leveldb::WriteBatch *batch;
+	virtual void Put(const leveldb::Slice &key, const leveldb::Slice &value) {
+		batch->Put(key, value);
+	}
+	virtual void Delete(const leveldb::Slice &key) {
+		batch->Delete(key);
+	}
+};
+
 Transaction::Transaction(SSDB *db_, const std::string &key)
-	: db(db_), lock_key(key) {
+	: db(db_), lock_key(key), deferred(NULL) {
 	db->lock_key(lock_key);
 }
 
 Transaction::Transaction(SSDB *db_, const Bytes &key) 
-	: db(db_), lock_key(key.data(), key.size()) {
+	: db(db_), lock_key(key.data(), key.size()), deferred(NULL) {
 	if (!lock_key.empty()) {
 		db->lock_key(lock_key);	
 	}
@@ -35,6 +47,14 @@ void Transaction::rollback() {
 
 Transaction::Status Transaction::commit() {
 	WriteOptions option;
+	if (!attached_key.empty()) {
+		updates.Put(attached_key, attached_val);
+	}
+	if (deferred) {
+		DeferredCopier copier;
+		copier.batch = deferred;
+		return updates.Iterate(&copier);
+	}
 	return db->write(option, &updates);
 }
 
@@ -53,3 +73,11 @@ void Transaction::put(const std::string &key, const std::string &val) {
 	updates.Put(Slice(key.data(), key.size()), Slice(val.data(), val.size()));
 }
 
+void Transaction::attach(const std::string &key, const std::string &val) {
+	attached_key = key;
+	attached_val = val;
+}
+
+void Transaction::defer(WriteBatch *batch) {
+	deferred = batch;
+}
@@ -25,6 +25,9 @@ private:
 	SSDB *db;
 	WriteBatch updates;
 	std::string lock_key;
+	std::string attached_key;
+	std::string attached_val;
+	WriteBatch *deferred;
 
 public:
 	Transaction(SSDB *db_, const std::string &key);
@@ -40,6 +43,10 @@ public:
 	void put(const Bytes &key, const Bytes &val);
 	void del(const std::string &key);
 	void put(const std::string &key, const std::string &val);
+	// written along with the updates of every commit
+	void attach(const std::string &key, const std::string &val);
+	// commit() adds the updates to batch, the caller writes it later
+	void defer(WriteBatch *batch);
 };
 
 #endif
@@ -5,30 +5,56 @@ found in the LICENSE file.
 */
 #include <pthread.h>
 #include <time.h>
+#include <errno.h>
+#include <sys/time.h>
 #include "../include.h"
 #include "../util/log.h"
 #include "../util/hash.h"
 #include "ttl.h"
 
 #define EXPIRATION_LIST_KEY "\xff\xff\xff\xff\xff|EXPIRE_LIST|KV"
-#define BATCH_SIZE    100
+#define EXPIRATION_TICK       10           /* ms */
+#define EXPIRATION_HORIZON    (60 * 1000)  /* ms of deadlines loaded into the wheels */
+#define LOAD_BATCH            10000        /* keys loaded from one partition at once */
+#define MAX_LOADED            100000       /* keys in the wheel of one partition */
+#define MIN_BATCH_SIZE        64
+#define MAX_BATCH_SIZE        2048
+#define MAX_IDLE              1000         /* ms */
 
 ExpirationHandler::ExpirationHandler(SSDB *ssdb, SSDB_BinLog *binlog){
 	this->ssdb = ssdb;
 	this->binlog = binlog;
 	this->thread_quit = false;
 
+	int64_t now = time_ms();
 	for (int i = 0; i < EXPIR_CONCURRENT; i++) {
 		this->list_name[i] = std::string(EXPIRATION_LIST_KEY) + str(i);
-		this->first_timeout[i] = INT64_MAX;
+		this->wheels[i] = new TimerWheel(now, EXPIRATION_TICK);
+		this->loaded_until[i] = -1;
 	}
 	this->tid = 0;
+
+	this->batch_size = MIN_BATCH_SIZE;
+	this->wake_time = INT64_MAX;
+	pthread_mutex_init(&wait_mutex, NULL);
+	pthread_cond_init(&wait_cond, NULL);
+
+	this->stat_expired = 0;
+	this->stat_batches = 0;
+	this->stat_lag_sum = 0;
+	this->stat_lag_last = 0;
+	this->stat_lag_max = 0;
 }
 
 ExpirationHandler::~ExpirationHandler(){
 	if (tid != 0) {
 		this->stop();
 	}
+	for (int i = 0; i < EXPIR_CONCURRENT; i++) {
+		delete wheels[i];
+	}
+	pthread_cond_destroy(&wait_cond);
+	pthread_mutex_destroy(&wait_mutex);
 	ssdb = NULL;
 }
 
@@ -48,7 +74,10 @@ void ExpirationHandler::start(){
 
 void ExpirationHandler::stop(){
 	if (tid != 0) {
+		pthread_mutex_lock(&wait_mutex);
 		thread_quit = true;
+		pthread_cond_signal(&wait_cond);
+		pthread_mutex_unlock(&wait_mutex);
 		pthread_join(tid, NULL);
 		log_info("expiration thread stop tid: %lu.", tid);
 		tid = 0;
@@ -83,20 +112,17 @@ int ExpirationHandler::set_ttl(const Bytes &key, int64_t ttl){
 		return -1;
 	}
 
-	if(expired < first_timeout[idx]){
-		first_timeout[idx] = expired;
-	}
-
 	std::string s_key = key.String();
-	if(!fast_keys[idx].empty() && expired <= fast_keys[idx].max_score()){
-		fast_keys[idx].add(s_key, expired);
-		if(fast_keys[idx].size() > BATCH_SIZE){
-			log_debug("pop_back");
-			fast_keys[idx].pop_back();
+	if(expired < loaded_until[idx] || (expired == loaded_until[idx] && s_key <= loaded_key[idx])){
+		wheels[idx]->add(s_key, expired);
+		pthread_mutex_lock(&wait_mutex);
+		if(expired < wake_time){
+			pthread_cond_signal(&wait_cond);
 		}
+		pthread_mutex_unlock(&wait_mutex);
 	}else{
-		fast_keys[idx].del(s_key);
-		//log_debug("don't put in fast_keys");
+		// to be loaded when it gets close
+		wheels[idx]->del(s_key);
 	}
 
 	return 0;
@@ -106,10 +132,8 @@ int ExpirationHandler::del_ttl(const Bytes &key){
 	uint32_t i = string_hash(key) >> (32-EXPIR_CON_DEGREE);
 	Locking l(&mutexs[i]);
 
-	if(!this->fast_keys[i].empty()){
-		fast_keys[i].del(key.String());
-	}
-	
+	wheels[i]->del(key.String());
+
 	Transaction trans(ssdb, Bytes());
 	ssdb->zdel(this->list_name[i], key, trans, 0);
 
@@ -126,73 +150,192 @@ int64_t ExpirationHandler::get_ttl(const Bytes &key, const leveldb::Snapshot *sn
 	return -1;
 }
 
-void ExpirationHandler::load_expiration_keys_from_db(int idx, int num){
-	ZIterator *it;
-	it = ssdb->zscan(this->list_name[idx], "", "", "", num, 0);
+// assert mutexs[idx] held
+void ExpirationHandler::load_expiration_keys_from_db(int idx, int64_t now){
+	if(loaded_until[idx] >= now + EXPIRATION_HORIZON/2 || wheels[idx]->size() >= MAX_LOADED){
+		return;
+	}
+	int64_t until = now + EXPIRATION_HORIZON;
+	ZIterator *it = ssdb->zscan(this->list_name[idx], loaded_key[idx], str(loaded_until[idx]), str(until), LOAD_BATCH, 0);
+	if(it == NULL){
+		return;
+	}
 	int n = 0;
 	while(it->next()){
 		n ++;
 		std::string &key = it->field;
 		int64_t score = str_to_int64(it->score);
+		loaded_until[idx] = score;
+		loaded_key[idx] = key;
 		if(score < 2000000000){
 			// older version compatible
 			score *= 1000;
 		}
-		fast_keys[idx].add(key, score);
+		wheels[idx]->add(key, score);
 	}
 	delete it;
-	log_debug("load %d keys into fast_keys", n);
+	if(n < LOAD_BATCH){
+		// all of them up to until, the ones scored until are scanned again
+		loaded_until[idx] = until;
+		loaded_key[idx] = "";
+	}
+	log_debug("load %d keys into wheel %d", n, idx);
+}
+
+// the deadline of key in the expiration list of partition idx, -1 if it has none
+int64_t ExpirationHandler::get_deadline(int idx, const std::string &key){
+	std::string score;
+	if(ssdb->zget(this->list_name[idx], key, &score, 0) != 1){
+		return -1;
+	}
+	int64_t ex = str_to_int64(score);
+	if(ex < 2000000000){
+		// older version compatible
+		ex *= 1000;
+	}
+	return ex;
 }
 
-void ExpirationHandler::expire_loop(){
+int ExpirationHandler::expire_loop(){
+	int64_t now = time_ms();
+	std::vector<TimerWheel::Entry> due;
+	std::vector<int> parts;
+	std::vector<std::string> keys;
+	std::vector<std::string> lists;
+	std::vector<int64_t> times;
+	std::vector<int> key_parts;
 
-	// for each partition
+	// take what is due off the wheels of every partition at once
 	for (int i = 0; i < EXPIR_CONCURRENT; i++) {
+		this->mutexs[i].lock();
+	}
+	if(!this->ssdb){
+		for (int i = 0; i < EXPIR_CONCURRENT; i++) {
+			this->mutexs[i].unlock();
+		}
+		return 0;
+	}
 
-		Locking l(&this->mutexs[i]);
-		if(!this->ssdb){
-			return;
+	// a fair share of the batch for every partition first, then whatever is left
+	int share = batch_size / EXPIR_CONCURRENT;
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < EXPIR_CONCURRENT && (int)due.size() < batch_size; i++) {
+			if(pass == 0){
+				this->load_expiration_keys_from_db(i, now);
+			}
+			int max = pass == 0 ? share : batch_size - (int)due.size();
+			int n = wheels[i]->expire(now, max, &due);
+			parts.insert(parts.end(), n, i);
 		}
+	}
 
-		if(this->fast_keys[i].empty()){
-			this->load_expiration_keys_from_db(i, BATCH_SIZE);
-			if(this->fast_keys[i].empty()){
-				this->first_timeout[i] = INT64_MAX;
+	for (int i = 0; i < EXPIR_CONCURRENT; i++) {
+		this->mutexs[i].unlock();
+	}
 
-				continue;
+	int expired = 0;
+	int64_t lag_sum = 0;
+	int64_t lag_max = 0;
+	// the due keys are checked and deleted in one write under the locks of
+	// their partitions, taken in index order like above, set_ttl() and
+	// del_ttl() can't change them or the lists meanwhile
+	bool involved[EXPIR_CONCURRENT] = {false};
+	for (size_t i = 0; i < parts.size(); i++) {
+		involved[parts[i]] = true;
+	}
+	for (int idx = 0; idx < EXPIR_CONCURRENT; idx++) {
+		if(involved[idx]){
+			this->mutexs[idx].lock();
+		}
+	}
+	for (size_t i = 0; i < due.size(); i++) {
+		// a key given a new ttl or persisted since it was taken off the wheel is kept
+		if(this->get_deadline(parts[i], due[i].key) != due[i].time){
+			continue;
+		}
+		keys.push_back(due[i].key);
+		lists.push_back(this->list_name[parts[i]]);
+		times.push_back(due[i].time);
+		key_parts.push_back(parts[i]);
+	}
+	if(!keys.empty()){
+		// no row lock, prevent from dead lock
+		Transaction trans(ssdb, Bytes());
+		if(ssdb->multi_del(keys, lists, trans, 0) == -1){
+			log_error("expire %d keys failed", (int)keys.size());
+			// try again next round
+			for (size_t i = 0; i < keys.size(); i++) {
+				wheels[key_parts[i]]->add(keys[i], times[i]);
+			}
+		}else{
+			if(binlog){
+				binlog->write(BinlogType::SYNC, BinlogCommand::K_DEL, keys);
+			}
+			expired = (int)keys.size();
+			for (size_t i = 0; i < times.size(); i++) {
+				int64_t lag = now - times[i];
+				lag_sum += lag;
+				if(lag > lag_max){
+					lag_max = lag;
+				}
 			}
 		}
+	}
+	for (int idx = 0; idx < EXPIR_CONCURRENT; idx++) {
+		if(involved[idx]){
+			this->mutexs[idx].unlock();
+		}
+	}
 
-		int64_t now = time_ms();
-		int64_t score;
-		std::string key;
-		int max = 5; // prevent from block set_ttl && del_ttl too long
-		while (max-- > 0 && this->fast_keys[i].front(&key, &score)) {
-			this->first_timeout[i] = score;
-
-			if(score <= now){
-				log_debug("expired %s", key.c_str());
-				{
-					// no row lock, prevent from dead lock
-					Transaction trans(ssdb, Bytes());
-					ssdb->del(key, trans);
-					if (binlog) {
-						binlog->write(BinlogType::SYNC, BinlogCommand::K_DEL, key);
-					}
-				}
-				{
-					// no row lock, prevent from dead lock
-					Transaction trans(ssdb, Bytes());
-					ssdb->zdel(this->list_name[i], key, trans, 0);
-					this->fast_keys[i].pop_front();
-				}
+	if(expired > 0){
+		log_debug("expired %d keys, max lag %" PRId64 "ms", expired, lag_max);
+		pthread_mutex_lock(&wait_mutex);
+		stat_expired += expired;
+		stat_batches ++;
+		stat_lag_sum += lag_sum;
+		stat_lag_last = lag_max;
+		if(lag_max > stat_lag_max){
+			stat_lag_max = lag_max;
+		}
+		pthread_mutex_unlock(&wait_mutex);
+	}
+	return expired;
+}
 
-			} else {
-				break;
+/* the time the next key might be due, or a load is needed */
+int64_t ExpirationHandler::next_time(){
+	int64_t next = INT64_MAX;
+	for (int i = 0; i < EXPIR_CONCURRENT; i++) {
+		Locking l(&this->mutexs[i]);
+		int64_t t = wheels[i]->next_time();
+		if(t < next){
+			next = t;
+		}
+		if(wheels[i]->size() < MAX_LOADED){
+			t = loaded_until[i] - EXPIRATION_HORIZON/2;
+			if(t < next){
+				next = t;
 			}
 		}
+	}
+	return next;
+}
 
-	}/* end of for */
+void ExpirationHandler::wait(int64_t until){
+	struct timespec ts;
+	ts.tv_sec = until / 1000;
+	ts.tv_nsec = (until % 1000) * 1000 * 1000;
+
+	pthread_mutex_lock(&wait_mutex);
+	wake_time = until;
+	while(!thread_quit && time_ms() < until){
+		// set_ttl() wakes us up for an earlier deadline
+		if(pthread_cond_timedwait(&wait_cond, &wait_mutex, &ts) != ETIMEDOUT){
+			break;
+		}
+	}
+	wake_time = INT64_MAX;
+	pthread_mutex_unlock(&wait_mutex);
 }
 
 void* ExpirationHandler::thread_func(void *arg){
@@ -200,21 +343,26 @@ void* ExpirationHandler::thread_func(void *arg){
 	ExpirationHandler *handler = (ExpirationHandler *)arg;
 
 	while(!handler->thread_quit){
-		bool immediately = false;
-		int64_t now = time_ms();
-		for (int i = 0; i < EXPIR_CONCURRENT; i++) {
-			if (handler->first_timeout[i] <= now) {
-				immediately = true;
-				break;
+		int num = handler->expire_loop();
+		if(num >= handler->batch_size){
+			// falling behind, take more at a time and go on right away
+			if(handler->batch_size < MAX_BATCH_SIZE){
+				handler->batch_size *= 2;
 			}
-		}
-
-		if(!immediately){
-			usleep(10 * 1000);
 			continue;
 		}
+		if(handler->batch_size > MIN_BATCH_SIZE){
+			handler->batch_size /= 2;
+		}
 
-		handler->expire_loop();
+		int64_t now = time_ms();
+		int64_t next = handler->next_time();
+		if(next > now + MAX_IDLE){
+			next = now + MAX_IDLE;
+		}
+		if(next > now){
+			handler->wait(next);
+		}
 	}
 
 	log_debug("ExpirationHandler thread quit");
@@ -232,3 +380,26 @@ uint64_t ExpirationHandler::expires() {
 	}
 	return nexpires;
 }
+
+std::string ExpirationHandler::stats() {
+	int64_t loaded = 0;
+	for(int i = 0; i < EXPIR_CONCURRENT; i++) {
+		Locking l(&this->mutexs[i]);
+		loaded += wheels[i]->size();
+	}
+
+	pthread_mutex_lock(&wait_mutex);
+	char buf[512];
+	snprintf(buf, sizeof(buf),
+		"expire_loaded:%" PRId64 "\n"
+		"expired_keys:%" PRIu64 "\n"
+		"expire_batches:%" PRIu64 "\n"
+		"expire_batch_size:%d\n"
+		"expire_lag_ms:%" PRId64 "\n"
+		"expire_lag_avg_ms:%.1f\n"
+		"expire_lag_max_ms:%" PRId64,
+		loaded, stat_expired, stat_batches, batch_size, stat_lag_last,
+		stat_expired ? (double)stat_lag_sum / stat_expired : 0.0, stat_lag_max);
+	pthread_mutex_unlock(&wait_mutex);
+	return buf;
+}
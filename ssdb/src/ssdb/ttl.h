@@ -9,12 +9,21 @@ found in the LICENSE file.
 #include "ssdb.h"
 #include "binlog2.h"
 #include "../util/thread.h"
-#include "../util/sorted_set.h"
+#include "../util/timer_wheel.h"
 #include <string>
 
 #define EXPIR_CON_DEGREE 3
 #define EXPIR_CONCURRENT (1<<EXPIR_CON_DEGREE)
 
+/**
+ * Deadlines are kept in db, one zset per partition, and the ones due
+ * within the next minute are loaded into a timer wheel per partition.
+ * The expiration thread deletes all due keys of every partition in one
+ * write batch and one binlog batch, under the locks of the partitions
+ * involved taken in index order. The batch grows while there is a
+ * backlog and shrinks back once it is cleared. In between the thread
+ * sleeps until the earliest deadline it knows of.
+ **/
 class ExpirationHandler
 {
 public:
@@ -32,6 +41,7 @@ public:
 	void stop();
 	int running();
 	uint64_t expires();
+	std::string stats();
 
 private:
 	SSDB *ssdb;
@@ -39,13 +49,31 @@ private:
 	volatile bool thread_quit;
 	Mutex mutexs[EXPIR_CONCURRENT];
 	std::string list_name[EXPIR_CONCURRENT];
-	int64_t first_timeout[EXPIR_CONCURRENT];
-	SortedSet fast_keys[EXPIR_CONCURRENT];
+	TimerWheel *wheels[EXPIR_CONCURRENT];
+	/* (score, key) of the last deadline loaded, the ones before are in the wheel */
+	int64_t loaded_until[EXPIR_CONCURRENT];
+	std::string loaded_key[EXPIR_CONCURRENT];
 	pthread_t tid;
 
-	void expire_loop();
+	// pacing
+	int batch_size;                           /* keys deleted in one write */
+	int64_t wake_time;                        /* guarded by wait_mutex */
+	pthread_mutex_t wait_mutex;
+	pthread_cond_t wait_cond;
+
+	// statistic, guarded by wait_mutex
+	uint64_t stat_expired;
+	uint64_t stat_batches;
+	uint64_t stat_lag_sum;
+	int64_t stat_lag_last;                    /* worst lag in the last batch */
+	int64_t stat_lag_max;
+
+	int expire_loop();
+	int64_t next_time();
+	void wait(int64_t until);
 	static void* thread_func(void *arg);
-	void load_expiration_keys_from_db(int idx, int num);
+	void load_expiration_keys_from_db(int idx, int64_t now);
+	int64_t get_deadline(int idx, const std::string &key);
 
 private:
 	static uint32_t string_hash(const Bytes &s);
@@ -103,10 +103,10 @@ int decode_deprecated_key(const Bytes &slice, std::string *key, char *t, uint64_
 	if(decoder.read_data(key, -sizeof(int16_t)-sizeof(uint64_t)) == -1) {
 		return -1;
 	}
+	/* encode_deprecated_key() stores it in host byte order */
 	if(decoder.read_uint64(version) == -1) {
 		return -1;
 	}
-	*version = big_endian(*version);
 	return 0;
 }
 
@@ -0,0 +1,156 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "version_alloc.h"
+#include "ssdb.h"
+#include "../util/bytes.h"
+#include "version.h"
+#include "../util/log.h"
+#include "../util/thread.h"
+#include "../util/atomic.h"
+#include "../util/strings.h"
+
+VersionAllocator::VersionAllocator(SSDB *db, uint64_t lease_size)
+	: db(db), lease_size(lease_size < 2 ? 2 : lease_size), next(0), lease_end(0),
+	renew_pending(0), running(false), quit(false), stat_renews(0), stat_stalls(0) {
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+VersionAllocator::~VersionAllocator() {
+	if(running) {
+		pthread_mutex_lock(&mutex);
+		quit = true;
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&mutex);
+		pthread_join(tid, NULL);
+	}
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+int VersionAllocator::init() {
+	std::string val;
+	int ret = db->raw_get(global_version_key(), &val);
+	if(ret == -1) {
+		log_error("load global version failed");
+		return -1;
+	}
+	if(ret == 1) {
+		/* older servers persisted a lagging counter instead of a lease, keep the step */
+		next = str_to_uint64(val) + lease_size * 10;
+	}
+
+	pthread_mutex_lock(&mutex);
+	ret = renew();
+	pthread_mutex_unlock(&mutex);
+	if(ret == -1) {
+		return -1;
+	}
+
+	int err = pthread_create(&tid, NULL, &VersionAllocator::renew_thread, this);
+	if(err != 0) {
+		log_error("start version lease thread failed: %s", strerror(err));
+		return -1;
+	}
+	running = true;
+	log_info("global version: %" PRIu64 ", lease: %" PRIu64, (uint64_t)next, (uint64_t)lease_end);
+	return 0;
+}
+
+void VersionAllocator::pause() {
+	pthread_mutex_lock(&mutex);
+}
+
+int VersionAllocator::resume(bool renew) {
+	int ret = 0;
+	if(renew) {
+		lease_end = 0;
+		ret = this->renew();
+	}
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
+int VersionAllocator::alloc(uint64_t *version) {
+	uint64_t v = atomic_add_uint64(&next, 1);
+	uint64_t end = lease_end;
+	if(v + lease_size / 2 < end) {
+		*version = v;
+		return 1;
+	}
+	if(v < end) {
+		/* half of the lease is gone, have it renewed in the background */
+		if(atomic_cmp_set_uint32(&renew_pending, 0, 1)) {
+			pthread_mutex_lock(&mutex);
+			pthread_cond_signal(&cond);
+			pthread_mutex_unlock(&mutex);
+		}
+		*version = v;
+		return 1;
+	}
+
+	pthread_mutex_lock(&mutex);
+	stat_stalls++;
+	while(v >= lease_end) {
+		if(renew() == -1) {
+			pthread_mutex_unlock(&mutex);
+			return -1;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	*version = v;
+	return 1;
+}
+
+// assert mutex held
+int VersionAllocator::renew() {
+	uint64_t end = next + lease_size;
+	if(end <= lease_end) {
+		return 0;
+	}
+	if(db->raw_set(global_version_key(), str(end)) != 1) {
+		log_error("persist global version lease failed");
+		return -1;
+	}
+	__sync_synchronize();
+	lease_end = end;
+	stat_renews++;
+	return 0;
+}
+
+void *VersionAllocator::renew_thread(void *arg) {
+	VersionAllocator *alloc = (VersionAllocator *)arg;
+	SET_PROC_NAME("version_lease");
+
+	pthread_mutex_lock(&alloc->mutex);
+	while(!alloc->quit) {
+		if(!alloc->renew_pending) {
+			pthread_cond_wait(&alloc->cond, &alloc->mutex);
+			continue;
+		}
+		/* on failure the next allocation past half of the lease retries */
+		alloc->renew();
+		alloc->renew_pending = 0;
+	}
+	pthread_mutex_unlock(&alloc->mutex);
+	return NULL;
+}
+
+std::string VersionAllocator::stats() {
+	pthread_mutex_lock(&mutex);
+	char buf[256];
+	snprintf(buf, sizeof(buf),
+		"global_version:%" PRIu64 "\n"
+		"global_version_lease:%" PRIu64 "\n"
+		"global_version_renews:%" PRIu64 "\n"
+		"global_version_stalls:%" PRIu64,
+		(uint64_t)next, (uint64_t)lease_end, stat_renews, stat_stalls);
+	pthread_mutex_unlock(&mutex);
+	return buf;
+}
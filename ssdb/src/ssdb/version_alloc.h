@@ -0,0 +1,62 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+#ifndef SSDB_VERSION_ALLOC_H_
+#define SSDB_VERSION_ALLOC_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+class SSDB;
+
+/**
+ * Allocator of the global key version.
+ *
+ * Versions are handed out by an atomic increment. The persisted global
+ * version is a lease: every version below it may have been used, so
+ * after a restart allocation resumes from there. A background thread
+ * renews the lease once half of it is consumed, only when the lease
+ * runs out before the renewal lands does an allocation wait for it.
+ **/
+class VersionAllocator {
+public:
+	VersionAllocator(SSDB *db, uint64_t lease_size=10000);
+	~VersionAllocator();
+
+	/* load the persisted lease, take a new one and start renewing, -1 on error */
+	int init();
+	/* block allocations past the lease and renewals, e.g. while flushdb swaps the db */
+	void pause();
+	/* @renew: persist a lease for the current version again, -1 on error */
+	int resume(bool renew);
+
+	// @return 1: ok, -1: error
+	int alloc(uint64_t *version);
+
+	uint64_t current() const { return next; }
+	std::string stats();
+
+private:
+	SSDB *db;
+	uint64_t lease_size;
+	volatile uint64_t next;           /* last allocated version */
+	volatile uint64_t lease_end;      /* versions below it are covered by the persisted lease */
+	volatile uint32_t renew_pending;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t tid;
+	bool running;
+	bool quit;
+
+	uint64_t stat_renews;
+	uint64_t stat_stalls;             /* allocations that waited for a lease */
+
+	int renew();
+	static void *renew_thread(void *arg);
+};
+
+#endif
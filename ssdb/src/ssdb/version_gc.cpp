@@ -0,0 +1,380 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/time.h>
+#include <vector>
+#include "leveldb/db.h"
+#include "leveldb/iterator.h"
+#include "version_gc.h"
+#include "options.h"
+#include "t_kv.h"
+#include "t_hash.h"
+#include "t_set.h"
+#include "t_zset.h"
+#include "t_queue.h"
+#include "version.h"
+#include "../util/log.h"
+#include "../util/thread.h"
+
+/* deprecated versions counted per hold of the db lock */
+#define GC_COUNT_STEP	10000
+
+/* type(1)|len(key)|key|version, shared by all members of one version of a collection */
+static std::string data_prefix(char type, const std::string &key, uint64_t version){
+	std::string buf;
+	buf.append(1, type);
+	buf.append(1, (uint8_t)key.size());
+	buf.append(key.data(), key.size());
+	version = big_endian(version);
+	buf.append((char*)&version, sizeof(version));
+	return buf;
+}
+
+/* keys are ordered by the trailing slot first, a seek target needs one too */
+static std::string with_slot(const std::string &prefix, int16_t slot){
+	std::string buf(prefix);
+	buf.append((char*)&slot, sizeof(slot));
+	return buf;
+}
+
+VersionGC::VersionGC(SSDBImpl *ssdb, const Options &opt)
+	: ssdb(ssdb), batch_size(opt.gc_batch_size), compact_threshold(opt.gc_compact_threshold),
+	key_limit(opt.gc_keys_per_sec), byte_limit((uint64_t)opt.gc_mb_per_sec * 1024 * 1024),
+	batch_keys(0), batch_bytes(0), running(false), quit(false),
+	backlog(0), stat_versions(0), stat_keys(0), stat_bytes(0), stat_batches(0),
+	stat_compactions(0), stat_throttle_us(0), rate_keys(0), rate_bytes(0), rate_time(0),
+	window_keys(0), window_bytes(0), window_start(millitime()) {
+	pthread_mutex_init(&db_mutex, NULL);
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+VersionGC::~VersionGC() {
+	if(running) {
+		pthread_mutex_lock(&mutex);
+		quit = true;
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&mutex);
+		pthread_join(tid, NULL);
+	}
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+	pthread_mutex_destroy(&db_mutex);
+}
+
+int VersionGC::start() {
+	int err = pthread_create(&tid, NULL, &VersionGC::run, this);
+	if(err != 0) {
+		log_error("start gc thread failed: %s", strerror(err));
+		return -1;
+	}
+	running = true;
+	return 0;
+}
+
+void VersionGC::pause() {
+	pthread_mutex_lock(&db_mutex);
+}
+
+void VersionGC::resume() {
+	pthread_mutex_unlock(&db_mutex);
+}
+
+void *VersionGC::run(void *arg) {
+	VersionGC *gc = (VersionGC *)arg;
+	std::string procname = "gc_" + gc->ssdb->get_name();
+	SET_PROC_NAME(procname.c_str());
+	while(!gc->quit) {
+		int64_t count = gc->pass();
+		log_debug("gc %s loop done, clean %" PRId64 " keys", gc->ssdb->get_name().c_str(), count);
+		/* give some time to clean up low level data */
+		if(gc->sleep(count == 0 ? 60 : 10)) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* @return true if asked to quit */
+bool VersionGC::sleep(int seconds) {
+	struct timeval now;
+	struct timespec ts;
+	gettimeofday(&now, NULL);
+	ts.tv_sec = now.tv_sec + seconds;
+	ts.tv_nsec = now.tv_usec * 1000;
+
+	pthread_mutex_lock(&mutex);
+	while(!quit) {
+		if(pthread_cond_timedwait(&cond, &mutex, &ts) == ETIMEDOUT) {
+			break;
+		}
+	}
+	bool ret = quit;
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
+/* one walk over the deprecated versions, @return number of versions collected */
+int64_t VersionGC::pass() {
+	const std::string prefix(SSDB_DEPRECATED_KEY_PREFIX, sizeof(SSDB_DEPRECATED_KEY_PREFIX));
+	const std::string start = with_slot(prefix, -1);
+	leveldb::ReadOptions ro;
+	ro.fill_cache = false;
+
+	/* counted a step at a time, so flushdb is not held up by a long backlog */
+	uint64_t pending = 0;
+	std::string cursor = start;
+	bool more = true;
+	while(more && !quit) {
+		more = false;
+		uint64_t n = 0;
+		pthread_mutex_lock(&db_mutex);
+		leveldb::Iterator *it = ssdb->ldb->NewIterator(ro);
+		for(it->Seek(cursor); it->Valid() && it->key().starts_with(prefix); it->Next()) {
+			if(n++ == GC_COUNT_STEP) {
+				cursor = it->key().ToString();
+				more = true;
+				break;
+			}
+			pending ++;
+		}
+		delete it;
+		pthread_mutex_unlock(&db_mutex);
+	}
+	pthread_mutex_lock(&mutex);
+	backlog = pending;
+	pthread_mutex_unlock(&mutex);
+
+	int64_t count = 0;
+	cursor = start;
+	while(!quit) {
+		/* the db is only held for one batch of records at a time */
+		pthread_mutex_lock(&db_mutex);
+		std::vector<std::string> records;
+		leveldb::Iterator *it = ssdb->ldb->NewIterator(ro);
+		for(it->Seek(cursor); it->Valid() && records.size() < batch_size; it->Next()) {
+			if(!it->key().starts_with(prefix)) {
+				break;
+			}
+			records.push_back(it->key().ToString());
+		}
+		delete it;
+
+		for(size_t i = 0; i < records.size() && !quit; i++) {
+			if(collect(records[i]) == -1) {
+				break;
+			}
+			count ++;
+			if(batch_keys >= batch_size && flush() == -1) {
+				break;
+			}
+		}
+		/* the records scanned are gone once flushed, go on right after them */
+		int ret = flush();
+		pthread_mutex_unlock(&db_mutex);
+		if(ret == -1 || records.empty()) {
+			break;
+		}
+		cursor = records.back();
+	}
+
+	pthread_mutex_lock(&mutex);
+	backlog = 0;
+	pthread_mutex_unlock(&mutex);
+	return count;
+}
+
+int VersionGC::collect(const std::string &record) {
+	std::string key;
+	uint64_t version;
+	char t;
+	if(decode_deprecated_key(record, &key, &t, &version) == -1) {
+		log_error("gc decode deprecated key failed: %s", hexmem(record.data(), record.size()).c_str());
+		del(record, record.size());
+		return 0;
+	}
+
+	std::string types;      /* data key types of the collection */
+	std::string size_key;
+	switch(t) {
+		case DataType::KV:
+			del(encode_kv_key(key, version), key.size());
+			break;
+		case DataType::HASH:
+			types.append(1, DataType::HASH);
+			size_key = encode_hsize_key(key, version);
+			break;
+		case DataType::SET:
+			types.append(1, DataType::SET);
+			size_key = encode_ssize_key(key, version);
+			break;
+		case DataType::ZSET:
+			types.append(1, DataType::ZSET);
+			types.append(1, DataType::ZSCORE);
+			types.append(1, DataType::ZRANK);
+			size_key = encode_zsize_key(key, version);
+			break;
+		case DataType::QUEUE:
+			types.append(1, DataType::QUEUE);
+			size_key = encode_qsize_key(key, version);
+			break;
+		default:
+			log_error("gc %s unknown type: %s", ssdb->get_name().c_str(), hexmem(record.data(), record.size()).c_str());
+			break;
+	}
+
+	int16_t slot = KEY_HASH_SLOT(key);
+	uint64_t keys = 0;
+	for(size_t i = 0; i < types.size(); i++) {
+		if(collect_range(data_prefix(types[i], key, version), slot, &keys) == -1) {
+			return -1;
+		}
+	}
+	if(!size_key.empty()) {
+		del(size_key, size_key.size());
+	}
+	del(record, record.size());
+	log_debug("gc %s delete %c %s, %" PRIu64 " keys", ssdb->get_name().c_str(), t, key.c_str(), keys);
+
+	if(compact_threshold > 0 && keys >= compact_threshold) {
+		/* the range is all tombstones now, don't leave reads to skip over them */
+		if(flush() == -1) {
+			return -1;
+		}
+		for(size_t i = 0; i < types.size(); i++) {
+			std::string prefix = with_slot(data_prefix(types[i], key, version), slot);
+			std::string limit = with_slot(data_prefix(types[i], key, version + 1), slot);
+			leveldb::Slice begin(prefix), end(limit);
+			ssdb->ldb->CompactRange(&begin, &end);
+		}
+		pthread_mutex_lock(&mutex);
+		stat_compactions ++;
+		pthread_mutex_unlock(&mutex);
+	}
+
+	pthread_mutex_lock(&mutex);
+	stat_versions ++;
+	if(backlog > 0) {
+		backlog --;
+	}
+	pthread_mutex_unlock(&mutex);
+	return 0;
+}
+
+/* delete the keys starting with @prefix, a batch at a time */
+int VersionGC::collect_range(const std::string &prefix, int16_t slot, uint64_t *keys) {
+	leveldb::ReadOptions ro;
+	ro.fill_cache = false;
+	std::string from = with_slot(prefix, slot);
+	while(!quit) {
+		bool more = false;
+		leveldb::Iterator *it = ssdb->ldb->NewIterator(ro);
+		for(it->Seek(from); it->Valid(); it->Next()) {
+			leveldb::Slice k = it->key();
+			if(!k.starts_with(prefix)) {
+				break;
+			}
+			if(batch_keys >= batch_size) {
+				/* resume here after the batch is flushed */
+				from = k.ToString();
+				more = true;
+				break;
+			}
+			del(k.ToString(), k.size() + it->value().size());
+			(*keys) ++;
+		}
+		leveldb::Status s = it->status();
+		delete it;
+		if(!s.ok()) {
+			log_error("gc iterate failed: %s", s.ToString().c_str());
+			return -1;
+		}
+		if(!more) {
+			return 0;
+		}
+		if(flush() == -1) {
+			return -1;
+		}
+	}
+	return -1;
+}
+
+void VersionGC::del(const std::string &key, uint64_t bytes) {
+	batch.Delete(key);
+	batch_keys ++;
+	batch_bytes += bytes;
+}
+
+int VersionGC::flush() {
+	if(batch_keys == 0) {
+		return 0;
+	}
+	uint64_t keys = batch_keys;
+	uint64_t bytes = batch_bytes;
+	leveldb::WriteOptions wo;
+	leveldb::Status s = ssdb->ldb->Write(wo, &batch);
+	batch.Clear();
+	batch_keys = 0;
+	batch_bytes = 0;
+	if(!s.ok()) {
+		log_error("gc write failed: %s", s.ToString().c_str());
+		return -1;
+	}
+
+	pthread_mutex_lock(&mutex);
+	stat_keys += keys;
+	stat_bytes += bytes;
+	stat_batches ++;
+	window_keys += keys;
+	window_bytes += bytes;
+	double now = millitime();
+	if(now - window_start >= 1) {
+		rate_keys = window_keys / (now - window_start);
+		rate_bytes = window_bytes / (now - window_start);
+		rate_time = now;
+		window_keys = 0;
+		window_bytes = 0;
+		window_start = now;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	/* pay for the batch, with the db free for others meanwhile */
+	pthread_mutex_unlock(&db_mutex);
+	int64_t us = key_limit.consume(keys);
+	us += byte_limit.consume(bytes);
+	pthread_mutex_lock(&db_mutex);
+
+	if(us > 0) {
+		pthread_mutex_lock(&mutex);
+		stat_throttle_us += us;
+		pthread_mutex_unlock(&mutex);
+	}
+	return 0;
+}
+
+std::string VersionGC::stats() {
+	pthread_mutex_lock(&mutex);
+	bool idle = millitime() - rate_time > 2;
+	char buf[512];
+	snprintf(buf, sizeof(buf),
+		"gc_backlog:%" PRIu64 "\n"
+		"gc_versions:%" PRIu64 "\n"
+		"gc_keys:%" PRIu64 "\n"
+		"gc_bytes:%" PRIu64 "\n"
+		"gc_batches:%" PRIu64 "\n"
+		"gc_compactions:%" PRIu64 "\n"
+		"gc_throttled_ms:%" PRIu64 "\n"
+		"gc_keys_per_sec:%.0f\n"
+		"gc_bytes_per_sec:%.0f",
+		backlog, stat_versions, stat_keys, stat_bytes, stat_batches,
+		stat_compactions, stat_throttle_us / 1000,
+		idle ? 0 : rate_keys, idle ? 0 : rate_bytes);
+	pthread_mutex_unlock(&mutex);
+	return buf;
+}
@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+#ifndef SSDB_VERSION_GC_H_
+#define SSDB_VERSION_GC_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include "leveldb/write_batch.h"
+#include "../util/token_bucket.h"
+
+class SSDBImpl;
+class Options;
+
+/**
+ * Collects the data of deleted keys, recorded as deprecated versions.
+ *
+ * Deletions go to leveldb in WriteBatches of at most batch_size keys,
+ * small keys share a batch and a huge collection is deleted a batch at
+ * a time, resuming from the last key it deleted. Every batch is paid
+ * for in a keys/s and a bytes/s token bucket, so the collector yields
+ * to foreground writes. Collections of at least compact_threshold keys
+ * get their ranges compacted afterwards.
+ **/
+class VersionGC {
+public:
+	VersionGC(SSDBImpl *ssdb, const Options &opt);
+	~VersionGC();
+
+	int start();
+	/* keep the collector off the db, e.g. while flushdb replaces it */
+	void pause();
+	void resume();
+	std::string stats();
+
+private:
+	SSDBImpl *ssdb;
+	uint64_t batch_size;
+	uint64_t compact_threshold;      /* 0: never compact */
+	TokenBucket key_limit;
+	TokenBucket byte_limit;
+
+	leveldb::WriteBatch batch;
+	uint64_t batch_keys;
+	uint64_t batch_bytes;
+
+	pthread_t tid;
+	bool running;
+	volatile bool quit;
+	pthread_mutex_t db_mutex;        /* held while touching the db */
+	pthread_mutex_t mutex;           /* guards the stats and quit */
+	pthread_cond_t cond;
+
+	// statistic
+	uint64_t backlog;                /* deprecated versions left in this pass */
+	uint64_t stat_versions;
+	uint64_t stat_keys;
+	uint64_t stat_bytes;
+	uint64_t stat_batches;
+	uint64_t stat_compactions;
+	uint64_t stat_throttle_us;
+	double rate_keys;                /* throughput over the last second of work */
+	double rate_bytes;
+	double rate_time;
+	uint64_t window_keys;
+	uint64_t window_bytes;
+	double window_start;
+
+	int64_t pass();
+	int collect(const std::string &record);
+	int collect_range(const std::string &prefix, int16_t slot, uint64_t *keys);
+	void del(const std::string &key, uint64_t bytes);
+	int flush();
+	bool sleep(int seconds);
+
+	static void *run(void *arg);
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef UTIL_HASH_MAP_H_
+#define UTIL_HASH_MAP_H_
+
+/* the hash map the compiler provides, HASH_MAP<K, V, ...> */
+#define GCC_VERSION (__GNUC__ * 100 + __GNUC_MINOR__)
+#if GCC_VERSION >= 403
+	#include <tr1/unordered_map>
+	#define HASH_MAP std::tr1::unordered_map
+#else
+	#ifdef NEW_MAC
+		#include <unordered_map>
+		#define HASH_MAP std::unordered_map
+	#else
+		#include <ext/hash_map>
+		#define HASH_MAP __gnu_cxx::hash_map
+	#endif
+#endif
+
+#endif
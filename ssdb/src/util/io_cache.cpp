@@ -128,30 +128,17 @@ int ReadCache::readn(int fd, char *buf, int n) {
 }
 
 int ReadCache::seek(uint64_t pos) {
-	if (pos < offset) {
-		return -1;
-	}
-
-	while (offset+(uint64_t)(end-buf) < pos) {
-		offset += (uint64_t)(end-buf);
-		reset();
-
-		int ret = readn(fd, buf, cap);
-		if (ret < 0) {
-			return -1;
-		}
-		if (ret == 0) break;
-		if (ret > 0) {
-			end += ret;
-		}
+	// inside the buffer, just move the cursor
+	if (pos >= offset && pos <= offset+(uint64_t)(end-buf)) {
+		cur = buf + (pos - offset);
+		return 0;
 	}
 
-	if (offset+(uint64_t)(end-buf) < pos) {
+	// otherwise drop the buffer and jump directly
+	if (lseek(fd, (off_t)pos, SEEK_SET) == (off_t)-1) {
 		return -1;
 	}
-
-	cur += (pos - offset) - (cur - buf);
-	assert (cur <= end);
+	offset = pos;
+	reset();
 	return 0;
 }
-
@@ -0,0 +1,86 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+/* throughput and latency of SelectableQueue, N writers and one polling reader */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <vector>
+#include "thread.h"
+
+static int64_t time_us(){
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+struct Item{
+	int64_t time;    /* pushed at, us */
+};
+
+static SelectableQueue<Item> *queue;
+static int items_per_writer;
+
+static void* writer(void *arg){
+	for(int i=0; i<items_per_writer; i++){
+		Item item;
+		item.time = time_us();
+		queue->push(item);
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv){
+	int num_writers = argc > 1 ? atoi(argv[1]) : 4;
+	int total = argc > 2 ? atoi(argv[2]) : 1000000;
+	items_per_writer = total / num_writers;
+	total = items_per_writer * num_writers;
+
+	queue = new SelectableQueue<Item>();
+	std::vector<int64_t> latency;
+	latency.reserve(total);
+	std::vector<Item> items;
+	int64_t wakeups = 0;
+
+	int64_t start = time_us();
+	std::vector<pthread_t> tids(num_writers);
+	for(int i=0; i<num_writers; i++){
+		pthread_create(&tids[i], NULL, writer, NULL);
+	}
+
+	struct pollfd pfd;
+	pfd.fd = queue->fd();
+	pfd.events = POLLIN;
+	while((int)latency.size() < total){
+		if(poll(&pfd, 1, 1000) <= 0){
+			fprintf(stderr, "poll timeout, %d of %d items\n", (int)latency.size(), total);
+			return 1;
+		}
+		wakeups ++;
+		items.clear();
+		queue->pop(&items);
+		int64_t now = time_us();
+		for(size_t i=0; i<items.size(); i++){
+			latency.push_back(now - items[i].time);
+		}
+	}
+	int64_t time = time_us() - start;
+
+	for(int i=0; i<num_writers; i++){
+		pthread_join(tids[i], NULL);
+	}
+	delete queue;
+
+	std::sort(latency.begin(), latency.end());
+	printf("writers: %d, items: %d, time: %.3f s\n", num_writers, total, time / 1000000.0);
+	printf("items/s: %.0f, wakeups: %" PRId64 ", items/wakeup: %.1f\n",
+		total * 1000000.0 / time, wakeups, (double)total / wakeups);
+	printf("latency us, p50: %" PRId64 ", p99: %" PRId64 ", max: %" PRId64 "\n",
+		latency[total / 2], latency[total * 99 / 100], latency[total - 1]);
+	return 0;
+}
@@ -15,7 +15,11 @@ found in the LICENSE file.
 #include <queue>
 #include <vector>
 #include <set>
+#include <fcntl.h>
 #include <sys/prctl.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 #include "spin_lock.h"
 
@@ -117,13 +121,29 @@ class Queue{
 };
 
 
-// Selectable queue, multi writers, single reader
+/**
+ * Selectable queue, multi writers, single reader.
+ *
+ * Writers push onto a lock-free stack, the reader takes the whole stack
+ * at once and reverses it into arrival order. Only the first push after
+ * the reader has drained the queue makes fd() readable (an eventfd, a
+ * pipe where there is none), so a burst of pushes costs one write and one
+ * read, and the reader must take everything there is on each wakeup.
+ **/
 template <class T>
 class SelectableQueue{
 	private:
+		struct Node{
+			T item;
+			Node *next;
+		};
 		int fds[2];
-		pthread_mutex_t mutex;
-		std::queue<T> items;
+		Node * volatile head;
+		volatile int signaled;
+		volatile int count;
+
+		void notify();
+		void clear();
 	public:
 		SelectableQueue();
 		~SelectableQueue();
@@ -133,8 +153,8 @@ class SelectableQueue{
 		int size();
 		// multi writer
 		int push(const T item);
-		// single reader
-		int pop(T *data);
+		// single reader, appends all items queued, returns the number of them
+		int pop(std::vector<T> *list);
 };
 
 template<class W, class JOB>
@@ -182,7 +202,8 @@ class WorkerPool{
 		void proceed();
 
 		int push(JOB job);
-		int pop(JOB *job);
+		// all results done so far
+		int pop(std::vector<JOB> *list);
 };
 
 
@@ -266,78 +287,106 @@ int Queue<T>::pop(T *data){
 
 template <class T>
 SelectableQueue<T>::SelectableQueue(){
+#ifdef __linux__
+	fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK);
+	if(fds[0] == -1){
+		fprintf(stderr, "create eventfd error\n");
+		exit(0);
+	}
+#else
 	if(pipe(fds) == -1){
 		fprintf(stderr, "create pipe error\n");
 		exit(0);
 	}
-	pthread_mutex_init(&mutex, NULL);
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+#endif
+	head = NULL;
+	signaled = 0;
+	count = 0;
 }
 
 template <class T>
 SelectableQueue<T>::~SelectableQueue(){
-	pthread_mutex_destroy(&mutex);
+	Node *node = head;
+	while(node){
+		Node *next = node->next;
+		delete node;
+		node = next;
+	}
 	close(fds[0]);
-	close(fds[1]);
+	if(fds[1] != fds[0]){
+		close(fds[1]);
+	}
 }
 
 template <class T>
-int SelectableQueue<T>::push(const T item){
-	if(pthread_mutex_lock(&mutex) != 0){
-		return -1;
-	}
-	{
-		items.push(item);
-	}
+void SelectableQueue<T>::notify(){
+#ifdef __linux__
+	uint64_t v = 1;
+	if(::write(fds[1], &v, sizeof(v)) == -1 && errno != EAGAIN){
+#else
 	if(::write(fds[1], "1", 1) == -1){
+#endif
 		fprintf(stderr, "write fds error\n");
 		exit(0);
 	}
-	pthread_mutex_unlock(&mutex);
+}
+
+template <class T>
+void SelectableQueue<T>::clear(){
+	// one read resets an eventfd, and a pipe never has more than one byte
+	char buf[64];
+	while(::read(fds[0], buf, sizeof(buf)) == -1 && errno == EINTR){
+	}
+}
+
+template <class T>
+int SelectableQueue<T>::push(const T item){
+	Node *node = new Node();
+	node->item = item;
+	Node *old;
+	do{
+		old = head;
+		node->next = old;
+	}while(!__sync_bool_compare_and_swap(&head, old, node));
+	__sync_add_and_fetch(&count, 1);
+
+	// the reader has not been told since it last drained the queue
+	if(__sync_lock_test_and_set(&signaled, 1) == 0){
+		notify();
+	}
 	return 1;
 }
 
 template <class T>
 int SelectableQueue<T>::size(){
-	int ret = 0;
-	pthread_mutex_lock(&mutex);
-	ret = items.size();
-	pthread_mutex_unlock(&mutex);
-	return ret;
+	return count;
 }
 
 template <class T>
-int SelectableQueue<T>::pop(T *data){
-	int n, ret = 1;
-	char buf[1];
-
-	while(1){
-		n = ::read(fds[0], buf, 1);
-		if(n < 0){
-			if(errno == EINTR){
-				continue;
-			}else{
-				return -1;
-			}
-		}else if(n == 0){
-			ret = -1;
-		}else{
-			if(pthread_mutex_lock(&mutex) != 0){
-				return -1;
-			}
-			{
-				if(items.empty()){
-					fprintf(stderr, "%s %d error!\n", __FILE__, __LINE__);
-					pthread_mutex_unlock(&mutex);
-					return -1;
-				}
-				*data = items.front();
-				items.pop();
-			}
-			pthread_mutex_unlock(&mutex);
-		}
-		break;
+int SelectableQueue<T>::pop(std::vector<T> *list){
+	clear();
+	// re-arm before taking the items, a push after this will notify again
+	__sync_lock_release(&signaled);
+	__sync_synchronize();
+
+	Node *node = __sync_lock_test_and_set(&head, (Node *)NULL);
+	Node *prev = NULL;
+	while(node){
+		Node *next = node->next;
+		node->next = prev;
+		prev = node;
+		node = next;
 	}
-	return ret;
+	int n = 0;
+	for(node = prev; node; n++){
+		list->push_back(node->item);
+		Node *next = node->next;
+		delete node;
+		node = next;
+	}
+	__sync_sub_and_fetch(&count, n);
+	return n;
 }
 
 
@@ -361,8 +410,8 @@ int WorkerPool<W, JOB>::push(JOB job){
 }
 
 template<class W, class JOB>
-int WorkerPool<W, JOB>::pop(JOB *job){
-	return this->results.pop(job);
+int WorkerPool<W, JOB>::pop(std::vector<JOB> *list){
+	return this->results.pop(list);
 }
 
 template<class W, class JOB>
@@ -384,7 +433,10 @@ void* WorkerPool<W, JOB>::_run_worker(void *arg){
 			break;
 		}
 		ReadLockGuard<RWLock> guard(tp->mutex);
-		worker->proc(&job);
+		if(worker->proc(&job) == 1){
+			// the worker has passed the result on
+			continue;
+		}
 		if(tp->results.push(job) == -1){
 			fprintf(stderr, "results.push error\n");
 			::exit(0);
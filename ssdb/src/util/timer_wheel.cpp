@@ -0,0 +1,142 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+#include "timer_wheel.h"
+
+TimerWheel::TimerWheel(int64_t now, int64_t tick){
+	this->tick = tick > 0 ? tick : 1;
+	this->current = now / this->tick;
+	this->entries = 0;
+}
+
+int TimerWheel::size() const{
+	return (int)times.size();
+}
+
+int TimerWheel::add(const std::string &key, int64_t time){
+	std::map<std::string, int64_t>::iterator it = times.find(key);
+	if(it != times.end()){
+		if(it->second == time){
+			return 0;
+		}
+		// the entry in the old slot goes stale
+		it->second = time;
+	}else{
+		times[key] = time;
+	}
+
+	Entry entry;
+	entry.key = key;
+	entry.time = time;
+	place(entry);
+	return it == times.end() ? 1 : 0;
+}
+
+int TimerWheel::del(const std::string &key){
+	return times.erase(key) ? 1 : 0;
+}
+
+int64_t TimerWheel::get(const std::string &key) const{
+	std::map<std::string, int64_t>::const_iterator it = times.find(key);
+	if(it == times.end()){
+		return -1;
+	}
+	return it->second;
+}
+
+int TimerWheel::expire(int64_t now, int max, std::vector<Entry> *list){
+	int64_t target = now / tick;
+	int num = 0;
+	if(entries == 0){
+		if(current < target){
+			current = target;
+		}
+		return 0;
+	}
+	while(current <= target){
+		std::vector<Entry> &slot = root[current & (ROOT_SIZE - 1)];
+		while(!slot.empty() && num < max){
+			Entry &entry = slot.back();
+			if(live(entry)){
+				times.erase(entry.key);
+				list->push_back(entry);
+				num ++;
+			}
+			slot.pop_back();
+			entries --;
+		}
+		if(!slot.empty() || current == target){
+			break;
+		}
+		current ++;
+		if((current & (ROOT_SIZE - 1)) == 0){
+			cascade();
+		}
+	}
+	return num;
+}
+
+int64_t TimerWheel::next_time() const{
+	if(entries == 0){
+		return INT64_MAX;
+	}
+	for(int i = 0; i < ROOT_SIZE; i++){
+		if(!root[(current + i) & (ROOT_SIZE - 1)].empty()){
+			return (current + i) * tick;
+		}
+	}
+	// nothing comes down to the root level before the next cascade
+	return ((current >> ROOT_BITS) + 1) * ROOT_SIZE * tick;
+}
+
+void TimerWheel::place(const Entry &entry){
+	// a slot holds the deadlines in (t-1, t] ticks, never fire early
+	int64_t t = (entry.time + tick - 1) / tick;
+	if(t < current){
+		t = current;
+	}
+	int64_t delta = t - current;
+	entries ++;
+	if(delta < ROOT_SIZE){
+		root[t & (ROOT_SIZE - 1)].push_back(entry);
+		return;
+	}
+	int top = LEVELS - 2;
+	int64_t max_delta = (int64_t)1 << (ROOT_BITS + (LEVELS - 1) * LEVEL_BITS);
+	if(delta >= max_delta){
+		t = current + max_delta - 1;
+	}
+	for(int level = 0; level <= top; level++){
+		int shift = ROOT_BITS + level * LEVEL_BITS;
+		if(level == top || delta < ((int64_t)1 << (shift + LEVEL_BITS))){
+			levels[level][(t >> shift) & (LEVEL_SIZE - 1)].push_back(entry);
+			return;
+		}
+	}
+}
+
+// move the slots due in this turn of the root level down, level by level
+void TimerWheel::cascade(){
+	for(int level = 0; level < LEVELS - 1; level++){
+		int shift = ROOT_BITS + level * LEVEL_BITS;
+		int index = (current >> shift) & (LEVEL_SIZE - 1);
+		std::vector<Entry> slot;
+		slot.swap(levels[level][index]);
+		entries -= (int)slot.size();
+		for(size_t i = 0; i < slot.size(); i++){
+			if(live(slot[i])){
+				place(slot[i]);
+			}
+		}
+		if(index != 0){
+			break;
+		}
+	}
+}
+
+bool TimerWheel::live(const Entry &entry) const{
+	std::map<std::string, int64_t>::const_iterator it = times.find(entry.key);
+	return it != times.end() && it->second == entry.time;
+}
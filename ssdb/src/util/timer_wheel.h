@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+#ifndef UTIL_TIMER_WHEEL_H
+#define UTIL_TIMER_WHEEL_H
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <map>
+
+/**
+ * Hierarchical timer wheel of keys with deadlines in milliseconds.
+ *
+ * The first level has 256 slots of one tick, each of the 4 levels above
+ * has 64 slots spanning a whole turn of the level below, the last slot of
+ * the top level takes whatever lies beyond. A slot is a plain vector of
+ * (key, deadline), entries of a rescheduled or deleted key are dropped
+ * lazily when their slot comes up, so add() and del() never search a slot.
+ **/
+class TimerWheel
+{
+public:
+	struct Entry
+	{
+		std::string key;
+		int64_t time;
+	};
+
+	TimerWheel(int64_t now, int64_t tick=10);
+
+	bool empty() const{
+		return size() == 0;
+	}
+	int size() const;
+	// 1: new, 0: updated
+	int add(const std::string &key, int64_t time);
+	// 0: not found, 1: found and deleted
+	int del(const std::string &key);
+	// deadline of key, -1 if not found
+	int64_t get(const std::string &key) const;
+	// take at most max keys due by now, earliest tick first, return number taken
+	int expire(int64_t now, int max, std::vector<Entry> *list);
+	// no key is due before the returned time
+	int64_t next_time() const;
+
+private:
+	static const int LEVELS = 5;
+	static const int ROOT_BITS = 8;
+	static const int LEVEL_BITS = 6;
+	static const int ROOT_SIZE = 1 << ROOT_BITS;
+	static const int LEVEL_SIZE = 1 << LEVEL_BITS;
+
+	int64_t tick;
+	int64_t current;          /* tick of root[current % ROOT_SIZE], earlier ticks are done */
+	int entries;              /* live and stale entries in slots */
+	std::vector<Entry> root[ROOT_SIZE];
+	std::vector<Entry> levels[LEVELS - 1][LEVEL_SIZE];
+	std::map<std::string, int64_t> times;
+
+	void place(const Entry &entry);
+	void cascade();
+	bool live(const Entry &entry) const;
+};
+
+#endif
@@ -0,0 +1,57 @@
+/*
+Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+#ifndef UTIL_TOKEN_BUCKET_H_
+#define UTIL_TOKEN_BUCKET_H_
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+/**
+ * Token bucket holding at most one second of tokens. consume() takes
+ * the tokens right away and sleeps off the debt, so a caller asking
+ * for a large amount pays for it after the fact instead of starving.
+ * Not thread safe.
+ **/
+class TokenBucket
+{
+public:
+	/* @rate tokens per second, 0: unlimited */
+	TokenBucket(uint64_t rate=0) : rate(rate), tokens((double)rate), last(now_us()) {}
+
+	/* @return microseconds slept */
+	int64_t consume(uint64_t n){
+		if(rate == 0){
+			return 0;
+		}
+		int64_t now = now_us();
+		tokens += (double)(now - last) * rate / 1000000;
+		if(tokens > (double)rate){
+			tokens = (double)rate;
+		}
+		last = now;
+		tokens -= (double)n;
+		if(tokens >= 0){
+			return 0;
+		}
+		int64_t wait = (int64_t)(-tokens * 1000000 / rate);
+		usleep((useconds_t)wait);
+		return wait;
+	}
+
+private:
+	uint64_t rate;
+	double tokens;
+	int64_t last;
+
+	static int64_t now_us(){
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	}
+};
+
+#endif
@@ -0,0 +1,114 @@
+<?php
+/**
+ * Kills a slave, more than once, while incr/hincr/qpush_back traffic
+ * is replicated to it, then checks it ends up with the master's values.
+ * The events sent again after each restart must not be applied twice.
+ *
+ * Set replication.apply_threads (and apply_batch) in the slave's config
+ * to test the parallel apply.
+ *
+ * usage: php test_slave_replay.php [master_port] [slave_port] [slave_conf]
+ */
+
+include(dirname(__FILE__) . '/../api/php/SSDB.php');
+
+$host = '127.0.0.1';
+$master_port = isset($argv[1])? intval($argv[1]) : 8888;
+$slave_port = isset($argv[2])? intval($argv[2]) : 8889;
+$slave_conf = isset($argv[3])? $argv[3] : dirname(__FILE__) . '/../ssdb_slave.conf';
+$server = dirname(__FILE__) . '/../ssdb-server';
+
+$keys = 200;
+$queues = 7;
+$kills = 3;
+$rounds = 4000;
+
+function slave_pid($conf){
+	if(!preg_match('/^pidfile\s*=\s*(\S+)/m', file_get_contents($conf), $m)){
+		return false;
+	}
+	$file = $m[1][0] == '/'? $m[1] : dirname($conf) . '/' . $m[1];
+	return intval(@file_get_contents($file));
+}
+
+function start_slave($host, $port){
+	for($i=0; $i<50; $i++){
+		usleep(100 * 1000);
+		try{
+			$slave = new SimpleSSDB($host, $port);
+			$slave->start_slave();
+			return $slave;
+		}catch(Exception $e){
+		}
+	}
+	die("slave $host:$port not up\n");
+}
+
+$master = new SimpleSSDB($host, $master_port);
+$slave = start_slave($host, $slave_port);
+
+for($i=0; $i<$keys; $i++){
+	$master->del("TEST_replay_$i");
+}
+$master->del('TEST_replay_end');
+$master->hclear('TEST_replay_h');
+for($i=0; $i<$queues; $i++){
+	$master->qclear("TEST_replay_q$i");
+}
+
+for($n=0; $n<=$kills; $n++){
+	for($r=0; $r<$rounds; $r++){
+		$i = $r % $keys;
+		$master->incr("TEST_replay_$i", 1);
+		$master->hincr('TEST_replay_h', "f$i", 2);
+		$master->qpush_back('TEST_replay_q' . ($r % $queues), $r);
+	}
+	if($n == $kills){
+		break;
+	}
+	$pid = slave_pid($slave_conf);
+	if(!$pid){
+		die("no pid for $slave_conf\n");
+	}
+	echo "kill -9 $pid\n";
+	exec("kill -9 $pid");
+	do{
+		usleep(100 * 1000);
+		exec("kill -0 $pid 2>/dev/null", $output, $ret);
+	}while($ret == 0);
+	exec("$server -d $slave_conf");
+	$slave = start_slave($host, $slave_port);
+}
+
+// the slave has caught up once it has the last write
+$mark = strval(time());
+$master->set('TEST_replay_end', $mark);
+for($i=0; $i<600 && $slave->get('TEST_replay_end') !== $mark; $i++){
+	usleep(100 * 1000);
+}
+
+$errors = 0;
+for($i=0; $i<$keys; $i++){
+	$a = $master->get("TEST_replay_$i");
+	$b = $slave->get("TEST_replay_$i");
+	if($a !== $b){
+		echo "TEST_replay_$i master: $a, slave: $b\n";
+		$errors ++;
+	}
+	$a = $master->hget('TEST_replay_h', "f$i");
+	$b = $slave->hget('TEST_replay_h', "f$i");
+	if($a !== $b){
+		echo "TEST_replay_h f$i master: $a, slave: $b\n";
+		$errors ++;
+	}
+}
+for($i=0; $i<$queues; $i++){
+	$a = $master->qsize("TEST_replay_q$i");
+	$b = $slave->qsize("TEST_replay_q$i");
+	if($a !== $b){
+		echo "TEST_replay_q$i size master: $a, slave: $b\n";
+		$errors ++;
+	}
+}
+printf("%d error(s)\n", $errors);
+exit($errors? 1 : 0);
@@ -0,0 +1,305 @@
+#!/usr/bin/env python
+#coding: utf-8
+#file   : test_redirect.py
+#
+# slot redirects of a hashslot pool, answered by scripted ssdb servers:
+# "tryagain" and "moved" are retried by nutcracker after a backoff, "ask"
+# is sent to the importing server. moved/ask need a zookeeper at T_ZK.
+
+import os
+import sys
+import json
+import socket
+import threading
+import SocketServer
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+WORKDIR = os.path.join(PWD,'../')
+sys.path.append(os.path.join(WORKDIR,'lib/'))
+sys.path.append(os.path.join(WORKDIR,'conf/'))
+
+import conf
+
+from server_modules import *
+from utils import *
+from nose import with_setup
+from nose.plugins.skip import SkipTest
+
+CLUSTER_NAME = 'ntest'
+nc_verbose = int(getenv('T_VERBOSE', 5))
+mbuf = int(getenv('T_MBUF', 512))
+zk_host = getenv('T_ZK', '')
+
+HASHSLOT_SLOT_NUM = 16384
+
+def crc16_table():
+    table = []
+    for i in range(256):
+        crc = i << 8
+        for j in range(8):
+            if crc & 0x8000:
+                crc = (crc << 1) ^ 0x1021
+            else:
+                crc = crc << 1
+        table.append(crc & 0xffff)
+    return table
+
+CRC16_TAB = crc16_table()
+
+def key_slot(key):
+    # hash: crc16, the slot is the hash modulo the number of slots
+    crc = 0
+    for c in key:
+        crc = ((crc << 8) ^ CRC16_TAB[((crc >> 8) ^ ord(c)) & 0xff]) & 0xffffffff
+    return crc % HASHSLOT_SLOT_NUM
+
+def ssdb_pack(*blocks):
+    return ''.join(['%d\n%s\n' % (len(b), b) for b in blocks]) + '\n'
+
+def ssdb_unpack(buf):
+    '''split one request off buf, returns (blocks, rest) or (None, buf)'''
+    blocks = []
+    pos = 0
+    while True:
+        eol = buf.find('\n', pos)
+        if eol < 0:
+            return None, buf
+        if buf[pos:eol] in ('', '\r'):
+            return blocks, buf[eol + 1:]
+        size = int(buf[pos:eol])
+        if len(buf) < eol + 1 + size + 1:
+            return None, buf
+        blocks.append(buf[eol + 1:eol + 1 + size])
+        pos = eol + 1 + size + 1
+
+class FakeSsdb(SocketServer.ThreadingMixIn, SocketServer.TCPServer):
+    '''
+    answers get with its name, or with the next scripted reply queued for
+    the key; remembers every command it was sent
+    '''
+    allow_reuse_address = True
+    daemon_threads = True
+
+    def __init__(self, port, name):
+        SocketServer.TCPServer.__init__(self, ('127.0.0.1', port), FakeSsdbHandler)
+        self.port = port
+        self.name = name
+        self.script = {}
+        self.commands = []
+        self.lock = threading.Lock()
+
+    def reply(self, blocks):
+        with self.lock:
+            self.commands.append(blocks)
+            if blocks[0] != 'get':
+                return ssdb_pack('ok')
+            script = self.script.get(blocks[1], [])
+            if script:
+                return script.pop(0)
+            return ssdb_pack('ok', self.name)
+
+    def count(self, cmd, key=None):
+        with self.lock:
+            return len([b for b in self.commands
+                        if b[0] == cmd and (key is None or b[1:2] == [key])])
+
+    def start(self):
+        t = threading.Thread(target=self.serve_forever)
+        t.setDaemon(True)
+        t.start()
+
+    def stop(self):
+        self.shutdown()
+        self.server_close()
+
+class FakeSsdbHandler(SocketServer.BaseRequestHandler):
+    def handle(self):
+        buf = ''
+        while True:
+            data = self.request.recv(4096)
+            if not data:
+                return
+            buf += data
+            while True:
+                blocks, buf = ssdb_unpack(buf)
+                if blocks is None:
+                    break
+                if blocks:
+                    self.request.sendall(self.server.reply(blocks))
+
+MOVED = ssdb_pack('error', 'moved')
+ASK = ssdb_pack('error', 'ask')
+TRYAGAIN = ssdb_pack('error', 'tryagain')
+
+all_ssdb = []
+
+class HashslotNutCracker(NutCracker):
+    def _gen_conf(self):
+        content = '''
+$cluster_name:
+  listen: 0.0.0.0:$port
+  hash: crc16
+  distribution: hashslot
+  protocol: ssdb
+  preconnect: true
+  auto_eject_hosts: false
+  timeout: 3000
+  server_connections: 1
+  server_retry_timeout: 2000
+  server_failure_limit: 2
+'''
+        content = TT(content, self.args)
+        if self.args.get('zk'):
+            content += '  zookeeperservers:\n  - %s:1\n' % self.args['zk']
+        content += '  servers:\n'
+        content += '\n'.join(['    - 127.0.0.1:%d:1 %s' % (s.port, s.name)
+                              for s in all_ssdb])
+        return content + '\n'
+
+nc = HashslotNutCracker('127.0.0.1', 4100, '/tmp/r/nutcracker-4100',
+                        CLUSTER_NAME, [], mbuf=mbuf, verbose=nc_verbose)
+
+zk = None
+
+def zk_connect():
+    global zk
+    if not zk_host:
+        raise SkipTest('T_ZK is not set')
+    try:
+        from kazoo.client import KazooClient
+    except ImportError:
+        raise SkipTest('kazoo is not installed')
+
+    zk = KazooClient(hosts=zk_host)
+    zk.start(timeout=5)
+
+def zk_put(path, value):
+    if zk.exists(path):
+        zk.set(path, value)
+    else:
+        zk.create(path, value, makepath=True)
+
+def slot_map_snapshot(version, owner):
+    '''owner: {slot: node}, every other slot is on node 0'''
+    lines = ['v1 %d %d' % (version, HASHSLOT_SLOT_NUM)]
+    first = 0
+    for slot in sorted(owner.keys()) + [HASHSLOT_SLOT_NUM]:
+        if slot > first:
+            lines.append('%d %d 0' % (first, slot - first))
+        if slot < HASHSLOT_SLOT_NUM:
+            lines.append('%d 1 %d' % (slot, owner[slot]))
+        first = slot + 1
+    return '\n'.join(lines) + '\n'
+
+def _setup_nc(use_zk):
+    global all_ssdb
+    if use_zk:
+        zk_connect()
+
+    all_ssdb = [FakeSsdb(2100, 'ssdb-2100'), FakeSsdb(2101, 'ssdb-2101')]
+    for s in all_ssdb:
+        s.start()
+
+    if use_zk:
+        for path in ('/migrate_tasks', '/slot_map'):
+            if zk.exists(path):
+                zk.delete(path, recursive=True)
+        for i, s in enumerate(all_ssdb):
+            zk_put('/nodes/%d' % i, json.dumps({'ip': '127.0.0.1', 'port': s.port,
+                                                'slave_ip': '', 'slave_port': 0}))
+        zk_put('/slot_map_snapshot', slot_map_snapshot(1, {}))
+        nc.args['zk'] = zk_host
+    else:
+        nc.args['zk'] = None
+
+    nc.deploy()
+    nc.stop()
+    nc.start()
+
+def _setup():
+    _setup_nc(False)
+
+def _setup_zk():
+    _setup_nc(True)
+
+def _teardown():
+    global zk
+    assert(nc._alive())
+    nc.stop()
+    for s in all_ssdb:
+        s.stop()
+    if zk:
+        zk.stop()
+        zk = None
+
+def get_tcp_conn(host, port):
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.connect((host, port))
+    s.settimeout(5)
+    return s
+
+def ssdb_get(key):
+    conn = get_tcp_conn(nc.host(), nc.port())
+    conn.sendall(ssdb_pack('get', key))
+    buf = ''
+    while True:
+        data = conn.recv(4096)
+        assert(data)
+        buf += data
+        blocks, buf = ssdb_unpack(buf)
+        if blocks is not None:
+            conn.close()
+            return blocks
+
+def slot0_key():
+    # a key of the first quarter, on ssdb-2100 with the default and test maps
+    for i in range(1000):
+        key = 'kkk-%d' % i
+        if key_slot(key) < HASHSLOT_SLOT_NUM / 4:
+            return key
+
+@with_setup(_setup, _teardown)
+def test_tryagain():
+    key = slot0_key()
+    all_ssdb[0].script[key] = [TRYAGAIN, TRYAGAIN]
+
+    assert(ssdb_get(key) == ['ok', 'ssdb-2100'])
+    assert(all_ssdb[0].count('get', key) == 3)
+
+@with_setup(_setup_zk, _teardown)
+def test_moved():
+    key = slot0_key()
+    slot = key_slot(key)
+    # the old owner keeps answering moved until the map says where it went
+    all_ssdb[0].script[key] = [MOVED] * 100
+
+    def move():
+        time.sleep(.5)
+        zk_put('/slot_map_snapshot', slot_map_snapshot(2, {slot: 1}))
+    t = threading.Thread(target=move)
+    t.start()
+
+    assert(ssdb_get(key) == ['ok', 'ssdb-2101'])
+    t.join()
+
+    # backed off while the map was read, instead of spinning on the old owner
+    assert(all_ssdb[0].count('get', key) < 20)
+    assert(nc._alive())
+
+@with_setup(_setup_zk, _teardown)
+def test_ask():
+    key = slot0_key()
+    slot = key_slot(key)
+    zk_put('/migrate_tasks/%d' % slot, json.dumps({'node_index': 1}))
+    all_ssdb[0].script[key] = [ASK] * 100
+
+    # the first ask starts the read of the migrate task and backs off
+    assert(ssdb_get(key) == ['ok', 'ssdb-2101'])
+    assert(all_ssdb[1].count('asking') == 1)
+    assert(all_ssdb[1].count('get', key) == 1)
+
+    # the migrate task is cached now, the next ask goes over at once
+    n = all_ssdb[0].count('get', key)
+    assert(ssdb_get(key) == ['ok', 'ssdb-2101'])
+    assert(all_ssdb[0].count('get', key) == n + 1)
+    assert(all_ssdb[1].count('asking') == 2)